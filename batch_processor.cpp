@@ -0,0 +1,349 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <functional>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "batch_processor.h"
+#include "bounded_queue.h"
+#include "result_cache.h"
+
+#define LIST_EXTENSION      ".txt"
+
+
+/*
+ * An image moving through the stages
+ */
+struct BatchItem
+{
+    std::string path;       ///< Source file
+    Image source;           ///< Decoded image, released once filtered
+    Image result;           ///< Filtered image
+};
+
+typedef BoundedQueue<std::unique_ptr<BatchItem>> BatchQueue;
+
+/*
+ * Time spent by the workers of a stage on the images, queue waits excluded
+ */
+struct StageStatistics
+{
+    std::atomic<long long> busyTime;    ///< Microseconds
+    std::atomic<int> processed;         ///< Images completed by the stage
+    std::atomic<int> failed;            ///< Images dropped by the stage
+};
+
+static bool hasSuffix(const std::string& name, const std::string& suffix)
+{
+    return name.size() >= suffix.size() &&
+           name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/*
+ * @brief: return the file name of path without directories and extension
+ */
+static std::string getBaseName(const std::string& path)
+{
+    size_t start = path.find_last_of('/');
+    start = start == std::string::npos ? 0 : start + 1;
+
+    size_t end = path.find_last_of('.');
+    if (end == std::string::npos || end < start) {
+        end = path.size();
+    }
+
+    return path.substr(start, end - start);
+}
+
+/*
+ * @brief: run worker on workers threads and close output
+ *         once the last one returns
+ */
+static void startStage(std::vector<std::thread>& threads, int workers,
+                       const std::function<void()>& worker, BatchQueue* output)
+{
+    // Shared by the workers of the stage, released by the last one
+    std::shared_ptr<std::atomic<int>> running = std::make_shared<std::atomic<int>>(workers);
+
+    for (int i = 0; i < workers; i++) {
+        threads.push_back(std::thread([worker, output, running]() {
+            worker();
+            if (running->fetch_sub(1) == 1 && output != nullptr) {
+                output->close();
+            }
+        }));
+    }
+}
+
+static long long getElapsedTime(const std::chrono::high_resolution_clock::time_point& start)
+{
+    auto now = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+}
+
+static void printStage(const char* name, const StageStatistics& statistics,
+                       int workers, long long totalTime)
+{
+    double utilization = totalTime > 0 ?
+                         100.0 * statistics.busyTime.load() / (static_cast<double>(totalTime) * workers) : 0;
+
+    std::cout << name << ": " << workers << " workers, "
+              << statistics.processed.load() << " images, "
+              << statistics.failed.load() << " failed, "
+              << static_cast<int>(utilization + 0.5) << "% utilization" << std::endl;
+}
+
+
+BatchProcessor::BatchProcessor(const FilterPipeline& pipeline,
+                               const CudaMemType cudaType,
+                               const BorderMode border,
+                               const PixelFormat format) : m_pipeline(pipeline)
+{
+    m_cudaType = cudaType;
+    m_borderMode = border;
+    m_pixelFormat = format;
+    m_decodeWorkers = 2;
+    m_filterWorkers = 1;
+    m_encodeWorkers = 2;
+    m_queueCapacity = 4;
+}
+
+void BatchProcessor::setWorkers(int decodeWorkers, int filterWorkers, int encodeWorkers)
+{
+    m_decodeWorkers = std::max(decodeWorkers, 1);
+    m_filterWorkers = std::max(filterWorkers, 1);
+    m_encodeWorkers = std::max(encodeWorkers, 1);
+}
+
+void BatchProcessor::setQueueCapacity(int capacity)
+{
+    m_queueCapacity = std::max(capacity, 1);
+}
+
+bool BatchProcessor::isBatchPath(const char* path)
+{
+    struct stat status;
+    if (stat(path, &status) != 0) {
+        return false;
+    }
+
+    return S_ISDIR(status.st_mode) || hasSuffix(path, LIST_EXTENSION);
+}
+
+bool BatchProcessor::listImages(const char* path, std::vector<std::string>& imagePaths)
+{
+    imagePaths.clear();
+
+    struct stat status;
+    if (stat(path, &status) != 0) {
+        std::cerr << "Unable to access " << path << std::endl;
+        return false;
+    }
+
+    if (S_ISDIR(status.st_mode)) {
+        DIR* directory = opendir(path);
+        if (directory == nullptr) {
+            std::cerr << "Unable to open directory " << path << std::endl;
+            return false;
+        }
+
+        std::string folder = path;
+        if (!hasSuffix(folder, "/")) {
+            folder += "/";
+        }
+
+        struct dirent* entry;
+        while ((entry = readdir(directory)) != nullptr) {
+            std::string name = entry->d_name;
+            ImageFileFormat format = Image::getFileFormat(name.c_str());
+            if (hasSuffix(name, Image::getFileExtension(format))) {
+                imagePaths.push_back(folder + name);
+            }
+        }
+        closedir(directory);
+
+        std::sort(imagePaths.begin(), imagePaths.end());
+    }
+    else {
+        // One path per line, empty lines are ignored
+        std::ifstream listFile(path);
+        if (!listFile) {
+            std::cerr << "Unable to open list file " << path << std::endl;
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(listFile, line)) {
+            if (!line.empty()) {
+                imagePaths.push_back(line);
+            }
+        }
+    }
+
+    if (imagePaths.empty()) {
+        std::cerr << "No images found in " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool BatchProcessor::run(const std::vector<std::string>& imagePaths,
+                         const std::string& outputFolder,
+                         const std::string& outputSuffix) const
+{
+    if (m_pipeline.getKernelCount() == 0) {
+        std::cerr << "Empty filter pipeline" << std::endl;
+        return false;
+    }
+
+    BatchQueue decodedQueue(m_queueCapacity);
+    BatchQueue filteredQueue(m_queueCapacity);
+
+    StageStatistics decodeStatistics = {{0}, {0}, {0}};
+    StageStatistics filterStatistics = {{0}, {0}, {0}};
+    StageStatistics encodeStatistics = {{0}, {0}, {0}};
+
+    std::atomic<size_t> nextImage(0);
+
+    // Buffer allocations of the filter workspaces
+    std::atomic<long long> workspaceAllocations(0);
+    std::atomic<long long> workspaceReuses(0);
+
+    auto decodeWorker = [&]() {
+        for (size_t i = nextImage.fetch_add(1); i < imagePaths.size(); i = nextImage.fetch_add(1)) {
+            auto t1 = std::chrono::high_resolution_clock::now();
+
+            std::unique_ptr<BatchItem> item(new BatchItem());
+            item->path = imagePaths[i];
+            item->source.setPixelFormat(m_pixelFormat);
+            item->source.setBorderMode(m_borderMode);
+
+            bool loaded = false;
+            try {
+                loaded = item->source.loadImage(item->path.c_str());
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Unable to load image " << item->path << ": " << e.what() << std::endl;
+            }
+
+            decodeStatistics.busyTime += getElapsedTime(t1);
+            if (!loaded) {
+                decodeStatistics.failed++;
+                continue;
+            }
+            decodeStatistics.processed++;
+
+            if (!decodedQueue.push(std::move(item))) {
+                break;
+            }
+        }
+    };
+
+    auto filterWorker = [&]() {
+        // Scratch, device memory and backends reused by the images of the worker
+        Workspace workspace;
+        ResultCache& cache = ResultCache::getInstance();
+        bool useCache = cache.isEnabled();
+
+        std::unique_ptr<BatchItem> item;
+        while (decodedQueue.pop(item)) {
+            auto t1 = std::chrono::high_resolution_clock::now();
+
+            // Images already filtered, by this batch or a previous run,
+            // are taken from the result cache
+            uint64_t cacheKey = useCache ? ResultCache::getKey(item->source, m_pipeline, m_cudaType,
+                                                               FilterAlgorithm::AUTO) : 0;
+            bool filtered = useCache && cache.lookup(cacheKey, item->result);
+            if (!filtered) {
+                if (m_pipeline.getKernelCount() == 1) {
+                    filtered = item->source.multithreadFiltering(item->result, m_pipeline.getKernel(0), m_cudaType,
+                                                                 &workspace);
+                }
+                else {
+                    filtered = item->source.applyFilter(item->result, m_pipeline, true);
+                }
+                if (filtered && useCache) {
+                    cache.store(cacheKey, item->result);
+                }
+            }
+            item->source = Image();
+
+            filterStatistics.busyTime += getElapsedTime(t1);
+            if (!filtered) {
+                std::cerr << "Unable to filter image " << item->path << std::endl;
+                filterStatistics.failed++;
+                continue;
+            }
+            filterStatistics.processed++;
+
+            if (!filteredQueue.push(std::move(item))) {
+                break;
+            }
+        }
+
+        workspaceAllocations += workspace.getStats().allocations;
+        workspaceReuses += workspace.getStats().reuses;
+    };
+
+    auto encodeWorker = [&]() {
+        std::unique_ptr<BatchItem> item;
+        while (filteredQueue.pop(item)) {
+            auto t1 = std::chrono::high_resolution_clock::now();
+
+            // Results are saved in the format of their source
+            std::string outputPath = outputFolder + getBaseName(item->path) + outputSuffix +
+                                     Image::getFileExtension(Image::getFileFormat(item->path.c_str()));
+            bool saved = false;
+            try {
+                saved = item->result.saveImage(outputPath.c_str());
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Unable to save image " << outputPath << ": " << e.what() << std::endl;
+            }
+            item.reset();
+
+            encodeStatistics.busyTime += getElapsedTime(t1);
+            if (saved) {
+                encodeStatistics.processed++;
+            }
+            else {
+                encodeStatistics.failed++;
+            }
+        }
+    };
+
+    std::cout << "Processing " << imagePaths.size() << " images" << std::endl;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> threads;
+    startStage(threads, m_decodeWorkers, decodeWorker, &decodedQueue);
+    startStage(threads, m_filterWorkers, filterWorker, &filteredQueue);
+    startStage(threads, m_encodeWorkers, encodeWorker, nullptr);
+
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+
+    long long totalTime = getElapsedTime(t1);
+
+    int completed = encodeStatistics.processed.load();
+    double imagesPerSecond = totalTime > 0 ? completed * 1e6 / totalTime : 0;
+
+    std::cout << std::endl;
+    std::cout << "Batch execution time: " << totalTime << " μs" << std::endl;
+    std::cout << "Processed " << completed << "/" << imagePaths.size() << " images, "
+              << imagesPerSecond << " images/s" << std::endl;
+    printStage("Decode", decodeStatistics, m_decodeWorkers, totalTime);
+    printStage("Filter", filterStatistics, m_filterWorkers, totalTime);
+    printStage("Encode", encodeStatistics, m_encodeWorkers, totalTime);
+    std::cout << "Filter workspaces: " << workspaceAllocations.load() << " allocations, "
+              << workspaceReuses.load() << " reuses" << std::endl;
+
+    return completed == static_cast<int>(imagePaths.size());
+}
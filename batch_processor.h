@@ -0,0 +1,84 @@
+#ifndef BATCH_PROCESSOR_H_
+#define BATCH_PROCESSOR_H_
+
+#include <string>
+#include <vector>
+#include "image.h"
+#include "filter_pipeline.h"
+
+/*
+ * Applies the same filter to many images. Each image goes through three
+ * stages: PNG decode, filter and PNG encode. Every stage runs on its own
+ * workers and hands the images to the next one through a bounded queue,
+ * so decoding and encoding overlap the filtering and the number of
+ * images in memory stays limited.
+ */
+class BatchProcessor
+{
+    public:
+        /*
+         * @brief: Ctor
+         *
+         * @param: pipeline: the kernels applied to each image; a single
+         *         kernel runs with cudaType, chains are fused on the CPU
+         */
+        BatchProcessor(const FilterPipeline& pipeline,
+                       const CudaMemType cudaType,
+                       const BorderMode border,
+                       const PixelFormat format);
+
+        /*
+         *  @brief: Dtor
+         */
+        ~BatchProcessor() {}
+
+        /*
+         * @brief: set the number of threads of each stage
+         */
+        void setWorkers(int decodeWorkers, int filterWorkers, int encodeWorkers);
+
+        /*
+         * @brief: set the number of images waiting between two stages
+         */
+        void setQueueCapacity(int capacity);
+
+        /*
+         * @brief: filter every image and save it in outputFolder with
+         *         outputSuffix appended to its name, in the format of
+         *         the source file. Images that cannot be
+         *         loaded or filtered are reported and skipped. Throughput and
+         *         stage utilization are printed at the end.
+         *
+         * @return: true if every image has been processed, false otherwise
+         */
+        bool run(const std::vector<std::string>& imagePaths,
+                 const std::string& outputFolder,
+                 const std::string& outputSuffix) const;
+
+        /*
+         * @brief: fill imagePaths with the .png, .pgm and .raw files of a directory,
+         *         sorted by name, or with the lines of a list file
+         *
+         * @return: true if successful, false otherwise
+         */
+        static bool listImages(const char* path, std::vector<std::string>& imagePaths);
+
+        /*
+         * @brief: return true if path is a directory or a list file,
+         *         to be processed as a batch
+         */
+        static bool isBatchPath(const char* path);
+
+    private:
+        FilterPipeline m_pipeline;      ///< Kernels applied to each image
+        CudaMemType m_cudaType;         ///< Filtering device of single kernels
+        BorderMode m_borderMode;        ///< Border mode of the loaded images
+        PixelFormat m_pixelFormat;      ///< Pixel format of the loaded images
+        int m_decodeWorkers;            ///< Threads decoding PNG files
+        int m_filterWorkers;            ///< Threads filtering images
+        int m_encodeWorkers;            ///< Threads encoding PNG files
+        int m_queueCapacity;            ///< Images waiting between two stages
+};
+
+
+#endif /* BATCH_PROCESSOR_H_ */
@@ -0,0 +1,683 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include "image.h"
+#include "kernel.h"
+#include "cpu_convolution.h"
+#include "convolution_backend.h"
+#include "thread_pool.h"
+
+#define DEFAULT_SIZES           "256,1024,2048"
+#define DEFAULT_KERNELS         "gaussian,sharpen,edge_detect,laplacian,gaussian_laplacian,box"
+#define DEFAULT_BORDERS         "replicate,zero,reflect,wrap"
+#define DEFAULT_WARMUP          2
+#define DEFAULT_REPETITIONS     10
+#define DEFAULT_OUTPUT          "benchmark.json"
+#define DEFAULT_WORK_FOLDER     "output/"
+// Slowdown of the median flagged by the compare mode, in percent
+#define DEFAULT_THRESHOLD       10.0
+// Median changes below this are timer noise, in microseconds
+#define MIN_REGRESSION_DELTA    5.0
+
+#define BOX_FILTER_SIZE         9
+#define IMAGE_SEED              12345u
+
+
+/*
+ * Timing statistics of a benchmark case, in microseconds
+ */
+struct Statistics
+{
+    double min;
+    double mean;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+    double stddev;
+};
+
+struct BenchmarkResult
+{
+    std::string name;           ///< Unique key, used by the compare mode
+    std::string suite;          ///< micro or macro
+    std::string backend;
+    std::string kernel;
+    std::string border;
+    int width;
+    int height;
+    Statistics statistics;
+};
+
+struct BenchmarkOptions
+{
+    std::vector<int> sizes;             ///< Square image sides
+    std::vector<std::string> kernels;
+    std::vector<std::string> borders;
+    std::vector<std::string> backends;
+    bool runMicro;                      ///< Convolution functions on preallocated buffers
+    bool runMacro;                      ///< Load, filter and save through Image
+    int warmup;                         ///< Untimed runs before the repetitions
+    int repetitions;                    ///< Timed runs
+    std::string outputFile;             ///< JSON results
+    std::string workFolder;             ///< Images written by the macro suite
+};
+
+
+static std::vector<std::string> splitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+
+    return items;
+}
+
+static bool hasItem(const std::vector<std::string>& items, const std::string& item)
+{
+    return std::find(items.begin(), items.end(), item) != items.end();
+}
+
+/*
+ * @brief: build a kernel from its command line name
+ *
+ * @return: true if successful, false for unknown names
+ */
+static bool buildKernel(const std::string& name, Kernel& kernel)
+{
+    if (name == "gaussian") {
+        return kernel.setGaussianFilter(7, 7, 1);
+    }
+    if (name == "sharpen") {
+        return kernel.setSharpenFilter();
+    }
+    if (name == "edge_detect") {
+        return kernel.setEdgeDetectionFilter();
+    }
+    if (name == "laplacian") {
+        return kernel.setLaplacianFilter();
+    }
+    if (name == "gaussian_laplacian") {
+        return kernel.setGaussianLaplacianFilter();
+    }
+    if (name == "box") {
+        const int taps = BOX_FILTER_SIZE * BOX_FILTER_SIZE;
+        return kernel.setFilter(std::vector<float>(taps, 1.0f / taps), BOX_FILTER_SIZE, BOX_FILTER_SIZE);
+    }
+
+    return false;
+}
+
+static bool parseBorder(const std::string& name, BorderMode& border)
+{
+    if (name == "replicate") {
+        border = BorderMode::REPLICATE;
+    }
+    else if (name == "zero") {
+        border = BorderMode::ZERO;
+    }
+    else if (name == "reflect") {
+        border = BorderMode::REFLECT;
+    }
+    else if (name == "wrap") {
+        border = BorderMode::WRAP;
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * @brief: fill an image with a gradient and deterministic noise, so every
+ *         run filters the same pixels
+ */
+static void fillImage(const ImageView& image)
+{
+    unsigned int state = IMAGE_SEED;
+    for (int y = 0; y < image.getHeight(); y++) {
+        float* row = image.getRow(y);
+        for (int x = 0; x < image.getWidth(); x++) {
+            state = state * 1664525u + 1013904223u;
+            row[x] = static_cast<float>((x + y) % 192 + (state >> 26));
+        }
+    }
+}
+
+/*
+ * @brief: return the p percentile of sorted samples, nearest rank
+ */
+static double getPercentile(const std::vector<double>& sorted, double p)
+{
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::min(std::max(rank, static_cast<size_t>(1)), sorted.size()) - 1];
+}
+
+/*
+ * @brief: run function warmup times, then time it repetitions times
+ *
+ * @return: false if any run failed
+ */
+static bool measure(const std::function<bool()>& function, int warmup, int repetitions,
+                    Statistics& statistics)
+{
+    std::vector<double> samples;
+
+    for (int i = 0; i < warmup; i++) {
+        if (!function()) {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < repetitions; i++) {
+        auto t1 = std::chrono::high_resolution_clock::now();
+        bool result = function();
+        auto t2 = std::chrono::high_resolution_clock::now();
+        if (!result) {
+            return false;
+        }
+        samples.push_back(std::chrono::duration<double, std::micro>(t2 - t1).count());
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    double sum = 0;
+    for (double sample : samples) {
+        sum += sample;
+    }
+    statistics.mean = sum / samples.size();
+
+    double squares = 0;
+    for (double sample : samples) {
+        squares += (sample - statistics.mean) * (sample - statistics.mean);
+    }
+    statistics.stddev = std::sqrt(squares / samples.size());
+
+    statistics.min = samples.front();
+    statistics.max = samples.back();
+    statistics.p50 = getPercentile(samples, 50);
+    statistics.p90 = getPercentile(samples, 90);
+    statistics.p99 = getPercentile(samples, 99);
+
+    return true;
+}
+
+static void printResult(const BenchmarkResult& result)
+{
+    std::cout << result.name << ": p50 " << result.statistics.p50
+              << " μs, p99 " << result.statistics.p99 << " μs" << std::endl;
+}
+
+/*
+ * @brief: return the function timed by a micro benchmark case, an empty
+ *         function if the backend cannot run the kernel on this machine.
+ *         The backend is prepared outside the measures.
+ */
+static std::function<bool()> getMicroCase(ConvolutionBackend& backend, const Kernel& kernel,
+                                          const ConstImageView& source, const ImageView& out,
+                                          const ConstImageView8& source8, const ImageView8& out8,
+                                          BorderMode border)
+{
+    if (!backend.isAvailable() || !backend.supports(kernel)) {
+        return std::function<bool()>();
+    }
+
+    if (!backend.prepare(kernel, border)) {
+        return std::function<bool()>();
+    }
+
+    // The views are captured by value: the buffers outlive the case.
+    // CUDA backends are measured with their host-device copies.
+    ConvolutionBackend* instance = &backend;
+    if (backend.getCapabilities().integer) {
+        return [=]() {
+            return instance->execute(&source8, &out8, 1);
+        };
+    }
+
+    return [=]() {
+        return instance->execute(&source, &out, 1);
+    };
+}
+
+/*
+ * @brief: every size x kernel x border x backend combination, on the
+ *         convolution functions with preallocated buffers
+ */
+static bool runMicroSuite(const BenchmarkOptions& options,
+                          std::vector<BenchmarkResult>& results)
+{
+    bool success = true;
+
+    for (int size : options.sizes) {
+        ImageBuffer source(size, size);
+        ImageBuffer out(size, size);
+        fillImage(source.getView());
+
+        ImageBuffer8 source8(size, size);
+        ImageBuffer8 out8(size, size);
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                source8.getRow(y)[x] = static_cast<uint8_t>(source.getRow(y)[x]);
+            }
+        }
+
+        for (const std::string& kernelName : options.kernels) {
+            Kernel kernel;
+            buildKernel(kernelName, kernel);
+
+            for (const std::string& borderName : options.borders) {
+                BorderMode border = BorderMode::REPLICATE;
+                parseBorder(borderName, border);
+
+                for (const std::string& backendName : options.backends) {
+                    std::unique_ptr<ConvolutionBackend> backend = BackendRegistry::getInstance().create(backendName);
+                    std::function<bool()> function = getMicroCase(*backend, kernel,
+                                                                  source.getView(), out.getView(),
+                                                                  source8.getView(), out8.getView(),
+                                                                  border);
+                    if (!function) {
+                        continue;
+                    }
+
+                    BenchmarkResult result;
+                    result.suite = "micro";
+                    result.backend = backendName;
+                    result.kernel = kernelName;
+                    result.border = borderName;
+                    result.width = size;
+                    result.height = size;
+                    result.name = "micro/" + backendName + "/" + kernelName + "/" + borderName + "/" +
+                                  std::to_string(size) + "x" + std::to_string(size);
+
+                    bool measured = measure(function, options.warmup, options.repetitions, result.statistics);
+                    backend->teardown();
+                    if (!measured) {
+                        std::cerr << "Benchmark " << result.name << " failed" << std::endl;
+                        success = false;
+                        continue;
+                    }
+
+                    printResult(result);
+                    results.push_back(result);
+                }
+            }
+        }
+    }
+
+    return success;
+}
+
+/*
+ * @brief: load a PNG, filter it on the CPU backend and save the result,
+ *         for every size and kernel
+ */
+static bool runMacroSuite(const BenchmarkOptions& options,
+                          std::vector<BenchmarkResult>& results)
+{
+    bool success = true;
+
+    for (int size : options.sizes) {
+        const std::string sourceFile = options.workFolder + "benchmark_source_" + std::to_string(size) + ".png";
+        const std::string outFile = options.workFolder + "benchmark_result_" + std::to_string(size) + ".png";
+
+        ImageBuffer buffer(size, size);
+        fillImage(buffer.getView());
+
+        Image sourceImage;
+        sourceImage.setImage(std::move(buffer));
+        if (!sourceImage.saveImage(sourceFile.c_str())) {
+            std::cerr << "Unable to write " << sourceFile << std::endl;
+            return false;
+        }
+
+        for (const std::string& kernelName : options.kernels) {
+            Kernel kernel;
+            buildKernel(kernelName, kernel);
+
+            auto function = [&]() {
+                Image image;
+                Image result;
+                return image.loadImage(sourceFile.c_str()) &&
+                       image.multithreadFiltering(result, kernel, CudaMemType::CPU_MULTITHREAD) &&
+                       result.saveImage(outFile.c_str());
+            };
+
+            BenchmarkResult result;
+            result.suite = "macro";
+            result.backend = "cpu";
+            result.kernel = kernelName;
+            result.border = "replicate";
+            result.width = size;
+            result.height = size;
+            result.name = "macro/end_to_end/" + kernelName + "/" + std::to_string(size) + "x" + std::to_string(size);
+
+            if (!measure(function, options.warmup, options.repetitions, result.statistics)) {
+                std::cerr << "Benchmark " << result.name << " failed" << std::endl;
+                success = false;
+                continue;
+            }
+
+            printResult(result);
+            results.push_back(result);
+        }
+
+        remove(sourceFile.c_str());
+        remove(outFile.c_str());
+    }
+
+    return success;
+}
+
+/*
+ * @brief: write the results as JSON, one result object per line
+ */
+static bool writeResults(const BenchmarkOptions& options, bool gpuAvailable,
+                         const std::vector<BenchmarkResult>& results)
+{
+    std::ofstream file(options.outputFile);
+    if (!file) {
+        std::cerr << "Unable to write " << options.outputFile << std::endl;
+        return false;
+    }
+
+    file << "{" << std::endl;
+    file << "  \"cpu_isa\": \"" << getCpuIsaName(getCpuIsa()) << "\"," << std::endl;
+    file << "  \"threads\": " << ThreadPool::getInstance().getThreadCount() << "," << std::endl;
+    file << "  \"gpu\": " << (gpuAvailable ? "true" : "false") << "," << std::endl;
+    file << "  \"warmup\": " << options.warmup << "," << std::endl;
+    file << "  \"repetitions\": " << options.repetitions << "," << std::endl;
+    file << "  \"results\": [" << std::endl;
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult& result = results[i];
+        const Statistics& statistics = result.statistics;
+        const double megapixels = static_cast<double>(result.width) * result.height / 1e6;
+
+        file << "    {\"name\": \"" << result.name << "\", "
+             << "\"suite\": \"" << result.suite << "\", "
+             << "\"backend\": \"" << result.backend << "\", "
+             << "\"kernel\": \"" << result.kernel << "\", "
+             << "\"border\": \"" << result.border << "\", "
+             << "\"width\": " << result.width << ", "
+             << "\"height\": " << result.height << ", "
+             << "\"min_us\": " << statistics.min << ", "
+             << "\"mean_us\": " << statistics.mean << ", "
+             << "\"p50_us\": " << statistics.p50 << ", "
+             << "\"p90_us\": " << statistics.p90 << ", "
+             << "\"p99_us\": " << statistics.p99 << ", "
+             << "\"max_us\": " << statistics.max << ", "
+             << "\"stddev_us\": " << statistics.stddev << ", "
+             << "\"mpixels_per_s\": " << megapixels / (statistics.p50 / 1e6) << "}"
+             << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+
+    file << "  ]" << std::endl;
+    file << "}" << std::endl;
+
+    return static_cast<bool>(file);
+}
+
+/*
+ * @brief: read the median of each result of a file written by writeResults
+ *
+ * @return: true if successful, false otherwise
+ */
+static bool readMedians(const char* filename, std::map<std::string, double>& medians)
+{
+    std::ifstream file(filename);
+    if (!file) {
+        std::cerr << "Unable to read " << filename << std::endl;
+        return false;
+    }
+
+    const std::string nameKey = "\"name\": \"";
+    const std::string medianKey = "\"p50_us\": ";
+
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t name = line.find(nameKey);
+        size_t median = line.find(medianKey);
+        if (name == std::string::npos || median == std::string::npos) {
+            continue;
+        }
+
+        name += nameKey.size();
+        size_t nameEnd = line.find('"', name);
+        medians[line.substr(name, nameEnd - name)] = atof(line.c_str() + median + medianKey.size());
+    }
+
+    if (medians.empty()) {
+        std::cerr << "No benchmark results in " << filename << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * @brief: compare the medians of two result files
+ *
+ * @return: the number of regressions, -1 on errors
+ */
+static int compareResults(const char* baselineFile, const char* currentFile, double threshold)
+{
+    std::map<std::string, double> baseline;
+    std::map<std::string, double> current;
+    if (!readMedians(baselineFile, baseline) || !readMedians(currentFile, current)) {
+        return -1;
+    }
+
+    int regressions = 0;
+    int improvements = 0;
+    int missing = 0;
+
+    for (const auto& entry : current) {
+        auto reference = baseline.find(entry.first);
+        if (reference == baseline.end()) {
+            std::cout << "NEW         " << entry.first << ": " << entry.second << " μs" << std::endl;
+            continue;
+        }
+
+        const double delta = entry.second - reference->second;
+        const double change = reference->second > 0 ? 100.0 * delta / reference->second : 0;
+
+        const char* status = "ok          ";
+        if (change > threshold && delta > MIN_REGRESSION_DELTA) {
+            status = "REGRESSION  ";
+            regressions++;
+        }
+        else if (change < -threshold && -delta > MIN_REGRESSION_DELTA) {
+            status = "improvement ";
+            improvements++;
+        }
+
+        std::cout << status << entry.first << ": " << reference->second << " -> " << entry.second
+                  << " μs (" << (change >= 0 ? "+" : "") << change << "%)" << std::endl;
+    }
+
+    for (const auto& entry : baseline) {
+        if (current.find(entry.first) == current.end()) {
+            std::cout << "MISSING     " << entry.first << std::endl;
+            missing++;
+        }
+    }
+
+    std::cout << std::endl;
+    std::cout << regressions << " regressions, " << improvements << " improvements, "
+              << missing << " missing (threshold " << threshold << "%)" << std::endl;
+
+    return regressions;
+}
+
+static void printUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [options]" << std::endl;
+    std::cerr << "       " << program << " --compare baseline.json current.json [--threshold percent]" << std::endl;
+    std::cerr << "--sizes <list>: square image sides. Default: " << DEFAULT_SIZES << std::endl;
+    std::cerr << "--kernels <list>: default: " << DEFAULT_KERNELS << std::endl;
+    std::cerr << "--borders <list>: default: " << DEFAULT_BORDERS << std::endl;
+    std::cerr << "--backends <list>: default: all the registered backends";
+    for (const std::string& backend : BackendRegistry::getInstance().getNames()) {
+        std::cerr << " " << backend;
+    }
+    std::cerr << std::endl;
+    std::cerr << "--suite <micro | macro | all>: default: all" << std::endl;
+    std::cerr << "--warmup <n>: default: " << DEFAULT_WARMUP << std::endl;
+    std::cerr << "--repetitions <n>: default: " << DEFAULT_REPETITIONS << std::endl;
+    std::cerr << "--output <file>: default: " << DEFAULT_OUTPUT << std::endl;
+    std::cerr << "--work-folder <folder>: images of the macro suite. Default: " << DEFAULT_WORK_FOLDER << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    std::cout << "===== Kernel convolution benchmark =====" << std::endl;
+
+    BenchmarkOptions options;
+    std::string sizes = DEFAULT_SIZES;
+    std::string suite = "all";
+    options.kernels = splitList(DEFAULT_KERNELS);
+    options.borders = splitList(DEFAULT_BORDERS);
+    options.backends = BackendRegistry::getInstance().getNames();
+    options.warmup = DEFAULT_WARMUP;
+    options.repetitions = DEFAULT_REPETITIONS;
+    options.outputFile = DEFAULT_OUTPUT;
+    options.workFolder = DEFAULT_WORK_FOLDER;
+
+    const char* compareFiles[2] = {nullptr, nullptr};
+    double threshold = DEFAULT_THRESHOLD;
+
+    for (int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (option == "--compare" && i + 2 < argc) {
+            compareFiles[0] = argv[++i];
+            compareFiles[1] = argv[++i];
+        }
+        else if (option == "--threshold" && hasValue) {
+            threshold = atof(argv[++i]);
+        }
+        else if (option == "--sizes" && hasValue) {
+            sizes = argv[++i];
+        }
+        else if (option == "--kernels" && hasValue) {
+            options.kernels = splitList(argv[++i]);
+        }
+        else if (option == "--borders" && hasValue) {
+            options.borders = splitList(argv[++i]);
+        }
+        else if (option == "--backends" && hasValue) {
+            options.backends = splitList(argv[++i]);
+        }
+        else if (option == "--suite" && hasValue) {
+            suite = argv[++i];
+        }
+        else if (option == "--warmup" && hasValue) {
+            options.warmup = std::max(atoi(argv[++i]), 0);
+        }
+        else if (option == "--repetitions" && hasValue) {
+            options.repetitions = std::max(atoi(argv[++i]), 1);
+        }
+        else if (option == "--output" && hasValue) {
+            options.outputFile = argv[++i];
+        }
+        else if (option == "--work-folder" && hasValue) {
+            options.workFolder = argv[++i];
+            if (options.workFolder.back() != '/') {
+                options.workFolder += "/";
+            }
+        }
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Exit status 1 when a case regressed, so scripts can gate on it
+    if (compareFiles[0] != nullptr) {
+        int regressions = compareResults(compareFiles[0], compareFiles[1], threshold);
+        return regressions == 0 ? 0 : 1;
+    }
+
+    for (const std::string& size : splitList(sizes)) {
+        int side = atoi(size.c_str());
+        if (side <= 0) {
+            std::cerr << "Invalid image size " << size << std::endl;
+            return 1;
+        }
+        options.sizes.push_back(side);
+    }
+
+    for (const std::string& kernelName : options.kernels) {
+        Kernel kernel;
+        if (!buildKernel(kernelName, kernel)) {
+            std::cerr << "Invalid kernel " << kernelName << std::endl;
+            return 1;
+        }
+    }
+
+    for (const std::string& borderName : options.borders) {
+        BorderMode border;
+        if (!parseBorder(borderName, border)) {
+            std::cerr << "Invalid border mode " << borderName << std::endl;
+            return 1;
+        }
+    }
+
+    const std::vector<std::string> knownBackends = BackendRegistry::getInstance().getNames();
+    for (const std::string& backend : options.backends) {
+        if (!hasItem(knownBackends, backend)) {
+            std::cerr << "Invalid backend " << backend << std::endl;
+            return 1;
+        }
+    }
+
+    options.runMicro = suite == "micro" || suite == "all";
+    options.runMacro = suite == "macro" || suite == "all";
+    if (!options.runMicro && !options.runMacro) {
+        std::cerr << "Invalid suite " << suite << std::endl;
+        return 1;
+    }
+
+    // CUDA backends are skipped on machines without a GPU
+    bool gpuAvailable = BackendRegistry::getInstance().hasGpuBackend();
+
+    std::cout << "CPU: " << getCpuIsaName(getCpuIsa()) << ", "
+              << ThreadPool::getInstance().getThreadCount() << " threads; GPU: "
+              << (gpuAvailable ? "available" : "not available") << std::endl;
+    std::cout << options.warmup << " warm-up runs, " << options.repetitions << " repetitions" << std::endl;
+
+    std::vector<BenchmarkResult> results;
+    bool success = true;
+    if (options.runMicro) {
+        success = runMicroSuite(options, results) && success;
+    }
+    if (options.runMacro) {
+        success = runMacroSuite(options, results) && success;
+    }
+
+    if (!writeResults(options, gpuAvailable, results)) {
+        return 1;
+    }
+    std::cout << results.size() << " results saved in " << options.outputFile << std::endl;
+
+    return success ? 0 : 1;
+}
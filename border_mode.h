@@ -0,0 +1,61 @@
+#ifndef BORDER_MODE_H_
+#define BORDER_MODE_H_
+
+#ifdef __CUDACC__
+#define BORDER_FUNCTION __host__ __device__ inline
+#else
+#define BORDER_FUNCTION inline
+#endif
+
+/*
+ * How the pixels outside the image are read by the convolution
+ */
+enum class BorderMode
+{
+    REPLICATE,      ///< aaa|abcd|ddd
+    ZERO,           ///< 000|abcd|000
+    REFLECT,        ///< dcb|abcd|cba, the edge pixel is not repeated
+    WRAP            ///< bcd|abcd|abc
+};
+
+/*
+ * @brief: map a coordinate to the image coordinate read for the border mode
+ *
+ * @param: index: coordinate, possibly outside [0, size)
+ * @param: size: image size along the coordinate
+ * @return: the coordinate in [0, size), -1 if the pixel is zero
+ */
+BORDER_FUNCTION int getBorderIndex(int index, int size, BorderMode mode)
+{
+    if (index >= 0 && index < size) {
+        return index;
+    }
+
+    switch (mode) {
+        case BorderMode::ZERO:
+            return -1;
+
+        case BorderMode::REFLECT:
+        {
+            if (size == 1) {
+                return 0;
+            }
+            int period = 2 * (size - 1);
+            index = index % period;
+            if (index < 0) {
+                index += period;
+            }
+            return index < size ? index : period - index;
+        }
+
+        case BorderMode::WRAP:
+            index = index % size;
+            return index < 0 ? index + size : index;
+
+        default:
+            return index < 0 ? 0 : size - 1;
+    }
+}
+
+
+#endif /* BORDER_MODE_H_ */
@@ -0,0 +1,93 @@
+#ifndef BOUNDED_QUEUE_H_
+#define BOUNDED_QUEUE_H_
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+
+/*
+ * FIFO queue shared by producer and consumer threads. Producers block
+ * while the queue is full, so a fast stage cannot run ahead of a slow
+ * one by more than the capacity. Closing the queue wakes every thread:
+ * consumers drain the remaining items, then pop() fails.
+ */
+template <typename T>
+class BoundedQueue
+{
+    public:
+        /*
+         * @brief: Ctor
+         *
+         * @param: capacity: maximum number of queued items
+         */
+        explicit BoundedQueue(size_t capacity) :
+            m_capacity(capacity > 0 ? capacity : 1), m_closed(false) {}
+
+        BoundedQueue(const BoundedQueue&) = delete;
+        BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+        /*
+         * @brief: append an item, waiting for a free slot
+         *
+         * @return: true if queued, false if the queue has been closed
+         */
+        bool push(T item)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_notFull.wait(lock, [this] { return m_closed || m_items.size() < m_capacity; });
+            if (m_closed) {
+                return false;
+            }
+
+            m_items.push_back(std::move(item));
+            m_notEmpty.notify_one();
+
+            return true;
+        }
+
+        /*
+         * @brief: remove the oldest item, waiting for one to be available
+         *
+         * @return: true if item has been set, false if the queue
+         *          has been closed and is empty
+         */
+        bool pop(T& item)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_notEmpty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+            if (m_items.empty()) {
+                return false;
+            }
+
+            item = std::move(m_items.front());
+            m_items.pop_front();
+            m_notFull.notify_one();
+
+            return true;
+        }
+
+        /*
+         * @brief: refuse new items and wake the waiting threads
+         */
+        void close()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_closed = true;
+            }
+            m_notFull.notify_all();
+            m_notEmpty.notify_all();
+        }
+
+    private:
+        std::deque<T> m_items;                  ///< Queued items, oldest first
+        const size_t m_capacity;                ///< Maximum number of items
+        bool m_closed;                          ///< No more items will be pushed
+        std::mutex m_mutex;                     ///< Protects the state above
+        std::condition_variable m_notFull;      ///< Signals a free slot or the closing
+        std::condition_variable m_notEmpty;     ///< Signals a new item or the closing
+};
+
+
+#endif /* BOUNDED_QUEUE_H_ */
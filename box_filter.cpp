@@ -0,0 +1,322 @@
+#include <iostream>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "box_filter.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// Rows of the rows pass and columns of the columns pass run by a task
+#define BOX_ROW_BLOCK       16
+#define BOX_COLUMN_STRIP    256
+
+
+namespace {
+
+/*
+ * Row prefix sums of a thread, kept across the calls
+ */
+struct BoxBuffers
+{
+    std::vector<double> sums;
+    std::vector<double> squares;
+};
+
+BoxBuffers& getBoxBuffers()
+{
+    thread_local BoxBuffers buffers;
+    return buffers;
+}
+
+/*
+ * @brief: return the odd window sides of the passes of runBoxGaussian:
+ *         the m first passes use the size below the ideal one, the
+ *         others the size above, m giving the variance sigma^2
+ */
+void getBoxGaussianSizes(float sigma, int passes, std::vector<int>& sizes)
+{
+    const double variance = static_cast<double>(sigma) * sigma;
+    const double idealSize = std::sqrt(12.0 * variance / passes + 1.0);
+
+    int lower = static_cast<int>(std::floor(idealSize));
+    if (lower % 2 == 0) {
+        lower--;
+    }
+    lower = std::max(lower, 1);
+    const int upper = lower + 2;
+
+    // Each box of side w adds (w^2 - 1) / 12 to the variance
+    const double lowerPasses = (12.0 * variance - passes * lower * lower - 4.0 * passes * lower - 3.0 * passes) /
+                               (-4.0 * lower - 4.0);
+    const int m = std::min(std::max(static_cast<int>(std::lround(lowerPasses)), 0), passes);
+
+    sizes.resize(passes);
+    for (int i = 0; i < passes; i++) {
+        sizes[i] = i < m ? lower : upper;
+    }
+}
+
+}
+
+
+bool runBoxFilter(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                int boxWidth, int boxHeight,
+                BoxStatistic statistic,
+                BorderMode border,
+                bool multithread,
+                Workspace* workspace)
+{
+    if (boxWidth <= 0 || boxHeight <= 0 || boxWidth % 2 == 0 || boxHeight % 2 == 0) {
+        std::cerr << "Box filter sizes must be odd and positive" << std::endl;
+        return false;
+    }
+    if (!haveSamePlaneSize(sourceImages, outImages, planes)) {
+        std::cerr << "Output image size mismatch" << std::endl;
+        return false;
+    }
+
+    TRACE_SCOPE("runBoxFilter");
+
+    Workspace localWorkspace;
+    if (workspace == nullptr) {
+        workspace = &localWorkspace;
+    }
+
+    const int width = sourceImages[0].getWidth();
+    const int height = sourceImages[0].getHeight();
+    const int radiusX = boxWidth / 2;
+    const int radiusY = boxHeight / 2;
+    const bool variance = statistic == BoxStatistic::VARIANCE;
+
+    // Row i of the rows pass holds the window sums of the extended
+    // row i - radiusY: the window of output row y spans rows [y, y + boxHeight)
+    const int paddedWidth = width + 2 * radiusX;
+    const int paddedHeight = height + 2 * radiusY;
+    std::vector<ImageView> rowSums(planes);
+    std::vector<ImageView> rowSquares(variance ? planes : 0);
+    for (int plane = 0; plane < planes; plane++) {
+        rowSums[plane] = workspace->getPlane(WorkspaceBuffer::ROW_PASS, plane, width, paddedHeight);
+        if (variance) {
+            rowSquares[plane] = workspace->getPlane(WorkspaceBuffer::SQUARE_ROW_PASS, plane, width, paddedHeight);
+        }
+    }
+
+    std::vector<int> columnIndex(paddedWidth);
+    for (int j = 0; j < paddedWidth; j++) {
+        columnIndex[j] = getBorderIndex(j - radiusX, width, border);
+    }
+
+    // Rows pass: prefix sums of the extended rows, read through the border mode
+    const int rowBlocks = (paddedHeight + BOX_ROW_BLOCK - 1) / BOX_ROW_BLOCK;
+    runTasks(rowBlocks * planes, [&](int task) {
+        const int plane = task / rowBlocks;
+        const int startRow = (task % rowBlocks) * BOX_ROW_BLOCK;
+        const int endRow = std::min(startRow + BOX_ROW_BLOCK, paddedHeight);
+        const ConstImageView& source = sourceImages[plane];
+
+        BoxBuffers& buffers = getBoxBuffers();
+        buffers.sums.resize(paddedWidth + 1);
+        buffers.squares.resize(paddedWidth + 1);
+        double* sums = buffers.sums.data();
+        double* squares = buffers.squares.data();
+
+        for (int i = startRow; i < endRow; i++) {
+            float* sumRow = rowSums[plane].getRow(i);
+            float* squareRow = variance ? rowSquares[plane].getRow(i) : nullptr;
+            const int y = getBorderIndex(i - radiusY, height, border);
+            if (y < 0) {
+                std::fill(sumRow, sumRow + width, 0.0f);
+                if (variance) {
+                    std::fill(squareRow, squareRow + width, 0.0f);
+                }
+                continue;
+            }
+
+            const float* sourceRow = source.getRow(y);
+            sums[0] = 0;
+            squares[0] = 0;
+            for (int j = 0; j < paddedWidth; j++) {
+                const int x = columnIndex[j];
+                const double pixel = x < 0 ? 0.0 : sourceRow[x];
+                sums[j + 1] = sums[j] + pixel;
+                if (variance) {
+                    squares[j + 1] = squares[j] + pixel * pixel;
+                }
+            }
+
+            for (int x = 0; x < width; x++) {
+                sumRow[x] = static_cast<float>(sums[x + boxWidth] - sums[x]);
+            }
+            if (variance) {
+                for (int x = 0; x < width; x++) {
+                    squareRow[x] = static_cast<float>(squares[x + boxWidth] - squares[x]);
+                }
+            }
+        }
+    }, multithread);
+
+    // Columns pass: the window sums of a strip slide down the rows,
+    // adding the entering row and removing the leaving one
+    const double scale = 1.0 / (static_cast<double>(boxWidth) * boxHeight);
+    const int columnStrips = (width + BOX_COLUMN_STRIP - 1) / BOX_COLUMN_STRIP;
+    runTasks(columnStrips * planes, [&](int task) {
+        const int plane = task / columnStrips;
+        const int startCol = (task % columnStrips) * BOX_COLUMN_STRIP;
+        const int cols = std::min(BOX_COLUMN_STRIP, width - startCol);
+        const ImageView& sumPlane = rowSums[plane];
+        const ImageView& out = outImages[plane];
+
+        double windowSums[BOX_COLUMN_STRIP];
+        double windowSquares[BOX_COLUMN_STRIP];
+        std::fill(windowSums, windowSums + cols, 0.0);
+        std::fill(windowSquares, windowSquares + cols, 0.0);
+        for (int i = 0; i < boxHeight - 1; i++) {
+            const float* sumRow = sumPlane.getRow(i) + startCol;
+            for (int x = 0; x < cols; x++) {
+                windowSums[x] += sumRow[x];
+            }
+            if (variance) {
+                const float* squareRow = rowSquares[plane].getRow(i) + startCol;
+                for (int x = 0; x < cols; x++) {
+                    windowSquares[x] += squareRow[x];
+                }
+            }
+        }
+
+        for (int y = 0; y < height; y++) {
+            const float* entering = sumPlane.getRow(y + boxHeight - 1) + startCol;
+            float* outRow = out.getRow(y) + startCol;
+
+            if (!variance) {
+                for (int x = 0; x < cols; x++) {
+                    windowSums[x] += entering[x];
+                    outRow[x] = static_cast<float>(windowSums[x] * scale);
+                }
+            }
+            else {
+                const float* squaresEntering = rowSquares[plane].getRow(y + boxHeight - 1) + startCol;
+                for (int x = 0; x < cols; x++) {
+                    windowSums[x] += entering[x];
+                    windowSquares[x] += squaresEntering[x];
+                    const double mean = windowSums[x] * scale;
+                    const double variance = windowSquares[x] * scale - mean * mean;
+                    outRow[x] = static_cast<float>(std::min(std::max(variance, 0.0), 255.0));
+                }
+            }
+
+            const float* leaving = sumPlane.getRow(y) + startCol;
+            for (int x = 0; x < cols; x++) {
+                windowSums[x] -= leaving[x];
+            }
+            if (variance) {
+                const float* squaresLeaving = rowSquares[plane].getRow(y) + startCol;
+                for (int x = 0; x < cols; x++) {
+                    windowSquares[x] -= squaresLeaving[x];
+                }
+            }
+        }
+    }, multithread);
+
+    return true;
+}
+
+bool runBoxGaussian(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                float sigma,
+                int passes,
+                BorderMode border,
+                bool multithread,
+                Workspace* workspace)
+{
+    if (!(sigma >= BOX_GAUSSIAN_MIN_SIGMA)) {
+        std::cerr << "Box Gaussian needs a standard deviation of at least "
+                  << BOX_GAUSSIAN_MIN_SIGMA << std::endl;
+        return false;
+    }
+    if (passes < 1) {
+        std::cerr << "Box Gaussian needs at least one pass" << std::endl;
+        return false;
+    }
+
+    if (!haveSamePlaneSize(sourceImages, outImages, planes)) {
+        std::cerr << "Output image size mismatch" << std::endl;
+        return false;
+    }
+
+    std::vector<int> sizes;
+    getBoxGaussianSizes(sigma, passes, sizes);
+
+    TRACE_STATUS("Starting box Gaussian, sigma " << sigma << ", " << passes << " boxes of "
+                 << sizes.front() << " to " << sizes.back());
+
+    Workspace localWorkspace;
+    if (workspace == nullptr) {
+        workspace = &localWorkspace;
+    }
+
+    // The source is extended once by the radii of all the boxes: pixel
+    // (x, y) of a pass reads its radius around (x, y) of the previous
+    // one, so the center of the last pass only reads the border mode
+    // of the source, never the border mode applied to a pass
+    const int width = sourceImages[0].getWidth();
+    const int height = sourceImages[0].getHeight();
+    int extension = 0;
+    for (int size : sizes) {
+        extension += size / 2;
+    }
+    const int extendedWidth = width + 2 * extension;
+    const int extendedHeight = height + 2 * extension;
+
+    std::vector<ImageView> extended(planes);
+    for (int plane = 0; plane < planes; plane++) {
+        extended[plane] = workspace->getPlane(WorkspaceBuffer::BOX_SOURCE, plane, extendedWidth, extendedHeight);
+    }
+
+    std::vector<int> columnIndex(extendedWidth);
+    for (int j = 0; j < extendedWidth; j++) {
+        columnIndex[j] = getBorderIndex(j - extension, width, border);
+    }
+
+    const int rowBlocks = (extendedHeight + BOX_ROW_BLOCK - 1) / BOX_ROW_BLOCK;
+    runTasks(rowBlocks * planes, [&](int task) {
+        const int plane = task / rowBlocks;
+        const int startRow = (task % rowBlocks) * BOX_ROW_BLOCK;
+        const int endRow = std::min(startRow + BOX_ROW_BLOCK, extendedHeight);
+
+        for (int i = startRow; i < endRow; i++) {
+            float* extendedRow = extended[plane].getRow(i);
+            const int y = getBorderIndex(i - extension, height, border);
+            if (y < 0) {
+                std::fill(extendedRow, extendedRow + extendedWidth, 0.0f);
+                continue;
+            }
+
+            const float* sourceRow = sourceImages[plane].getRow(y);
+            for (int j = 0; j < extendedWidth; j++) {
+                const int x = columnIndex[j];
+                extendedRow[j] = x < 0 ? 0.0f : sourceRow[x];
+            }
+        }
+    }, multithread);
+
+    // The passes run in place on the extended planes
+    std::vector<ConstImageView> extendedViews(extended.begin(), extended.end());
+    for (int i = 0; i < passes; i++) {
+        if (!runBoxFilter(extendedViews.data(), extended.data(), planes, sizes[i], sizes[i],
+                          BoxStatistic::MEAN, border, multithread, workspace)) {
+            return false;
+        }
+    }
+
+    for (int plane = 0; plane < planes; plane++) {
+        for (int y = 0; y < height; y++) {
+            const float* extendedRow = extended[plane].getRow(y + extension) + extension;
+            std::copy(extendedRow, extendedRow + width, outImages[plane].getRow(y));
+        }
+    }
+
+    return true;
+}
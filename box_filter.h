@@ -0,0 +1,81 @@
+#ifndef BOX_FILTER_H_
+#define BOX_FILTER_H_
+
+#include "border_mode.h"
+#include "image_buffer.h"
+#include "workspace.h"
+
+// Smallest standard deviation the box approximation is defined for:
+// below it the boxes are too narrow to make a Gaussian
+#define BOX_GAUSSIAN_MIN_SIGMA          1.0f
+
+/*
+ * Value computed on the window of each pixel by runBoxFilter
+ */
+enum class BoxStatistic
+{
+    MEAN,           ///< Mean of the window
+    VARIANCE        ///< Variance of the window, E[x^2] - E[x]^2
+};
+
+/*
+ * @brief: This function will compute a statistic of the
+ *         boxWidth x boxHeight window centered on each pixel from the
+ *         summed-area table (integral image) of the source, extended
+ *         by the window radius according to the border mode. The two
+ *         prefix sums of the table are run separately: the rows pass
+ *         keeps the differences of the row prefix sums at the window
+ *         width, the columns pass turns them into window sums with a
+ *         running sum per column. Each output costs a fixed number of
+ *         operations, whatever the window size. The running sums are
+ *         kept in double precision. The outputs are in [0, 255] as
+ *         those of the other filters: variances above 255 saturate.
+ *
+ * @param: planes: number of source and output views, the channels
+ *         of an image. The output views may be the source views.
+ * @param: boxWidth, boxHeight: odd window sizes
+ * @param: multithread: the rows, then the column strips, are split
+ *         among the thread pool threads, otherwise run on the calling thread
+ * @param: workspace: holds the rows pass planes (ROW_PASS and, for
+ *         the variance, SQUARE_ROW_PASS), allocated by the call if nullptr
+ * @return: true if successful, false otherwise
+ */
+bool runBoxFilter(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                int boxWidth, int boxHeight,
+                BoxStatistic statistic,
+                BorderMode border,
+                bool multithread,
+                Workspace* workspace = nullptr);
+
+/*
+ * @brief: approximate the Gaussian blur of standard deviation sigma
+ *         by passes box means (runBoxFilter) of square windows. The
+ *         window sizes are the odd sizes around the ideal one whose
+ *         mix gives the variance of the Gaussian (Kovesi, "Fast
+ *         almost-Gaussian filtering", 2010). The cost per pixel
+ *         depends on the passes only. The source is extended once by
+ *         the radii of all the boxes according to the border mode, so
+ *         the passes never apply the border mode to a blurred image.
+ *         With 3 passes the difference from the direct convolution
+ *         with a Gaussian kernel is a few gray levels (see README).
+ *
+ * @param: sigma: standard deviation, at least BOX_GAUSSIAN_MIN_SIGMA
+ * @param: passes: number of box means, at least 1
+ * @param: workspace: holds the extended source (BOX_SOURCE) and the
+ *         planes of runBoxFilter, allocated by the call if nullptr
+ * @return: true if successful, false if sigma is too small, there
+ *          is no pass or the sizes differ
+ */
+bool runBoxGaussian(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                float sigma,
+                int passes,
+                BorderMode border,
+                bool multithread,
+                Workspace* workspace = nullptr);
+
+
+#endif /* BOX_FILTER_H_ */
@@ -0,0 +1,155 @@
+#include <iostream>
+#include <cstdlib>
+#include "command_line.h"
+#include "convolution_planner.h"
+#include "result_cache.h"
+
+
+bool parseFilterCommand(const std::string& command, FilterPipeline& pipeline)
+{
+    size_t filterStart = 0;
+    while (filterStart <= command.size()) {
+        size_t filterEnd = command.find(FILTER_CHAIN_SEPARATOR, filterStart);
+        if (filterEnd == std::string::npos) {
+            filterEnd = command.size();
+        }
+        std::string filterName = command.substr(filterStart, filterEnd - filterStart);
+        filterStart = filterEnd + 1;
+
+        Kernel filter = Kernel();
+        if (filterName == GAUSSIAN_FILTER_COMMAND) {
+            filter.setGaussianFilter(7, 7, 1);
+        }
+        else if (filterName == SHARPENING_FILTER_COMMAND) {
+            filter.setSharpenFilter();
+        }
+        else if (filterName == EDGE_DETECTION_FILTER_COMMAND) {
+            filter.setEdgeDetectionFilter();
+        }
+        else if (filterName == LAPLACIAN_FILTER_COMMAND) {
+            filter.setLaplacianFilter();
+        }
+        else if (filterName == GAUSSIAN_LAPLACIAN_COMMAND) {
+            filter.setGaussianLaplacianFilter();
+        }
+        else {
+            std::cerr << "Invalid filter type " << filterName << std::endl;
+            return false;
+        }
+
+        pipeline.addKernel(filter);
+    }
+
+    return true;
+}
+
+bool parseFilterParameter(const std::string& command, std::string& name, float& value)
+{
+    size_t separator = command.find(FILTER_PARAMETER_SEPARATOR);
+    if (separator == std::string::npos) {
+        return false;
+    }
+
+    name = command.substr(0, separator);
+    if (name != RECURSIVE_GAUSSIAN_COMMAND && name != BOX_FILTER_COMMAND &&
+        name != LOCAL_VARIANCE_COMMAND && name != BOX_GAUSSIAN_COMMAND &&
+        name != MEDIAN_FILTER_COMMAND && name != ERODE_FILTER_COMMAND && name != DILATE_FILTER_COMMAND) {
+        return false;
+    }
+
+    const char* parameter = command.c_str() + separator + 1;
+    char* end = nullptr;
+    value = strtof(parameter, &end);
+
+    return end != parameter && *end == '\0';
+}
+
+bool parseCudaMemType(const std::string& command, CudaMemType& cudaType)
+{
+    if (command == CUDA_GLOBAL) {
+        cudaType = CudaMemType::GLOBAL;
+    }
+    else if (command == CUDA_CONSTANT) {
+        cudaType = CudaMemType::CONSTANT;
+    }
+    else if (command == CUDA_SHARED) {
+        cudaType = CudaMemType::SHARED;
+    }
+    else if (command == CPU_THREADS) {
+        cudaType = CudaMemType::CPU_MULTITHREAD;
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+bool parseBorderMode(const std::string& command, BorderMode& border)
+{
+    if (command == BORDER_REPLICATE) {
+        border = BorderMode::REPLICATE;
+    }
+    else if (command == BORDER_ZERO) {
+        border = BorderMode::ZERO;
+    }
+    else if (command == BORDER_REFLECT) {
+        border = BorderMode::REFLECT;
+    }
+    else if (command == BORDER_WRAP) {
+        border = BorderMode::WRAP;
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+bool parsePixelFormat(const std::string& command, PixelFormat& format)
+{
+    if (command == PIXEL_FLOAT) {
+        format = PixelFormat::FLOAT;
+    }
+    else if (command == PIXEL_UINT8) {
+        format = PixelFormat::UINT8;
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+void setupConvolutionPlanner()
+{
+    const char* profileFile = getenv(PROFILE_FILE_ENV);
+    if (profileFile == nullptr || profileFile[0] == '\0') {
+        profileFile = DEFAULT_PROFILE_FILE;
+    }
+
+    ConvolutionPlanner& planner = ConvolutionPlanner::getInstance();
+    if (!planner.loadProfile(profileFile)) {
+        std::cout << "Tuning the convolution planner..." << std::endl;
+        if (planner.tune() && planner.saveProfile(profileFile)) {
+            std::cout << "Tuning profile saved in " << profileFile << std::endl;
+        }
+    }
+}
+
+void setupResultCache()
+{
+    ResultCache& cache = ResultCache::getInstance();
+
+    const char* memorySize = getenv(CACHE_MEMORY_SIZE_ENV);
+    if (memorySize != nullptr && memorySize[0] != '\0') {
+        cache.setMemoryBudget(static_cast<size_t>(atol(memorySize)) << 20);
+    }
+
+    const char* directory = getenv(CACHE_DIR_ENV);
+    if (directory != nullptr && directory[0] != '\0') {
+        const char* diskSize = getenv(CACHE_DISK_SIZE_ENV);
+        long diskMegabytes = diskSize != nullptr && diskSize[0] != '\0' ? atol(diskSize) : DEFAULT_CACHE_DISK_MB;
+        cache.setDiskTier(directory, static_cast<size_t>(diskMegabytes) << 20);
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef COMMAND_LINE_H_
+#define COMMAND_LINE_H_
+
+#include <string>
+#include "image.h"
+#include "filter_pipeline.h"
+
+/*
+ * Option values shared by the command line of the application
+ * and the requests of the filter server
+ */
+#define GAUSSIAN_FILTER_COMMAND        "gaussian"
+#define SHARPENING_FILTER_COMMAND      "sharpen"
+#define EDGE_DETECTION_FILTER_COMMAND  "edge_detect"
+#define LAPLACIAN_FILTER_COMMAND       "laplacian"
+#define GAUSSIAN_LAPLACIAN_COMMAND     "gaussian_laplacian"
+
+// Filters without a kernel matrix, followed by their parameter:
+// recursive_gaussian:<standard deviation>, box:<window size>,
+// variance:<window size>, box_gaussian:<standard deviation>,
+// median:<window size>, erode:<window size>, dilate:<window size>
+#define RECURSIVE_GAUSSIAN_COMMAND     "recursive_gaussian"
+#define BOX_FILTER_COMMAND             "box"
+#define LOCAL_VARIANCE_COMMAND         "variance"
+#define BOX_GAUSSIAN_COMMAND           "box_gaussian"
+#define MEDIAN_FILTER_COMMAND          "median"
+#define ERODE_FILTER_COMMAND           "erode"
+#define DILATE_FILTER_COMMAND          "dilate"
+#define FILTER_PARAMETER_SEPARATOR     ':'
+
+#define CUDA_GLOBAL		"global"
+#define CUDA_CONSTANT	"constant"
+#define CUDA_SHARED		"shared"
+#define CPU_THREADS		"cpu"
+#define CPU_STREAM		"stream"
+
+#define BORDER_REPLICATE	"replicate"
+#define BORDER_ZERO			"zero"
+#define BORDER_REFLECT		"reflect"
+#define BORDER_WRAP			"wrap"
+
+#define PIXEL_FLOAT			"float"
+#define PIXEL_UINT8			"uint8"
+
+#define FILTER_CHAIN_SEPARATOR	'+'
+
+// Environment variable overriding the planner profile file
+#define PROFILE_FILE_ENV        "KC_TUNING_PROFILE"
+#define DEFAULT_PROFILE_FILE    "tuning.profile"
+
+// Environment variables of the result cache: the folder enables the
+// disk tier, the memory size the memory tier, the sizes are in MiB
+#define CACHE_DIR_ENV           "KC_CACHE_DIR"
+#define CACHE_DISK_SIZE_ENV     "KC_CACHE_DISK_MB"
+#define CACHE_MEMORY_SIZE_ENV   "KC_CACHE_MEMORY_MB"
+#define DEFAULT_CACHE_DISK_MB   1024
+
+/*
+ * @brief: append to pipeline the built-in filters named by command,
+ *         several names joined by FILTER_CHAIN_SEPARATOR being
+ *         applied in sequence
+ *
+ * @return: true if successful, false if a name is unknown (printed)
+ */
+bool parseFilterCommand(const std::string& command, FilterPipeline& pipeline);
+
+/*
+ * @brief: parse a filter without kernel matrix, name:value
+ *
+ * @return: true if command is the name of such a filter followed
+ *          by a number, false otherwise
+ */
+bool parseFilterParameter(const std::string& command, std::string& name, float& value);
+
+/*
+ * @brief: parse a CUDA memory type, CPU_STREAM excluded
+ *
+ * @return: true if successful, false if the name is unknown
+ */
+bool parseCudaMemType(const std::string& command, CudaMemType& cudaType);
+
+/*
+ * @brief: parse a border mode
+ *
+ * @return: true if successful, false if the name is unknown
+ */
+bool parseBorderMode(const std::string& command, BorderMode& border);
+
+/*
+ * @brief: parse a pixel format
+ *
+ * @return: true if successful, false if the name is unknown
+ */
+bool parsePixelFormat(const std::string& command, PixelFormat& format);
+
+/*
+ * @brief: load the profile of the convolution planner, measuring
+ *         and saving it when the file is missing or stale
+ */
+void setupConvolutionPlanner();
+
+/*
+ * @brief: size the tiers of the result cache from the environment
+ */
+void setupResultCache();
+
+
+#endif /* COMMAND_LINE_H_ */
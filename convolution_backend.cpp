@@ -0,0 +1,373 @@
+#include <iostream>
+#include "convolution_backend.h"
+#include "cpu_convolution.h"
+#include "fft_convolution.h"
+#include "convolution_planner.h"
+#include "trace.h"
+
+
+/*
+ * @brief: return the tiles and threads planned for a CPU backend
+ */
+static CpuTiling getPlannedTiling(const Kernel& kernel, ConvolutionMethod method,
+                                  int width, int height, int planes,
+                                  bool multithread)
+{
+    return ConvolutionPlanner::getInstance().getPlan(kernel, method,
+                                                     width, height, planes,
+                                                     multithread).tiling;
+}
+
+/*
+ * Spatial convolution on the CPU with the 2D mask
+ */
+class DirectBackend : public ConvolutionBackend
+{
+    public:
+        DirectBackend(const char* name, bool multithread) : m_name(name), m_multithread(multithread) {}
+
+        const char* getName() const override { return m_name; }
+
+        BackendCapabilities getCapabilities() const override
+        {
+            return {false, m_multithread, false, false, 0};
+        }
+
+        bool execute(const ConstImageView* sourceImages,
+                     const ImageView* outImages,
+                     int planes) override
+        {
+            const Kernel& kernel = *m_kernel;
+            const int filterWidth = kernel.getKernelWidth();
+            const int filterHeight = kernel.getKernelHeight();
+            const int width = sourceImages[0].getWidth();
+            const int height = sourceImages[0].getHeight();
+
+            if (m_multithread) {
+                return runCpuMultithread(sourceImages, outImages, planes,
+                                         kernel.getKernel().data(),
+                                         filterWidth, filterHeight,
+                                         m_borderMode,
+                                         getPlannedTiling(kernel, ConvolutionMethod::DIRECT,
+                                                          width, height, planes, true));
+            }
+
+            if (!haveSamePlaneSize(sourceImages, outImages, planes)) {
+                std::cerr << "Output image size mismatch" << std::endl;
+                return false;
+            }
+
+            TRACE_COUNT(TraceCounter::PIXELS_PROCESSED, static_cast<long long>(width) * height * planes);
+
+            for (int plane = 0; plane < planes; plane++) {
+                convolveTile(sourceImages[plane].getData(), sourceImages[plane].getStride(),
+                             outImages[plane].getData(), outImages[plane].getStride(),
+                             kernel.getKernel().data(),
+                             width, height,
+                             filterWidth, filterHeight,
+                             m_borderMode,
+                             0, width, 0, height);
+            }
+
+            return true;
+        }
+
+        using ConvolutionBackend::execute;
+
+    private:
+        const char* m_name;         ///< Registered name
+        bool m_multithread;         ///< Tiles run on the thread pool
+};
+
+/*
+ * Two 1D passes per term of a separable kernel
+ */
+class SeparableBackend : public ConvolutionBackend
+{
+    public:
+        SeparableBackend(const char* name, bool multithread) : m_name(name), m_multithread(multithread) {}
+
+        const char* getName() const override { return m_name; }
+
+        BackendCapabilities getCapabilities() const override
+        {
+            return {false, m_multithread, true, false, 0};
+        }
+
+        bool execute(const ConstImageView* sourceImages,
+                     const ImageView* outImages,
+                     int planes) override
+        {
+            const Kernel& kernel = *m_kernel;
+
+            return runCpuSeparable(sourceImages, outImages, planes,
+                                   kernel.getRowFactors().data(), kernel.getColumnFactors().data(),
+                                   kernel.getSeparableRank(),
+                                   kernel.getKernelWidth(), kernel.getKernelHeight(),
+                                   m_borderMode,
+                                   m_multithread,
+                                   getPlannedTiling(kernel, ConvolutionMethod::SEPARABLE,
+                                                    sourceImages[0].getWidth(), sourceImages[0].getHeight(),
+                                                    planes, m_multithread),
+                                   m_workspace);
+        }
+
+        using ConvolutionBackend::execute;
+
+    private:
+        const char* m_name;         ///< Registered name
+        bool m_multithread;         ///< Tiles run on the thread pool
+};
+
+/*
+ * Spatial convolution over the non-zero taps of the mask
+ */
+class SparseBackend : public ConvolutionBackend
+{
+    public:
+        SparseBackend(const char* name, bool multithread) : m_name(name), m_multithread(multithread) {}
+
+        const char* getName() const override { return m_name; }
+
+        BackendCapabilities getCapabilities() const override
+        {
+            return {false, m_multithread, false, false, 0};
+        }
+
+        bool execute(const ConstImageView* sourceImages,
+                     const ImageView* outImages,
+                     int planes) override
+        {
+            const Kernel& kernel = *m_kernel;
+
+            return runCpuSparse(sourceImages, outImages, planes,
+                                kernel.getKernel().data(),
+                                kernel.getKernelWidth(), kernel.getKernelHeight(),
+                                m_borderMode,
+                                m_multithread,
+                                getPlannedTiling(kernel, ConvolutionMethod::SPARSE,
+                                                 sourceImages[0].getWidth(), sourceImages[0].getHeight(),
+                                                 planes, m_multithread));
+        }
+
+        using ConvolutionBackend::execute;
+
+    private:
+        const char* m_name;         ///< Registered name
+        bool m_multithread;         ///< Tiles run on the thread pool
+};
+
+/*
+ * Overlap-save convolution in the frequency domain, no kernel size limit
+ */
+class FftBackend : public ConvolutionBackend
+{
+    public:
+        FftBackend(const char* name, bool multithread) : m_name(name), m_multithread(multithread) {}
+
+        const char* getName() const override { return m_name; }
+
+        BackendCapabilities getCapabilities() const override
+        {
+            return {false, m_multithread, false, false, 0};
+        }
+
+        bool execute(const ConstImageView* sourceImages,
+                     const ImageView* outImages,
+                     int planes) override
+        {
+            const Kernel& kernel = *m_kernel;
+
+            return runCpuFft(sourceImages, outImages, planes,
+                             kernel.getKernel().data(),
+                             kernel.getKernelWidth(), kernel.getKernelHeight(),
+                             m_borderMode,
+                             m_multithread,
+                             getPlannedTiling(kernel, ConvolutionMethod::FFT,
+                                              sourceImages[0].getWidth(), sourceImages[0].getHeight(),
+                                              planes, m_multithread).threads);
+        }
+
+        using ConvolutionBackend::execute;
+
+    private:
+        const char* m_name;         ///< Registered name
+        bool m_multithread;         ///< Tiles run on the thread pool
+};
+
+/*
+ * Fixed-point convolution of 8-bit images
+ */
+class IntegerBackend : public ConvolutionBackend
+{
+    public:
+        IntegerBackend(const char* name, bool multithread) : m_name(name), m_multithread(multithread) {}
+
+        const char* getName() const override { return m_name; }
+
+        BackendCapabilities getCapabilities() const override
+        {
+            return {false, m_multithread, false, true, 0};
+        }
+
+        bool execute(const ConstImageView8* sourceImages,
+                     const ImageView8* outImages,
+                     int planes) override
+        {
+            const Kernel& kernel = *m_kernel;
+
+            // Tiled as the 2D float loop
+            return runCpuInteger(sourceImages, outImages, planes,
+                                 kernel.getFixedPointKernel().data(),
+                                 kernel.getFixedPointShift(), kernel.isFixedPointNarrow(),
+                                 kernel.getKernelWidth(), kernel.getKernelHeight(),
+                                 m_borderMode,
+                                 m_multithread,
+                                 getPlannedTiling(kernel, ConvolutionMethod::DIRECT,
+                                                  sourceImages[0].getWidth(), sourceImages[0].getHeight(),
+                                                  planes, m_multithread));
+        }
+
+        using ConvolutionBackend::execute;
+
+    private:
+        const char* m_name;         ///< Registered name
+        bool m_multithread;         ///< Tiles run on the thread pool
+};
+
+template <typename T>
+static BackendFactory getCpuFactory(const char* name, bool multithread)
+{
+    return [name, multithread]() {
+        return std::unique_ptr<ConvolutionBackend>(new T(name, multithread));
+    };
+}
+
+
+ConvolutionBackend::ConvolutionBackend()
+{
+    m_kernel = nullptr;
+    m_borderMode = BorderMode::REPLICATE;
+    m_workspace = nullptr;
+}
+
+bool ConvolutionBackend::supports(const Kernel& kernel) const
+{
+    BackendCapabilities capabilities = getCapabilities();
+
+    if (kernel.getKernelWidth() == 0 || kernel.getKernelHeight() == 0) {
+        return false;
+    }
+
+    if (capabilities.maxKernelSize > 0 &&
+        (kernel.getKernelWidth() > capabilities.maxKernelSize ||
+         kernel.getKernelHeight() > capabilities.maxKernelSize)) {
+        return false;
+    }
+
+    if (capabilities.separableOnly && !kernel.isSeparable()) {
+        return false;
+    }
+
+    if (capabilities.integer && !kernel.isFixedPoint()) {
+        return false;
+    }
+
+    return true;
+}
+
+bool ConvolutionBackend::prepare(const Kernel& kernel, BorderMode border)
+{
+    if (!supports(kernel)) {
+        std::cerr << "Kernel not supported by the " << getName() << " backend" << std::endl;
+        return false;
+    }
+
+    m_kernel = &kernel;
+    m_borderMode = border;
+
+    return true;
+}
+
+bool ConvolutionBackend::execute(const ConstImageView*, const ImageView*, int)
+{
+    std::cerr << "The " << getName() << " backend does not filter float images" << std::endl;
+    return false;
+}
+
+bool ConvolutionBackend::execute(const ConstImageView8*, const ImageView8*, int)
+{
+    std::cerr << "The " << getName() << " backend does not filter 8-bit images" << std::endl;
+    return false;
+}
+
+void ConvolutionBackend::teardown()
+{
+    m_kernel = nullptr;
+}
+
+
+BackendRegistry::BackendRegistry()
+{
+    add("sequential", getCpuFactory<DirectBackend>("sequential", false));
+    add("cpu", getCpuFactory<DirectBackend>("cpu", true));
+    add("sequential_separable", getCpuFactory<SeparableBackend>("sequential_separable", false));
+    add("cpu_separable", getCpuFactory<SeparableBackend>("cpu_separable", true));
+    add("sequential_sparse", getCpuFactory<SparseBackend>("sequential_sparse", false));
+    add("cpu_sparse", getCpuFactory<SparseBackend>("cpu_sparse", true));
+    add("sequential_fft", getCpuFactory<FftBackend>("sequential_fft", false));
+    add("cpu_fft", getCpuFactory<FftBackend>("cpu_fft", true));
+    add("sequential_integer", getCpuFactory<IntegerBackend>("sequential_integer", false));
+    add("cpu_integer", getCpuFactory<IntegerBackend>("cpu_integer", true));
+}
+
+BackendRegistry& BackendRegistry::getInstance()
+{
+    static BackendRegistry registry;
+    return registry;
+}
+
+void BackendRegistry::add(const std::string& name, const BackendFactory& factory)
+{
+    for (auto& backend : m_backends) {
+        if (backend.first == name) {
+            backend.second = factory;
+            return;
+        }
+    }
+
+    m_backends.push_back(std::make_pair(name, factory));
+}
+
+std::unique_ptr<ConvolutionBackend> BackendRegistry::create(const std::string& name) const
+{
+    for (const auto& backend : m_backends) {
+        if (backend.first == name) {
+            return backend.second();
+        }
+    }
+
+    return std::unique_ptr<ConvolutionBackend>();
+}
+
+std::vector<std::string> BackendRegistry::getNames() const
+{
+    std::vector<std::string> names;
+    for (const auto& backend : m_backends) {
+        names.push_back(backend.first);
+    }
+
+    return names;
+}
+
+bool BackendRegistry::hasGpuBackend() const
+{
+    for (const auto& backend : m_backends) {
+        std::unique_ptr<ConvolutionBackend> instance = backend.second();
+        if (instance->getCapabilities().gpu && instance->isAvailable()) {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,166 @@
+#ifndef CONVOLUTION_BACKEND_H_
+#define CONVOLUTION_BACKEND_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include "kernel.h"
+#include "border_mode.h"
+#include "image_buffer.h"
+#include "workspace.h"
+
+/*
+ * What a backend can run
+ */
+struct BackendCapabilities
+{
+    bool gpu;               ///< Needs a CUDA device
+    bool multithread;       ///< Runs on the CPU thread pool
+    bool separableOnly;     ///< Runs the 1D passes of separable kernels only
+    bool integer;           ///< Works on 8-bit views with fixed-point kernels only
+    int maxKernelSize;      ///< Biggest kernel side, 0 if there is no limit
+};
+
+/*
+ * A convolution implementation. An instance filters images with one
+ * kernel at a time: prepare() validates the kernel and sets up what the
+ * executions share, execute() filters the planes of an image (the
+ * channels, see runCpuMultithread) and teardown() releases the setup.
+ * Instances are created by the BackendRegistry and are not shared
+ * between threads.
+ */
+class ConvolutionBackend
+{
+    public:
+        ConvolutionBackend();
+
+        /*
+         *  @brief: Dtor
+         */
+        virtual ~ConvolutionBackend() {}
+
+        ConvolutionBackend(const ConvolutionBackend&) = delete;
+        ConvolutionBackend& operator=(const ConvolutionBackend&) = delete;
+
+        /*
+         * @brief: return the name the backend is registered with
+         */
+        virtual const char* getName() const = 0;
+
+        virtual BackendCapabilities getCapabilities() const = 0;
+
+        /*
+         * @brief: return true if the device of the backend can be used
+         *         on this machine
+         */
+        virtual bool isAvailable() const { return true; }
+
+        /*
+         * @brief: return true if the kernel fits the capabilities
+         *         of the backend
+         */
+        bool supports(const Kernel& kernel) const;
+
+        /*
+         * @brief: set the kernel and border mode of the next executions.
+         *         The kernel must outlive them.
+         *
+         * @return: true if successful, false if the kernel is not supported
+         */
+        virtual bool prepare(const Kernel& kernel, BorderMode border);
+
+        /*
+         * @brief: filter float planes with the prepared kernel. Each output
+         *         view must have the size of the source views.
+         *
+         * @return: true if successful, false otherwise
+         */
+        virtual bool execute(const ConstImageView* sourceImages,
+                             const ImageView* outImages,
+                             int planes);
+
+        /*
+         * @brief: filter 8-bit planes, for integer backends
+         */
+        virtual bool execute(const ConstImageView8* sourceImages,
+                             const ImageView8* outImages,
+                             int planes);
+
+        /*
+         * @brief: release what prepare() has set up
+         */
+        virtual void teardown();
+
+        /*
+         * @brief: set the workspace holding the scratch and device
+         *         memory of the executions, nullptr to allocate it
+         *         on each execution
+         */
+        void setWorkspace(Workspace* workspace) { m_workspace = workspace; }
+
+    protected:
+        const Kernel* m_kernel;         ///< Prepared kernel, nullptr before prepare()
+        BorderMode m_borderMode;        ///< Prepared border mode
+        Workspace* m_workspace;         ///< Memory reused by the executions, may be nullptr
+};
+
+typedef std::function<std::unique_ptr<ConvolutionBackend>()> BackendFactory;
+
+/*
+ * Process wide list of the backends. The CPU backends are always
+ * registered; the CUDA ones register themselves when gpu_convolution.cu
+ * is linked, so CPU-only builds simply do not have them.
+ */
+class BackendRegistry
+{
+    public:
+        BackendRegistry(const BackendRegistry&) = delete;
+        BackendRegistry& operator=(const BackendRegistry&) = delete;
+
+        /*
+         * @brief: return the process wide registry
+         */
+        static BackendRegistry& getInstance();
+
+        /*
+         * @brief: register a backend. Called during static initialization.
+         */
+        void add(const std::string& name, const BackendFactory& factory);
+
+        /*
+         * @brief: return a new instance of a backend, nullptr if the name
+         *         is not registered
+         */
+        std::unique_ptr<ConvolutionBackend> create(const std::string& name) const;
+
+        /*
+         * @brief: return the names of the backends, in registration order
+         */
+        std::vector<std::string> getNames() const;
+
+        /*
+         * @brief: return true if a GPU backend is registered and its device
+         *         can be used. The first call initializes the device.
+         */
+        bool hasGpuBackend() const;
+
+    private:
+        BackendRegistry();
+
+        std::vector<std::pair<std::string, BackendFactory>> m_backends;    ///< Name and factory
+};
+
+/*
+ * Registers a backend from a static object
+ */
+struct BackendRegistration
+{
+    BackendRegistration(const char* name, const BackendFactory& factory)
+    {
+        BackendRegistry::getInstance().add(name, factory);
+    }
+};
+
+
+#endif /* CONVOLUTION_BACKEND_H_ */
@@ -0,0 +1,541 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <vector>
+#include "convolution_planner.h"
+#include "convolution_backend.h"
+#include "fft_convolution.h"
+#include "gpu_convolution.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+#define PROFILE_VERSION         1
+
+// Calibration image side and timed runs per measure (after one warm-up run)
+#define TUNING_IMAGE_SIZE       1024
+#define TUNING_REPETITIONS      3
+
+
+/*
+ * A numeric field of the profile file
+ */
+struct ProfileField
+{
+    const char* key;
+    float TuningProfile::* floatValue;      ///< nullptr for integer fields
+    int TuningProfile::* intValue;
+};
+
+static const ProfileField s_profileFields[] = {
+    {"threads", nullptr, &TuningProfile::threads},
+    {"direct_tap_cost", &TuningProfile::directTapCost, nullptr},
+    {"unrolled_tap_cost", &TuningProfile::unrolledTapCost, nullptr},
+    {"separable_tap_cost", &TuningProfile::separableTapCost, nullptr},
+    {"sparse_tap_cost", &TuningProfile::sparseTapCost, nullptr},
+    {"fft_unit_cost", &TuningProfile::fftUnitCost, nullptr},
+    {"thread_cost", &TuningProfile::threadCost, nullptr},
+    {"cpu_tile_width", nullptr, &TuningProfile::cpuTileWidth},
+    {"cpu_tile_height", nullptr, &TuningProfile::cpuTileHeight},
+    {"gpu_block_width", nullptr, &TuningProfile::gpuBlockWidth},
+    {"gpu_block_height", nullptr, &TuningProfile::gpuBlockHeight},
+    {"gpu_shared_tile_width", nullptr, &TuningProfile::gpuSharedTileWidth},
+    {"gpu_shared_tile_height", nullptr, &TuningProfile::gpuSharedTileHeight},
+    {"gpu_shared_thread_rows", nullptr, &TuningProfile::gpuSharedThreadRows}
+};
+
+
+TuningProfile::TuningProfile()
+{
+    const CpuTiling tiling;
+    const GpuBlockSize blockSize;
+
+    // Untuned estimates: a tap costs a scalar operation, shared
+    // by the pixels of a vector. The sparse loop also loads and
+    // stores the output row on each tap.
+    const float vectorTapCost = 1.0f / getCpuIsaVectorWidth(getCpuIsa());
+
+    isa = getCpuIsaName(getCpuIsa());
+    threads = ThreadPool::getInstance().getThreadCount();
+    directTapCost = vectorTapCost;
+    unrolledTapCost = vectorTapCost;
+    separableTapCost = vectorTapCost;
+    sparseTapCost = 2 * vectorTapCost;
+    fftUnitCost = 1.0f;
+    threadCost = 5000.0f;
+    cpuTileWidth = tiling.tileWidth;
+    cpuTileHeight = tiling.tileHeight;
+    gpuBlockWidth = blockSize.blockWidth;
+    gpuBlockHeight = blockSize.blockHeight;
+    gpuSharedTileWidth = blockSize.sharedTileWidth;
+    gpuSharedTileHeight = blockSize.sharedTileHeight;
+    gpuSharedThreadRows = blockSize.sharedThreadRows;
+}
+
+/*
+ * @brief: return true if the 2D loop has an unrolled version for the mask
+ */
+static bool isUnrolledSize(int filterWidth, int filterHeight)
+{
+    return filterWidth == filterHeight &&
+           (filterWidth == 3 || filterWidth == 5 || filterWidth == 7);
+}
+
+static int getNonZeroTaps(const Kernel& kernel)
+{
+    const std::vector<float>& mask = kernel.getKernel();
+    return mask.size() - std::count(mask.begin(), mask.end(), 0.0f);
+}
+
+/*
+ * @brief: return the estimated cost of a method per output pixel
+ *         on one thread, in ns. INFINITY if the method cannot run the kernel.
+ */
+static float getCostPerPixel(const TuningProfile& profile,
+                             const Kernel& kernel, ConvolutionMethod method,
+                             int width, int height)
+{
+    const int filterWidth = kernel.getKernelWidth();
+    const int filterHeight = kernel.getKernelHeight();
+
+    switch (method) {
+        case ConvolutionMethod::DIRECT:
+            return filterWidth * filterHeight *
+                   (isUnrolledSize(filterWidth, filterHeight) ? profile.unrolledTapCost : profile.directTapCost);
+
+        case ConvolutionMethod::SEPARABLE:
+            if (!kernel.isSeparable()) {
+                return INFINITY;
+            }
+            return kernel.getSeparableRank() * (filterWidth + filterHeight) * profile.separableTapCost;
+
+        case ConvolutionMethod::SPARSE:
+            return getNonZeroTaps(kernel) * profile.sparseTapCost;
+
+        default:
+            return getFftCostPerPixel(width, height, filterWidth, filterHeight) * profile.fftUnitCost;
+    }
+}
+
+/*
+ * @brief: run function once untimed, then TUNING_REPETITIONS times
+ *
+ * @return: the median time in ns, INFINITY if a run failed
+ */
+static double measure(const std::function<bool()>& function)
+{
+    if (!function()) {
+        return INFINITY;
+    }
+
+    std::vector<double> samples;
+    for (int i = 0; i < TUNING_REPETITIONS; i++) {
+        auto t1 = std::chrono::steady_clock::now();
+        if (!function()) {
+            return INFINITY;
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count());
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    return samples[samples.size() / 2];
+}
+
+/*
+ * @brief: return a size x size mask of pseudo random coefficients,
+ *         without zeros, so it is neither separable nor sparse
+ */
+static std::vector<float> getTuningMask(int size)
+{
+    std::vector<float> mask(size * size);
+    unsigned int state = 12345;
+    for (float& coefficient : mask) {
+        state = state * 1103515245 + 12345;
+        coefficient = ((state >> 16) % 255 + 1) / (255.0f * size * size);
+    }
+
+    return mask;
+}
+
+
+ConvolutionPlanner::ConvolutionPlanner()
+{
+}
+
+ConvolutionPlanner& ConvolutionPlanner::getInstance()
+{
+    static ConvolutionPlanner planner;
+    return planner;
+}
+
+const TuningProfile& ConvolutionPlanner::getProfile() const
+{
+    return m_profile;
+}
+
+void ConvolutionPlanner::setProfile(const TuningProfile& profile)
+{
+    m_profile = profile;
+}
+
+ConvolutionPlan ConvolutionPlanner::getPlan(const Kernel& kernel, ConvolutionMethod method,
+                                            int width, int height, int planes,
+                                            bool multithread) const
+{
+    ConvolutionPlan plan;
+    plan.method = method;
+    plan.tiling = CpuTiling(m_profile.cpuTileWidth, m_profile.cpuTileHeight, 1);
+
+    const float work = getCostPerPixel(m_profile, kernel, method, width, height) *
+                       static_cast<float>(width) * height * planes;
+    plan.cost = work;
+
+    if (!multithread || !std::isfinite(work)) {
+        return plan;
+    }
+
+    // Each thread taking part in the job adds threadCost to the work
+    // divided between the threads: the sum is lowest for
+    // sqrt(work / threadCost) threads
+    int maxThreads = ThreadPool::getInstance().getThreadCount();
+    if (method != ConvolutionMethod::FFT) {
+        const long tiles = static_cast<long>((width + plan.tiling.tileWidth - 1) / plan.tiling.tileWidth) *
+                           ((height + plan.tiling.tileHeight - 1) / plan.tiling.tileHeight) * planes;
+        maxThreads = std::min(static_cast<long>(maxThreads), tiles);
+    }
+
+    const float threadCost = std::max(m_profile.threadCost, 1.0f);
+    const int threads = std::min(std::max(static_cast<int>(std::sqrt(work / threadCost)), 1), maxThreads);
+
+    plan.tiling.threads = threads;
+    plan.cost = work / threads + threadCost * threads;
+
+    return plan;
+}
+
+ConvolutionPlan ConvolutionPlanner::getPlan(const Kernel& kernel,
+                                            int width, int height, int planes,
+                                            bool multithread) const
+{
+    const ConvolutionMethod methods[] = {ConvolutionMethod::DIRECT, ConvolutionMethod::SEPARABLE,
+                                         ConvolutionMethod::SPARSE, ConvolutionMethod::FFT};
+
+    ConvolutionPlan bestPlan = getPlan(kernel, ConvolutionMethod::DIRECT, width, height, planes, multithread);
+    for (ConvolutionMethod method : methods) {
+        ConvolutionPlan plan = getPlan(kernel, method, width, height, planes, multithread);
+        if (plan.cost < bestPlan.cost) {
+            bestPlan = plan;
+        }
+    }
+
+    return bestPlan;
+}
+
+bool ConvolutionPlanner::tune()
+{
+    TRACE_SCOPE("ConvolutionPlanner::tune");
+
+    const int size = TUNING_IMAGE_SIZE;
+    const float pixels = static_cast<float>(size) * size;
+
+    ImageBuffer source(size, size);
+    ImageBuffer out(size, size);
+    unsigned int state = 1;
+    for (int y = 0; y < size; y++) {
+        float* row = source.getRow(y);
+        for (int x = 0; x < size; x++) {
+            state = state * 1103515245 + 12345;
+            row[x] = (state >> 16) % 256;
+        }
+    }
+
+    const ConstImageView sourceView = source.getView();
+    const ImageView outView = out.getView();
+    const BorderMode border = BorderMode::REPLICATE;
+
+    // Generic and unrolled 2D loops, a separable and a sparse 11x11
+    // kernel (the mask border only) and a 31x31 FFT
+    const std::vector<float> unrolledMask = getTuningMask(5);
+    const std::vector<float> directMask = getTuningMask(11);
+    const std::vector<float> fftMask = getTuningMask(31);
+    const std::vector<float> factors(11, 1.0f / 11);
+    std::vector<float> sparseMask(directMask);
+    int sparseTaps = 0;
+    for (int h = 0; h < 11; h++) {
+        for (int w = 0; w < 11; w++) {
+            if (h > 0 && h < 10 && w > 0 && w < 10) {
+                sparseMask[h * 11 + w] = 0.0f;
+            }
+            else {
+                sparseTaps++;
+            }
+        }
+    }
+
+    auto runDirect = [&](const std::vector<float>& mask, int filterSize) {
+        convolveTile(sourceView.getData(), sourceView.getStride(),
+                     outView.getData(), outView.getStride(),
+                     mask.data(),
+                     size, size,
+                     filterSize, filterSize,
+                     border,
+                     0, size, 0, size);
+        return true;
+    };
+
+    TuningProfile profile;
+    ThreadPool& pool = ThreadPool::getInstance();
+    profile.unrolledTapCost = measure([&]() { return runDirect(unrolledMask, 5); }) / (pixels * 25);
+    profile.directTapCost = measure([&]() { return runDirect(directMask, 11); }) / (pixels * 121);
+    profile.separableTapCost = measure([&]() {
+        return runCpuSeparable(&sourceView, &outView, 1,
+                               factors.data(), factors.data(), 1,
+                               11, 11, border, false);
+    }) / (pixels * 22);
+    profile.sparseTapCost = measure([&]() {
+        return runCpuSparse(&sourceView, &outView, 1,
+                            sparseMask.data(), 11, 11, border, false);
+    }) / (pixels * sparseTaps);
+    profile.fftUnitCost = measure([&]() {
+        return runCpuFft(&sourceView, &outView, 1,
+                         fftMask.data(), 31, 31, border, false);
+    }) / (pixels * getFftCostPerPixel(size, size, 31, 31));
+
+    // Waking the workers for a job of empty tasks
+    const int threads = pool.getThreadCount();
+    if (threads > 1) {
+        profile.threadCost = measure([&]() {
+            pool.parallelFor(threads, [](int) {});
+            return true;
+        }) / threads;
+    }
+
+    // Tile sizes of the 2D loop on all the threads
+    const CpuTiling tilings[] = {CpuTiling(256, 16), CpuTiling(512, 16), CpuTiling(1024, 8),
+                                 CpuTiling(1024, 16), CpuTiling(1024, 32), CpuTiling(2048, 16)};
+    double bestTime = INFINITY;
+    for (const CpuTiling& tiling : tilings) {
+        double time = measure([&]() {
+            return runCpuMultithread(&sourceView, &outView, 1,
+                                     directMask.data(), 11, 11, border, tiling);
+        });
+        if (time < bestTime) {
+            bestTime = time;
+            profile.cpuTileWidth = tiling.tileWidth;
+            profile.cpuTileHeight = tiling.tileHeight;
+        }
+    }
+
+    const float costs[] = {profile.unrolledTapCost, profile.directTapCost, profile.separableTapCost,
+                           profile.sparseTapCost, profile.fftUnitCost};
+    for (float cost : costs) {
+        if (!std::isfinite(cost) || cost <= 0) {
+            std::cerr << "Convolution planner tuning failed" << std::endl;
+            return false;
+        }
+    }
+
+    // The CUDA backends read their blocks from the profile
+    // being tuned. CPU-only builds have none.
+    if (BackendRegistry::getInstance().hasGpuBackend()) {
+        m_profile = profile;
+        tuneGpu(sourceView, outView);
+        profile = m_profile;
+    }
+
+    m_profile = profile;
+
+    return true;
+}
+
+void ConvolutionPlanner::tuneGpu(const ConstImageView& source, const ImageView& out)
+{
+    Kernel kernel;
+    kernel.setFilter(getTuningMask(7), 7, 7);
+
+    BackendRegistry& registry = BackendRegistry::getInstance();
+    std::unique_ptr<ConvolutionBackend> constantBackend = registry.create("cuda_constant");
+    std::unique_ptr<ConvolutionBackend> sharedBackend = registry.create("cuda_shared");
+    if (!constantBackend || !sharedBackend ||
+        !constantBackend->prepare(kernel, BorderMode::REPLICATE) ||
+        !sharedBackend->prepare(kernel, BorderMode::REPLICATE)) {
+        return;
+    }
+
+    // Thread blocks of the one pixel per thread kernels
+    const GpuBlockSize blocks[] = {GpuBlockSize(32, 32), GpuBlockSize(32, 16), GpuBlockSize(32, 8),
+                                   GpuBlockSize(64, 8), GpuBlockSize(16, 16), GpuBlockSize(128, 4)};
+    double bestTime = INFINITY;
+    GpuBlockSize best;
+    for (const GpuBlockSize& block : blocks) {
+        m_profile.gpuBlockWidth = block.blockWidth;
+        m_profile.gpuBlockHeight = block.blockHeight;
+        double time = measure([&]() { return constantBackend->execute(&source, &out, 1); });
+        if (time < bestTime) {
+            bestTime = time;
+            best.blockWidth = block.blockWidth;
+            best.blockHeight = block.blockHeight;
+        }
+    }
+    m_profile.gpuBlockWidth = best.blockWidth;
+    m_profile.gpuBlockHeight = best.blockHeight;
+
+    // Shared memory tiles: output pixels and thread rows
+    const GpuBlockSize tiles[] = {GpuBlockSize(32, 32, 64, 32, 8), GpuBlockSize(32, 32, 32, 32, 8),
+                                  GpuBlockSize(32, 32, 64, 16, 8), GpuBlockSize(32, 32, 128, 16, 4),
+                                  GpuBlockSize(32, 32, 32, 16, 16), GpuBlockSize(32, 32, 64, 64, 4)};
+    bestTime = INFINITY;
+    for (const GpuBlockSize& tile : tiles) {
+        m_profile.gpuSharedTileWidth = tile.sharedTileWidth;
+        m_profile.gpuSharedTileHeight = tile.sharedTileHeight;
+        m_profile.gpuSharedThreadRows = tile.sharedThreadRows;
+        double time = measure([&]() { return sharedBackend->execute(&source, &out, 1); });
+        if (time < bestTime) {
+            bestTime = time;
+            best.sharedTileWidth = tile.sharedTileWidth;
+            best.sharedTileHeight = tile.sharedTileHeight;
+            best.sharedThreadRows = tile.sharedThreadRows;
+        }
+    }
+    m_profile.gpuSharedTileWidth = best.sharedTileWidth;
+    m_profile.gpuSharedTileHeight = best.sharedTileHeight;
+    m_profile.gpuSharedThreadRows = best.sharedThreadRows;
+
+    constantBackend->teardown();
+    sharedBackend->teardown();
+}
+
+bool ConvolutionPlanner::loadProfile(const char* filename)
+{
+    std::ifstream file(filename);
+    if (!file) {
+        return false;
+    }
+
+    TuningProfile profile;
+    const TuningProfile machine;
+    int version = 0;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key) || key[0] == '#') {
+            continue;
+        }
+
+        if (key == "version") {
+            fields >> version;
+        }
+        else if (key == "isa") {
+            fields >> profile.isa;
+        }
+
+        for (const ProfileField& field : s_profileFields) {
+            if (key == field.key && field.floatValue != nullptr) {
+                fields >> profile.*field.floatValue;
+            }
+            else if (key == field.key) {
+                fields >> profile.*field.intValue;
+            }
+        }
+
+        if (fields.fail()) {
+            std::cerr << "Invalid tuning profile line in " << filename << ": " << line << std::endl;
+            return false;
+        }
+    }
+
+    if (version != PROFILE_VERSION) {
+        std::cerr << "Unsupported tuning profile version in " << filename << std::endl;
+        return false;
+    }
+
+    // Measures of another machine, or of the same one with another
+    // instruction set (see setCpuIsa) or thread count, do not apply
+    if (profile.isa != machine.isa || profile.threads != machine.threads) {
+        std::cout << "Tuning profile " << filename << " was measured with " << profile.isa
+                  << " on " << profile.threads << " threads" << std::endl;
+        return false;
+    }
+
+    if (profile.cpuTileWidth < 1 || profile.cpuTileHeight < 1 ||
+        profile.gpuBlockWidth < 1 || profile.gpuBlockHeight < 1 ||
+        profile.gpuSharedTileWidth < 1 || profile.gpuSharedTileHeight < 1 ||
+        profile.gpuSharedThreadRows < 1) {
+        std::cerr << "Invalid tile size in " << filename << std::endl;
+        return false;
+    }
+
+    m_profile = profile;
+
+    return true;
+}
+
+bool ConvolutionPlanner::saveProfile(const char* filename) const
+{
+    std::ofstream file(filename);
+    if (!file) {
+        std::cerr << "Unable to write " << filename << std::endl;
+        return false;
+    }
+
+    file << "# Convolution planner profile, costs in ns per output pixel" << std::endl;
+    file << "version " << PROFILE_VERSION << std::endl;
+    file << "isa " << m_profile.isa << std::endl;
+    for (const ProfileField& field : s_profileFields) {
+        file << field.key << " ";
+        if (field.floatValue != nullptr) {
+            file << m_profile.*field.floatValue << std::endl;
+        }
+        else {
+            file << m_profile.*field.intValue << std::endl;
+        }
+    }
+
+    if (!file) {
+        std::cerr << "Unable to write " << filename << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+const char* getBackendName(ConvolutionMethod method, bool multithread)
+{
+    switch (method) {
+        case ConvolutionMethod::SEPARABLE:
+            return multithread ? "cpu_separable" : "sequential_separable";
+
+        case ConvolutionMethod::SPARSE:
+            return multithread ? "cpu_sparse" : "sequential_sparse";
+
+        case ConvolutionMethod::FFT:
+            return multithread ? "cpu_fft" : "sequential_fft";
+
+        default:
+            return multithread ? "cpu" : "sequential";
+    }
+}
+
+const char* getConvolutionMethodName(ConvolutionMethod method)
+{
+    switch (method) {
+        case ConvolutionMethod::SEPARABLE:
+            return "separable";
+
+        case ConvolutionMethod::SPARSE:
+            return "sparse";
+
+        case ConvolutionMethod::FFT:
+            return "FFT";
+
+        default:
+            return "direct";
+    }
+}
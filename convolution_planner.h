@@ -0,0 +1,149 @@
+#ifndef CONVOLUTION_PLANNER_H_
+#define CONVOLUTION_PLANNER_H_
+
+#include <string>
+#include "kernel.h"
+#include "cpu_convolution.h"
+
+enum class ConvolutionMethod
+{
+    DIRECT,     ///< 2D mask
+    SEPARABLE,  ///< Horizontal and vertical 1D passes for each term of the decomposition
+    SPARSE,     ///< Non-zero taps of the mask only
+    FFT         ///< Overlap-save tiles in the frequency domain
+};
+
+/*
+ * How a convolution runs on the CPU
+ */
+struct ConvolutionPlan
+{
+    ConvolutionMethod method;
+    CpuTiling tiling;       ///< Tiles and threads (the FFT uses the threads only)
+    float cost;             ///< Estimated execution time, in ns
+};
+
+/*
+ * Constants of the cost model of a machine, measured by
+ * ConvolutionPlanner::tune. Tap costs are in ns per output
+ * pixel on one thread.
+ */
+struct TuningProfile
+{
+    TuningProfile();
+
+    std::string isa;            ///< Instruction set of the measures (see getCpuIsaName)
+    int threads;                ///< Thread pool size of the measures
+    float directTapCost;        ///< 2D loop, generic mask sizes
+    float unrolledTapCost;      ///< 2D loop, 3x3, 5x5 and 7x7 masks
+    float separableTapCost;     ///< Per tap of the 1D factors
+    float sparseTapCost;        ///< Per non-zero tap
+    float fftUnitCost;          ///< Per unit of getFftCostPerPixel
+    float threadCost;           ///< Cost of a thread taking part in a pool job, in ns
+    int cpuTileWidth;           ///< See CpuTiling
+    int cpuTileHeight;
+    int gpuBlockWidth;          ///< See GpuBlockSize
+    int gpuBlockHeight;
+    int gpuSharedTileWidth;
+    int gpuSharedTileHeight;
+    int gpuSharedThreadRows;
+};
+
+/*
+ * Chooses the convolution method, the tile size and the number of
+ * threads from the estimated execution time of each method. The
+ * estimates use the default profile until a profile is measured with
+ * tune() or loaded from a file. The profile must be set up before
+ * the filtering starts.
+ */
+class ConvolutionPlanner
+{
+    public:
+        ConvolutionPlanner(const ConvolutionPlanner&) = delete;
+        ConvolutionPlanner& operator=(const ConvolutionPlanner&) = delete;
+
+        /*
+         * @brief: return the process wide planner
+         */
+        static ConvolutionPlanner& getInstance();
+
+        /*
+         * @brief: return the cheapest plan among the methods that can
+         *         run the kernel
+         *
+         * @param: planes: number of planes filtered by the same call
+         * @param: multithread: the plan runs on the thread pool,
+         *         otherwise on the calling thread
+         */
+        ConvolutionPlan getPlan(const Kernel& kernel,
+                                int width, int height, int planes,
+                                bool multithread) const;
+
+        /*
+         * @brief: return the plan of a given method. SEPARABLE plans
+         *         are valid for separable kernels only.
+         */
+        ConvolutionPlan getPlan(const Kernel& kernel, ConvolutionMethod method,
+                                int width, int height, int planes,
+                                bool multithread) const;
+
+        /*
+         * @brief: return the cost model constants
+         */
+        const TuningProfile& getProfile() const;
+
+        /*
+         * @brief: replace the cost model constants
+         */
+        void setProfile(const TuningProfile& profile);
+
+        /*
+         * @brief: measure the cost model constants on this machine: the
+         *         cost of a tap of each method, the thread pool overhead,
+         *         the CPU tile size and, if a CUDA device is available,
+         *         the thread blocks of the CUDA kernels. Takes about a second.
+         *
+         * @return: true if successful, false otherwise
+         */
+        bool tune();
+
+        /*
+         * @brief: load a profile saved by saveProfile. Profiles measured
+         *         with another instruction set or thread count are rejected.
+         *
+         * @return: true if successful, false otherwise
+         */
+        bool loadProfile(const char* filename);
+
+        /*
+         * @brief: save the profile as "key value" lines
+         *
+         * @return: true if successful, false otherwise
+         */
+        bool saveProfile(const char* filename) const;
+
+    private:
+        ConvolutionPlanner();
+
+        /*
+         * @brief: measure the thread blocks of the CUDA kernels
+         *         and store them in m_profile
+         */
+        void tuneGpu(const ConstImageView& source, const ImageView& out);
+
+        TuningProfile m_profile;        ///< Cost model constants
+};
+
+/*
+ * @brief: return the name of the registered CPU backend running
+ *         a method (see convolution_backend.h)
+ */
+const char* getBackendName(ConvolutionMethod method, bool multithread);
+
+/*
+ * @brief: return a printable name for the method
+ */
+const char* getConvolutionMethodName(ConvolutionMethod method);
+
+
+#endif /* CONVOLUTION_PLANNER_H_ */
@@ -0,0 +1,816 @@
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <functional>
+#include "cpu_convolution.h"
+#include "simd_convolution.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+
+/*
+ * Row loop selectors implemented for one instruction set
+ * (see simd_convolution.h)
+ */
+struct ConvolutionFunctions
+{
+    ConvolveRowFunction (*getConvolveRow)(int, int);
+    HorizontalRowFunction (*getHorizontalRow)(int);
+    VerticalRowFunction (*getVerticalRow)(int);
+    ConvolveRowU8Function (*getConvolveRowU8)(bool);
+};
+
+static inline uint8_t saturateU8(int32_t value)
+{
+    return static_cast<uint8_t>(std::min(std::max(value, 0), 255));
+}
+
+/*
+ * Portable fallbacks, used when no vector extension is available
+ */
+static void convolveRowScalar(const float* const* rows,
+                float* outRow,
+                const float* mask,
+                int filterWidth, int filterHeight,
+                int startCol, int endCol)
+{
+    const int s = filterWidth / 2;
+
+    for (int x = startCol; x < endCol; x++) {
+        float pixelSum = 0;
+        for (int h = 0; h < filterHeight; h++) {
+            const float* sourceRow = rows[h] + x - s;
+            const float* maskRow = mask + h * filterWidth;
+            for (int w = 0; w < filterWidth; w++) {
+                pixelSum += maskRow[w] * sourceRow[w];
+            }
+        }
+        // Branchless thresholding
+        outRow[x] = std::min(std::max(pixelSum, 0.0f), 255.0f);
+    }
+}
+
+static void horizontalRowScalar(const float* sourceRow,
+                float* outRow,
+                const float* coefficients, int taps,
+                int startCol, int endCol)
+{
+    const int s = taps / 2;
+
+    for (int x = startCol; x < endCol; x++) {
+        const float* source = sourceRow + x - s;
+        float pixelSum = 0;
+        for (int w = 0; w < taps; w++) {
+            pixelSum += coefficients[w] * source[w];
+        }
+        outRow[x] = pixelSum;
+    }
+}
+
+static void verticalRowScalar(const float* const* rows,
+                float* outRow,
+                const float* coefficients, int taps,
+                int startCol, int endCol,
+                bool accumulate, bool threshold)
+{
+    for (int x = startCol; x < endCol; x++) {
+        float pixelSum = 0;
+        for (int h = 0; h < taps; h++) {
+            pixelSum += coefficients[h] * rows[h][x];
+        }
+        if (accumulate) {
+            pixelSum = outRow[x] + pixelSum;
+        }
+        if (threshold) {
+            pixelSum = std::min(std::max(pixelSum, 0.0f), 255.0f);
+        }
+        outRow[x] = pixelSum;
+    }
+}
+
+static void convolveRowU8Scalar(const uint8_t* const* rows,
+                uint8_t* outRow,
+                const int16_t* mask,
+                int filterWidth, int filterHeight,
+                int shift,
+                int startCol, int endCol)
+{
+    const int s = filterWidth / 2;
+    const int32_t bias = shift > 0 ? 1 << (shift - 1) : 0;
+
+    for (int x = startCol; x < endCol; x++) {
+        int32_t pixelSum = bias;
+        for (int h = 0; h < filterHeight; h++) {
+            const uint8_t* sourceRow = rows[h] + x - s;
+            const int16_t* maskRow = mask + h * filterWidth;
+            for (int w = 0; w < filterWidth; w++) {
+                pixelSum += maskRow[w] * sourceRow[w];
+            }
+        }
+        outRow[x] = saturateU8(pixelSum >> shift);
+    }
+}
+
+static bool isCpuIsaSupported(const CpuIsa isa)
+{
+    switch (isa) {
+        case CpuIsa::AVX512:
+            return __builtin_cpu_supports("avx512f");
+
+        case CpuIsa::AVX2:
+            return __builtin_cpu_supports("avx2");
+
+        case CpuIsa::SSE:
+            return __builtin_cpu_supports("sse2");
+
+        default:
+            return true;
+    }
+}
+
+/*
+ * The scalar loops have no specializations: they are only a fallback
+ */
+static ConvolveRowFunction getConvolveRowScalar(int, int)
+{
+    return convolveRowScalar;
+}
+
+static HorizontalRowFunction getHorizontalRowScalar(int)
+{
+    return horizontalRowScalar;
+}
+
+static VerticalRowFunction getVerticalRowScalar(int)
+{
+    return verticalRowScalar;
+}
+
+static ConvolveRowU8Function getConvolveRowU8Scalar(bool)
+{
+    return convolveRowU8Scalar;
+}
+
+static ConvolutionFunctions getConvolutionFunctions(const CpuIsa isa)
+{
+    switch (isa) {
+        case CpuIsa::AVX512:
+            return {getConvolveRowAvx512, getHorizontalRowAvx512, getVerticalRowAvx512,
+                    getConvolveRowU8Avx512};
+
+        case CpuIsa::AVX2:
+            return {getConvolveRowAvx2, getHorizontalRowAvx2, getVerticalRowAvx2,
+                    getConvolveRowU8Avx2};
+
+        case CpuIsa::SSE:
+            return {getConvolveRowSse, getHorizontalRowSse, getVerticalRowSse,
+                    getConvolveRowU8Sse};
+
+        default:
+            return {getConvolveRowScalar, getHorizontalRowScalar, getVerticalRowScalar,
+                    getConvolveRowU8Scalar};
+    }
+}
+
+static CpuIsa detectCpuIsa()
+{
+    // Required when called before main, from a static initializer
+    __builtin_cpu_init();
+
+    const CpuIsa candidates[] = {CpuIsa::AVX512, CpuIsa::AVX2, CpuIsa::SSE};
+    for (CpuIsa isa : candidates) {
+        if (isCpuIsaSupported(isa)) {
+            return isa;
+        }
+    }
+
+    return CpuIsa::SCALAR;
+}
+
+// Selected once at startup, can be narrowed by setCpuIsa
+static CpuIsa s_cpuIsa = detectCpuIsa();
+static ConvolutionFunctions s_functions = getConvolutionFunctions(s_cpuIsa);
+
+CpuIsa getCpuIsa()
+{
+    return s_cpuIsa;
+}
+
+bool setCpuIsa(const CpuIsa isa)
+{
+    if (!isCpuIsaSupported(isa)) {
+        std::cerr << getCpuIsaName(isa) << " is not supported by this CPU" << std::endl;
+        return false;
+    }
+
+    s_cpuIsa = isa;
+    s_functions = getConvolutionFunctions(isa);
+
+    return true;
+}
+
+int getCpuIsaVectorWidth(const CpuIsa isa)
+{
+    switch (isa) {
+        case CpuIsa::AVX512:
+            return 16;
+
+        case CpuIsa::AVX2:
+            return 8;
+
+        case CpuIsa::SSE:
+            return 4;
+
+        default:
+            return 1;
+    }
+}
+
+const char* getCpuIsaName(const CpuIsa isa)
+{
+    switch (isa) {
+        case CpuIsa::AVX512:
+            return "AVX-512";
+
+        case CpuIsa::AVX2:
+            return "AVX2";
+
+        case CpuIsa::SSE:
+            return "SSE";
+
+        default:
+            return "scalar";
+    }
+}
+
+/*
+ * @brief: fill rows with the source rows read by output row y,
+ *         nullptr for the rows outside the image in ZERO border mode
+ */
+template <typename T>
+static void getSourceRows(const T* source, int sourceStride,
+                          int height, int taps, BorderMode border,
+                          int y, const T** rows)
+{
+    const int s = taps / 2;
+
+    for (int h = 0; h < taps; h++) {
+        int row = getBorderIndex(y - s + h, height, border);
+        rows[h] = row < 0 ? nullptr : source + row * sourceStride;
+    }
+}
+
+/*
+ * @brief: return the interior columns of [startCol, endCol), where
+ *         every horizontal tap falls inside the image
+ */
+static void getInteriorColumns(int width, int taps,
+                               int startCol, int endCol,
+                               int& interiorStart, int& interiorEnd)
+{
+    const int s = taps / 2;
+
+    interiorStart = std::min(std::max(startCol, s), endCol);
+    interiorEnd = std::max(std::min(endCol, width - s), interiorStart);
+}
+
+/*
+ * @brief: compute the output columns of [startCol, endCol) outside
+ *         [interiorStart, interiorEnd): taps are remapped per column.
+ *         columns is a scratch of filterWidth indexes.
+ */
+static void convolveEdgeColumns(const float* const* rows,
+                                float* outRow,
+                                const float* mask,
+                                int width,
+                                int filterWidth, int filterHeight,
+                                BorderMode border,
+                                int startCol, int endCol,
+                                int interiorStart, int interiorEnd,
+                                int* columns)
+{
+    const int s = filterWidth / 2;
+
+    for (int x = startCol; x < endCol; x++) {
+        if (x >= interiorStart && x < interiorEnd) {
+            x = interiorEnd - 1;
+            continue;
+        }
+
+        for (int w = 0; w < filterWidth; w++) {
+            columns[w] = getBorderIndex(x - s + w, width, border);
+        }
+
+        float pixelSum = 0;
+        for (int h = 0; h < filterHeight; h++) {
+            const float* maskRow = mask + h * filterWidth;
+            for (int w = 0; w < filterWidth; w++) {
+                if (columns[w] >= 0) {
+                    pixelSum += maskRow[w] * rows[h][columns[w]];
+                }
+            }
+        }
+        outRow[x] = std::min(std::max(pixelSum, 0.0f), 255.0f);
+    }
+}
+
+void convolveTile(const float* sourceImage, int sourceStride,
+                float* outImage, int outStride,
+                const float* mask,
+                int width, int height,
+                int filterWidth, int filterHeight,
+                BorderMode border,
+                int startCol, int endCol,
+                int startRow, int endRow)
+{
+    std::vector<const float*> rows(filterHeight);
+    std::vector<int> columns(filterWidth);
+    // Rows outside the image in ZERO border mode
+    std::vector<float> zeroRow;
+
+    int interiorStart = 0;
+    int interiorEnd = 0;
+    getInteriorColumns(width, filterWidth, startCol, endCol, interiorStart, interiorEnd);
+
+    const ConvolveRowFunction convolveRow = s_functions.getConvolveRow(filterWidth, filterHeight);
+
+    for (int y = startRow; y < endRow; y++) {
+        float* outRow = outImage + y * outStride;
+        getSourceRows(sourceImage, sourceStride, height, filterHeight, border, y, rows.data());
+
+        for (int h = 0; h < filterHeight; h++) {
+            if (rows[h] == nullptr) {
+                zeroRow.resize(width, 0.0f);
+                rows[h] = zeroRow.data();
+            }
+        }
+
+        convolveRow(rows.data(), outRow, mask,
+                    filterWidth, filterHeight,
+                    interiorStart, interiorEnd);
+
+        convolveEdgeColumns(rows.data(), outRow, mask,
+                            width, filterWidth, filterHeight,
+                            border,
+                            startCol, endCol,
+                            interiorStart, interiorEnd,
+                            columns.data());
+    }
+}
+
+/*
+ * Position of a non-zero coefficient in a mask
+ */
+struct SparseTap
+{
+    int row;
+    int column;
+};
+
+/*
+ * @brief: Same as convolveTile over the non-zero taps of the mask only.
+ *         Each tap is a shifted source row: the interior runs the vertical
+ *         pass loop over these rows, one coefficient each. taps and
+ *         coefficients are in mask order.
+ */
+static void convolveTileSparse(const float* sourceImage, int sourceStride,
+                               float* outImage, int outStride,
+                               const float* mask,
+                               const std::vector<SparseTap>& taps,
+                               const std::vector<float>& coefficients,
+                               int width, int height,
+                               int filterWidth, int filterHeight,
+                               BorderMode border,
+                               int startCol, int endCol,
+                               int startRow, int endRow)
+{
+    const int s = filterWidth / 2;
+
+    std::vector<const float*> rows(filterHeight);
+    std::vector<const float*> tapRows(taps.size());
+    std::vector<int> columns(filterWidth);
+    std::vector<float> zeroRow;
+
+    int interiorStart = 0;
+    int interiorEnd = 0;
+    getInteriorColumns(width, filterWidth, startCol, endCol, interiorStart, interiorEnd);
+
+    const VerticalRowFunction sparseRow = s_functions.getVerticalRow(taps.size());
+
+    for (int y = startRow; y < endRow; y++) {
+        float* outRow = outImage + y * outStride;
+        getSourceRows(sourceImage, sourceStride, height, filterHeight, border, y, rows.data());
+
+        for (int h = 0; h < filterHeight; h++) {
+            if (rows[h] == nullptr) {
+                zeroRow.resize(width, 0.0f);
+                rows[h] = zeroRow.data();
+            }
+        }
+
+        // Rows start at the first interior column
+        if (interiorStart < interiorEnd) {
+            for (size_t i = 0; i < taps.size(); i++) {
+                tapRows[i] = rows[taps[i].row] + interiorStart - s + taps[i].column;
+            }
+
+            sparseRow(tapRows.data(), outRow + interiorStart,
+                      coefficients.data(), taps.size(),
+                      0, interiorEnd - interiorStart,
+                      false, true);
+        }
+
+        convolveEdgeColumns(rows.data(), outRow, mask,
+                            width, filterWidth, filterHeight,
+                            border,
+                            startCol, endCol,
+                            interiorStart, interiorEnd,
+                            columns.data());
+    }
+}
+
+void convolveRows(const float* const* rows,
+                float* outRow,
+                const float* mask,
+                int width,
+                int filterWidth, int filterHeight,
+                BorderMode border)
+{
+    std::vector<int> columns(filterWidth);
+
+    int interiorStart = 0;
+    int interiorEnd = 0;
+    getInteriorColumns(width, filterWidth, 0, width, interiorStart, interiorEnd);
+
+    s_functions.getConvolveRow(filterWidth, filterHeight)(rows, outRow, mask,
+                                                          filterWidth, filterHeight,
+                                                          interiorStart, interiorEnd);
+
+    convolveEdgeColumns(rows, outRow, mask,
+                        width, filterWidth, filterHeight,
+                        border,
+                        0, width,
+                        interiorStart, interiorEnd,
+                        columns.data());
+}
+
+void convolveTileU8(const uint8_t* sourceImage, int sourceStride,
+                uint8_t* outImage, int outStride,
+                const int16_t* mask, int shift, bool narrow,
+                int width, int height,
+                int filterWidth, int filterHeight,
+                BorderMode border,
+                int startCol, int endCol,
+                int startRow, int endRow)
+{
+    const int s = filterWidth / 2;
+    const int32_t bias = shift > 0 ? 1 << (shift - 1) : 0;
+
+    std::vector<const uint8_t*> rows(filterHeight);
+    std::vector<int> columns(filterWidth);
+    std::vector<uint8_t> zeroRow;
+
+    int interiorStart = 0;
+    int interiorEnd = 0;
+    getInteriorColumns(width, filterWidth, startCol, endCol, interiorStart, interiorEnd);
+
+    const ConvolveRowU8Function convolveRow = s_functions.getConvolveRowU8(narrow);
+
+    for (int y = startRow; y < endRow; y++) {
+        uint8_t* outRow = outImage + y * outStride;
+        getSourceRows(sourceImage, sourceStride, height, filterHeight, border, y, rows.data());
+
+        for (int h = 0; h < filterHeight; h++) {
+            if (rows[h] == nullptr) {
+                zeroRow.resize(width, 0);
+                rows[h] = zeroRow.data();
+            }
+        }
+
+        convolveRow(rows.data(), outRow, mask,
+                    filterWidth, filterHeight, shift,
+                    interiorStart, interiorEnd);
+
+        for (int x = startCol; x < endCol; x++) {
+            if (x >= interiorStart && x < interiorEnd) {
+                x = interiorEnd - 1;
+                continue;
+            }
+
+            for (int w = 0; w < filterWidth; w++) {
+                columns[w] = getBorderIndex(x - s + w, width, border);
+            }
+
+            int32_t pixelSum = bias;
+            for (int h = 0; h < filterHeight; h++) {
+                const int16_t* maskRow = mask + h * filterWidth;
+                for (int w = 0; w < filterWidth; w++) {
+                    if (columns[w] >= 0) {
+                        pixelSum += maskRow[w] * rows[h][columns[w]];
+                    }
+                }
+            }
+            outRow[x] = saturateU8(pixelSum >> shift);
+        }
+    }
+}
+
+void horizontalPass(const float* source, int sourceStride,
+                float* out, int outStride,
+                const float* coefficients, int taps,
+                int width, BorderMode border,
+                int startCol, int endCol,
+                int startRow, int endRow)
+{
+    const int s = taps / 2;
+
+    int interiorStart = 0;
+    int interiorEnd = 0;
+    getInteriorColumns(width, taps, startCol, endCol, interiorStart, interiorEnd);
+
+    const HorizontalRowFunction horizontalRow = s_functions.getHorizontalRow(taps);
+
+    for (int y = startRow; y < endRow; y++) {
+        const float* sourceRow = source + y * sourceStride;
+        float* outRow = out + y * outStride;
+
+        horizontalRow(sourceRow, outRow,
+                      coefficients, taps,
+                      interiorStart, interiorEnd);
+
+        for (int x = startCol; x < endCol; x++) {
+            if (x >= interiorStart && x < interiorEnd) {
+                x = interiorEnd - 1;
+                continue;
+            }
+
+            float pixelSum = 0;
+            for (int w = 0; w < taps; w++) {
+                int column = getBorderIndex(x - s + w, width, border);
+                if (column >= 0) {
+                    pixelSum += coefficients[w] * sourceRow[column];
+                }
+            }
+            outRow[x] = pixelSum;
+        }
+    }
+}
+
+void verticalPass(const float* source, int sourceStride,
+                float* out, int outStride,
+                const float* coefficients, int taps,
+                int height, BorderMode border,
+                int startCol, int endCol,
+                int startRow, int endRow,
+                bool accumulate, bool threshold)
+{
+    std::vector<const float*> rows(taps);
+    std::vector<float> zeroRow;
+
+    const VerticalRowFunction verticalRow = s_functions.getVerticalRow(taps);
+
+    for (int y = startRow; y < endRow; y++) {
+        getSourceRows(source, sourceStride, height, taps, border, y, rows.data());
+
+        for (int h = 0; h < taps; h++) {
+            if (rows[h] == nullptr) {
+                // Indexed with the output columns
+                zeroRow.resize(endCol, 0.0f);
+                rows[h] = zeroRow.data();
+            }
+        }
+
+        verticalRow(rows.data(), out + y * outStride,
+                    coefficients, taps,
+                    startCol, endCol,
+                    accumulate, threshold);
+    }
+}
+
+void verticalRows(const float* const* rows,
+                float* outRow,
+                const float* coefficients, int taps,
+                int width,
+                bool accumulate, bool threshold)
+{
+    s_functions.getVerticalRow(taps)(rows, outRow,
+                                     coefficients, taps,
+                                     0, width,
+                                     accumulate, threshold);
+}
+
+/*
+ * @brief: split [0, width) x [0, height) of each plane in tiles and run
+ *         tileFunction(plane, startCol, endCol, startRow, endRow) on each of them
+ */
+static void forEachTile(int width, int height, int planes, bool multithread,
+                        const CpuTiling& tiling,
+                        const std::function<void(int, int, int, int, int)>& tileFunction)
+{
+    const int tileWidth = std::max(tiling.tileWidth, 1);
+    const int tileHeight = std::max(tiling.tileHeight, 1);
+    const int tilesPerRow = (width + tileWidth - 1) / tileWidth;
+    const int tilesPerCol = (height + tileHeight - 1) / tileHeight;
+    const int tilesPerPlane = tilesPerRow * tilesPerCol;
+
+    auto runTile = [&](int tile) {
+        int plane = tile / tilesPerPlane;
+        int startCol = (tile % tilesPerPlane % tilesPerRow) * tileWidth;
+        int startRow = (tile % tilesPerPlane / tilesPerRow) * tileHeight;
+
+        tileFunction(plane,
+                     startCol, std::min(startCol + tileWidth, width),
+                     startRow, std::min(startRow + tileHeight, height));
+    };
+
+    runTasks(tilesPerPlane * planes, runTile, multithread, std::max(tiling.threads, 0));
+}
+
+bool runCpuMultithread(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                const float* mask,
+                int filterWidth, int filterHeight,
+                BorderMode border,
+                const CpuTiling& tiling)
+{
+    if (!haveSamePlaneSize(sourceImages, outImages, planes)) {
+        std::cerr << "Output image size mismatch" << std::endl;
+        return false;
+    }
+
+    const int width = sourceImages[0].getWidth();
+    const int height = sourceImages[0].getHeight();
+
+    ThreadPool& pool = ThreadPool::getInstance();
+    const unsigned int threads = tiling.threads > 0 ?
+                                 std::min(static_cast<unsigned int>(tiling.threads), pool.getThreadCount()) :
+                                 pool.getThreadCount();
+
+    TRACE_STATUS("Starting CPU multithread convolution on " << threads << " threads ("
+                 << getCpuIsaName(getCpuIsa()) << ")");
+
+    TRACE_SCOPE("runCpuMultithread");
+    TRACE_COUNT(TraceCounter::PIXELS_PROCESSED, static_cast<long long>(width) * height * planes);
+
+    forEachTile(width, height, planes, true, tiling, [&](int plane, int startCol, int endCol, int startRow, int endRow) {
+        convolveTile(sourceImages[plane].getData(), sourceImages[plane].getStride(),
+                     outImages[plane].getData(), outImages[plane].getStride(),
+                     mask,
+                     width, height,
+                     filterWidth, filterHeight,
+                     border,
+                     startCol, endCol,
+                     startRow, endRow);
+    });
+
+    return true;
+}
+
+bool runCpuSeparable(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                const float* rowFactors,
+                const float* columnFactors,
+                int rank,
+                int filterWidth, int filterHeight,
+                BorderMode border,
+                bool multithread,
+                const CpuTiling& tiling,
+                Workspace* workspace)
+{
+    if (!haveSamePlaneSize(sourceImages, outImages, planes)) {
+        std::cerr << "Output image size mismatch" << std::endl;
+        return false;
+    }
+
+    const int width = sourceImages[0].getWidth();
+    const int height = sourceImages[0].getHeight();
+
+    TRACE_SCOPE("runCpuSeparable");
+    TRACE_COUNT(TraceCounter::PIXELS_PROCESSED, static_cast<long long>(width) * height * planes);
+
+    // Horizontal pass result of each plane, the vertical pass resolves
+    // the top and bottom borders on it
+    Workspace localWorkspace;
+    if (workspace == nullptr) {
+        workspace = &localWorkspace;
+    }
+
+    std::vector<ImageView> rowPassImages(planes);
+    for (int plane = 0; plane < planes; plane++) {
+        rowPassImages[plane] = workspace->getPlane(WorkspaceBuffer::ROW_PASS, plane, width, height);
+    }
+
+    for (int term = 0; term < rank; term++) {
+        const float* rowFactor = rowFactors + term * filterWidth;
+        const float* columnFactor = columnFactors + term * filterHeight;
+
+        forEachTile(width, height, planes, multithread, tiling, [&](int plane, int startCol, int endCol, int startRow, int endRow) {
+            horizontalPass(sourceImages[plane].getData(), sourceImages[plane].getStride(),
+                           rowPassImages[plane].getRow(0), rowPassImages[plane].getStride(),
+                           rowFactor, filterWidth,
+                           width, border,
+                           startCol, endCol,
+                           startRow, endRow);
+        });
+
+        // Terms are summed in the output image, thresholding after the last one
+        forEachTile(width, height, planes, multithread, tiling, [&](int plane, int startCol, int endCol, int startRow, int endRow) {
+            verticalPass(rowPassImages[plane].getRow(0), rowPassImages[plane].getStride(),
+                         outImages[plane].getData(), outImages[plane].getStride(),
+                         columnFactor, filterHeight,
+                         height, border,
+                         startCol, endCol,
+                         startRow, endRow,
+                         term > 0, term == rank - 1);
+        });
+    }
+
+    return true;
+}
+
+bool runCpuSparse(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                const float* mask,
+                int filterWidth, int filterHeight,
+                BorderMode border,
+                bool multithread,
+                const CpuTiling& tiling)
+{
+    if (!haveSamePlaneSize(sourceImages, outImages, planes)) {
+        std::cerr << "Output image size mismatch" << std::endl;
+        return false;
+    }
+
+    const int width = sourceImages[0].getWidth();
+    const int height = sourceImages[0].getHeight();
+
+    TRACE_SCOPE("runCpuSparse");
+    TRACE_COUNT(TraceCounter::PIXELS_PROCESSED, static_cast<long long>(width) * height * planes);
+
+    std::vector<SparseTap> taps;
+    std::vector<float> coefficients;
+    for (int h = 0; h < filterHeight; h++) {
+        for (int w = 0; w < filterWidth; w++) {
+            if (mask[h * filterWidth + w] != 0.0f) {
+                taps.push_back({h, w});
+                coefficients.push_back(mask[h * filterWidth + w]);
+            }
+        }
+    }
+
+    forEachTile(width, height, planes, multithread, tiling, [&](int plane, int startCol, int endCol, int startRow, int endRow) {
+        convolveTileSparse(sourceImages[plane].getData(), sourceImages[plane].getStride(),
+                           outImages[plane].getData(), outImages[plane].getStride(),
+                           mask, taps, coefficients,
+                           width, height,
+                           filterWidth, filterHeight,
+                           border,
+                           startCol, endCol,
+                           startRow, endRow);
+    });
+
+    return true;
+}
+
+bool runCpuInteger(const ConstImageView8* sourceImages,
+                const ImageView8* outImages,
+                int planes,
+                const int16_t* mask,
+                int shift, bool narrow,
+                int filterWidth, int filterHeight,
+                BorderMode border,
+                bool multithread,
+                const CpuTiling& tiling)
+{
+    if (!haveSamePlaneSize(sourceImages, outImages, planes)) {
+        std::cerr << "Output image size mismatch" << std::endl;
+        return false;
+    }
+
+    if (shift < 0) {
+        std::cerr << "Kernel has no fixed-point representation" << std::endl;
+        return false;
+    }
+
+    const int width = sourceImages[0].getWidth();
+    const int height = sourceImages[0].getHeight();
+
+    TRACE_SCOPE("runCpuInteger");
+    TRACE_COUNT(TraceCounter::PIXELS_PROCESSED, static_cast<long long>(width) * height * planes);
+
+    forEachTile(width, height, planes, multithread, tiling, [&](int plane, int startCol, int endCol, int startRow, int endRow) {
+        convolveTileU8(sourceImages[plane].getData(), sourceImages[plane].getStride(),
+                       outImages[plane].getData(), outImages[plane].getStride(),
+                       mask, shift, narrow,
+                       width, height,
+                       filterWidth, filterHeight,
+                       border,
+                       startCol, endCol,
+                       startRow, endRow);
+    });
+
+    return true;
+}
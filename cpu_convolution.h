@@ -0,0 +1,219 @@
+#ifndef CPU_CONVOLUTION_H_
+#define CPU_CONVOLUTION_H_
+
+#include "border_mode.h"
+#include "image_buffer.h"
+#include "workspace.h"
+
+enum class CpuIsa
+{
+    SCALAR,
+    SSE,
+    AVX2,
+    AVX512
+};
+
+/*
+ * How the CPU convolutions split the output image. The defaults are
+ * used unless the planner (convolution_planner.h) has a tuned profile.
+ */
+struct CpuTiling
+{
+    CpuTiling(int tileWidth = 1024, int tileHeight = 16, int threads = 0) :
+        tileWidth(tileWidth), tileHeight(tileHeight), threads(threads) {}
+
+    int tileWidth;      ///< Tiles are wide and short: rows stay contiguous in memory
+    int tileHeight;     ///< while big images still produce enough tiles to balance the threads
+    int threads;        ///< Thread pool threads taking part, 0 for all of them
+};
+
+/*
+ * @brief: This function will calculate the image convolution on the CPU
+ *         using all the cores. The output image is split in tiles that
+ *         are executed by the process wide thread pool.
+ *         Parameters follow the CUDA launchers' convention: each output
+ *         view must have the size of the source views.
+ *
+ * @param: planes: number of source and output views, the channels of an
+ *         image. The tiles of all the planes run in the same pool job.
+ * @param: tiling: tile size and number of threads
+ */
+bool runCpuMultithread(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                const float* mask,
+                int filterWidth, int filterHeight,
+                BorderMode border,
+                const CpuTiling& tiling = CpuTiling());
+
+/*
+ * @brief: This function will calculate the convolution of a separable
+ *         kernel with a horizontal pass followed by a vertical pass
+ *         for each term of the decomposition (see Kernel::getRowFactors).
+ *
+ * @param: planes: number of source and output views (see runCpuMultithread)
+ * @param: multithread: run the passes on the thread pool, otherwise
+ *         on the calling thread
+ * @param: workspace: holds the horizontal pass planes, allocated
+ *         by the call if nullptr
+ */
+bool runCpuSeparable(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                const float* rowFactors,
+                const float* columnFactors,
+                int rank,
+                int filterWidth, int filterHeight,
+                BorderMode border,
+                bool multithread,
+                const CpuTiling& tiling = CpuTiling(),
+                Workspace* workspace = nullptr);
+
+/*
+ * @brief: This function will calculate the convolution over the
+ *         non-zero taps of the mask only: each tap reads a shifted source
+ *         row, scaled by its coefficient. Cheaper than the 2D loop for
+ *         masks with many zeros (e.g. rings, dilated kernels). The taps
+ *         are accumulated in the same order as convolveTile, so the
+ *         result is the same.
+ *
+ * @param: planes: number of source and output views (see runCpuMultithread)
+ * @param: multithread: run the tiles on the thread pool, otherwise
+ *         on the calling thread
+ */
+bool runCpuSparse(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                const float* mask,
+                int filterWidth, int filterHeight,
+                BorderMode border,
+                bool multithread,
+                const CpuTiling& tiling = CpuTiling());
+
+/*
+ * @brief: This function will calculate the convolution of an 8-bit image
+ *         with the fixed-point form of a kernel (see
+ *         Kernel::getFixedPointKernel), without converting to float.
+ *
+ * @param: planes: number of source and output views (see runCpuMultithread)
+ * @param: multithread: run the tiles on the thread pool, otherwise
+ *         on the calling thread
+ */
+bool runCpuInteger(const ConstImageView8* sourceImages,
+                const ImageView8* outImages,
+                int planes,
+                const int16_t* mask,
+                int shift, bool narrow,
+                int filterWidth, int filterHeight,
+                BorderMode border,
+                bool multithread,
+                const CpuTiling& tiling = CpuTiling());
+
+/*
+ * @brief: Apply the convolution to the output pixels in
+ *         [startCol, endCol) x [startRow, endRow). Pixels outside the
+ *         width x height source image are read according to the border mode.
+ *         The widest instruction set supported by the CPU is used for the
+ *         image interior, unrolled for the 3x3, 5x5 and 7x7 kernels;
+ *         border strips go through a scalar loop.
+ *         Strides are in pixels.
+ */
+void convolveTile(const float* sourceImage, int sourceStride,
+                float* outImage, int outStride,
+                const float* mask,
+                int width, int height,
+                int filterWidth, int filterHeight,
+                BorderMode border,
+                int startCol, int endCol,
+                int startRow, int endRow);
+
+/*
+ * @brief: Apply the convolution to a whole output row, given the
+ *         filterHeight source rows it reads, already remapped
+ *         according to the border mode (rows outside the image in ZERO
+ *         mode point to zeros). Columns are remapped as in convolveTile.
+ */
+void convolveRows(const float* const* rows,
+                float* outRow,
+                const float* mask,
+                int width,
+                int filterWidth, int filterHeight,
+                BorderMode border);
+
+/*
+ * @brief: Same as convolveTile on 8-bit pixels, with a fixed-point mask:
+ *         taps are accumulated in integers, rounded, shifted right by
+ *         shift bits and saturated to [0, 255].
+ *
+ * @param: narrow: the sums fit 16 bits (see Kernel::isFixedPointNarrow)
+ */
+void convolveTileU8(const uint8_t* sourceImage, int sourceStride,
+                uint8_t* outImage, int outStride,
+                const int16_t* mask, int shift, bool narrow,
+                int width, int height,
+                int filterWidth, int filterHeight,
+                BorderMode border,
+                int startCol, int endCol,
+                int startRow, int endRow);
+
+/*
+ * @brief: 1D horizontal convolution, centered on the output pixel:
+ *         out[y][x] = sum(coefficients[w] * source[y][x - taps / 2 + w])
+ *         for each (x, y) in [startCol, endCol) x [startRow, endRow).
+ */
+void horizontalPass(const float* source, int sourceStride,
+                float* out, int outStride,
+                const float* coefficients, int taps,
+                int width, BorderMode border,
+                int startCol, int endCol,
+                int startRow, int endRow);
+
+/*
+ * @brief: 1D vertical convolution, centered on the output pixel:
+ *         out[y][x] = sum(coefficients[h] * source[y - taps / 2 + h][x]).
+ *         With accumulate the result is added to out, with
+ *         threshold it is clamped to [0, 255].
+ */
+void verticalPass(const float* source, int sourceStride,
+                float* out, int outStride,
+                const float* coefficients, int taps,
+                int height, BorderMode border,
+                int startCol, int endCol,
+                int startRow, int endRow,
+                bool accumulate, bool threshold);
+
+/*
+ * @brief: 1D vertical convolution of a whole output row, given the
+ *         taps source rows it reads (see convolveRows and verticalPass)
+ */
+void verticalRows(const float* const* rows,
+                float* outRow,
+                const float* coefficients, int taps,
+                int width,
+                bool accumulate, bool threshold);
+
+/*
+ * @brief: return the instruction set used by convolveTile
+ */
+CpuIsa getCpuIsa();
+
+/*
+ * @brief: force the instruction set used by convolveTile.
+ *         Requests not supported by the CPU are ignored.
+ *
+ * @return: true if the instruction set has been selected, false otherwise
+ */
+bool setCpuIsa(const CpuIsa isa);
+
+/*
+ * @brief: return the number of output pixels computed per instruction
+ */
+int getCpuIsaVectorWidth(const CpuIsa isa);
+
+/*
+ * @brief: return a printable name for the instruction set
+ */
+const char* getCpuIsaName(const CpuIsa isa);
+
+
+#endif /* CPU_CONVOLUTION_H_ */
@@ -0,0 +1,432 @@
+#include <iostream>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "fft_convolution.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// Range of the FFT sizes tried for the overlap-save tiles
+#define FFT_MIN_SIZE            16
+#define FFT_MAX_SIZE            4096
+// Cost of a complex butterfly, in scalar direct convolution taps
+#define FFT_BUTTERFLY_COST      6.0f
+
+
+namespace {
+
+/*
+ * Radix-2 complex FFT of a fixed power of two size.
+ * Data is interleaved (re, im), transforms are unscaled.
+ */
+class FftPlan
+{
+    public:
+        explicit FftPlan(int size);
+
+        void transform(float* data, bool inverse) const;
+
+    private:
+        int m_size;
+        std::vector<int> m_bitReverse;      ///< Bit reversal permutation
+        std::vector<float> m_twiddles;      ///< exp(-2*pi*i*k/size), k < size/2
+};
+
+FftPlan::FftPlan(int size) : m_size(size), m_bitReverse(size), m_twiddles(size)
+{
+    int bits = 0;
+    while ((1 << bits) < size) {
+        bits++;
+    }
+
+    for (int i = 0; i < size; i++) {
+        int reversed = 0;
+        for (int b = 0; b < bits; b++) {
+            if (i & (1 << b)) {
+                reversed |= 1 << (bits - 1 - b);
+            }
+        }
+        m_bitReverse[i] = reversed;
+    }
+
+    for (int k = 0; k < size / 2; k++) {
+        double angle = -2 * M_PI * k / size;
+        m_twiddles[2 * k] = cos(angle);
+        m_twiddles[2 * k + 1] = sin(angle);
+    }
+}
+
+void FftPlan::transform(float* data, bool inverse) const
+{
+    const int n = m_size;
+
+    for (int i = 0; i < n; i++) {
+        int j = m_bitReverse[i];
+        if (i < j) {
+            std::swap(data[2 * i], data[2 * j]);
+            std::swap(data[2 * i + 1], data[2 * j + 1]);
+        }
+    }
+
+    // The inverse transform uses the conjugate twiddles
+    const float sign = inverse ? -1.0f : 1.0f;
+
+    for (int length = 2; length <= n; length <<= 1) {
+        int half = length / 2;
+        int step = n / length;
+        for (int k = 0; k < half; k++) {
+            float wr = m_twiddles[2 * k * step];
+            float wi = sign * m_twiddles[2 * k * step + 1];
+            for (int start = 0; start < n; start += length) {
+                float* a = data + 2 * (start + k);
+                float* b = a + 2 * half;
+                float tr = b[0] * wr - b[1] * wi;
+                float ti = b[0] * wi + b[1] * wr;
+                b[0] = a[0] - tr;
+                b[1] = a[1] - ti;
+                a[0] += tr;
+                a[1] += ti;
+            }
+        }
+    }
+}
+
+/*
+ * 2D FFT of a size x size real block. The spectrum keeps the
+ * size/2 + 1 non redundant columns of each row.
+ * Rows are transformed as size/2 complex values (even samples in the
+ * real part, odd samples in the imaginary part), then split.
+ */
+class RealFft2D
+{
+    public:
+        explicit RealFft2D(int size);
+
+        /*
+         * @brief: return the number of floats of a spectrum
+         */
+        int getSpectrumSize() const;
+
+        /*
+         * @brief: return the number of floats of the scratch buffer
+         */
+        int getScratchSize() const;
+
+        void forward(const float* input, float* spectrum, float* scratch) const;
+
+        /*
+         * @brief: inverse transform, scaled by size * size / 2.
+         *         The spectrum is overwritten.
+         */
+        void inverse(float* spectrum, float* output, float* scratch) const;
+
+    private:
+        int m_size;
+        FftPlan m_rowPlan;                  ///< size/2 points, packed real rows
+        FftPlan m_columnPlan;               ///< size points
+        std::vector<float> m_realTwiddles;  ///< exp(-2*pi*i*k/size), k <= size/2
+};
+
+RealFft2D::RealFft2D(int size) : m_size(size), m_rowPlan(size / 2), m_columnPlan(size),
+                                 m_realTwiddles(size + 2)
+{
+    for (int k = 0; k <= size / 2; k++) {
+        double angle = -2 * M_PI * k / size;
+        m_realTwiddles[2 * k] = cos(angle);
+        m_realTwiddles[2 * k + 1] = sin(angle);
+    }
+}
+
+int RealFft2D::getSpectrumSize() const
+{
+    return m_size * (m_size / 2 + 1) * 2;
+}
+
+int RealFft2D::getScratchSize() const
+{
+    return m_size * 2;
+}
+
+void RealFft2D::forward(const float* input, float* spectrum, float* scratch) const
+{
+    const int n = m_size;
+    const int m = n / 2;
+    const int spectrumWidth = m + 1;
+
+    for (int y = 0; y < n; y++) {
+        // Packed real row: z[k] = x[2k] + i * x[2k + 1]
+        std::copy(input + y * n, input + (y + 1) * n, scratch);
+        m_rowPlan.transform(scratch, false);
+
+        float* outRow = spectrum + y * spectrumWidth * 2;
+        for (int k = 0; k <= m; k++) {
+            const float* zk = scratch + 2 * (k % m);
+            const float* zmk = scratch + 2 * ((m - k) % m);
+
+            // Even and odd samples spectra
+            float evenRe = (zk[0] + zmk[0]) * 0.5f;
+            float evenIm = (zk[1] - zmk[1]) * 0.5f;
+            float oddRe = (zk[1] + zmk[1]) * 0.5f;
+            float oddIm = (zmk[0] - zk[0]) * 0.5f;
+
+            float wr = m_realTwiddles[2 * k];
+            float wi = m_realTwiddles[2 * k + 1];
+            outRow[2 * k] = evenRe + oddRe * wr - oddIm * wi;
+            outRow[2 * k + 1] = evenIm + oddRe * wi + oddIm * wr;
+        }
+    }
+
+    for (int x = 0; x < spectrumWidth; x++) {
+        for (int y = 0; y < n; y++) {
+            scratch[2 * y] = spectrum[(x + y * spectrumWidth) * 2];
+            scratch[2 * y + 1] = spectrum[(x + y * spectrumWidth) * 2 + 1];
+        }
+        m_columnPlan.transform(scratch, false);
+        for (int y = 0; y < n; y++) {
+            spectrum[(x + y * spectrumWidth) * 2] = scratch[2 * y];
+            spectrum[(x + y * spectrumWidth) * 2 + 1] = scratch[2 * y + 1];
+        }
+    }
+}
+
+void RealFft2D::inverse(float* spectrum, float* output, float* scratch) const
+{
+    const int n = m_size;
+    const int m = n / 2;
+    const int spectrumWidth = m + 1;
+
+    for (int x = 0; x < spectrumWidth; x++) {
+        for (int y = 0; y < n; y++) {
+            scratch[2 * y] = spectrum[(x + y * spectrumWidth) * 2];
+            scratch[2 * y + 1] = spectrum[(x + y * spectrumWidth) * 2 + 1];
+        }
+        m_columnPlan.transform(scratch, true);
+        for (int y = 0; y < n; y++) {
+            spectrum[(x + y * spectrumWidth) * 2] = scratch[2 * y];
+            spectrum[(x + y * spectrumWidth) * 2 + 1] = scratch[2 * y + 1];
+        }
+    }
+
+    for (int y = 0; y < n; y++) {
+        const float* inRow = spectrum + y * spectrumWidth * 2;
+        for (int k = 0; k < m; k++) {
+            const float* xk = inRow + 2 * k;
+            const float* xmk = inRow + 2 * (m - k);
+
+            // Rebuild the even and odd samples spectra
+            float evenRe = (xk[0] + xmk[0]) * 0.5f;
+            float evenIm = (xk[1] - xmk[1]) * 0.5f;
+            float diffRe = (xk[0] - xmk[0]) * 0.5f;
+            float diffIm = (xk[1] + xmk[1]) * 0.5f;
+
+            // Multiply by the conjugate twiddle
+            float wr = m_realTwiddles[2 * k];
+            float wi = -m_realTwiddles[2 * k + 1];
+            float oddRe = diffRe * wr - diffIm * wi;
+            float oddIm = diffRe * wi + diffIm * wr;
+
+            scratch[2 * k] = evenRe - oddIm;
+            scratch[2 * k + 1] = evenIm + oddRe;
+        }
+        m_rowPlan.transform(scratch, true);
+        std::copy(scratch, scratch + n, output + y * n);
+    }
+}
+
+/*
+ * @brief: return the cost in taps of a tiled FFT convolution of size n
+ */
+float getFftTilingCost(int n, int width, int height, int filterWidth, int filterHeight)
+{
+    int blockWidth = n - filterWidth + 1;
+    int blockHeight = n - filterHeight + 1;
+    if (blockWidth < 1 || blockHeight < 1) {
+        return INFINITY;
+    }
+
+    float tiles = static_cast<float>((width + blockWidth - 1) / blockWidth) *
+                  ((height + blockHeight - 1) / blockHeight);
+
+    // Forward and inverse transforms are about n^2 / 2 * log2(n) butterflies each,
+    // plus the spectrum product and the block copies
+    float butterflies = static_cast<float>(n) * n * log2f(n) + static_cast<float>(n) * n / 2;
+    float tileCost = FFT_BUTTERFLY_COST * butterflies + 2.0f * n * n;
+
+    return tiles * tileCost / (static_cast<float>(width) * height);
+}
+
+/*
+ * @brief: return the FFT size with the lowest cost
+ */
+int chooseFftSize(int width, int height, int filterWidth, int filterHeight)
+{
+    int largestUseful = FFT_MIN_SIZE;
+    while (largestUseful < FFT_MAX_SIZE &&
+           largestUseful < std::max(width + filterWidth - 1, height + filterHeight - 1)) {
+        largestUseful <<= 1;
+    }
+
+    int bestSize = 0;
+    float bestCost = INFINITY;
+    for (int n = FFT_MIN_SIZE; n <= FFT_MAX_SIZE; n <<= 1) {
+        float cost = getFftTilingCost(n, width, height, filterWidth, filterHeight);
+        if (cost < bestCost) {
+            bestCost = cost;
+            bestSize = n;
+        }
+        if (n >= largestUseful && bestSize != 0) {
+            break;
+        }
+    }
+
+    return bestSize;
+}
+
+/*
+ * Buffers of the tiles run by a thread, kept between the calls
+ * so the pool workers do not allocate them per tile
+ */
+struct FftTileBuffers
+{
+    std::vector<float> block;
+    std::vector<float> spectrum;
+    std::vector<float> scratch;
+    std::vector<int> columns;
+};
+
+FftTileBuffers& getTileBuffers()
+{
+    thread_local FftTileBuffers buffers;
+    return buffers;
+}
+
+} // namespace
+
+float getFftCostPerPixel(int width, int height,
+                int filterWidth, int filterHeight)
+{
+    int n = chooseFftSize(width, height, filterWidth, filterHeight);
+    if (n == 0) {
+        return INFINITY;
+    }
+
+    return getFftTilingCost(n, width, height, filterWidth, filterHeight);
+}
+
+bool runCpuFft(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                const float* mask,
+                int filterWidth, int filterHeight,
+                BorderMode border,
+                bool multithread,
+                int threads)
+{
+    if (!haveSamePlaneSize(sourceImages, outImages, planes)) {
+        std::cerr << "Output image size mismatch" << std::endl;
+        return false;
+    }
+
+    const int width = sourceImages[0].getWidth();
+    const int height = sourceImages[0].getHeight();
+
+    const int n = chooseFftSize(width, height, filterWidth, filterHeight);
+    if (n == 0) {
+        std::cerr << "Kernel too big for the frequency domain convolution" << std::endl;
+        return false;
+    }
+
+    TRACE_STATUS("Starting FFT convolution, " << n << "x" << n << " tiles");
+
+    // Each tile gives the output pixels whose taps do not wrap around
+    const int blockWidth = n - filterWidth + 1;
+    const int blockHeight = n - filterHeight + 1;
+    const int tilesPerRow = (width + blockWidth - 1) / blockWidth;
+    const int tilesPerCol = (height + blockHeight - 1) / blockHeight;
+    const int tilesPerPlane = tilesPerRow * tilesPerCol;
+
+    TRACE_SCOPE("runCpuFft");
+    TRACE_COUNT(TraceCounter::PIXELS_PROCESSED, static_cast<long long>(width) * height * planes);
+
+    RealFft2D fft(n);
+
+    // The convolution loops correlate the image with the mask: the mask is
+    // stored mirrored around the origin. The inverse transform scale is
+    // folded in the kernel spectrum.
+    const float scale = 1.0f / (static_cast<float>(n) * n / 2);
+    std::vector<float> kernelBlock(n * n, 0.0f);
+    for (int h = 0; h < filterHeight; h++) {
+        for (int w = 0; w < filterWidth; w++) {
+            kernelBlock[((n - w) % n) + ((n - h) % n) * n] = mask[w + h * filterWidth] * scale;
+        }
+    }
+
+    std::vector<float> kernelSpectrum(fft.getSpectrumSize());
+    std::vector<float> kernelScratch(fft.getScratchSize());
+    fft.forward(kernelBlock.data(), kernelSpectrum.data(), kernelScratch.data());
+
+    auto runTile = [&](int tile) {
+        const ConstImageView& sourceImage = sourceImages[tile / tilesPerPlane];
+        const ImageView& outImage = outImages[tile / tilesPerPlane];
+        const int startCol = (tile % tilesPerPlane % tilesPerRow) * blockWidth;
+        const int startRow = (tile % tilesPerPlane / tilesPerRow) * blockHeight;
+
+        FftTileBuffers& buffers = getTileBuffers();
+        std::vector<float>& block = buffers.block;
+        std::vector<float>& spectrum = buffers.spectrum;
+        std::vector<float>& scratch = buffers.scratch;
+        block.assign(n * n, 0.0f);
+        spectrum.resize(fft.getSpectrumSize());
+        scratch.resize(fft.getScratchSize());
+
+        // Load the tile with its halo, reading the pixels outside the image
+        // according to the border mode. The block is zero filled past the
+        // halo of the last tiles.
+        const int loadWidth = std::min(n, width + filterWidth - 1 - startCol);
+        const int loadHeight = std::min(n, height + filterHeight - 1 - startRow);
+        std::vector<int>& columns = buffers.columns;
+        columns.resize(loadWidth);
+        for (int x = 0; x < loadWidth; x++) {
+            columns[x] = getBorderIndex(startCol - filterWidth / 2 + x, width, border);
+        }
+        for (int y = 0; y < loadHeight; y++) {
+            int row = getBorderIndex(startRow - filterHeight / 2 + y, height, border);
+            if (row < 0) {
+                continue;
+            }
+            const float* sourceRow = sourceImage.getRow(row);
+            float* blockRow = block.data() + y * n;
+            for (int x = 0; x < loadWidth; x++) {
+                if (columns[x] >= 0) {
+                    blockRow[x] = sourceRow[columns[x]];
+                }
+            }
+        }
+
+        fft.forward(block.data(), spectrum.data(), scratch.data());
+
+        for (size_t i = 0; i < spectrum.size(); i += 2) {
+            float re = spectrum[i] * kernelSpectrum[i] - spectrum[i + 1] * kernelSpectrum[i + 1];
+            float im = spectrum[i] * kernelSpectrum[i + 1] + spectrum[i + 1] * kernelSpectrum[i];
+            spectrum[i] = re;
+            spectrum[i + 1] = im;
+        }
+
+        fft.inverse(spectrum.data(), block.data(), scratch.data());
+
+        // Write the valid part of the tile, thresholding overflowing values
+        const int storeWidth = std::min(blockWidth, width - startCol);
+        const int storeHeight = std::min(blockHeight, height - startRow);
+        for (int y = 0; y < storeHeight; y++) {
+            float* outRow = outImage.getRow(startRow + y) + startCol;
+            const float* blockRow = block.data() + y * n;
+            for (int x = 0; x < storeWidth; x++) {
+                outRow[x] = std::min(std::max(blockRow[x], 0.0f), 255.0f);
+            }
+        }
+    };
+
+    runTasks(tilesPerPlane * planes, runTile, multithread, std::max(threads, 0));
+
+    return true;
+}
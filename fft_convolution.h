@@ -0,0 +1,41 @@
+#ifndef FFT_CONVOLUTION_H_
+#define FFT_CONVOLUTION_H_
+
+#include "border_mode.h"
+#include "image_buffer.h"
+
+/*
+ * @brief: This function will calculate the image convolution in the
+ *         frequency domain. The source image is split in
+ *         overlap-save tiles: each tile is transformed with a 2D
+ *         real-to-complex FFT, multiplied by the kernel spectrum and
+ *         transformed back, keeping only the pixels not affected by
+ *         the circular wrap-around. There is no limit on the kernel size.
+ *         The tile halos are read according to the border mode.
+ *
+ * @param: planes: number of source and output views, the channels
+ *         of an image, transformed in the same tile loop
+ * @param: multithread: tiles are executed by the thread pool,
+ *         otherwise on the calling thread
+ * @param: threads: thread pool threads taking part, 0 for all of them.
+ *         The tile size is chosen by the cost model.
+ */
+bool runCpuFft(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                const float* mask,
+                int filterWidth, int filterHeight,
+                BorderMode border,
+                bool multithread,
+                int threads = 0);
+
+/*
+ * @brief: return the estimated cost of runCpuFft per output pixel,
+ *         expressed in scalar direct convolution taps. Used to decide
+ *         when the frequency domain is cheaper than the direct convolution.
+ */
+float getFftCostPerPixel(int width, int height,
+                int filterWidth, int filterHeight);
+
+
+#endif /* FFT_CONVOLUTION_H_ */
@@ -0,0 +1,287 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include "mapped_file.h"
+
+// Source of the filter_shm requests: shm:<width>x<height>
+#define SHARED_MEMORY_PREFIX    "shm:"
+
+#define OUTPUT_FOLDER   "output/"
+
+/*
+ * Latencies measured by a connection, in microseconds
+ */
+struct ConnectionResult
+{
+    std::vector<double> latencies;      ///< Round trips of the successful requests
+    std::vector<double> serverTimes;    ///< Processing times reported by the server
+    int failed;                         ///< Requests answered by an error or lost
+};
+
+/*
+ * @brief: connect to the server socket
+ *
+ * @return: the socket, -1 if the connection failed
+ */
+static int connectServer(const char* socketPath)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) {
+        return -1;
+    }
+    if (connect(server, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0) {
+        close(server);
+        return -1;
+    }
+
+    return server;
+}
+
+/*
+ * @brief: send a request line and wait for the response line
+ *
+ * @return: true if a response was received, false if the connection failed
+ */
+static bool sendRequest(int server, const std::string& request, std::string& response)
+{
+    std::string line = request + '\n';
+    size_t sent = 0;
+    while (sent < line.size()) {
+        ssize_t written = send(server, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        sent += written;
+    }
+
+    // One request at a time: the response is all the connection receives
+    response.clear();
+    char buffer[256];
+    while (response.empty() || response.back() != '\n') {
+        ssize_t size = recv(server, buffer, sizeof(buffer), 0);
+        if (size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (size <= 0) {
+            return false;
+        }
+        response.append(buffer, size);
+    }
+    response.pop_back();
+
+    return true;
+}
+
+/*
+ * @brief: return the p-th percentile of sorted samples, nearest rank
+ */
+static double getPercentile(const std::vector<double>& sorted, double p)
+{
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::min(std::max(rank, static_cast<size_t>(1)), sorted.size()) - 1];
+}
+
+static double getMean(const std::vector<double>& samples)
+{
+    double sum = 0;
+    for (double sample : samples) {
+        sum += sample;
+    }
+
+    return samples.empty() ? 0 : sum / samples.size();
+}
+
+/*
+ * @brief: send requests requests on a new connection, plus a warm-up
+ *         one not measured
+ */
+static void runConnection(const char* socketPath, const std::string& request,
+                          int requests, ConnectionResult& result)
+{
+    result.failed = 0;
+
+    int server = connectServer(socketPath);
+    if (server < 0) {
+        std::cerr << "Unable to connect to " << socketPath << std::endl;
+        result.failed = requests;
+        return;
+    }
+
+    std::string response;
+    if (!sendRequest(server, request, response)) {
+        result.failed = requests;
+        close(server);
+        return;
+    }
+    if (response.compare(0, 3, "ok ") != 0) {
+        std::cerr << "Request failed: " << response << std::endl;
+    }
+
+    for (int i = 0; i < requests; i++) {
+        auto t1 = std::chrono::high_resolution_clock::now();
+        bool received = sendRequest(server, request, response);
+        auto t2 = std::chrono::high_resolution_clock::now();
+
+        if (!received) {
+            result.failed += requests - i;
+            break;
+        }
+        if (response.compare(0, 3, "ok ") != 0) {
+            result.failed++;
+            continue;
+        }
+
+        result.latencies.push_back(std::chrono::duration<double, std::micro>(t2 - t1).count());
+        result.serverTimes.push_back(atof(response.c_str() + 3));
+    }
+
+    close(server);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 3 && std::string(argv[2]) == "shutdown") {
+        int server = connectServer(argv[1]);
+        std::string response;
+        if (server < 0 || !sendRequest(server, "shutdown", response)) {
+            std::cerr << "Unable to reach the server on " << argv[1] << std::endl;
+            return 1;
+        }
+        close(server);
+        return 0;
+    }
+
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " socket_path filter_type source cuda_mem_type border_mode pixel_format requests connections" << std::endl;
+        std::cerr << "filter_type: filters of the request, as for kernel_convolution" << std::endl;
+        std::cerr << "source: image path (results saved in " << OUTPUT_FOLDER << "), or "
+                  << SHARED_MEMORY_PREFIX << "<width>x<height> for a grayscale image in shared memory" << std::endl;
+        std::cerr << "(optional) cuda_mem_type: <global | constant | shared | cpu>. Default: shared" << std::endl;
+        std::cerr << "(optional) border_mode: <replicate | zero | reflect | wrap>. Default: replicate" << std::endl;
+        std::cerr << "(optional) pixel_format: <float | uint8>. Default: float, uint8 for shared memory" << std::endl;
+        std::cerr << "(optional) requests: measured requests per connection. Default: 100" << std::endl;
+        std::cerr << "(optional) connections: concurrent connections. Default: 1" << std::endl;
+        std::cerr << "Shutdown: " << argv[0] << " socket_path shutdown" << std::endl;
+        return 1;
+    }
+
+    const char* socketPath = argv[1];
+    std::string filters = argv[2];
+    std::string source = argv[3];
+    bool sharedMemory = source.compare(0, strlen(SHARED_MEMORY_PREFIX), SHARED_MEMORY_PREFIX) == 0;
+    std::string cudaMemType = argc >= 5 ? argv[4] : "shared";
+    std::string borderMode = argc >= 6 ? argv[5] : "replicate";
+    std::string pixelFormat = argc >= 7 ? argv[6] : (sharedMemory ? "uint8" : "float");
+    int requests = argc >= 8 ? atoi(argv[7]) : 100;
+    int connections = argc >= 9 ? atoi(argv[8]) : 1;
+    if (requests <= 0 || connections <= 0) {
+        std::cerr << "Invalid requests or connections" << std::endl;
+        return 1;
+    }
+
+    int width = 0;
+    int height = 0;
+    if (sharedMemory &&
+        (sscanf(source.c_str() + strlen(SHARED_MEMORY_PREFIX), "%dx%d", &width, &height) != 2 ||
+         width <= 0 || height <= 0)) {
+        std::cerr << "Invalid shared memory image " << source << std::endl;
+        return 1;
+    }
+
+    // Each connection filters its own image: a shared memory object,
+    // or an output file
+    std::vector<std::string> requestLines(connections);
+    std::vector<std::string> sharedNames;
+    std::vector<std::unique_ptr<MappedFile>> sharedImages;
+    for (int c = 0; c < connections; c++) {
+        std::string options = " " + cudaMemType + " " + borderMode + " " + pixelFormat;
+        if (sharedMemory) {
+            std::string name = "/kernel_client_" + std::to_string(getpid()) + "_" + std::to_string(c);
+            std::unique_ptr<MappedFile> image(new MappedFile());
+            if (!image->createShared(name.c_str(), static_cast<size_t>(width) * height)) {
+                return 1;
+            }
+            for (size_t i = 0; i < image->getSize(); i++) {
+                image->getData()[i] = static_cast<uint8_t>((i * 7) ^ (i / width));
+            }
+            sharedNames.push_back(name);
+            sharedImages.push_back(std::move(image));
+
+            requestLines[c] = "filter_shm " + filters + " " + name + " " +
+                              std::to_string(width) + " " + std::to_string(height) + options;
+        }
+        else {
+            size_t extension = source.find_last_of('.');
+            std::string output = std::string(OUTPUT_FOLDER) + "served_" + std::to_string(c) +
+                                 (extension == std::string::npos ? ".png" : source.substr(extension));
+            requestLines[c] = "filter " + filters + " " + source + " " + output + options;
+        }
+    }
+
+    std::vector<ConnectionResult> results(connections);
+    std::vector<std::thread> threads;
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (int c = 0; c < connections; c++) {
+        threads.push_back(std::thread(runConnection, socketPath, std::cref(requestLines[c]),
+                                      requests, std::ref(results[c])));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+
+    for (const auto& name : sharedNames) {
+        shm_unlink(name.c_str());
+    }
+
+    std::vector<double> latencies;
+    std::vector<double> serverTimes;
+    int failed = 0;
+    for (const auto& result : results) {
+        latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+        serverTimes.insert(serverTimes.end(), result.serverTimes.begin(), result.serverTimes.end());
+        failed += result.failed;
+    }
+
+    std::cout << "Requests: " << latencies.size() << ", failed: " << failed
+              << ", connections: " << connections << std::endl;
+    if (latencies.empty()) {
+        return 1;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    double wallTime = std::chrono::duration<double>(t2 - t1).count();
+    std::cout << "Latency (μs): mean " << getMean(latencies)
+              << ", p50 " << getPercentile(latencies, 50)
+              << ", p90 " << getPercentile(latencies, 90)
+              << ", p99 " << getPercentile(latencies, 99)
+              << ", max " << latencies.back() << std::endl;
+    std::cout << "Server processing (μs): mean " << getMean(serverTimes) << std::endl;
+    std::cout << "Throughput: " << latencies.size() / wallTime << " requests/s" << std::endl;
+
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,381 @@
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include "filter_pipeline.h"
+#include "cpu_convolution.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// Output tiles of the fused chain: the intermediates of a tile, with
+// the halos of a few 7x7 kernels, are around 100 KB and stay in cache
+#define PIPELINE_TILE_WIDTH     256
+#define PIPELINE_TILE_HEIGHT    64
+
+// Kernels summing up to this cannot push a [0, 255] image out of range
+#define COLLAPSE_SUM_TOLERANCE  1e-5
+
+
+/*
+ * Pixels [startCol, endCol) x [startRow, endRow), in image coordinates
+ */
+struct Region
+{
+    int startCol;
+    int endCol;
+    int startRow;
+    int endRow;
+};
+
+/*
+ * @brief: return the pixels of a width x height image read by a
+ *         filterWidth x filterHeight kernel computing the output region,
+ *         once the coordinates outside the image are remapped
+ */
+static Region getSourceRegion(const Region& region,
+                              int filterWidth, int filterHeight,
+                              int width, int height,
+                              BorderMode border)
+{
+    const int sw = filterWidth / 2;
+    const int sh = filterHeight / 2;
+
+    // Reflections of images smaller than the kernel can reach any pixel
+    Region source = {region.startCol, region.endCol, region.startRow, region.endRow};
+    for (int x = region.startCol - sw; x < region.endCol + sw; x++) {
+        int column = getBorderIndex(x, width, border);
+        if (column >= 0) {
+            source.startCol = std::min(source.startCol, column);
+            source.endCol = std::max(source.endCol, column + 1);
+        }
+    }
+    for (int y = region.startRow - sh; y < region.endRow + sh; y++) {
+        int row = getBorderIndex(y, height, border);
+        if (row >= 0) {
+            source.startRow = std::min(source.startRow, row);
+            source.endRow = std::max(source.endRow, row + 1);
+        }
+    }
+
+    return source;
+}
+
+/*
+ * @brief: return the pointer to pixel (0, 0) of an image whose region
+ *         is stored in buffer, so that the convolution functions can
+ *         index the buffer with image coordinates. Only the pixels of
+ *         the region are ever read or written through it.
+ */
+static float* getImageOrigin(ImageBuffer& buffer, const Region& region)
+{
+    return buffer.getRow(0) - static_cast<ptrdiff_t>(region.startRow) * buffer.getStride() - region.startCol;
+}
+
+/*
+ * @brief: apply one kernel to the output region, reading the source
+ *         image with the border mode. source and out point to pixel
+ *         (0, 0) of width x height images, as done by the
+ *         sequential filtering: separable kernels run as 1D passes.
+ */
+static void runStep(const Kernel& kernel,
+                    const float* source, int sourceStride,
+                    float* out, int outStride,
+                    int width, int height,
+                    BorderMode border,
+                    const Region& region)
+{
+    const int filterWidth = kernel.getKernelWidth();
+    const int filterHeight = kernel.getKernelHeight();
+
+    if (!kernel.isSeparable()) {
+        convolveTile(source, sourceStride,
+                     out, outStride,
+                     kernel.getKernel().data(),
+                     width, height,
+                     filterWidth, filterHeight,
+                     border,
+                     region.startCol, region.endCol,
+                     region.startRow, region.endRow);
+        return;
+    }
+
+    // The horizontal pass covers the rows read by the vertical pass
+    const Region rowRegion = getSourceRegion(region, 1, filterHeight, width, height, border);
+    ImageBuffer rowPassImage(region.endCol - region.startCol, rowRegion.endRow - rowRegion.startRow);
+    const Region rowPassRegion = {region.startCol, region.endCol, rowRegion.startRow, rowRegion.endRow};
+    float* rowPass = getImageOrigin(rowPassImage, rowPassRegion);
+
+    const int rank = kernel.getSeparableRank();
+    for (int term = 0; term < rank; term++) {
+        horizontalPass(source, sourceStride,
+                       rowPass, rowPassImage.getStride(),
+                       kernel.getRowFactors().data() + term * filterWidth, filterWidth,
+                       width, border,
+                       region.startCol, region.endCol,
+                       rowRegion.startRow, rowRegion.endRow);
+
+        verticalPass(rowPass, rowPassImage.getStride(),
+                     out, outStride,
+                     kernel.getColumnFactors().data() + term * filterHeight, filterHeight,
+                     height, border,
+                     region.startCol, region.endCol,
+                     region.startRow, region.endRow,
+                     term > 0, term == rank - 1);
+    }
+}
+
+/*
+ * @brief: return the cost of a kernel in taps per pixel
+ */
+static int getKernelCost(const Kernel& kernel)
+{
+    if (kernel.isSeparable()) {
+        return kernel.getSeparableRank() * (kernel.getKernelWidth() + kernel.getKernelHeight());
+    }
+
+    return kernel.getKernelWidth() * kernel.getKernelHeight();
+}
+
+/*
+ * @brief: split [0, width) x [0, height) in pipeline tiles and run
+ *         tileFunction on each of them
+ */
+static void forEachPipelineTile(int width, int height, bool multithread,
+                                const std::function<void(const Region&)>& tileFunction)
+{
+    const int tilesPerRow = (width + PIPELINE_TILE_WIDTH - 1) / PIPELINE_TILE_WIDTH;
+    const int tilesPerCol = (height + PIPELINE_TILE_HEIGHT - 1) / PIPELINE_TILE_HEIGHT;
+
+    auto runTile = [&](int tile) {
+        const int startCol = (tile % tilesPerRow) * PIPELINE_TILE_WIDTH;
+        const int startRow = (tile / tilesPerRow) * PIPELINE_TILE_HEIGHT;
+        const Region region = {startCol, std::min(startCol + PIPELINE_TILE_WIDTH, width),
+                               startRow, std::min(startRow + PIPELINE_TILE_HEIGHT, height)};
+
+        tileFunction(region);
+    };
+
+    runTasks(tilesPerRow * tilesPerCol, runTile, multithread);
+}
+
+
+FilterPipeline::FilterPipeline()
+{
+    m_collapseLinear = false;
+}
+
+void FilterPipeline::addKernel(const Kernel& kernel)
+{
+    m_kernels.push_back(kernel);
+}
+
+void FilterPipeline::clear()
+{
+    m_kernels.clear();
+}
+
+int FilterPipeline::getKernelCount() const
+{
+    return static_cast<int>(m_kernels.size());
+}
+
+const Kernel& FilterPipeline::getKernel(int index) const
+{
+    return m_kernels[index];
+}
+
+void FilterPipeline::setCollapseLinear(bool collapse)
+{
+    m_collapseLinear = collapse;
+}
+
+bool FilterPipeline::getCollapseLinear() const
+{
+    return m_collapseLinear;
+}
+
+bool FilterPipeline::buildCollapsedKernel(const ConstImageView& sourceImage, Kernel& collapsed) const
+{
+    if (m_kernels.size() < 2) {
+        return false;
+    }
+
+    // Every step but the last one must keep the pixels in [0, 255],
+    // otherwise its thresholding is not linear
+    for (size_t i = 0; i + 1 < m_kernels.size(); i++) {
+        float sum = 0;
+        for (float coefficient : m_kernels[i].getKernel()) {
+            if (coefficient < 0) {
+                return false;
+            }
+            sum += coefficient;
+        }
+        if (sum > 1 + COLLAPSE_SUM_TOLERANCE) {
+            return false;
+        }
+    }
+
+    // The kernels are correlated with the image: the taps of the
+    // chain are the sums of the products of the taps at each offset
+    std::vector<float> matrix = m_kernels[0].getKernel();
+    int matrixWidth = m_kernels[0].getKernelWidth();
+    int matrixHeight = m_kernels[0].getKernelHeight();
+    int chainCost = getKernelCost(m_kernels[0]);
+
+    for (size_t i = 1; i < m_kernels.size(); i++) {
+        const std::vector<float>& mask = m_kernels[i].getKernel();
+        const int filterWidth = m_kernels[i].getKernelWidth();
+        const int filterHeight = m_kernels[i].getKernelHeight();
+
+        const int newWidth = matrixWidth + filterWidth - 1;
+        const int newHeight = matrixHeight + filterHeight - 1;
+        std::vector<float> newMatrix(newWidth * newHeight, 0.0f);
+        for (int h = 0; h < filterHeight; h++) {
+            for (int w = 0; w < filterWidth; w++) {
+                const float coefficient = mask[w + h * filterWidth];
+                for (int y = 0; y < matrixHeight; y++) {
+                    for (int x = 0; x < matrixWidth; x++) {
+                        newMatrix[(x + w) + (y + h) * newWidth] += coefficient * matrix[x + y * matrixWidth];
+                    }
+                }
+            }
+        }
+
+        matrix.swap(newMatrix);
+        matrixWidth = newWidth;
+        matrixHeight = newHeight;
+        chainCost += getKernelCost(m_kernels[i]);
+    }
+
+    collapsed.setFilter(matrix, matrixHeight, matrixWidth);
+    if (getKernelCost(collapsed) >= chainCost) {
+        return false;
+    }
+
+    // The first step only keeps its output in range for pixels in range
+    for (int y = 0; y < sourceImage.getHeight(); y++) {
+        const float* sourceRow = sourceImage.getRow(y);
+        for (int x = 0; x < sourceImage.getWidth(); x++) {
+            if (sourceRow[x] < 0.0f || sourceRow[x] > 255.0f) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool FilterPipeline::run(const ConstImageView& sourceImage,
+                         const ImageView& outImage,
+                         BorderMode border,
+                         bool multithread) const
+{
+    const int width = sourceImage.getWidth();
+    const int height = sourceImage.getHeight();
+    const int steps = getKernelCount();
+
+    if (outImage.getWidth() != width || outImage.getHeight() != height) {
+        std::cerr << "Output image size mismatch" << std::endl;
+        return false;
+    }
+
+    if (steps == 0) {
+        std::cerr << "Empty filter pipeline" << std::endl;
+        return false;
+    }
+
+    for (const Kernel& kernel : m_kernels) {
+        if (kernel.getKernelWidth() == 0 || kernel.getKernelHeight() == 0) {
+            std::cerr << "Invalid filter dimension" << std::endl;
+            return false;
+        }
+    }
+
+    TRACE_SCOPE("FilterPipeline::run");
+    TRACE_COUNT(TraceCounter::PIXELS_PROCESSED, static_cast<long long>(width) * height);
+
+    if (border == BorderMode::WRAP) {
+        // One full intermediate image per step, the last step
+        // writes the output
+        ImageBuffer stepImages[2];
+        ConstImageView stepSource = sourceImage;
+
+        for (int step = 0; step < steps; step++) {
+            ImageView stepOut = outImage;
+            if (step < steps - 1) {
+                stepImages[step % 2].reset(width, height);
+                stepOut = stepImages[step % 2].getView();
+            }
+
+            forEachPipelineTile(width, height, multithread, [&](const Region& region) {
+                runStep(m_kernels[step],
+                        stepSource.getData(), stepSource.getStride(),
+                        stepOut.getData(), stepOut.getStride(),
+                        width, height,
+                        border,
+                        region);
+            });
+
+            stepSource = stepOut;
+        }
+    }
+    else {
+        Kernel collapsed;
+        const bool useCollapsed = m_collapseLinear && buildCollapsedKernel(sourceImage, collapsed);
+        const int haloWidth = collapsed.getKernelWidth() / 2;
+        const int haloHeight = collapsed.getKernelHeight() / 2;
+
+        forEachPipelineTile(width, height, multithread, [&](const Region& tile) {
+            if (useCollapsed &&
+                tile.startCol >= haloWidth && tile.endCol + haloWidth <= width &&
+                tile.startRow >= haloHeight && tile.endRow + haloHeight <= height) {
+                runStep(collapsed,
+                        sourceImage.getData(), sourceImage.getStride(),
+                        outImage.getData(), outImage.getStride(),
+                        width, height,
+                        border,
+                        tile);
+                return;
+            }
+
+            // Regions computed by each step, grown backwards from the tile
+            std::vector<Region> regions(steps);
+            regions[steps - 1] = tile;
+            for (int step = steps - 1; step > 0; step--) {
+                regions[step - 1] = getSourceRegion(regions[step],
+                                                    m_kernels[step].getKernelWidth(),
+                                                    m_kernels[step].getKernelHeight(),
+                                                    width, height,
+                                                    border);
+            }
+
+            ImageBuffer stepImages[2];
+            const float* stepSource = sourceImage.getData();
+            int stepSourceStride = sourceImage.getStride();
+
+            for (int step = 0; step < steps; step++) {
+                float* stepOut = outImage.getData();
+                int stepOutStride = outImage.getStride();
+
+                if (step < steps - 1) {
+                    ImageBuffer& stepImage = stepImages[step % 2];
+                    stepImage.reset(regions[step].endCol - regions[step].startCol,
+                                    regions[step].endRow - regions[step].startRow);
+                    stepOut = getImageOrigin(stepImage, regions[step]);
+                    stepOutStride = stepImage.getStride();
+                }
+
+                runStep(m_kernels[step],
+                        stepSource, stepSourceStride,
+                        stepOut, stepOutStride,
+                        width, height,
+                        border,
+                        regions[step]);
+
+                stepSource = stepOut;
+                stepSourceStride = stepOutStride;
+            }
+        });
+    }
+
+    return true;
+}
@@ -0,0 +1,93 @@
+#ifndef FILTER_PIPELINE_H_
+#define FILTER_PIPELINE_H_
+
+#include <vector>
+#include "kernel.h"
+#include "border_mode.h"
+#include "image_buffer.h"
+
+/*
+ * Ordered list of kernels applied one after the other, each step reading
+ * the thresholded result of the previous one. The output is computed tile
+ * by tile: each tile computes the intermediate steps only on its region
+ * grown by the radius of the following kernels (the halo), so the
+ * intermediates stay in per-tile scratch buffers that fit the cache
+ * instead of being written to full images.
+ */
+class FilterPipeline
+{
+    public:
+        FilterPipeline();
+
+        /*
+         *  @brief: Dtor
+         */
+        ~FilterPipeline() {}
+
+        /*
+         * @brief: append a kernel to the chain
+         */
+        void addKernel(const Kernel& kernel);
+
+        /*
+         * @brief: remove all the kernels
+         */
+        void clear();
+
+        /*
+         * @brief: get the number of kernels in the chain
+         */
+        int getKernelCount() const;
+
+        /*
+         * @brief: get the kernel applied by step index
+         */
+        const Kernel& getKernel(int index) const;
+
+        /*
+         * @brief: allow the chain to be replaced by a single kernel,
+         *         the convolution of all its kernels, when it is cheaper.
+         *         It is used only when no intermediate step can be
+         *         thresholded (kernels before the last one non-negative with
+         *         sum <= 1) and only on the tiles whose halo does not reach
+         *         the borders, so the result still matches the step by step
+         *         processing up to float rounding. Disabled by default.
+         */
+        void setCollapseLinear(bool collapse);
+
+        /*
+         * @brief: get if the chain can be replaced by a single kernel
+         */
+        bool getCollapseLinear() const;
+
+        /*
+         * @brief: apply the chain to the source image. The result matches
+         *         the kernels applied one by one with FilterAlgorithm::DIRECT.
+         *         The intermediate steps read the previous one with the same
+         *         border mode; WRAP reads the opposite side of the image,
+         *         outside of any tile halo, and runs the steps one by one
+         *         on full intermediate images.
+         *
+         * @param: multithread: tiles are executed by the thread pool,
+         *         otherwise on the calling thread
+         * @return: true if successful, false otherwise
+         */
+        bool run(const ConstImageView& sourceImage,
+                 const ImageView& outImage,
+                 BorderMode border,
+                 bool multithread) const;
+
+    private:
+        /*
+         * @brief: build the convolution of all the kernels of the chain
+         *
+         * @return: true if the chain can be collapsed and it is cheaper
+         */
+        bool buildCollapsedKernel(const ConstImageView& sourceImage, Kernel& collapsed) const;
+
+        std::vector<Kernel> m_kernels;      ///< Steps, in application order
+        bool m_collapseLinear;              ///< Single kernel allowed for linear chains
+};
+
+
+#endif /* FILTER_PIPELINE_H_ */
@@ -0,0 +1,378 @@
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "filter_server.h"
+#include "command_line.h"
+#include "mapped_file.h"
+#include "result_cache.h"
+
+// Interval of the checks of the stop request by the blocked threads
+#define STOP_POLL_INTERVAL_MS   200
+
+// Longest accepted request line
+#define MAX_REQUEST_LENGTH      4096
+
+// Set by the SIGINT and SIGTERM handler
+static volatile sig_atomic_t s_stopSignal = 0;
+
+static void onStopSignal(int)
+{
+    s_stopSignal = 1;
+}
+
+/*
+ * @brief: send a response line, the newline is appended
+ *
+ * @return: true if successful, false otherwise
+ */
+static bool sendLine(int socket, std::string line)
+{
+    line += '\n';
+
+    size_t sent = 0;
+    while (sent < line.size()) {
+        // A client gone away must not raise SIGPIPE
+        ssize_t written = send(socket, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        sent += written;
+    }
+
+    return true;
+}
+
+
+FilterServer::FilterServer(const std::string& socketPath, int workers) :
+    m_socketPath(socketPath), m_workers(workers > 0 ? workers : 1), m_stop(false),
+    m_served(0), m_failed(0)
+{
+    m_workspaceStats = {0, 0, 0, 0, 0};
+}
+
+bool FilterServer::run()
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (m_socketPath.empty() || m_socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Invalid socket path " << m_socketPath << std::endl;
+        return false;
+    }
+    strncpy(address.sun_path, m_socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        std::cerr << "Unable to create the server socket" << std::endl;
+        return false;
+    }
+
+    // A socket file left by a previous server prevents the bind
+    unlink(m_socketPath.c_str());
+    if (bind(listener, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listener, SOMAXCONN) != 0) {
+        std::cerr << "Unable to listen on " << m_socketPath << std::endl;
+        close(listener);
+        return false;
+    }
+
+    // The workers poll the listener and race for the connections:
+    // the losers get EAGAIN instead of blocking in accept
+    fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+
+    s_stopSignal = 0;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onStopSignal;
+    sigemptyset(&action.sa_mask);
+    struct sigaction previousInt;
+    struct sigaction previousTerm;
+    sigaction(SIGINT, &action, &previousInt);
+    sigaction(SIGTERM, &action, &previousTerm);
+
+    std::cout << "Serving on " << m_socketPath << " with " << m_workers << " workers" << std::endl;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < m_workers; i++) {
+        threads.push_back(std::thread(&FilterServer::serveConnections, this, listener));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    sigaction(SIGINT, &previousInt, nullptr);
+    sigaction(SIGTERM, &previousTerm, nullptr);
+    close(listener);
+    unlink(m_socketPath.c_str());
+
+    std::cout << "Served requests: " << m_served << ", failed: " << m_failed << std::endl;
+    std::cout << "Worker workspaces: " << m_workspaceStats.allocations << " allocations, "
+              << m_workspaceStats.reuses << " reuses" << std::endl;
+    ResultCache::getInstance().printStats();
+
+    return true;
+}
+
+void FilterServer::stop()
+{
+    m_stop = true;
+}
+
+bool FilterServer::isStopping() const
+{
+    return m_stop || s_stopSignal != 0;
+}
+
+void FilterServer::serveConnections(int listener)
+{
+    Worker worker;
+
+    while (!isStopping()) {
+        struct pollfd listenerPoll = {listener, POLLIN, 0};
+        if (poll(&listenerPoll, 1, STOP_POLL_INTERVAL_MS) <= 0) {
+            continue;
+        }
+
+        int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0) {
+            continue;
+        }
+
+        serveConnection(connection, worker);
+        close(connection);
+    }
+
+    WorkspaceStats stats = worker.workspace.getStats();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_workspaceStats.allocations += stats.allocations;
+    m_workspaceStats.allocatedBytes += stats.allocatedBytes;
+    m_workspaceStats.reuses += stats.reuses;
+}
+
+void FilterServer::serveConnection(int socket, Worker& worker)
+{
+    std::string received;
+    char buffer[MAX_REQUEST_LENGTH];
+
+    while (!isStopping()) {
+        struct pollfd socketPoll = {socket, POLLIN, 0};
+        if (poll(&socketPoll, 1, STOP_POLL_INTERVAL_MS) <= 0) {
+            continue;
+        }
+
+        ssize_t size = recv(socket, buffer, sizeof(buffer), 0);
+        if (size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (size <= 0) {
+            return;
+        }
+        received.append(buffer, size);
+
+        size_t lineEnd;
+        while ((lineEnd = received.find('\n')) != std::string::npos) {
+            std::string request = received.substr(0, lineEnd);
+            received.erase(0, lineEnd + 1);
+
+            std::string response;
+            bool running = handleRequest(request, worker, response);
+            if (!sendLine(socket, response)) {
+                return;
+            }
+            if (!running) {
+                stop();
+                return;
+            }
+        }
+
+        if (received.size() > MAX_REQUEST_LENGTH) {
+            sendLine(socket, std::string(SERVER_RESPONSE_ERROR) + " request too long");
+            return;
+        }
+    }
+}
+
+bool FilterServer::handleRequest(const std::string& request, Worker& worker, std::string& response)
+{
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    std::istringstream fields(request);
+    std::string command;
+    fields >> command;
+
+    std::string error;
+    if (command == SERVER_REQUEST_SHUTDOWN) {
+        response = SERVER_RESPONSE_OK;
+        return false;
+    }
+    else if (command == SERVER_REQUEST_FILTER || command == SERVER_REQUEST_FILTER_SHM) {
+        bool sharedMemory = command == SERVER_REQUEST_FILTER_SHM;
+
+        std::string filters;
+        std::string source;
+        std::string output;
+        int width = 0;
+        int height = 0;
+        fields >> filters >> source;
+        if (sharedMemory) {
+            fields >> width >> height;
+        }
+        else {
+            fields >> output;
+        }
+        bool complete = !fields.fail();
+
+        std::string cudaMemCmd;
+        std::string borderCmd;
+        std::string formatCmd;
+        fields >> cudaMemCmd >> borderCmd >> formatCmd;
+
+        const FilterPipeline* pipeline = nullptr;
+
+        // Shared memory pixels are 8-bit: filtered as such by default
+        CudaMemType cudaType = CudaMemType::SHARED;
+        BorderMode borderMode = BorderMode::REPLICATE;
+        PixelFormat pixelFormat = sharedMemory ? PixelFormat::UINT8 : PixelFormat::FLOAT;
+
+        if (!complete) {
+            error = "missing request fields";
+        }
+        else if (sharedMemory && (width <= 0 || height <= 0)) {
+            error = "invalid image size";
+        }
+        else if (!cudaMemCmd.empty() && !parseCudaMemType(cudaMemCmd, cudaType)) {
+            error = "invalid cuda_mem_type " + cudaMemCmd;
+        }
+        else if (!borderCmd.empty() && !parseBorderMode(borderCmd, borderMode)) {
+            error = "invalid border_mode " + borderCmd;
+        }
+        else if (!formatCmd.empty() && !parsePixelFormat(formatCmd, pixelFormat)) {
+            error = "invalid pixel_format " + formatCmd;
+        }
+        else if ((pipeline = getPipeline(filters)) == nullptr) {
+            error = "invalid filter_type " + filters;
+        }
+        else if (sharedMemory) {
+            size_t rowSize = static_cast<size_t>(width);
+            MappedFile memory;
+            if (!memory.openShared(source.c_str(), rowSize * height)) {
+                error = "unable to map " + source;
+            }
+            else {
+                // The pixels are copied in buffers kept by the worker
+                worker.sharedPlanes.resize(1);
+                ImageBuffer8& plane = worker.sharedPlanes[0];
+                plane.reset(width, height);
+                for (int y = 0; y < height; y++) {
+                    memcpy(plane.getRow(y), memory.getData() + y * rowSize, rowSize);
+                }
+                worker.source.swapImage(worker.sharedPlanes);
+                worker.source.setPixelFormat(pixelFormat);
+                worker.source.setBorderMode(borderMode);
+
+                if (!filter(worker.source, *pipeline, cudaType, worker)) {
+                    error = "filtering failed";
+                }
+                else {
+                    worker.result.setPixelFormat(PixelFormat::UINT8);
+                    ConstImageView8 result = worker.result.getImageView8();
+                    for (int y = 0; y < height; y++) {
+                        memcpy(memory.getData() + y * rowSize, result.getRow(y), rowSize);
+                    }
+                }
+            }
+        }
+        else {
+            Image image;
+            image.setPixelFormat(pixelFormat);
+            if (!image.loadImage(source.c_str())) {
+                error = "unable to load " + source;
+            }
+            else {
+                image.setBorderMode(borderMode);
+                if (!filter(image, *pipeline, cudaType, worker)) {
+                    error = "filtering failed";
+                }
+                else if (!worker.result.saveImage(output.c_str())) {
+                    error = "unable to save " + output;
+                }
+            }
+        }
+    }
+    else {
+        error = "unknown request " + command;
+    }
+
+    auto t2 = std::chrono::high_resolution_clock::now();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (error.empty()) {
+        m_served++;
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+        response = std::string(SERVER_RESPONSE_OK) + " " + std::to_string(duration);
+    }
+    else {
+        m_failed++;
+        response = std::string(SERVER_RESPONSE_ERROR) + " " + error;
+    }
+
+    return true;
+}
+
+bool FilterServer::filter(Image& source, const FilterPipeline& pipeline,
+                          CudaMemType cudaType, Worker& worker)
+{
+    ResultCache& cache = ResultCache::getInstance();
+    bool useCache = cache.isEnabled();
+    uint64_t cacheKey = useCache ? ResultCache::getKey(source, pipeline, cudaType, FilterAlgorithm::AUTO) : 0;
+    if (useCache && cache.lookup(cacheKey, worker.result)) {
+        return true;
+    }
+
+    // Filter chains are fused on the CPU
+    bool filtered = false;
+    if (pipeline.getKernelCount() > 1) {
+        filtered = source.applyFilter(worker.result, pipeline, true);
+    }
+    else {
+        filtered = source.multithreadFiltering(worker.result, pipeline.getKernel(0), cudaType,
+                                               &worker.workspace);
+    }
+
+    if (filtered && useCache) {
+        cache.store(cacheKey, worker.result);
+    }
+
+    return filtered;
+}
+
+const FilterPipeline* FilterServer::getPipeline(const std::string& filters)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto cached = m_pipelines.find(filters);
+    if (cached != m_pipelines.end()) {
+        return &cached->second;
+    }
+
+    FilterPipeline pipeline;
+    if (!parseFilterCommand(filters, pipeline)) {
+        return nullptr;
+    }
+    pipeline.setCollapseLinear(true);
+
+    return &m_pipelines.insert(std::make_pair(filters, pipeline)).first->second;
+}
@@ -0,0 +1,137 @@
+#ifndef FILTER_SERVER_H_
+#define FILTER_SERVER_H_
+
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include "image.h"
+#include "filter_pipeline.h"
+#include "workspace.h"
+
+/*
+ * Requests of the filter server, one text line each. Optional
+ * fields take the values of the command line of the application.
+ *
+ *   filter <filters> <source_path> <output_path> [cuda_mem_type] [border] [format]
+ *       filter an image file and save the result in output_path
+ *   filter_shm <filters> <shm_name> <width> <height> [cuda_mem_type] [border] [format]
+ *       filter in place a width x height grayscale image, one byte per
+ *       pixel, in a POSIX shared memory object (see shm_open)
+ *   shutdown
+ *       stop the server once the running requests are answered
+ *
+ * Each request is answered by a line: "ok <processing time in us>",
+ * or "error <message>".
+ */
+#define SERVER_REQUEST_FILTER       "filter"
+#define SERVER_REQUEST_FILTER_SHM   "filter_shm"
+#define SERVER_REQUEST_SHUTDOWN     "shutdown"
+#define SERVER_RESPONSE_OK          "ok"
+#define SERVER_RESPONSE_ERROR       "error"
+
+/*
+ * Long-running filter process listening on a Unix domain socket. The
+ * startup costs of a run of the application (CUDA context, planner
+ * profile, thread pool, kernel construction, scratch memory) are paid
+ * once: the workers keep a Workspace each, the kernels of a filter
+ * command are built on its first request. Each worker serves one
+ * connection at a time, a connection sends any number of requests.
+ */
+class FilterServer
+{
+    public:
+        /*
+         * @brief: Ctor
+         *
+         * @param: socketPath: path of the socket file, replaced if present
+         * @param: workers: number of connections served concurrently
+         */
+        FilterServer(const std::string& socketPath, int workers);
+
+        /*
+         *  @brief: Dtor
+         */
+        ~FilterServer() {}
+
+        FilterServer(const FilterServer&) = delete;
+        FilterServer& operator=(const FilterServer&) = delete;
+
+        /*
+         * @brief: serve the connections until a shutdown request,
+         *         SIGINT or SIGTERM, then remove the socket file
+         *
+         * @return: true if successful, false if the socket cannot be opened
+         */
+        bool run();
+
+        /*
+         * @brief: make run() return once the running requests are answered
+         */
+        void stop();
+
+    private:
+        /*
+         * Memory kept by a worker across its requests
+         */
+        struct Worker
+        {
+            Workspace workspace;        ///< Scratch, output and device memory, backends
+            Image source;               ///< Image of the shared memory requests
+            Image result;               ///< Filtered image, planes swapped with the workspace
+            std::vector<ImageBuffer8> sharedPlanes;     ///< Pixels copied from the shared memory
+        };
+
+        /*
+         * @brief: accept and serve connections, one at a time,
+         *         until the server stops
+         */
+        void serveConnections(int listener);
+
+        /*
+         * @brief: answer the requests of a connection until it is closed
+         */
+        void serveConnection(int socket, Worker& worker);
+
+        /*
+         * @brief: execute a request line
+         *
+         * @params[out]: response: the line answered, newline excluded
+         * @return: false if the server must stop, true otherwise
+         */
+        bool handleRequest(const std::string& request, Worker& worker, std::string& response);
+
+        /*
+         * @brief: filter source in the result image of the worker
+         *
+         * @return: true if successful, false otherwise
+         */
+        bool filter(Image& source, const FilterPipeline& pipeline,
+                    CudaMemType cudaType, Worker& worker);
+
+        /*
+         * @brief: return true once stop() is called or a stop signal received
+         */
+        bool isStopping() const;
+
+        /*
+         * @brief: return the kernels of a filter command, built on the
+         *         first request
+         *
+         * @return: the kernels, nullptr if the command is invalid
+         */
+        const FilterPipeline* getPipeline(const std::string& filters);
+
+        std::string m_socketPath;           ///< Path of the socket file
+        int m_workers;                      ///< Connections served concurrently
+        std::atomic<bool> m_stop;           ///< Set to stop the accept loop
+        std::mutex m_mutex;                 ///< Protects the members below
+        std::map<std::string, FilterPipeline> m_pipelines;     ///< Kernels by filter command
+        long long m_served;                 ///< Successful requests
+        long long m_failed;                 ///< Requests answered by an error
+        WorkspaceStats m_workspaceStats;    ///< Counters of the workspaces of the stopped workers
+};
+
+
+#endif /* FILTER_SERVER_H_ */
@@ -1,12 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <iostream>
-#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <mutex>
 #include "gpu_convolution.h"
+#include "kernel.h"
+#include "convolution_backend.h"
+#include "convolution_planner.h"
+#include "trace.h"
 #include "cuda.h"
 
-#define BLOCK_WIDTH 	32
-#define BLOCK_HEIGHT	32
+// Limits of a thread block on every device since compute capability 2.0
+#define MAX_BLOCK_THREADS	1024
+#define MAX_SHARED_MEMORY	(48 * 1024)
 
 unsigned int divUp(const unsigned int& a, const unsigned int& b)
 {
@@ -18,37 +25,156 @@ unsigned int divUp(const unsigned int& a, const unsigned int& b)
 	}
 }
 
-const unsigned int MAX_FILTER_SIZE = 25;
+/*
+ * @brief: cudaMalloc as a workspace device allocator
+ */
+static void* allocateDeviceMemory(size_t bytes)
+{
+	void* memory = nullptr;
+	if (cudaMalloc(&memory, bytes) != cudaSuccess) {
+		return nullptr;
+	}
+
+	return memory;
+}
+
+/*
+ * @brief: cudaFree as a workspace device deallocator
+ */
+static void freeDeviceMemory(void* memory)
+{
+	cudaFree(memory);
+}
+
+/*
+ * Device memory of a launch: taken from the workspace, or allocated
+ * for the launch and freed when it returns
+ */
+class LaunchMemory
+{
+	public:
+		explicit LaunchMemory(Workspace* workspace) : m_workspace(workspace) {}
+
+		/*
+		 *  @brief: Dtor. Frees the memory not held by the workspace
+		 */
+		~LaunchMemory()
+		{
+			for (void* memory : m_allocations) {
+				freeDeviceMemory(memory);
+			}
+		}
+
+		LaunchMemory(const LaunchMemory&) = delete;
+		LaunchMemory& operator=(const LaunchMemory&) = delete;
+
+		/*
+		 * @brief: return bytes of device memory, nullptr on failure
+		 */
+		float* get(DeviceBuffer buffer, size_t bytes)
+		{
+			if (m_workspace != nullptr) {
+				return static_cast<float*>(m_workspace->getDeviceMemory(buffer, bytes,
+																		 allocateDeviceMemory,
+																		 freeDeviceMemory));
+			}
+
+			void* memory = allocateDeviceMemory(bytes);
+			if (memory != nullptr) {
+				m_allocations.push_back(memory);
+			}
+
+			return static_cast<float*>(memory);
+		}
+
+	private:
+		Workspace* m_workspace;             ///< Holds the memory, may be nullptr
+		std::vector<void*> m_allocations;   ///< Memory freed by the destructor
+};
+
+/*
+ * @brief: return true if a blockWidth x blockHeight thread block can be launched
+ */
+static bool checkBlockSize(int blockWidth, int blockHeight)
+{
+	if (blockWidth < 1 || blockHeight < 1 || blockWidth * blockHeight > MAX_BLOCK_THREADS) {
+		std::cerr << "Invalid CUDA block size " << blockWidth << "x" << blockHeight << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool isGpuAvailable()
+{
+	int deviceCount = 0;
+	if (cudaGetDeviceCount(&deviceCount) != cudaSuccess) {
+		// Clear the error, so it is not reported by the next launch
+		cudaGetLastError();
+		return false;
+	}
+
+	return deviceCount > 0;
+}
+
 __device__ __constant__ float d_cFilterKernel[MAX_FILTER_SIZE * MAX_FILTER_SIZE];
+__device__ __constant__ float d_cRowFactors[MAX_SEPARABLE_RANK * MAX_FILTER_SIZE];
+__device__ __constant__ float d_cColumnFactors[MAX_SEPARABLE_RANK * MAX_FILTER_SIZE];
 
+// The constant memory symbols are shared by the host threads (e.g. the
+// server workers): they are held from the upload of the coefficients
+// until the kernels reading them have finished
+static std::mutex s_constantMemoryMutex;
+
+template <int FW, int FH>
 __global__ void filterImageGlobal(float* d_sourceImagePtr, float* d_maskPtr, float* d_outImagePtr,
-									int width, int height, int paddedWidth, int paddedHeight,
-									int filterWidth, int filterHeight)
+									int width, int height,
+									int filterWidth, int filterHeight,
+									BorderMode border)
 {
-	const int s = floor(static_cast<float>(filterWidth) / 2);
-	const int i = blockIdx.y * blockDim.y + threadIdx.y + s;
-	const int j = blockIdx.x * blockDim.x + threadIdx.x + s;
-
-	unsigned int filterRowIndex = 0;
-	unsigned int sourceImgRowIndex = 0;
-	unsigned int sourceImgIndex = 0;
-	unsigned int maskIndex = 0;
+	// Sizes known at compile time unroll the taps, 0 reads them at runtime
+	filterWidth = FW > 0 ? FW : filterWidth;
+	filterHeight = FH > 0 ? FH : filterHeight;
+
+	const int sw = filterWidth / 2;
+	const int sh = filterHeight / 2;
+	const int i = blockIdx.y * blockDim.y + threadIdx.y;
+	const int j = blockIdx.x * blockDim.x + threadIdx.x;
+
+	// Planes are stacked in the device buffers, one per grid layer
+	const size_t planeOffset = static_cast<size_t>(blockIdx.z) * width * height;
+	d_sourceImagePtr += planeOffset;
+	d_outImagePtr += planeOffset;
+
+	int sourceImgRow = 0;
+	int sourceImgCol = 0;
 	float pixelSum = 0;
 
 	// Check out of bounds thread idx
-	if( j >= s && j < paddedWidth - s &&
-			i >= s && i < paddedHeight - s) {
+	if (j < width && i < height) {
 
-		int outPixelPos = (j - s) + (i - s) * width;
+		int outPixelPos = j + i * width;
+
+		// Taps of the interior pixels are all in the image,
+		// the others are read according to the border mode
+		bool interior = j >= sw && j < width - sw &&
+						i >= sh && i < height - sh;
 
 		// Apply convolution
-		for (int h = -s;  h <= s; h++) {
-			filterRowIndex = (h + s) * filterWidth;
-	    	sourceImgRowIndex = (h + i) * paddedWidth;
-	    	for (int w = -s; w <= s; w++) {
-	    		sourceImgIndex = w + j + sourceImgRowIndex;
-	    		maskIndex = (w + s) + filterRowIndex;
-	    		pixelSum += d_sourceImagePtr[sourceImgIndex] * d_maskPtr[maskIndex];
+		#pragma unroll
+		for (int h = 0; h < filterHeight; h++) {
+			sourceImgRow = interior ? i - sh + h : getBorderIndex(i - sh + h, height, border);
+			if (sourceImgRow < 0) {
+				continue;
+			}
+	    	#pragma unroll
+	    	for (int w = 0; w < filterWidth; w++) {
+	    		sourceImgCol = interior ? j - sw + w : getBorderIndex(j - sw + w, width, border);
+	    		if (sourceImgCol < 0) {
+	    			continue;
+	    		}
+	    		pixelSum += d_sourceImagePtr[sourceImgCol + sourceImgRow * width] *
+	    					d_maskPtr[w + h * filterWidth];
 	    	}
 		}
 
@@ -66,35 +192,56 @@ __global__ void filterImageGlobal(float* d_sourceImagePtr, float* d_maskPtr, flo
 	}
 }
 
+template <int FW, int FH>
 __global__ void filterImageConstant(float* d_sourceImagePtr, float* d_outImagePtr,
-										int width, int height, int paddedWidth, int paddedHeight,
-										int filterWidth, int filterHeight)
+										int width, int height,
+										int filterWidth, int filterHeight,
+										BorderMode border)
 {
-	const int s = floor(float(filterWidth) / 2);
-	const int i = blockIdx.y * blockDim.y + threadIdx.y + s;
-	const int j = blockIdx.x * blockDim.x + threadIdx.x + s;
-
-	unsigned int filterRowIndex = 0;
-	unsigned int sourceImgRowIndex = 0;
+	// Sizes known at compile time unroll the taps, 0 reads them at runtime
+	filterWidth = FW > 0 ? FW : filterWidth;
+	filterHeight = FH > 0 ? FH : filterHeight;
+
+	const int sw = filterWidth / 2;
+	const int sh = filterHeight / 2;
+	const int i = blockIdx.y * blockDim.y + threadIdx.y;
+	const int j = blockIdx.x * blockDim.x + threadIdx.x;
+
+	// Planes are stacked in the device buffers, one per grid layer
+	const size_t planeOffset = static_cast<size_t>(blockIdx.z) * width * height;
+	d_sourceImagePtr += planeOffset;
+	d_outImagePtr += planeOffset;
+
+	int sourceImgRow = 0;
+	int sourceImgCol = 0;
 	float pixelSum = 0;
-	unsigned int sourceImgIndex = 0;
-	unsigned int maskIndex = 0;
 
 	// Check out of bounds thread idx
-	if( j >= s && j < paddedWidth - s &&
-			i >= s && i < paddedHeight - s) {
+	if (j < width && i < height) {
+
+		int outPixelPos = j + i * width;
 
-		int outPixelPos = (j - s) + (i - s) * width;
+		// Taps of the interior pixels are all in the image,
+		// the others are read according to the border mode
+		bool interior = j >= sw && j < width - sw &&
+						i >= sh && i < height - sh;
 
 		// Apply convolution
-		for (int h = -s;  h <= s; h++) {
-			filterRowIndex = (h + s) * filterWidth;
-	    	sourceImgRowIndex = (h + i) * paddedWidth;
-	    	for (int w = -s; w <= s; w++) {
-	    		sourceImgIndex = w + j + sourceImgRowIndex;
-	    		maskIndex = (w + s) + filterRowIndex;
+		#pragma unroll
+		for (int h = 0; h < filterHeight; h++) {
+			sourceImgRow = interior ? i - sh + h : getBorderIndex(i - sh + h, height, border);
+			if (sourceImgRow < 0) {
+				continue;
+			}
+	    	#pragma unroll
+	    	for (int w = 0; w < filterWidth; w++) {
+	    		sourceImgCol = interior ? j - sw + w : getBorderIndex(j - sw + w, width, border);
+	    		if (sourceImgCol < 0) {
+	    			continue;
+	    		}
 	    		// Here we use the kernel stored in constant memory
-	    		pixelSum += d_sourceImagePtr[sourceImgIndex] * d_cFilterKernel[maskIndex];
+	    		pixelSum += d_sourceImagePtr[sourceImgCol + sourceImgRow * width] *
+	    					d_cFilterKernel[w + h * filterWidth];
 	    	}
 		}
 
@@ -112,13 +259,26 @@ __global__ void filterImageConstant(float* d_sourceImagePtr, float* d_outImagePt
 	}
 }
 
+template <int FW, int FH>
 __global__ void filterImageShared(float* d_sourceImagePtr, float* d_outImagePtr,
-									int paddedWidth, int paddedHeight,
 									int blockWidth, int blockHeight,
-									int surroundingPixels,
 									int width, int height,
-									int filterWidth, int filterHeight)
+									int filterWidth, int filterHeight,
+									BorderMode border)
 {
+	// Sizes known at compile time unroll the taps, 0 reads them at runtime
+	filterWidth = FW > 0 ? FW : filterWidth;
+	filterHeight = FH > 0 ? FH : filterHeight;
+
+	// Tile padding on each side, the mask can be non square
+	const int haloX = filterWidth / 2;
+	const int haloY = filterHeight / 2;
+
+	// Planes are stacked in the device buffers, one per grid layer
+	const size_t planeOffset = static_cast<size_t>(blockIdx.z) * width * height;
+	d_sourceImagePtr += planeOffset;
+	d_outImagePtr += planeOffset;
+
 	// Each block will share the same data, enabling a faster memory access.
 	// Global memory access for each block will be: number of tile's sub blocks * threads
 	// instead of kernel size * threads
@@ -127,84 +287,84 @@ __global__ void filterImageShared(float* d_sourceImagePtr, float* d_outImagePtr,
 	extern __shared__ float s_data[];
 
 	// Evaluate tile's size
-	unsigned int tileWidth = blockWidth + 2 * surroundingPixels;
-	unsigned int tileHeight = blockHeight + 2 * surroundingPixels;
+	int tileWidth = blockWidth + 2 * haloX;
+	int tileHeight = blockHeight + 2 * haloY;
 
 	// Evaluates number of sub blocks
-	unsigned int noSubBlocks = static_cast<int>(ceil(static_cast<float>(tileHeight) /
-												static_cast<float>(blockDim.y)));
-
-	// Get start and end coordinates for blocks
-	unsigned int blockStartCol = blockIdx.x * blockWidth + surroundingPixels;
-	unsigned int blockEndCol = blockStartCol + blockWidth;
-	unsigned int blockStartRow = blockIdx.y * blockHeight + surroundingPixels;
-	unsigned int blockEndRow = blockStartRow + blockHeight;
+	int noSubBlocks = static_cast<int>(ceil(static_cast<float>(tileHeight) /
+										static_cast<float>(blockDim.y)));
 
-	// Get start and end coordinates for tiles
-	unsigned int tileStartCol = blockStartCol - surroundingPixels;
-	unsigned int tileEndCol = blockEndCol + surroundingPixels;
-	unsigned int tileEndClampedCol = min(tileEndCol, paddedWidth);
+	// Get start coordinates for blocks, in image coordinates
+	int blockStartCol = blockIdx.x * blockWidth;
+	int blockStartRow = blockIdx.y * blockHeight;
 
-	unsigned int tileStartRow = blockStartRow - surroundingPixels;
-	unsigned int tileEndRow = blockEndRow + surroundingPixels;
-	unsigned int tileEndClampedRow = min(tileEndRow, paddedHeight);
+	// Get start coordinates for tiles, the tile padding can
+	// be outside the image
+	int tileStartCol = blockStartCol - haloX;
+	int tileStartRow = blockStartRow - haloY;
 
 	// Pixel position in tile
-	unsigned int tilePixelPosCol = threadIdx.x;
-	// Input image pixel column position
-	unsigned int iPixelPosCol = tileStartCol + tilePixelPosCol;
+	int tilePixelPosCol = threadIdx.x;
+	// Input image pixel column position, remapped by the border mode
+	int iPixelPosCol = getBorderIndex(tileStartCol + tilePixelPosCol, width, border);
 
-	unsigned int tilePixelPosRow = 0;
-	unsigned int iPixelPosRow = 0;
-	unsigned int iPixelPos = 0;
-	unsigned int tilePixelPos = 0;
+	int tilePixelPosRow = 0;
+	int iPixelPosRow = 0;
+	int tilePixelPos = 0;
 
 	for (int subBlockNo = 0; subBlockNo < noSubBlocks; subBlockNo++) {
 		tilePixelPosRow = threadIdx.y + subBlockNo * blockDim.y;
-		iPixelPosRow = tileStartRow + tilePixelPosRow;
-
-		// Check if the pixel is in the image
-		if (iPixelPosCol < tileEndClampedCol && iPixelPosRow < tileEndClampedRow) {
-			iPixelPos = iPixelPosRow * paddedWidth + iPixelPosCol;
-	      tilePixelPos = tilePixelPosRow * tileWidth + tilePixelPosCol;
-	      // Load the pixel in the shared memory
-	      s_data[tilePixelPos] = d_sourceImagePtr[iPixelPos];
-	    }
+
+		// Check if the pixel is in the tile
+		if (tilePixelPosCol < tileWidth && tilePixelPosRow < tileHeight) {
+			iPixelPosRow = getBorderIndex(tileStartRow + tilePixelPosRow, height, border);
+			tilePixelPos = tilePixelPosRow * tileWidth + tilePixelPosCol;
+
+			// Load the pixel in the shared memory, zero outside the image in ZERO mode
+			if (iPixelPosCol < 0 || iPixelPosRow < 0) {
+				s_data[tilePixelPos] = 0;
+			}
+			else {
+				s_data[tilePixelPos] = d_sourceImagePtr[iPixelPosRow * width + iPixelPosCol];
+			}
+		}
 	}
 
 	// Wait for threads loading data in tiles
 	__syncthreads();
 
-	unsigned int oPixelPosRow = 0;
-	unsigned int oPixelPos = 0;;
-	unsigned int tilePixelPosOffset = 0;
-	unsigned int maskIndex = 0;
-	unsigned int oPixelPosCol = iPixelPosCol - surroundingPixels;
+	int oPixelPosRow = 0;
+	int oPixelPos = 0;
+	int tilePixelPosOffset = 0;
+	int maskIndex = 0;
+	int oPixelPosCol = tileStartCol + tilePixelPosCol;
 
 	for (int subBlockNo = 0; subBlockNo < noSubBlocks; subBlockNo++) {
 
 		float pixelSum = 0;
 	    tilePixelPosRow = threadIdx.y + subBlockNo * blockDim.y;
-	    iPixelPosRow = tileStartRow + tilePixelPosRow;
+	    oPixelPosRow = tileStartRow + tilePixelPosRow;
 
-	    // Check if the pixel is in the tile and image.
+	    // Check if the pixel is in the block and image.
 	    // Pixels in the tile padding are exclude from evaluation.
-	    if (iPixelPosCol >= tileStartCol + surroundingPixels &&
-				iPixelPosCol < tileEndClampedCol - surroundingPixels &&
-				iPixelPosRow >= tileStartRow + surroundingPixels &&
-	    		iPixelPosRow < tileEndClampedRow - surroundingPixels) {
+	    if (tilePixelPosCol >= haloX &&
+				tilePixelPosCol < haloX + blockWidth &&
+				tilePixelPosRow >= haloY &&
+				tilePixelPosRow < haloY + blockHeight &&
+				oPixelPosCol < width && oPixelPosRow < height) {
 
 	    	// Evaluate pixel position for output image
-	    	oPixelPosRow = iPixelPosRow - surroundingPixels;
 	    	oPixelPos = oPixelPosRow * width + oPixelPosCol;
 
 	    	tilePixelPos = tilePixelPosRow * tileWidth + tilePixelPosCol;
 
 	    	// Apply convolution
-	    	for (int h = -surroundingPixels;  h <= surroundingPixels; h++) {
-	    		for (int w = -surroundingPixels; w <= surroundingPixels; w++) {
+	    	#pragma unroll
+	    	for (int h = -haloY;  h <= haloY; h++) {
+	    		#pragma unroll
+	    		for (int w = -haloX; w <= haloX; w++) {
 	    			tilePixelPosOffset = h * tileWidth + w;
-	    			maskIndex = (h + surroundingPixels) * filterWidth + (w + surroundingPixels);
+	    			maskIndex = (h + haloY) * filterWidth + (w + haloX);
 	    			pixelSum += s_data[tilePixelPos + tilePixelPosOffset] * d_cFilterKernel[maskIndex];
 				}
 			}
@@ -224,36 +384,199 @@ __global__ void filterImageShared(float* d_sourceImagePtr, float* d_outImagePtr,
 	}
 }
 
-bool runGlobal(const float* sourceImage,
-        		float* outImage,
+template <int TAPS>
+__global__ void filterRowsSeparable(float* d_sourceImagePtr, float* d_rowPassImagePtr,
+										int width, int height,
+										int filterWidth, int term,
+										BorderMode border)
+{
+	filterWidth = TAPS > 0 ? TAPS : filterWidth;
+
+	const int i = blockIdx.y * blockDim.y + threadIdx.y;
+	const int j = blockIdx.x * blockDim.x + threadIdx.x;
+
+	// Planes are stacked in the device buffers, one per grid layer
+	const size_t planeOffset = static_cast<size_t>(blockIdx.z) * width * height;
+	d_sourceImagePtr += planeOffset;
+	d_rowPassImagePtr += planeOffset;
+
+	if (j < width && i < height) {
+		const float* rowFactor = d_cRowFactors + term * filterWidth;
+		const int s = filterWidth / 2;
+		const float* sourceImgRow = d_sourceImagePtr + i * width;
+		float pixelSum = 0;
+
+		// The column pass resolves the top and bottom borders
+		#pragma unroll
+		for (int w = 0; w < filterWidth; w++) {
+			int sourceImgCol = getBorderIndex(j - s + w, width, border);
+			if (sourceImgCol >= 0) {
+				pixelSum += sourceImgRow[sourceImgCol] * rowFactor[w];
+			}
+		}
+
+		d_rowPassImagePtr[j + i * width] = pixelSum;
+	}
+}
+
+template <int TAPS>
+__global__ void filterColumnsSeparable(float* d_rowPassImagePtr, float* d_outImagePtr,
+										int width, int height,
+										int filterHeight, int term,
+										BorderMode border,
+										bool accumulate, bool threshold)
+{
+	filterHeight = TAPS > 0 ? TAPS : filterHeight;
+
+	const int i = blockIdx.y * blockDim.y + threadIdx.y;
+	const int j = blockIdx.x * blockDim.x + threadIdx.x;
+
+	// Planes are stacked in the device buffers, one per grid layer
+	const size_t planeOffset = static_cast<size_t>(blockIdx.z) * width * height;
+	d_rowPassImagePtr += planeOffset;
+	d_outImagePtr += planeOffset;
+
+	if (j < width && i < height) {
+		const float* columnFactor = d_cColumnFactors + term * filterHeight;
+		const int s = filterHeight / 2;
+		int outPixelPos = j + i * width;
+		float pixelSum = 0;
+
+		#pragma unroll
+		for (int h = 0; h < filterHeight; h++) {
+			int rowPassImgRow = getBorderIndex(i - s + h, height, border);
+			if (rowPassImgRow >= 0) {
+				pixelSum += d_rowPassImagePtr[j + rowPassImgRow * width] * columnFactor[h];
+			}
+		}
+
+		// Terms are summed in the output image
+		if (accumulate) {
+			pixelSum = d_outImagePtr[outPixelPos] + pixelSum;
+		}
+
+		// Thresholding overflowing pixel's values after the last term
+		if (threshold) {
+			if (pixelSum < 0) {
+				pixelSum = 0;
+			}
+			else if (pixelSum > 255) {
+				pixelSum = 255;
+			}
+		}
+
+		d_outImagePtr[outPixelPos] = pixelSum;
+	}
+}
+
+typedef void (*GlobalKernel)(float*, float*, float*, int, int, int, int, BorderMode);
+typedef void (*ConstantKernel)(float*, float*, int, int, int, int, BorderMode);
+typedef void (*SharedKernel)(float*, float*, int, int, int, int, int, int, BorderMode);
+typedef void (*RowsKernel)(float*, float*, int, int, int, int, BorderMode);
+typedef void (*ColumnsKernel)(float*, float*, int, int, int, int, BorderMode, bool, bool);
+
+template <class Function>
+struct KernelSpecialization
+{
+	int width;
+	int height;
+	Function function;
+};
+
+/*
+ * Dispatch tables: kernels unrolled for the sizes of the built-in
+ * filters (kernel.cpp) and of their 1D factors
+ */
+const KernelSpecialization<GlobalKernel> globalKernels[] = {
+	{3, 3, filterImageGlobal<3, 3>},
+	{5, 5, filterImageGlobal<5, 5>},
+	{7, 7, filterImageGlobal<7, 7>}
+};
+
+const KernelSpecialization<ConstantKernel> constantKernels[] = {
+	{3, 3, filterImageConstant<3, 3>},
+	{5, 5, filterImageConstant<5, 5>},
+	{7, 7, filterImageConstant<7, 7>}
+};
+
+const KernelSpecialization<SharedKernel> sharedKernels[] = {
+	{3, 3, filterImageShared<3, 3>},
+	{5, 5, filterImageShared<5, 5>},
+	{7, 7, filterImageShared<7, 7>}
+};
+
+const KernelSpecialization<RowsKernel> rowsKernels[] = {
+	{3, 1, filterRowsSeparable<3>},
+	{5, 1, filterRowsSeparable<5>},
+	{7, 1, filterRowsSeparable<7>}
+};
+
+const KernelSpecialization<ColumnsKernel> columnsKernels[] = {
+	{1, 3, filterColumnsSeparable<3>},
+	{1, 5, filterColumnsSeparable<5>},
+	{1, 7, filterColumnsSeparable<7>}
+};
+
+/*
+ * @brief: return the specialization for the kernel size,
+ *         the generic kernel if there is none
+ */
+template <class Function, int N>
+Function selectKernel(const KernelSpecialization<Function> (&table)[N],
+						int width, int height, Function generic)
+{
+	for (int i = 0; i < N; i++) {
+		if (table[i].width == width && table[i].height == height) {
+			return table[i].function;
+		}
+	}
+
+	return generic;
+}
+
+bool runGlobal(const ConstImageView* sourceImages,
+        		const ImageView* outImages,
+        		int planes,
         		const float* mask,
-        		int width, int height,
-        		int paddedWidth, int paddedHeight,
-        		int filterWidth, int filterHeight)
+        		int filterWidth, int filterHeight,
+        		BorderMode border,
+        		const GpuBlockSize& blockSize,
+        		Workspace* workspace)
 {
-	std::cout << "Starting CUDA global memory convolution" << std::endl;
+	if (!haveSamePlaneSize(sourceImages, outImages, planes)) {
+		std::cerr << "Output image size mismatch" << std::endl;
+		return false;
+	}
+
+	const int width = sourceImages[0].getWidth();
+	const int height = sourceImages[0].getHeight();
 
-	const int blockWidth = BLOCK_WIDTH;
-	const int blockHeight = BLOCK_HEIGHT;
+	TRACE_STATUS("Starting CUDA global memory convolution");
+	TRACE_SCOPE("runGlobal");
+	TRACE_COUNT(TraceCounter::PIXELS_PROCESSED, static_cast<long long>(width) * height * planes);
 
+	const int blockWidth = blockSize.blockWidth;
+	const int blockHeight = blockSize.blockHeight;
+	if (!checkBlockSize(blockWidth, blockHeight)) {
+		return false;
+	}
+
+	LaunchMemory deviceMemory(workspace);
 	float *d_sourceImagePtr;
 	float *d_outImagePtr;
 	float *d_maskPtr;
 
-	const int sourceImgSize = sizeof(float) * paddedWidth * paddedHeight;
+	const size_t sourceImgSize = sizeof(float) * width * height * planes;
 	const int maskSize = sizeof(float) * filterWidth * filterHeight;
-	const int outImageSize = sizeof(float) * width * height;
-
-	int copyDuration = 0;
-	auto t3 = std::chrono::high_resolution_clock::now();
-
-	// Allocate device memory for images and filter
-	cudaMalloc(reinterpret_cast<void**>(&d_sourceImagePtr), sourceImgSize);
-	cudaMalloc(reinterpret_cast<void**>(&d_maskPtr), maskSize);
-	cudaMalloc(reinterpret_cast<void**>(&d_outImagePtr), outImageSize);
-
-	auto t4 = std::chrono::high_resolution_clock::now();
-	copyDuration += std::chrono::duration_cast<std::chrono::microseconds>(t4 - t3).count();
+	const size_t outImageSize = sizeof(float) * width * height * planes;
+
+	{
+		TRACE_SCOPE("cuda allocate");
+		// Device memory for images and filter, reused from the workspace if any
+		d_sourceImagePtr = deviceMemory.get(DeviceBuffer::SOURCE, sourceImgSize);
+		d_maskPtr = deviceMemory.get(DeviceBuffer::MASK, maskSize);
+		d_outImagePtr = deviceMemory.get(DeviceBuffer::OUTPUT, outImageSize);
+	}
 
 	cudaError_t err = cudaGetLastError();
 	if (err != cudaSuccess) {
@@ -261,14 +584,18 @@ bool runGlobal(const float* sourceImage,
 		return false;
 	}
 
-	t3 = std::chrono::high_resolution_clock::now();
-
-	// Transfer data from host to device memory
-	cudaMemcpy(d_sourceImagePtr, sourceImage, sourceImgSize, cudaMemcpyHostToDevice);
-	cudaMemcpy(d_maskPtr, mask, maskSize, cudaMemcpyHostToDevice);
-
-	t4 = std::chrono::high_resolution_clock::now();
-	copyDuration += std::chrono::duration_cast<std::chrono::microseconds>(t4 - t3).count();
+	{
+		TRACE_SCOPE("cuda copy to device");
+		TRACE_COUNT(TraceCounter::BYTES_COPIED, sourceImgSize);
+		// Transfer data from host to device memory
+		// Rows of the host view can be strided, the device image is dense
+		for (int plane = 0; plane < planes; plane++) {
+			cudaMemcpy2D(d_sourceImagePtr + static_cast<size_t>(plane) * width * height, sizeof(float) * width,
+						 sourceImages[plane].getData(), sizeof(float) * sourceImages[plane].getStride(),
+						 sizeof(float) * width, height, cudaMemcpyHostToDevice);
+		}
+		cudaMemcpy(d_maskPtr, mask, maskSize, cudaMemcpyHostToDevice);
+	}
 
 	err = cudaGetLastError();
 	if (err != cudaSuccess) {
@@ -278,72 +605,89 @@ bool runGlobal(const float* sourceImage,
 
 	// Allocates block size and grid size
 	dim3 threadsPerBlock(blockWidth, blockHeight);
-	dim3 blocksPerGrid(divUp(width, blockWidth), divUp(height, blockHeight));
-
-	auto t1 = std::chrono::high_resolution_clock::now();
-
-	filterImageGlobal<<<blocksPerGrid, threadsPerBlock>>>(d_sourceImagePtr, d_maskPtr, d_outImagePtr,
-					 width,  height,  paddedWidth,  paddedHeight,
-					 filterWidth,  filterHeight);
+	dim3 blocksPerGrid(divUp(width, blockWidth), divUp(height, blockHeight), planes);
+
+	{
+		TRACE_SCOPE("cuda kernel");
+		GlobalKernel filterImage = selectKernel(globalKernels, filterWidth, filterHeight,
+												filterImageGlobal<0, 0>);
+
+		filterImage<<<blocksPerGrid, threadsPerBlock>>>(d_sourceImagePtr, d_maskPtr, d_outImagePtr,
+						 width,  height,
+						 filterWidth,  filterHeight,
+						 border);
+
+		err = cudaGetLastError();
+		if (err != cudaSuccess) {
+		    std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+		    return false;
+		}
 
-	err = cudaGetLastError();
-	if (err != cudaSuccess) {
-	    std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
-	    return false;
+		// Waits for threads to finish work
+		cudaDeviceSynchronize();
 	}
 
-	// Waits for threads to finish work
-	cudaDeviceSynchronize();
-
-	auto t2 = std::chrono::high_resolution_clock::now();
-	auto filterDuration = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
-	std::cout << "CUDA global memory filtering execution time: " << filterDuration << " μs" << std::endl;
-
-	t3 = std::chrono::high_resolution_clock::now();
-
-	// Transfer resulting image back
-	cudaMemcpy(outImage, d_outImagePtr, outImageSize, cudaMemcpyDeviceToHost);
-
-	t4 = std::chrono::high_resolution_clock::now();
-	copyDuration += std::chrono::duration_cast<std::chrono::microseconds>(t4 - t3).count();
-	std::cout << "Copy Execution time: " << copyDuration << " μs" << std::endl;
-
-	// Cleanup after kernel execution
-	cudaFree(d_sourceImagePtr);
-	cudaFree(d_maskPtr);
-	cudaFree(d_outImagePtr);
+	{
+		TRACE_SCOPE("cuda copy to host");
+		TRACE_COUNT(TraceCounter::BYTES_COPIED, outImageSize);
+		// Transfer resulting image back
+		for (int plane = 0; plane < planes; plane++) {
+			cudaMemcpy2D(outImages[plane].getData(), sizeof(float) * outImages[plane].getStride(),
+						 d_outImagePtr + static_cast<size_t>(plane) * width * height, sizeof(float) * width,
+						 sizeof(float) * width, height, cudaMemcpyDeviceToHost);
+		}
+	}
 
 	return true;
 }
 
-bool runConstant(const float* sourceImage,
-        			float* outImage,
+bool runConstant(const ConstImageView* sourceImages,
+        			const ImageView* outImages,
+        			int planes,
         			const float* mask,
-        			int width, int height,
-        			int paddedWidth, int paddedHeight,
-        			int filterWidth, int filterHeight)
+        			int filterWidth, int filterHeight,
+        			BorderMode border,
+        			const GpuBlockSize& blockSize,
+        			Workspace* workspace)
 {
-	std::cout << "Starting CUDA constant memory convolution" << std::endl;
+	if (!haveSamePlaneSize(sourceImages, outImages, planes)) {
+		std::cerr << "Output image size mismatch" << std::endl;
+		return false;
+	}
+
+	const int width = sourceImages[0].getWidth();
+	const int height = sourceImages[0].getHeight();
 
-	const int blockWidth = BLOCK_WIDTH;
-	const int blockHeight = BLOCK_HEIGHT;
+	TRACE_STATUS("Starting CUDA constant memory convolution");
+	TRACE_SCOPE("runConstant");
+	TRACE_COUNT(TraceCounter::PIXELS_PROCESSED, static_cast<long long>(width) * height * planes);
 
+	if (filterWidth > static_cast<int>(MAX_FILTER_SIZE) ||
+			filterHeight > static_cast<int>(MAX_FILTER_SIZE)) {
+		std::cerr << "Kernel too big for the constant memory" << std::endl;
+		return false;
+	}
+
+	const int blockWidth = blockSize.blockWidth;
+	const int blockHeight = blockSize.blockHeight;
+	if (!checkBlockSize(blockWidth, blockHeight)) {
+		return false;
+	}
+
+	LaunchMemory deviceMemory(workspace);
 	float *d_sourceImagePtr;
 	float *d_outImagePtr;
 
-	const int sourceImgSize = sizeof(float) * paddedWidth * paddedHeight;
+	const size_t sourceImgSize = sizeof(float) * width * height * planes;
 	const int maskSize = sizeof(float) * filterWidth * filterHeight;
-	const int outImageSize = sizeof(float) * width * height;
+	const size_t outImageSize = sizeof(float) * width * height * planes;
 
-	int copyDuration = 0;
-	auto t3 = std::chrono::high_resolution_clock::now();
-
-	// Allocate device memory for images and filter
-	cudaMalloc(reinterpret_cast<void**>(&d_sourceImagePtr), sourceImgSize);
-	cudaMalloc(reinterpret_cast<void**>(&d_outImagePtr), outImageSize);
-
-	auto t4 = std::chrono::high_resolution_clock::now();
-	copyDuration += std::chrono::duration_cast<std::chrono::microseconds>(t4 - t3).count();
+	{
+		TRACE_SCOPE("cuda allocate");
+		// Device memory for images, reused from the workspace if any
+		d_sourceImagePtr = deviceMemory.get(DeviceBuffer::SOURCE, sourceImgSize);
+		d_outImagePtr = deviceMemory.get(DeviceBuffer::OUTPUT, outImageSize);
+	}
 
 	cudaError_t err = cudaGetLastError();
 	if (err != cudaSuccess) {
@@ -351,14 +695,17 @@ bool runConstant(const float* sourceImage,
 		return false;
 	}
 
-	t3 = std::chrono::high_resolution_clock::now();
-
-	// Transfer data from host to device memory
-	cudaMemcpy(d_sourceImagePtr, sourceImage, sourceImgSize, cudaMemcpyHostToDevice);
-	cudaMemcpyToSymbol(d_cFilterKernel, mask, maskSize, 0, cudaMemcpyHostToDevice);
-
-	t4 = std::chrono::high_resolution_clock::now();
-	copyDuration += std::chrono::duration_cast<std::chrono::microseconds>(t4 - t3).count();
+	{
+		TRACE_SCOPE("cuda copy to device");
+		TRACE_COUNT(TraceCounter::BYTES_COPIED, sourceImgSize);
+		// Transfer data from host to device memory
+		// Rows of the host view can be strided, the device image is dense
+		for (int plane = 0; plane < planes; plane++) {
+			cudaMemcpy2D(d_sourceImagePtr + static_cast<size_t>(plane) * width * height, sizeof(float) * width,
+						 sourceImages[plane].getData(), sizeof(float) * sourceImages[plane].getStride(),
+						 sizeof(float) * width, height, cudaMemcpyHostToDevice);
+		}
+	}
 
 	err = cudaGetLastError();
 	if (err != cudaSuccess) {
@@ -368,89 +715,120 @@ bool runConstant(const float* sourceImage,
 
 	// Allocates block size and grid size
 	dim3 threadsPerBlock(blockWidth, blockHeight);
-	dim3 blocksPerGrid(divUp(width, blockWidth), divUp(height, blockHeight));
+	dim3 blocksPerGrid(divUp(width, blockWidth), divUp(height, blockHeight), planes);
 
-	auto t1 = std::chrono::high_resolution_clock::now();
+	std::unique_lock<std::mutex> constantMemoryLock(s_constantMemoryMutex);
+	{
+		TRACE_SCOPE("cuda copy to constant memory");
+		cudaMemcpyToSymbol(d_cFilterKernel, mask, maskSize, 0, cudaMemcpyHostToDevice);
+	}
 
-	filterImageConstant<<<blocksPerGrid, threadsPerBlock>>>(d_sourceImagePtr, d_outImagePtr,
-					 width,  height,  paddedWidth,  paddedHeight,
-					 filterWidth,  filterHeight);
+	{
+		TRACE_SCOPE("cuda kernel");
+		ConstantKernel filterImage = selectKernel(constantKernels, filterWidth, filterHeight,
+													filterImageConstant<0, 0>);
 
-	err = cudaGetLastError();
-	if (err != cudaSuccess) {
-	    std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
-	    return false;
-	}
+		filterImage<<<blocksPerGrid, threadsPerBlock>>>(d_sourceImagePtr, d_outImagePtr,
+						 width,  height,
+						 filterWidth,  filterHeight,
+						 border);
 
-	// Waits for threads to finish work
-	cudaDeviceSynchronize();
+		err = cudaGetLastError();
+		if (err != cudaSuccess) {
+		    std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+		    return false;
+		}
 
-	auto t2 = std::chrono::high_resolution_clock::now();
-	auto filterDuration = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
-	std::cout << "CUDA constant filtering execution time: " << filterDuration << " μs" << std::endl;
+		// Waits for threads to finish work
+		cudaDeviceSynchronize();
+	}
+	constantMemoryLock.unlock();
 
 	// Transfer resulting image back
-	t3 = std::chrono::high_resolution_clock::now();
-	cudaMemcpy(outImage, d_outImagePtr, outImageSize, cudaMemcpyDeviceToHost);
-	t4 = std::chrono::high_resolution_clock::now();
-	copyDuration += std::chrono::duration_cast<std::chrono::microseconds>(t4 - t3).count();
-	std::cout << "Copy Execution time: " << copyDuration << " μs" << std::endl;
-
-	// Cleanup after kernel execution
-	cudaFree(d_sourceImagePtr);
-	cudaFree(d_outImagePtr);
+	{
+		TRACE_SCOPE("cuda copy to host");
+		TRACE_COUNT(TraceCounter::BYTES_COPIED, outImageSize);
+		for (int plane = 0; plane < planes; plane++) {
+			cudaMemcpy2D(outImages[plane].getData(), sizeof(float) * outImages[plane].getStride(),
+						 d_outImagePtr + static_cast<size_t>(plane) * width * height, sizeof(float) * width,
+						 sizeof(float) * width, height, cudaMemcpyDeviceToHost);
+		}
+	}
 
 	return true;
 }
 
-bool runShared(const float* sourceImage,
-        		float* outImage,
+bool runShared(const ConstImageView* sourceImages,
+        		const ImageView* outImages,
+        		int planes,
         		const float* mask,
-        		int width, int height,
-        		int paddedWidth, int paddedHeight,
-        		int filterWidth, int filterHeight)
+        		int filterWidth, int filterHeight,
+        		BorderMode border,
+        		const GpuBlockSize& blockSize,
+        		Workspace* workspace)
 {
-	std::cout << "Starting CUDA shared memory convolution" << std::endl;
+	if (!haveSamePlaneSize(sourceImages, outImages, planes)) {
+		std::cerr << "Output image size mismatch" << std::endl;
+		return false;
+	}
+
+	const int width = sourceImages[0].getWidth();
+	const int height = sourceImages[0].getHeight();
+
+	TRACE_STATUS("Starting CUDA shared memory convolution");
+	TRACE_SCOPE("runShared");
+	TRACE_COUNT(TraceCounter::PIXELS_PROCESSED, static_cast<long long>(width) * height * planes);
+
+	if (filterWidth > static_cast<int>(MAX_FILTER_SIZE) ||
+			filterHeight > static_cast<int>(MAX_FILTER_SIZE)) {
+		std::cerr << "Kernel too big for the constant memory" << std::endl;
+		return false;
+	}
 
+	LaunchMemory deviceMemory(workspace);
 	float *d_sourceImagePtr;
 	float *d_outImagePtr;
 
-	const int blockWidth = 64;
-	const int blockHeight = 32;
-	const int surroundingPixels = floor(filterWidth / 2);
+	const int blockWidth = blockSize.sharedTileWidth;
+	const int blockHeight = blockSize.sharedTileHeight;
+	if (blockWidth < 1 || blockHeight < 1) {
+		std::cerr << "Invalid CUDA shared tile size " << blockWidth << "x" << blockHeight << std::endl;
+		return false;
+	}
 
-	// Tiles includes block size + block padding
-	const int tileWidth = blockWidth + 2 * surroundingPixels;
-	const int tileHeight = blockHeight + 2 * surroundingPixels;
+	// Tiles includes block size + block padding, of half the mask on each side
+	const int tileWidth = blockWidth + 2 * (filterWidth / 2);
+	const int tileHeight = blockHeight + 2 * (filterHeight / 2);
 
 	// Thread block height will be less than its width.
 	// This way we can use bigger kernel size without
 	// exceeding thread limit
-	const int threadBlockHeight = 8;
+	const int threadBlockHeight = std::min(blockSize.sharedThreadRows, MAX_BLOCK_THREADS / tileWidth);
+	if (!checkBlockSize(tileWidth, threadBlockHeight)) {
+		return false;
+	}
 
 	// Evaluate images and kernel size
-	const int sourceImgSize = sizeof(float) * paddedWidth * paddedHeight;
+	const size_t sourceImgSize = sizeof(float) * width * height * planes;
 	const int maskSize = sizeof(float) * filterWidth * filterHeight;
-	const int outImageSize = sizeof(float) * width * height;
+	const size_t outImageSize = sizeof(float) * width * height * planes;
 
 	dim3 threadsPerBlock(tileWidth, threadBlockHeight);
-	dim3 blocksPerGrid(divUp(width, blockWidth), divUp(height, blockHeight));
-
-	int noSubBlocks = static_cast<int>(ceil(static_cast<float>(tileHeight) /
-										static_cast<float>(divUp(height, blockHeight))));
+	dim3 blocksPerGrid(divUp(width, blockWidth), divUp(height, blockHeight), planes);
 
 	// Evaluates the shared memory size
 	int sharedMemorySize = tileWidth * tileHeight * sizeof(float);
+	if (sharedMemorySize > MAX_SHARED_MEMORY) {
+		std::cerr << "CUDA shared memory tile too big" << std::endl;
+		return false;
+	}
 
-	int copyDuration = 0;
-	auto t3 = std::chrono::high_resolution_clock::now();
-
-	// Allocate device memory for images
-	cudaMalloc(reinterpret_cast<void**>(&d_sourceImagePtr), sourceImgSize);
-	cudaMalloc(reinterpret_cast<void**>(&d_outImagePtr), outImageSize);
-
-	auto t4 = std::chrono::high_resolution_clock::now();
-	copyDuration += std::chrono::duration_cast<std::chrono::microseconds>(t4 - t3).count();
+	{
+		TRACE_SCOPE("cuda allocate");
+		// Device memory for images, reused from the workspace if any
+		d_sourceImagePtr = deviceMemory.get(DeviceBuffer::SOURCE, sourceImgSize);
+		d_outImagePtr = deviceMemory.get(DeviceBuffer::OUTPUT, outImageSize);
+	}
 
 	cudaError_t err = cudaGetLastError();
 	if (err != cudaSuccess) {
@@ -458,14 +836,17 @@ bool runShared(const float* sourceImage,
 		return false;
 	}
 
-	t3 = std::chrono::high_resolution_clock::now();
-
-	// Transfer data from host to device memory
-	cudaMemcpy(d_sourceImagePtr, sourceImage, sourceImgSize, cudaMemcpyHostToDevice);
-	cudaMemcpyToSymbol(d_cFilterKernel, mask, maskSize, 0, cudaMemcpyHostToDevice);
-
-	t4 = std::chrono::high_resolution_clock::now();
-	copyDuration += std::chrono::duration_cast<std::chrono::microseconds>( t4 - t3 ).count();
+	{
+		TRACE_SCOPE("cuda copy to device");
+		TRACE_COUNT(TraceCounter::BYTES_COPIED, sourceImgSize);
+		// Transfer data from host to device memory
+		// Rows of the host view can be strided, the device image is dense
+		for (int plane = 0; plane < planes; plane++) {
+			cudaMemcpy2D(d_sourceImagePtr + static_cast<size_t>(plane) * width * height, sizeof(float) * width,
+						 sourceImages[plane].getData(), sizeof(float) * sourceImages[plane].getStride(),
+						 sizeof(float) * width, height, cudaMemcpyHostToDevice);
+		}
+	}
 
 	err = cudaGetLastError();
 	if (err != cudaSuccess) {
@@ -473,15 +854,45 @@ bool runShared(const float* sourceImage,
 		return false;
 	}
 
-	auto t1 = std::chrono::high_resolution_clock::now();
+	std::unique_lock<std::mutex> constantMemoryLock(s_constantMemoryMutex);
+	{
+		TRACE_SCOPE("cuda copy to constant memory");
+		cudaMemcpyToSymbol(d_cFilterKernel, mask, maskSize, 0, cudaMemcpyHostToDevice);
+	}
+
+	{
+		TRACE_SCOPE("cuda kernel");
+		SharedKernel filterImage = selectKernel(sharedKernels, filterWidth, filterHeight,
+												filterImageShared<0, 0>);
+
+		// Launch kernel specifying the shared memory size
+		filterImage<<<blocksPerGrid, threadsPerBlock, sharedMemorySize>>>(d_sourceImagePtr, d_outImagePtr,
+																					blockWidth, blockHeight,
+																					width, height,
+																					filterWidth, filterHeight,
+																					border);
+
+		err = cudaGetLastError();
+		if (err != cudaSuccess) {
+			std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+			return false;
+		}
 
-	// Launch kernel specifying the shared memory size
-	filterImageShared<<<blocksPerGrid, threadsPerBlock, sharedMemorySize>>>(d_sourceImagePtr, d_outImagePtr,
-																				paddedWidth, paddedHeight,
-																				blockWidth, blockHeight,
-																				surroundingPixels,
-																				width, height,
-																				filterWidth, filterHeight);
+		// Waits for threads to finish work
+		cudaDeviceSynchronize();
+	}
+	constantMemoryLock.unlock();
+
+	{
+		TRACE_SCOPE("cuda copy to host");
+		TRACE_COUNT(TraceCounter::BYTES_COPIED, outImageSize);
+		// Transfer resulting image back
+		for (int plane = 0; plane < planes; plane++) {
+			cudaMemcpy2D(outImages[plane].getData(), sizeof(float) * outImages[plane].getStride(),
+						 d_outImagePtr + static_cast<size_t>(plane) * width * height, sizeof(float) * width,
+						 sizeof(float) * width, height, cudaMemcpyDeviceToHost);
+		}
+	}
 
 	err = cudaGetLastError();
 	if (err != cudaSuccess) {
@@ -489,21 +900,80 @@ bool runShared(const float* sourceImage,
 		return false;
 	}
 
-	// Waits for threads to finish work
-	cudaDeviceSynchronize();
+	return true;
+}
+
+bool runSeparable(const ConstImageView* sourceImages,
+        			const ImageView* outImages,
+        			int planes,
+        			const float* rowFactors,
+        			const float* columnFactors,
+        			int rank,
+        			int filterWidth, int filterHeight,
+        			BorderMode border,
+        			const GpuBlockSize& blockSize,
+        			Workspace* workspace)
+{
+	if (!haveSamePlaneSize(sourceImages, outImages, planes)) {
+		std::cerr << "Output image size mismatch" << std::endl;
+		return false;
+	}
+
+	const int width = sourceImages[0].getWidth();
+	const int height = sourceImages[0].getHeight();
 
-	auto t2 = std::chrono::high_resolution_clock::now();
-	auto filterDuration = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
-	std::cout << "CUDA shared filtering execution time: " << filterDuration << " μs" << std::endl;
+	TRACE_STATUS("Starting CUDA separable convolution, rank " << rank);
+	TRACE_SCOPE("runSeparable");
+	TRACE_COUNT(TraceCounter::PIXELS_PROCESSED, static_cast<long long>(width) * height * planes);
 
-	t3 = std::chrono::high_resolution_clock::now();
+	if (rank < 1 || rank > static_cast<int>(MAX_SEPARABLE_RANK) ||
+			filterWidth > static_cast<int>(MAX_FILTER_SIZE) ||
+			filterHeight > static_cast<int>(MAX_FILTER_SIZE)) {
+		std::cerr << "Unsupported separable kernel size" << std::endl;
+		return false;
+	}
 
-	// Transfer resulting image back
-	cudaMemcpy(outImage, d_outImagePtr, outImageSize, cudaMemcpyDeviceToHost);
+	const int blockWidth = blockSize.blockWidth;
+	const int blockHeight = blockSize.blockHeight;
+	if (!checkBlockSize(blockWidth, blockHeight)) {
+		return false;
+	}
 
-	t4 = std::chrono::high_resolution_clock::now();
-	copyDuration += std::chrono::duration_cast<std::chrono::microseconds>(t4 - t3).count();
-	std::cout << "Copy Execution time: " << copyDuration << " μs" << std::endl;
+	LaunchMemory deviceMemory(workspace);
+	float *d_sourceImagePtr;
+	float *d_rowPassImagePtr;
+	float *d_outImagePtr;
+
+	const size_t sourceImgSize = sizeof(float) * width * height * planes;
+	const size_t rowPassImageSize = sizeof(float) * width * height * planes;
+	const size_t outImageSize = sizeof(float) * width * height * planes;
+
+	{
+		TRACE_SCOPE("cuda allocate");
+		// Device memory for images and the horizontal pass result,
+		// reused from the workspace if any
+		d_sourceImagePtr = deviceMemory.get(DeviceBuffer::SOURCE, sourceImgSize);
+		d_rowPassImagePtr = deviceMemory.get(DeviceBuffer::ROW_PASS, rowPassImageSize);
+		d_outImagePtr = deviceMemory.get(DeviceBuffer::OUTPUT, outImageSize);
+	}
+
+	cudaError_t err = cudaGetLastError();
+	if (err != cudaSuccess) {
+		std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+		return false;
+	}
+
+	{
+		TRACE_SCOPE("cuda copy to device");
+		TRACE_COUNT(TraceCounter::BYTES_COPIED, sourceImgSize);
+		// Transfer data from host to device memory
+		// Rows of the host view can be strided, the device image is dense
+		for (int plane = 0; plane < planes; plane++) {
+			cudaMemcpy2D(d_sourceImagePtr + static_cast<size_t>(plane) * width * height, sizeof(float) * width,
+						 sourceImages[plane].getData(), sizeof(float) * sourceImages[plane].getStride(),
+						 sizeof(float) * width, height, cudaMemcpyHostToDevice);
+		}
+	}
 
 	err = cudaGetLastError();
 	if (err != cudaSuccess) {
@@ -511,9 +981,168 @@ bool runShared(const float* sourceImage,
 		return false;
 	}
 
-	// Cleanup after kernel execution
-	cudaFree(d_sourceImagePtr);
-	cudaFree(d_outImagePtr);
+	dim3 threadsPerBlock(blockWidth, blockHeight);
+	dim3 blocksPerGrid(divUp(width, blockWidth), divUp(height, blockHeight), planes);
+
+	std::unique_lock<std::mutex> constantMemoryLock(s_constantMemoryMutex);
+	{
+		TRACE_SCOPE("cuda copy to constant memory");
+		cudaMemcpyToSymbol(d_cRowFactors, rowFactors, sizeof(float) * rank * filterWidth, 0, cudaMemcpyHostToDevice);
+		cudaMemcpyToSymbol(d_cColumnFactors, columnFactors, sizeof(float) * rank * filterHeight, 0, cudaMemcpyHostToDevice);
+	}
+
+	{
+		TRACE_SCOPE("cuda kernel");
+		RowsKernel filterRows = selectKernel(rowsKernels, filterWidth, 1,
+												filterRowsSeparable<0>);
+		ColumnsKernel filterColumns = selectKernel(columnsKernels, 1, filterHeight,
+													filterColumnsSeparable<0>);
+
+		for (int term = 0; term < rank; term++) {
+			filterRows<<<blocksPerGrid, threadsPerBlock>>>(d_sourceImagePtr, d_rowPassImagePtr,
+							 width, height,
+							 filterWidth, term,
+							 border);
+
+			filterColumns<<<blocksPerGrid, threadsPerBlock>>>(d_rowPassImagePtr, d_outImagePtr,
+							 width, height,
+							 filterHeight, term,
+							 border,
+							 term > 0, term == rank - 1);
+		}
+
+		err = cudaGetLastError();
+		if (err != cudaSuccess) {
+		    std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
+		    return false;
+		}
+
+		// Waits for threads to finish work
+		cudaDeviceSynchronize();
+	}
+	constantMemoryLock.unlock();
+
+	{
+		TRACE_SCOPE("cuda copy to host");
+		TRACE_COUNT(TraceCounter::BYTES_COPIED, outImageSize);
+		// Transfer resulting image back
+		for (int plane = 0; plane < planes; plane++) {
+			cudaMemcpy2D(outImages[plane].getData(), sizeof(float) * outImages[plane].getStride(),
+						 d_outImagePtr + static_cast<size_t>(plane) * width * height, sizeof(float) * width,
+						 sizeof(float) * width, height, cudaMemcpyDeviceToHost);
+		}
+	}
 
 	return true;
 }
+
+/*
+ * @brief: return true if a CUDA device can be used, creating
+ * 	   its context on the first call
+ */
+static bool initGpu()
+{
+	static const bool available = isGpuAvailable() && cudaFree(0) == cudaSuccess;
+	return available;
+}
+
+typedef bool (*GpuLauncher)(const ConstImageView*, const ImageView*, int,
+							const float*, int, int, BorderMode,
+							const GpuBlockSize&, Workspace*);
+
+/*
+ * @brief: return the thread blocks of the planner profile
+ */
+static GpuBlockSize getPlannedBlockSize()
+{
+	const TuningProfile& profile = ConvolutionPlanner::getInstance().getProfile();
+
+	return GpuBlockSize(profile.gpuBlockWidth, profile.gpuBlockHeight,
+						profile.gpuSharedTileWidth, profile.gpuSharedTileHeight,
+						profile.gpuSharedThreadRows);
+}
+
+/*
+ * runGlobal, runConstant or runShared as a backend. The constant and
+ * shared memory kernels are limited by the constant memory: bigger
+ * kernels run on the CPU, in the frequency domain. The global memory
+ * kernel reads the mask from global memory and takes any size.
+ */
+class GpuBackend : public ConvolutionBackend
+{
+	public:
+		GpuBackend(const char* name, GpuLauncher launcher, int maxKernelSize) :
+			m_name(name), m_launcher(launcher), m_maxKernelSize(maxKernelSize) {}
+
+		const char* getName() const override { return m_name; }
+
+		BackendCapabilities getCapabilities() const override
+		{
+			return {true, false, false, false, m_maxKernelSize};
+		}
+
+		bool isAvailable() const override { return initGpu(); }
+
+		bool execute(const ConstImageView* sourceImages,
+					const ImageView* outImages,
+					int planes) override
+		{
+			return m_launcher(sourceImages, outImages, planes,
+							  m_kernel->getKernel().data(),
+							  m_kernel->getKernelWidth(), m_kernel->getKernelHeight(),
+							  m_borderMode,
+							  getPlannedBlockSize(),
+							  m_workspace);
+		}
+
+		using ConvolutionBackend::execute;
+
+	private:
+		const char* m_name;			///< Registered name
+		GpuLauncher m_launcher;		///< Launch function
+		int m_maxKernelSize;		///< Biggest kernel side, 0 if there is no limit
+};
+
+/*
+ * runSeparable as a backend
+ */
+class GpuSeparableBackend : public ConvolutionBackend
+{
+	public:
+		const char* getName() const override { return "cuda_separable"; }
+
+		BackendCapabilities getCapabilities() const override
+		{
+			return {true, false, true, false, static_cast<int>(MAX_FILTER_SIZE)};
+		}
+
+		bool isAvailable() const override { return initGpu(); }
+
+		bool execute(const ConstImageView* sourceImages,
+					const ImageView* outImages,
+					int planes) override
+		{
+			return runSeparable(sourceImages, outImages, planes,
+								m_kernel->getRowFactors().data(), m_kernel->getColumnFactors().data(),
+								m_kernel->getSeparableRank(),
+								m_kernel->getKernelWidth(), m_kernel->getKernelHeight(),
+								m_borderMode,
+								getPlannedBlockSize(),
+								m_workspace);
+		}
+
+		using ConvolutionBackend::execute;
+};
+
+static BackendRegistration s_globalRegistration("cuda_global", []() {
+	return std::unique_ptr<ConvolutionBackend>(new GpuBackend("cuda_global", runGlobal, 0));
+});
+static BackendRegistration s_constantRegistration("cuda_constant", []() {
+	return std::unique_ptr<ConvolutionBackend>(new GpuBackend("cuda_constant", runConstant, static_cast<int>(MAX_FILTER_SIZE)));
+});
+static BackendRegistration s_sharedRegistration("cuda_shared", []() {
+	return std::unique_ptr<ConvolutionBackend>(new GpuBackend("cuda_shared", runShared, static_cast<int>(MAX_FILTER_SIZE)));
+});
+static BackendRegistration s_separableRegistration("cuda_separable", []() {
+	return std::unique_ptr<ConvolutionBackend>(new GpuSeparableBackend());
+});
@@ -1,41 +1,108 @@
 #ifndef GPU_CONVOLUTION_H_
 #define GPU_CONVOLUTION_H_
 
+#include "border_mode.h"
+#include "image_buffer.h"
+#include "workspace.h"
+
+// Biggest kernel side that fits in the constant memory
+const unsigned int MAX_FILTER_SIZE = 25;
+
+/*
+ * Thread blocks of the CUDA launchers. The defaults are used unless
+ * the planner (convolution_planner.h) has a tuned profile.
+ */
+struct GpuBlockSize
+{
+	GpuBlockSize(int blockWidth = 32, int blockHeight = 32,
+				 int sharedTileWidth = 64, int sharedTileHeight = 32,
+				 int sharedThreadRows = 8) :
+		blockWidth(blockWidth), blockHeight(blockHeight),
+		sharedTileWidth(sharedTileWidth), sharedTileHeight(sharedTileHeight),
+		sharedThreadRows(sharedThreadRows) {}
+
+	int blockWidth;			///< Threads per block of runGlobal, runConstant and runSeparable,
+	int blockHeight;		///< one output pixel each
+	int sharedTileWidth;	///< Output pixels per block of runShared
+	int sharedTileHeight;
+	int sharedThreadRows;	///< Thread rows of runShared: a block has the tile width
+							///< plus its halo times this many threads
+};
+
+/*
+ * @brief: return true if a CUDA device can be used. The CPU
+ * 	   backends are the only ones available otherwise.
+ */
+bool isGpuAvailable();
+
 /*
  * @brief: This function will launch a CUDA kernel to calculate image
  *         convolution. The launched kernel will use global memory for
- * 	   source image and kernel matrix
+ * 	   source image and kernel matrix. Each output view must have
+ * 	   the size of the source views.
+ * 	   The planes (the channels of an image) are stacked in device
+ * 	   memory and filtered by the same launch, one grid layer each.
+ * 	   The device memory is kept in the workspace when there is one,
+ * 	   otherwise it is allocated and freed by each call.
  */
-bool runGlobal(const float* sourceImage,
-                float* outImage,
+bool runGlobal(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
                 const float* mask,
-                int width, int height,
-                int paddedWidth, int paddedHeight,
-                int filterWidth, int filterHeight);
+                int filterWidth, int filterHeight,
+                BorderMode border,
+                const GpuBlockSize& blockSize = GpuBlockSize(),
+                Workspace* workspace = nullptr);
 
 /*
  * @brief: This function will launch a CUDA kernel to calculate image
  * 	   convolution. The launched kernel will use global memory for
- * 	   source image and constant memory for kernel matrix
+ * 	   source image and constant memory for kernel matrix.
+ * 	   Kernels bigger than MAX_FILTER_SIZE are not supported.
  */
-bool runConstant(const float* sourceImage,
-                float* outImage,
+bool runConstant(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
                 const float* mask,
-                int width, int height,
-                int paddedWidth, int paddedHeight,
-                int filterWidth, int filterHeight);
+                int filterWidth, int filterHeight,
+                BorderMode border,
+                const GpuBlockSize& blockSize = GpuBlockSize(),
+                Workspace* workspace = nullptr);
 
 /*
  * @brief: This function will launch a CUDA kernel to calculate image
  * 	   convolution. The launched kernel will use shared memory to
- * 	   load tiles of the source image and constant memory for kernel matrix
+ * 	   load tiles of the source image and constant memory for kernel matrix.
+ * 	   The tiles are padded by half the kernel width on the left and
+ * 	   right and by half its height above and below, so the kernel
+ * 	   need not be square.
+ * 	   Kernels bigger than MAX_FILTER_SIZE are not supported.
  */
-bool runShared(const float* sourceImage,
-                float* outImage,
+bool runShared(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
                 const float* mask,
-                int width, int height,
-                int paddedWidth, int paddedHeight,
-                int filterWidth, int filterHeight);
+                int filterWidth, int filterHeight,
+                BorderMode border,
+                const GpuBlockSize& blockSize = GpuBlockSize(),
+                Workspace* workspace = nullptr);
+
+/*
+ * @brief: This function will launch two CUDA kernels per term of a
+ * 	   separable kernel: a horizontal pass over the source image,
+ * 	   followed by a vertical pass accumulated in the output image.
+ * 	   The 1D factors are stored in constant memory.
+ */
+bool runSeparable(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                const float* rowFactors,
+                const float* columnFactors,
+                int rank,
+                int filterWidth, int filterHeight,
+                BorderMode border,
+                const GpuBlockSize& blockSize = GpuBlockSize(),
+                Workspace* workspace = nullptr);
 
 
 #endif /* GPU_CONVOLUTION_H_ */
@@ -1,13 +1,371 @@
 #include <png++/png.hpp>
 #include <math.h>
+#include <cstdio>
+#include <fstream>
+#include <cstring>
+#include <cctype>
 #include "image.h"
-#include "gpu_convolution.h"
+#include "convolution_backend.h"
+#include "recursive_gaussian.h"
+#include "png_writer.h"
+#include "trace.h"
+
+// RAW files start with a RAW_HEADER_SIZE bytes header followed by the
+// rows, stride pixels apart: mapped rows are aligned like ImageBuffer rows
+#define RAW_MAGIC           "KCIM"
+#define RAW_VERSION         1
+#define RAW_HEADER_SIZE     IMAGE_BUFFER_ALIGNMENT
+#define RAW_FORMAT_FLOAT    0
+#define RAW_FORMAT_UINT8    1
+
+#define PGM_EXTENSION       ".pgm"
+#define RAW_EXTENSION       ".raw"
+#define PNG_EXTENSION       ".png"
+
+struct RawImageHeader
+{
+    char magic[4];          ///< RAW_MAGIC, not null terminated
+    uint32_t version;       ///< RAW_VERSION
+    uint32_t width;         ///< Pixels per row
+    uint32_t height;        ///< Number of rows
+    uint32_t stride;        ///< Distance between two rows, in pixels
+    uint32_t pixelFormat;   ///< RAW_FORMAT_FLOAT or RAW_FORMAT_UINT8
+};
+
+/*
+ * @brief: read the next PGM header field, skipping blanks and comments
+ *
+ * @return: the offset after the field, 0 on errors
+ */
+static size_t readPgmField(const uint8_t* data, size_t size, size_t offset, int& value)
+{
+    while (offset < size && (isspace(data[offset]) || data[offset] == '#')) {
+        if (data[offset] == '#') {
+            while (offset < size && data[offset] != '\n') {
+                offset++;
+            }
+        }
+        else {
+            offset++;
+        }
+    }
+
+    if (offset >= size || !isdigit(data[offset])) {
+        return 0;
+    }
+
+    long fieldValue = 0;
+    while (offset < size && isdigit(data[offset]) && fieldValue <= INT32_MAX) {
+        fieldValue = fieldValue * 10 + (data[offset] - '0');
+        offset++;
+    }
+    if (fieldValue > INT32_MAX) {
+        return 0;
+    }
+    value = static_cast<int>(fieldValue);
+
+    return offset;
+}
+
+/*
+ * @brief: return the number of channels of a PNG file: RGB and palette
+ *         files have 3, RGBA files 4, the others are loaded as grayscale
+ */
+static int getPngChannels(const char *filename)
+{
+    std::ifstream stream(filename, std::ios::binary);
+    png::reader<std::istream> reader(stream);
+    reader.read_info();
 
+    switch (reader.get_color_type()) {
+        case png::color_type_rgb:
+        case png::color_type_palette:
+            return 3;
+
+        case png::color_type_rgba:
+            return 4;
+
+        default:
+            return 1;
+    }
+}
+
+static inline uint8_t getPixelChannel(const png::gray_pixel& pixel, int)
+{
+    return pixel;
+}
+
+static inline uint8_t getPixelChannel(const png::rgb_pixel& pixel, int channel)
+{
+    return channel == 0 ? pixel.red : channel == 1 ? pixel.green : pixel.blue;
+}
+
+static inline uint8_t getPixelChannel(const png::rgba_pixel& pixel, int channel)
+{
+    return channel == 0 ? pixel.red : channel == 1 ? pixel.green :
+           channel == 2 ? pixel.blue : pixel.alpha;
+}
+
+/*
+ * @brief: decode a PNG file as Pixel, png++ converting the color
+ *         type, and split its channels in planes
+ */
+template <typename Pixel, typename T>
+static void readPngPlanes(const char *filename, int channels,
+                          std::vector<BasicImageBuffer<T>>& planes)
+{
+    png::image<Pixel> image(filename);
+
+    const int width = image.get_width();
+    const int height = image.get_height();
+
+    planes.clear();
+    planes.resize(channels);
+    for (int c = 0; c < channels; c++) {
+        planes[c].reset(width, height);
+    }
+
+    for (int h = 0; h < height; h++) {
+        for (int c = 0; c < channels; c++) {
+            T* imageRow = planes[c].getRow(h);
+            for (int w = 0; w < width; w++) {
+                imageRow[w] = getPixelChannel(image[h][w], c);
+            }
+        }
+    }
+}
+
+/*
+ * @brief: decode a PNG file in one plane per channel
+ */
+template <typename T>
+static void loadPngPlanes(const char *filename, std::vector<BasicImageBuffer<T>>& planes)
+{
+    switch (getPngChannels(filename)) {
+        case 3:
+            readPngPlanes<png::rgb_pixel>(filename, 3, planes);
+        break;
+
+        case 4:
+            readPngPlanes<png::rgba_pixel>(filename, 4, planes);
+        break;
+
+        default:
+            readPngPlanes<png::gray_pixel>(filename, 1, planes);
+        break;
+    }
+}
+
+/*
+ * @brief: return true if there are 1 to 4 planes of the same size
+ */
+template <typename T>
+static bool isValidPlaneSet(const std::vector<BasicImageBuffer<T>>& planes)
+{
+    if (planes.empty() || planes.size() > 4) {
+        return false;
+    }
+
+    for (const BasicImageBuffer<T>& plane : planes) {
+        if (plane.getWidth() != planes[0].getWidth() || plane.getHeight() != planes[0].getHeight()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * @brief: copy 8-bit pixels in a float view of the same size
+ */
+static void copyToFloat(const ConstImageView8& source, const ImageView& out)
+{
+    for (int y = 0; y < source.getHeight(); y++) {
+        const uint8_t* sourceRow = source.getRow(y);
+        float* outRow = out.getRow(y);
+        for (int x = 0; x < source.getWidth(); x++) {
+            outRow[x] = sourceRow[x];
+        }
+    }
+}
+
+/*
+ * @brief: copy float pixels in an 8-bit view of the same size,
+ *         rounding to the nearest integer and saturating
+ */
+static void copyToUint8(const ConstImageView& source, const ImageView8& out)
+{
+    for (int y = 0; y < source.getHeight(); y++) {
+        const float* sourceRow = source.getRow(y);
+        uint8_t* outRow = out.getRow(y);
+        for (int x = 0; x < source.getWidth(); x++) {
+            float pixel = std::min(std::max(sourceRow[x], 0.0f), 255.0f);
+            outRow[x] = static_cast<uint8_t>(pixel + 0.5f);
+        }
+    }
+}
+
+/*
+ * @brief: return the 8-bit pixel written in the files for a float
+ *         pixel: saturated to [0, 255] and truncated, as png++ does
+ */
+static inline uint8_t toFilePixel(float pixel)
+{
+    return static_cast<uint8_t>(std::min(std::max(pixel, 0.0f), 255.0f));
+}
+
+/*
+ * @brief: copy 8-bit pixels in a float buffer
+ */
+static ImageBuffer convertToFloat(const ConstImageView8& source)
+{
+    ImageBuffer converted(source.getWidth(), source.getHeight());
+    copyToFloat(source, converted.getView());
+
+    return converted;
+}
+
+/*
+ * @brief: copy float pixels in an 8-bit buffer, rounding to
+ *         the nearest integer and saturating
+ */
+static ImageBuffer8 convertToUint8(const ConstImageView& source)
+{
+    ImageBuffer8 converted(source.getWidth(), source.getHeight());
+    copyToUint8(source, converted.getView());
+
+    return converted;
+}
+
+/*
+ * @brief: copy the pixels of a view in another view of the same size
+ */
+template <typename T>
+static void copyPixels(const BasicImageView<const T>& source, const BasicImageView<T>& out)
+{
+    for (int y = 0; y < source.getHeight(); y++) {
+        memcpy(out.getRow(y), source.getRow(y), sizeof(T) * source.getWidth());
+    }
+}
+
+/*
+ * @brief: copy in window the source pixels starting at (startCol,
+ *         startRow), reading the pixels outside the image according
+ *         to the border mode
+ */
+template <typename T>
+static void copyWindow(const BasicImageView<const T>& source, const BasicImageView<T>& window,
+                       int startCol, int startRow, BorderMode border)
+{
+    for (int y = 0; y < window.getHeight(); y++) {
+        T* windowRow = window.getRow(y);
+        int sourceY = getBorderIndex(startRow + y, source.getHeight(), border);
+        if (sourceY < 0) {
+            memset(windowRow, 0, sizeof(T) * window.getWidth());
+            continue;
+        }
+
+        const T* sourceRow = source.getRow(sourceY);
+        for (int x = 0; x < window.getWidth(); x++) {
+            int sourceX = getBorderIndex(startCol + x, source.getWidth(), border);
+            windowRow[x] = sourceX < 0 ? 0 : sourceRow[sourceX];
+        }
+    }
+}
+
+/*
+ * @brief: append the ranges of [start, end) inside [0, size): clipped,
+ *         or wrapped around in WRAP mode
+ */
+static void appendRanges(int start, int end, int size, BorderMode border,
+                         std::vector<std::pair<int, int>>& ranges)
+{
+    if (border != BorderMode::WRAP) {
+        start = std::max(start, 0);
+        end = std::min(end, size);
+        if (start < end) {
+            ranges.push_back(std::make_pair(start, end));
+        }
+        return;
+    }
+
+    if (end - start >= size) {
+        ranges.push_back(std::make_pair(0, size));
+        return;
+    }
+
+    int wrappedStart = getBorderIndex(start, size, border);
+    int wrappedEnd = wrappedStart + end - start;
+    if (wrappedEnd <= size) {
+        ranges.push_back(std::make_pair(wrappedStart, wrappedEnd));
+    }
+    else {
+        ranges.push_back(std::make_pair(wrappedStart, size));
+        ranges.push_back(std::make_pair(0, wrappedEnd - size));
+    }
+}
+
+/*
+ * @brief: return the registered CUDA backend of a memory type:
+ *         separable kernels run as 1D passes
+ */
+static const char* getGpuBackendName(const CudaMemType cudaType, const Kernel& kernel)
+{
+    if (kernel.isSeparable()) {
+        return "cuda_separable";
+    }
+
+    switch (cudaType) {
+        case CudaMemType::GLOBAL:
+            return "cuda_global";
+
+        case CudaMemType::CONSTANT:
+            return "cuda_constant";
+
+        default:
+            return "cuda_shared";
+    }
+}
+
+/*
+ * @brief: filter the planes with a registered backend, whose
+ *         instance and memory are kept by the workspace
+ *
+ * @return: true if successful, false otherwise
+ */
+template <typename T>
+static bool runBackend(const char* name, const Kernel& kernel, BorderMode border,
+                       const BasicImageView<const T>* sourceImages,
+                       const BasicImageView<T>* outImages,
+                       int planes,
+                       Workspace& workspace)
+{
+    ConvolutionBackend* backend = workspace.getBackend(name);
+    if (backend == nullptr) {
+        std::cerr << "Unknown convolution backend " << name << std::endl;
+        return false;
+    }
+
+    if (!backend->prepare(kernel, border)) {
+        return false;
+    }
+
+    bool result = backend->execute(sourceImages, outImages, planes);
+    backend->teardown();
+
+    return result;
+}
 
 Image::Image()
 {
 	m_imageWidth = 0;
 	m_imageHeight = 0;
+	m_borderMode = BorderMode::REPLICATE;
+	m_pixelFormat = PixelFormat::FLOAT;
+	m_pngCompression = PNG_COMPRESSION_DEFAULT;
+	m_imageChannels = 1;
+	m_image.resize(1);
+	m_image8.resize(1);
 }
 
 int Image::getImageWidth() const
@@ -22,344 +380,1073 @@ int Image::getImageHeight() const
 
 int Image::getImageChannels() const
 {
-    return 1;
+    return m_imageChannels;
 }
 
 bool Image::setImage(const std::vector<float>& source, int width, int height)
 {
-    this->m_image = source;
-    this->m_imageWidth = width;
-    this->m_imageHeight = height;
+    if (source.size() != static_cast<size_t>(width) * height) {
+        std::cerr << "Invalid image size" << std::endl;
+        return false;
+    }
 
-    return true;
+    std::vector<ImageBuffer> planes(1);
+    planes[0].reset(width, height);
+    planes[0].copyFrom(ConstImageView(source.data(), width, height));
+
+    return setImage(std::move(planes));
 }
 
-std::vector<float> Image::getImage() const
+bool Image::setImage(ImageBuffer&& source)
 {
-    return this->m_image;
+    std::vector<ImageBuffer> planes(1);
+    planes[0] = std::move(source);
+
+    return setImage(std::move(planes));
 }
 
-bool Image::loadImage(const char *filename)
+bool Image::setImage(ImageBuffer8&& source)
 {
-    // Load image
-    png::image<png::gray_pixel> image(filename);
+    std::vector<ImageBuffer8> planes(1);
+    planes[0] = std::move(source);
 
-    // Build matrix from image
-    m_imageHeight = image.get_height();
-    m_imageWidth = image.get_width();
-    std::vector<float> imageMatrix(m_imageHeight * m_imageWidth);
+    return setImage(std::move(planes));
+}
 
-    for (unsigned int h = 0; h < image.get_height(); h++) {
-        for (unsigned int w = 0; w < image.get_width(); w++) {
-            imageMatrix[w + h * m_imageWidth] = image[h][w];
-        }
+bool Image::setImage(std::vector<ImageBuffer>&& planes)
+{
+    if (!isValidPlaneSet(planes)) {
+        std::cerr << "Invalid image channels" << std::endl;
+        return false;
     }
 
-    m_image = imageMatrix;
+    releaseMapping();
+    this->m_imageWidth = planes[0].getWidth();
+    this->m_imageHeight = planes[0].getHeight();
+    this->m_imageChannels = planes.size();
+    this->m_image = std::move(planes);
+    this->m_image8 = std::vector<ImageBuffer8>(m_imageChannels);
+    this->m_pixelFormat = PixelFormat::FLOAT;
 
     return true;
 }
 
-bool Image::saveImage(const char *filename) const
+bool Image::setImage(std::vector<ImageBuffer8>&& planes)
 {
-    int height = this->getImageHeight();
-    int width = this->getImageWidth();
+    if (!isValidPlaneSet(planes)) {
+        std::cerr << "Invalid image channels" << std::endl;
+        return false;
+    }
 
-   png::image<png::gray_pixel> imageFile(width, height);
+    releaseMapping();
+    this->m_imageWidth = planes[0].getWidth();
+    this->m_imageHeight = planes[0].getHeight();
+    this->m_imageChannels = planes.size();
+    this->m_image8 = std::move(planes);
+    this->m_image = std::vector<ImageBuffer>(m_imageChannels);
+    this->m_pixelFormat = PixelFormat::UINT8;
 
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            imageFile[y][x] = m_image[x + y * width];
-        }
+    return true;
+}
+
+bool Image::swapImage(std::vector<ImageBuffer>& planes)
+{
+    if (!isValidPlaneSet(planes)) {
+        std::cerr << "Invalid image channels" << std::endl;
+        return false;
     }
-    imageFile.write(filename);
 
-    std::cout << "Image saved in " << std::string(filename) << std::endl;
+    releaseMapping();
+    this->m_imageWidth = planes[0].getWidth();
+    this->m_imageHeight = planes[0].getHeight();
+    this->m_imageChannels = planes.size();
+    this->m_image.swap(planes);
+    this->m_image8.resize(m_imageChannels);
+    for (auto& plane : m_image8) {
+        plane = ImageBuffer8();
+    }
+    this->m_pixelFormat = PixelFormat::FLOAT;
 
     return true;
 }
 
-bool Image::applyFilter(Image& resultingImage, const Kernel& kernel) const
+bool Image::swapImage(std::vector<ImageBuffer8>& planes)
 {
-    std::cout << "Applying sequential filter to image" << std::endl;
+    if (!isValidPlaneSet(planes)) {
+        std::cerr << "Invalid image channels" << std::endl;
+        return false;
+    }
 
-    std::vector<float> newImage = applyFilterCommon(kernel);
+    releaseMapping();
+    this->m_imageWidth = planes[0].getWidth();
+    this->m_imageHeight = planes[0].getHeight();
+    this->m_imageChannels = planes.size();
+    this->m_image8.swap(planes);
+    this->m_image.resize(m_imageChannels);
+    for (auto& plane : m_image) {
+        plane = ImageBuffer();
+    }
+    this->m_pixelFormat = PixelFormat::UINT8;
 
-    resultingImage.setImage(newImage, m_imageWidth, m_imageHeight);
-    std::cout << "Done!" << std::endl;
+    return true;
+}
 
-    newImage.clear();
+const ImageBuffer& Image::getImage(int channel) const
+{
+    return this->m_image[channel];
+}
 
-    return true;
+const ImageBuffer8& Image::getImage8(int channel) const
+{
+    return this->m_image8[channel];
+}
+
+ConstImageView Image::getImageView(int channel) const
+{
+    // Mapped files hold a single channel
+    if (m_mappedFile) {
+        return m_mappedImage;
+    }
+
+    return m_image[channel].getView();
 }
 
-bool Image::applyFilter(const Kernel& kernel)
+ConstImageView8 Image::getImageView8(int channel) const
 {
-    std::cout << "Applying sequential filter to image" << std::endl;
+    if (m_mappedFile) {
+        return m_mappedImage8;
+    }
 
-    std::vector<float> newImage = applyFilterCommon(kernel);
-     if (newImage.empty()) {
-        return false;
+    return m_image8[channel].getView();
+}
+
+void Image::releaseMapping()
+{
+    m_mappedFile.reset();
+    m_mappedImage = ConstImageView();
+    m_mappedImage8 = ConstImageView8();
+}
+
+ImageBuffer Image::takeImage()
+{
+    // Mapped pixels are not owned: they are copied out
+    if (m_mappedFile && m_pixelFormat == PixelFormat::FLOAT) {
+        m_image[0].reset(m_imageWidth, m_imageHeight);
+        m_image[0].copyFrom(m_mappedImage);
+    }
+    releaseMapping();
+
+    ImageBuffer image = std::move(m_image[0]);
+
+    m_imageWidth = 0;
+    m_imageHeight = 0;
+    m_imageChannels = 1;
+    m_image = std::vector<ImageBuffer>(1);
+    m_image8 = std::vector<ImageBuffer8>(1);
+
+    return image;
+}
+
+void Image::setBorderMode(const BorderMode border)
+{
+    m_borderMode = border;
+}
+
+BorderMode Image::getBorderMode() const
+{
+    return m_borderMode;
+}
+
+void Image::setPixelFormat(const PixelFormat format)
+{
+    if (format == m_pixelFormat) {
+        return;
+    }
+
+    for (int c = 0; c < m_imageChannels; c++) {
+        if (format == PixelFormat::UINT8) {
+            m_image8[c] = convertToUint8(getImageView(c));
+            m_image[c] = ImageBuffer();
+        }
+        else {
+            m_image[c] = convertToFloat(getImageView8(c));
+            m_image8[c] = ImageBuffer8();
+        }
     }
+    releaseMapping();
+    m_pixelFormat = format;
+}
 
-    this->setImage(newImage, m_imageWidth, m_imageHeight);
+PixelFormat Image::getPixelFormat() const
+{
+    return m_pixelFormat;
+}
 
-    std::cout << "Done!" << std::endl;
+void Image::setPngCompression(int compressionLevel)
+{
+    m_pngCompression = compressionLevel;
+}
 
-    newImage.clear();
+int Image::getPngCompression() const
+{
+    return m_pngCompression;
+}
+
+bool Image::loadImage(const char *filename)
+{
+    TRACE_SCOPE("Image::loadImage");
+
+    releaseMapping();
+
+    ImageFileFormat fileFormat = getFileFormat(filename);
+    if (fileFormat != ImageFileFormat::PNG) {
+        return mapImage(filename, fileFormat);
+    }
+
+    // Load image, one plane per channel in the current pixel format
+    if (m_pixelFormat == PixelFormat::UINT8) {
+        loadPngPlanes(filename, m_image8);
+        m_imageChannels = m_image8.size();
+        m_image = std::vector<ImageBuffer>(m_imageChannels);
+    }
+    else {
+        loadPngPlanes(filename, m_image);
+        m_imageChannels = m_image.size();
+        m_image8 = std::vector<ImageBuffer8>(m_imageChannels);
+    }
+
+    m_imageWidth = m_pixelFormat == PixelFormat::UINT8 ? m_image8[0].getWidth() : m_image[0].getWidth();
+    m_imageHeight = m_pixelFormat == PixelFormat::UINT8 ? m_image8[0].getHeight() : m_image[0].getHeight();
 
     return true;
 }
 
-std::vector<float> Image::applyFilterCommon(const Kernel& kernel) const
+bool Image::saveImage(const char *filename) const
 {
-    // Get image dimensions
-    int channels = this->getImageChannels();
+    TRACE_SCOPE("Image::saveImage");
+
     int height = this->getImageHeight();
     int width = this->getImageWidth();
 
-    // Get filter dimensions
-    int filterHeight = kernel.getKernelHeight();
-    int filterWidth = kernel.getKernelWidth();
+    ImageFileFormat fileFormat = getFileFormat(filename);
+    if (fileFormat != ImageFileFormat::PNG) {
+        if (m_imageChannels != 1) {
+            std::cerr << "Only grayscale images can be saved as PGM or RAW files" << std::endl;
+            return false;
+        }
 
-    // Checking image channels and kernel size
-    if (channels != 1) {
-        std::cerr << "Invalid number of image's channels" << std::endl;
-          return std::vector<float>();
+        return writeMappedImage(filename, fileFormat);
     }
 
-     if (filterHeight == 0 || filterWidth == 0) {
-        std::cerr << "Invalid filter dimension" << std::endl;
-        return std::vector<float>();
-    }
-
-    // Input padding w.r.t. filter size
-    auto t1 = std::chrono::high_resolution_clock::now();
-    std::vector<float> paddedImage = buildReplicatePaddedImage(floor(filterHeight/2), floor(filterWidth/2));
-    auto t2 = std::chrono::high_resolution_clock::now();
-    auto paddingDuration = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
-    std::cout << "Padding Execution time: " << paddingDuration << " μs" << std::endl;
-
-    std::vector<float> newImage(height * width);
-
-    // Get kernel matrix
-    std::vector<float> mask = kernel.getKernel();
-
-    // Get pointers to matrixes
-    const float* maskPtr = {mask.data()};
-    const float* paddedImagePtr = {paddedImage.data()};
-
-    int paddedWidth = width + floor(filterWidth / 2) * 2;
-    int s = floor(filterWidth/2);
-    float pixelSum = 0;
-
-    int filterRowIndex = 0;
-    int sourceImgRowIndex = 0;
-    int outImgRowIndex = 0;
-
-    t1 = std::chrono::high_resolution_clock::now();
-    // Apply convolution
-    for (int i = s; i < height + s; i++) {
-    	outImgRowIndex = (i - s) * width;
-        for (int j = s; j < width + s; j++) {
-        	for (int h = -s;  h <= s; h++) {
-        		filterRowIndex = (h + s) * filterWidth;
-                sourceImgRowIndex = (h + i) * paddedWidth;
-                for (int w = -s; w <= s; w++) {
-                	pixelSum += maskPtr[(w + s) + filterRowIndex] *
-                                paddedImagePtr[w + j + sourceImgRowIndex];
-                }
-        	}
-            if (pixelSum < 0) {
-            	pixelSum = 0;
-            }
-            else if (pixelSum > 255) {
-            	pixelSum = 255;
+    // Filtered values are saturated and truncated (toFilePixel)
+    std::vector<ImageBuffer8> converted(m_imageChannels);
+    std::vector<ConstImageView8> planes(m_imageChannels);
+    for (int c = 0; c < m_imageChannels; c++) {
+        planes[c] = getImageView8(c);
+        if (m_pixelFormat == PixelFormat::UINT8) {
+            continue;
+        }
+
+        converted[c].reset(width, height);
+        for (int y = 0; y < height; y++) {
+            const float* imageRow = getImageView(c).getRow(y);
+            uint8_t* convertedRow = converted[c].getRow(y);
+            for (int x = 0; x < width; x++) {
+                convertedRow[x] = toFilePixel(imageRow[x]);
             }
-            newImage[(j - s) + outImgRowIndex] = pixelSum;
-            pixelSum = 0;
         }
+        planes[c] = converted[c].getView();
     }
-    t2 = std::chrono::high_resolution_clock::now();
-    // Evaluating execution times
-    auto filterDuration = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
-    std::cout << "Sequential filtering execution time: " << filterDuration << " μs" << std::endl;
 
-    paddedImage.clear();
-    mask.clear();
+    return writePng(filename, planes.data(), m_imageChannels, m_pngCompression, true);
+}
+
+ImageFileFormat Image::getFileFormat(const char *filename)
+{
+    std::string name = filename;
+    std::string extension = name.substr(std::min(name.find_last_of('.'), name.size()));
+    for (char& c : extension) {
+        c = tolower(c);
+    }
 
-    return newImage;
+    if (extension == PGM_EXTENSION) {
+        return ImageFileFormat::PGM;
+    }
+    if (extension == RAW_EXTENSION) {
+        return ImageFileFormat::RAW;
+    }
+
+    return ImageFileFormat::PNG;
 }
 
-bool Image::multithreadFiltering(Image& resultingImage, const Kernel& kernel, const CudaMemType cudaType)
+const char* Image::getFileExtension(const ImageFileFormat format)
 {
-    std::cout << "Applying multithread filter to image" << std::endl;
+    switch (format) {
+        case ImageFileFormat::PGM:
+            return PGM_EXTENSION;
 
-    // Get image dimensions
-    int channels = this->getImageChannels();
-    int height = this->getImageHeight();
-    int width = this->getImageWidth();
+        case ImageFileFormat::RAW:
+            return RAW_EXTENSION;
 
-    // Get filter dimensions
-    int filterHeight = kernel.getKernelHeight();
-    int filterWidth = kernel.getKernelWidth();
+        default:
+            return PNG_EXTENSION;
+    }
+}
 
-    if (channels != 1) {
-    	std::cerr << "Unsupported channel size" << std::endl;
-    	return false;
+bool Image::mapImage(const char *filename, const ImageFileFormat format)
+{
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+    if (!file->openRead(filename)) {
+        return false;
     }
 
-    // Input padding w.r.t. filter size
-    auto t1 = std::chrono::high_resolution_clock::now();
-    std::vector<float> paddedImage = buildReplicatePaddedImage(floor(filterHeight/2), floor(filterWidth/2));
-    auto t2 = std::chrono::high_resolution_clock::now();
-    auto paddingDuration = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
-    std::cout << "Padding Execution time: " << paddingDuration << " μs" << std::endl;
+    const uint8_t* data = file->getData();
+    const size_t size = file->getSize();
+
+    int width = 0;
+    int height = 0;
+    int stride = 0;
+    size_t offset = 0;
+    PixelFormat filePixelFormat = PixelFormat::UINT8;
+
+    if (format == ImageFileFormat::PGM) {
+        int maxValue = 0;
+        offset = size >= 2 && data[0] == 'P' && data[1] == '5' ? 2 : 0;
+        if (offset != 0) {
+            offset = readPgmField(data, size, offset, width);
+        }
+        if (offset != 0) {
+            offset = readPgmField(data, size, offset, height);
+        }
+        if (offset != 0) {
+            offset = readPgmField(data, size, offset, maxValue);
+        }
+        // A single blank separates the header from the pixels
+        if (offset == 0 || offset >= size || !isspace(data[offset])) {
+            std::cerr << "Invalid PGM header in " << filename << std::endl;
+            return false;
+        }
+        offset++;
+
+        if (maxValue == 0 || maxValue > 255) {
+            std::cerr << "Only 8-bit PGM images are supported" << std::endl;
+            return false;
+        }
+        stride = width;
+    }
+    else {
+        RawImageHeader header;
+        if (size < RAW_HEADER_SIZE) {
+            std::cerr << "Invalid RAW header in " << filename << std::endl;
+            return false;
+        }
+        memcpy(&header, data, sizeof(header));
+
+        if (memcmp(header.magic, RAW_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != RAW_VERSION ||
+            header.width > INT32_MAX || header.height > INT32_MAX ||
+            header.stride < header.width || header.stride > INT32_MAX ||
+            (header.pixelFormat != RAW_FORMAT_FLOAT && header.pixelFormat != RAW_FORMAT_UINT8)) {
+            std::cerr << "Invalid RAW header in " << filename << std::endl;
+            return false;
+        }
 
-    std::vector<float> newImage(height * width);
+        width = header.width;
+        height = header.height;
+        stride = header.stride;
+        offset = RAW_HEADER_SIZE;
+        filePixelFormat = header.pixelFormat == RAW_FORMAT_FLOAT ? PixelFormat::FLOAT : PixelFormat::UINT8;
+    }
 
-    // Get kernel matrix
-    std::vector<float> mask = kernel.getKernel();
+    const size_t pixelSize = filePixelFormat == PixelFormat::FLOAT ? sizeof(float) : sizeof(uint8_t);
+    if (width <= 0 || height <= 0 ||
+        (size - offset) / pixelSize / stride < static_cast<size_t>(height)) {
+        std::cerr << "Image size does not match the file size of " << filename << std::endl;
+        return false;
+    }
 
-    // Get pointers to matrixes
-    const float* maskPtr = {mask.data()};
-    const float* paddedImagePtr = {paddedImage.data()};
-    float* newImagePtr = {newImage.data()};
+    m_imageWidth = width;
+    m_imageHeight = height;
+    m_imageChannels = 1;
+    m_image = std::vector<ImageBuffer>(1);
+    m_image8 = std::vector<ImageBuffer8>(1);
+
+    // Float pixels are mapped as floats: RAW offsets and strides keep them aligned
+    ConstImageView fileImage;
+    ConstImageView8 fileImage8;
+    if (filePixelFormat == PixelFormat::FLOAT) {
+        fileImage = ConstImageView(reinterpret_cast<const float*>(data + offset), width, height, stride);
+    }
+    else {
+        fileImage8 = ConstImageView8(data + offset, width, height, stride);
+    }
 
-    bool result = false;
-    switch (cudaType) {
-    	case CudaMemType::GLOBAL:
-    		 result = runGlobal(paddedImagePtr, newImagePtr, maskPtr,
-    		                    width, height,
-    		                    width + floor(filterWidth / 2) * 2, height + floor(filterHeight / 2) * 2,
-    		                    filterWidth, filterHeight);
-    	break;
-
-    	case CudaMemType::CONSTANT:
-    		result = runConstant(paddedImagePtr, newImagePtr, maskPtr,
-    		    		            width, height,
-    		    		            width + floor(filterWidth / 2) * 2, height + floor(filterHeight / 2) * 2,
-    		    		            filterWidth, filterHeight);
-    	break;
-
-    	case CudaMemType::SHARED:
-    		result = runShared(paddedImagePtr, newImagePtr, maskPtr,
-                                width, height,
-                                width + floor(filterWidth / 2) * 2, height + floor(filterHeight / 2) * 2,
-                                filterWidth, filterHeight);
-    	break;
-
-    	default:
-    		result = runShared(paddedImagePtr, newImagePtr, maskPtr,
-                                width, height,
-                                width + floor(filterWidth / 2) * 2, height + floor(filterHeight / 2) * 2,
-                                filterWidth, filterHeight);
-    	break;
+    if (filePixelFormat == m_pixelFormat) {
+        m_mappedFile = file;
+        m_mappedImage = fileImage;
+        m_mappedImage8 = fileImage8;
+    }
+    else if (m_pixelFormat == PixelFormat::FLOAT) {
+        m_image[0] = convertToFloat(fileImage8);
+    }
+    else {
+        m_image8[0] = convertToUint8(fileImage);
     }
 
-     if (!result) {
-    	std::cerr << "Error while executing CUDA filtering" << std::endl;
-    	paddedImage.clear();
-    	newImage.clear();
-    	mask.clear();
+    return true;
+}
 
-    	return false;
+bool Image::writeMappedImage(const char *filename, const ImageFileFormat format) const
+{
+    const int width = this->getImageWidth();
+    const int height = this->getImageHeight();
+
+    size_t offset = 0;
+    int stride = width;
+    size_t pixelSize = sizeof(uint8_t);
+    char pgmHeader[64];
+
+    if (format == ImageFileFormat::PGM) {
+        offset = snprintf(pgmHeader, sizeof(pgmHeader), "P5\n%d %d\n255\n", width, height);
+    }
+    else {
+        offset = RAW_HEADER_SIZE;
+        if (m_pixelFormat == PixelFormat::FLOAT) {
+            stride = ImageBuffer::getAlignedStride(width);
+            pixelSize = sizeof(float);
+        }
+        else {
+            stride = ImageBuffer8::getAlignedStride(width);
+        }
     }
 
-    resultingImage.setImage(newImage, m_imageWidth, m_imageHeight);
+    MappedFile file;
+    if (!file.create(filename, offset + pixelSize * stride * height)) {
+        return false;
+    }
+    uint8_t* data = file.getData();
 
-    std::cout << "Done!" << std::endl;
+    if (format == ImageFileFormat::PGM) {
+        memcpy(data, pgmHeader, offset);
+    }
+    else {
+        RawImageHeader header;
+        memset(data, 0, RAW_HEADER_SIZE);
+        memcpy(header.magic, RAW_MAGIC, sizeof(header.magic));
+        header.version = RAW_VERSION;
+        header.width = width;
+        header.height = height;
+        header.stride = stride;
+        header.pixelFormat = m_pixelFormat == PixelFormat::FLOAT ? RAW_FORMAT_FLOAT : RAW_FORMAT_UINT8;
+        memcpy(data, &header, sizeof(header));
+    }
 
-    paddedImage.clear();
-    newImage.clear();
-    mask.clear();
+    // RAW files keep the pixel format, PGM files are 8-bit
+    // and converted as the PNG files are
+    for (int y = 0; y < height; y++) {
+        uint8_t* fileRow = data + offset + pixelSize * stride * y;
+
+        if (m_pixelFormat == PixelFormat::UINT8) {
+            memcpy(fileRow, getImageView8().getRow(y), width);
+        }
+        else if (format == ImageFileFormat::RAW) {
+            memcpy(fileRow, getImageView().getRow(y), sizeof(float) * width);
+        }
+        else {
+            const float* imageRow = getImageView().getRow(y);
+            for (int x = 0; x < width; x++) {
+                fileRow[x] = toFilePixel(imageRow[x]);
+            }
+        }
+    }
 
     return true;
 }
 
-std::vector<float> Image::buildReplicatePaddedImage(const int paddingHeight,
-                                                    const int paddingWidth) const
+bool Image::applyFilter(Image& resultingImage, const Kernel& kernel,
+                        const FilterAlgorithm algorithm,
+                        Workspace* workspace) const
 {
-    int height = this->getImageHeight();
-    int width = this->getImageWidth();
+    TRACE_STATUS("Applying sequential filter to image");
 
-    int paddedHeight = height + paddingHeight * 2;
-    int paddedWidth = width + paddingWidth * 2;
-    int maxHImageBoundary = height - 1;
-    int maxWImageBoundary = width - 1;
-    int paddedImageRowIndex = 0;
+    Workspace localWorkspace;
+    if (workspace == nullptr) {
+        workspace = &localWorkspace;
+    }
+
+    if (useIntegerFiltering(kernel, algorithm, false)) {
+        if (!applyFilterInteger(kernel, false, *workspace)) {
+            return false;
+        }
 
-    std::vector<float> paddedImage(paddedHeight * paddedWidth);
-    std::vector<float> sourceImage = this->m_image;
+        resultingImage.swapImage(workspace->getOutputPlanes8(m_imageChannels, m_imageWidth, m_imageHeight));
+        TRACE_STATUS("Done!");
 
-    for (int h = 0; h < paddedHeight; h++) {
-    	paddedImageRowIndex = h * paddedWidth;
-    	for (int w = 0; w < paddedWidth; w++) {
-            if ((h < paddingHeight) && (w < paddingWidth)) {
-            	paddedImage[w + paddedImageRowIndex] = sourceImage[0];
-            }
-            else if ((h > maxHImageBoundary) && (w > maxWImageBoundary)) {
-               paddedImage[w + paddedImageRowIndex] = sourceImage[(width - 1) + (height - 1) * width];
+        return true;
+    }
+
+    if (!applyFilterCommon(getFloatViews(*workspace), kernel, algorithm, *workspace)) {
+        return false;
+    }
+
+    setResult(resultingImage, *workspace);
+    TRACE_STATUS("Done!");
+
+    return true;
+}
+
+bool Image::applyFilter(const Kernel& kernel, const FilterAlgorithm algorithm,
+                        Workspace* workspace)
+{
+    // The result planes are exchanged with the image planes
+    return applyFilter(*this, kernel, algorithm, workspace);
+}
+
+bool Image::applyFilter(Image& resultingImage, const FilterPipeline& pipeline,
+                        bool multithread) const
+{
+    TRACE_STATUS("Applying filter pipeline to image (" << pipeline.getKernelCount() << " kernels)");
+    TRACE_SCOPE("Image::applyFilter pipeline");
+
+    if (m_pixelFormat == PixelFormat::UINT8) {
+        // Each step reads the result of the previous one, which is
+        // moved from step to step: the pixels are never copied
+        const Image* stepImage = this;
+        Image stepResult;
+        for (int step = 0; step < pipeline.getKernelCount(); step++) {
+            Image nextImage;
+            bool result = false;
+            if (multithread) {
+                result = stepImage->multithreadFiltering(nextImage, pipeline.getKernel(step),
+                                                         CudaMemType::CPU_MULTITHREAD);
             }
-            else if ((h < paddingHeight) && (w > maxWImageBoundary)) {
-               paddedImage[w + paddedImageRowIndex] = sourceImage[(width - 1) + (0) * width];
+            else {
+                result = stepImage->applyFilter(nextImage, pipeline.getKernel(step), FilterAlgorithm::DIRECT);
             }
-            else if ((w < paddingWidth) && (h > maxHImageBoundary)) {
-               paddedImage[w + paddedImageRowIndex] = sourceImage[(0) + (height - 1) * width];
+            if (!result) {
+                return false;
             }
-            else if (h < paddingHeight) {
-               paddedImage[w + paddedImageRowIndex] = sourceImage[(w) + (0) * width];
+            nextImage.setBorderMode(m_borderMode);
+            stepResult = std::move(nextImage);
+            stepImage = &stepResult;
+        }
+
+        if (stepImage == this) {
+            resultingImage = *this;
+        }
+        else {
+            resultingImage = std::move(stepResult);
+        }
+        TRACE_STATUS("Done!");
+
+        return true;
+    }
+
+    // Each channel runs the whole chain, tiles in parallel
+    std::vector<ImageBuffer> newImage(m_imageChannels);
+    for (int c = 0; c < m_imageChannels; c++) {
+        newImage[c].reset(this->getImageWidth(), this->getImageHeight());
+        if (!pipeline.run(getImageView(c), newImage[c].getView(), m_borderMode, multithread)) {
+            return false;
+        }
+    }
+
+    resultingImage.setImage(std::move(newImage));
+    TRACE_STATUS("Done!");
+
+    return true;
+}
+
+bool Image::applyRecursiveGaussian(Image& resultingImage, float stdDev,
+                                   bool multithread, Workspace* workspace) const
+{
+    TRACE_STATUS("Applying recursive Gaussian filter to image");
+
+    return applyPlaneFilter(resultingImage,
+                            [&](const ConstImageView* sources, const ImageView* outs, Workspace&) {
+                                return runRecursiveGaussian(sources, outs, m_imageChannels, stdDev,
+                                                            m_borderMode, multithread);
+                            }, workspace);
+}
+
+bool Image::applyBoxFilter(Image& resultingImage, int boxWidth, int boxHeight,
+                           BoxStatistic statistic, bool multithread, Workspace* workspace) const
+{
+    TRACE_STATUS("Applying " << boxWidth << "x" << boxHeight << " box "
+                 << (statistic == BoxStatistic::VARIANCE ? "variance" : "mean") << " filter to image");
+
+    return applyPlaneFilter(resultingImage,
+                            [&](const ConstImageView* sources, const ImageView* outs, Workspace& scratch) {
+                                return runBoxFilter(sources, outs, m_imageChannels, boxWidth, boxHeight,
+                                                    statistic, m_borderMode, multithread, &scratch);
+                            }, workspace);
+}
+
+bool Image::applyBoxGaussian(Image& resultingImage, float stdDev, int passes,
+                             bool multithread, Workspace* workspace) const
+{
+    TRACE_STATUS("Applying box Gaussian filter to image");
+
+    return applyPlaneFilter(resultingImage,
+                            [&](const ConstImageView* sources, const ImageView* outs, Workspace& scratch) {
+                                return runBoxGaussian(sources, outs, m_imageChannels, stdDev, passes,
+                                                      m_borderMode, multithread, &scratch);
+                            }, workspace);
+}
+
+bool Image::applyMedianFilter(Image& resultingImage, int windowSize,
+                              bool multithread, Workspace* workspace) const
+{
+    TRACE_STATUS("Applying " << windowSize << "x" << windowSize << " median filter to image");
+
+    return applyPlaneFilter(resultingImage,
+                            [&](const ConstImageView* sources, const ImageView* outs, Workspace&) {
+                                return runMedianFilter(sources, outs, m_imageChannels, windowSize,
+                                                       m_borderMode, multithread);
+                            }, workspace);
+}
+
+bool Image::applyMorphologyFilter(Image& resultingImage, int windowWidth, int windowHeight,
+                                  MorphologyOperation operation, bool multithread,
+                                  Workspace* workspace) const
+{
+    TRACE_STATUS("Applying " << windowWidth << "x" << windowHeight << " "
+                 << (operation == MorphologyOperation::ERODE ? "erosion" : "dilation") << " to image");
+
+    return applyPlaneFilter(resultingImage,
+                            [&](const ConstImageView* sources, const ImageView* outs, Workspace& scratch) {
+                                return runMorphologyFilter(sources, outs, m_imageChannels, windowWidth, windowHeight,
+                                                           operation, m_borderMode, multithread, &scratch);
+                            }, workspace);
+}
+
+bool Image::applyFilterIncremental(Image& resultingImage, const Kernel& kernel,
+                                   const std::vector<ImageRect>& dirtyRects,
+                                   const FilterAlgorithm algorithm,
+                                   Workspace* workspace) const
+{
+    TRACE_SCOPE("Image::applyFilterIncremental");
+
+    if (resultingImage.m_imageWidth != m_imageWidth || resultingImage.m_imageHeight != m_imageHeight ||
+        resultingImage.m_imageChannels != m_imageChannels || resultingImage.m_pixelFormat != m_pixelFormat) {
+        std::cerr << "The previous result does not match the image" << std::endl;
+        return false;
+    }
+
+    // The patches are written in the owned planes of the result
+    if (resultingImage.m_mappedFile) {
+        std::cerr << "The previous result must be held in memory" << std::endl;
+        return false;
+    }
+
+    int filterWidth = kernel.getKernelWidth();
+    int filterHeight = kernel.getKernelHeight();
+    if (filterWidth == 0 || filterHeight == 0) {
+        std::cerr << "Invalid filter dimension" << std::endl;
+        return false;
+    }
+
+    Workspace localWorkspace;
+    if (workspace == nullptr) {
+        workspace = &localWorkspace;
+    }
+
+    // The regions run the method applyFilter uses on the whole
+    // image, not the one planned for their own size
+    bool integer = useIntegerFiltering(kernel, algorithm, false);
+    FilterAlgorithm regionAlgorithm = algorithm;
+    if (integer) {
+        regionAlgorithm = FilterAlgorithm::DIRECT;
+    }
+    else if (algorithm == FilterAlgorithm::AUTO) {
+        switch (selectConvolutionMethod(kernel, algorithm, false)) {
+            case ConvolutionMethod::SPARSE:
+                regionAlgorithm = FilterAlgorithm::SPARSE;
+            break;
+
+            case ConvolutionMethod::FFT:
+                regionAlgorithm = FilterAlgorithm::FFT;
+            break;
+
+            default:
+                regionAlgorithm = FilterAlgorithm::DIRECT;
+            break;
+        }
+    }
+
+    // Output pixel x reads the columns [x - left, x + right]
+    int left = filterWidth / 2;
+    int right = filterWidth - 1 - left;
+    int top = filterHeight / 2;
+    int bottom = filterHeight - 1 - top;
+
+    for (const ImageRect& rect : dirtyRects) {
+        int startCol = std::max(rect.x, 0);
+        int endCol = std::min(rect.x + rect.width, m_imageWidth);
+        int startRow = std::max(rect.y, 0);
+        int endRow = std::min(rect.y + rect.height, m_imageHeight);
+        if (startCol >= endCol || startRow >= endRow) {
+            continue;
+        }
+
+        std::vector<std::pair<int, int>> columns;
+        std::vector<std::pair<int, int>> rows;
+        appendRanges(startCol - right, endCol + left, m_imageWidth, m_borderMode, columns);
+        appendRanges(startRow - bottom, endRow + top, m_imageHeight, m_borderMode, rows);
+
+        for (const auto& rowRange : rows) {
+            for (const auto& columnRange : columns) {
+                ImageRect region = {columnRange.first, rowRange.first,
+                                    columnRange.second - columnRange.first,
+                                    rowRange.second - rowRange.first};
+                if (!filterRegion(region, resultingImage, kernel, regionAlgorithm, integer, *workspace)) {
+                    return false;
+                }
             }
-            else if (w < paddingWidth) {
-               paddedImage[w + paddedImageRowIndex] = sourceImage[(0) + (h) * width];
+        }
+    }
+
+    return true;
+}
+
+std::vector<ImageRect> Image::getChangedRects(const Image& previous, int tileSize) const
+{
+    std::vector<ImageRect> rects;
+
+    if (previous.m_imageWidth != m_imageWidth || previous.m_imageHeight != m_imageHeight ||
+        previous.m_imageChannels != m_imageChannels || previous.m_pixelFormat != m_pixelFormat) {
+        rects.push_back(ImageRect{0, 0, m_imageWidth, m_imageHeight});
+        return rects;
+    }
+
+    tileSize = std::max(tileSize, 1);
+    size_t pixelSize = m_pixelFormat == PixelFormat::UINT8 ? sizeof(uint8_t) : sizeof(float);
+
+    for (int tileY = 0; tileY < m_imageHeight; tileY += tileSize) {
+        int tileHeight = std::min(tileSize, m_imageHeight - tileY);
+
+        for (int tileX = 0; tileX < m_imageWidth; tileX += tileSize) {
+            int tileWidth = std::min(tileSize, m_imageWidth - tileX);
+
+            bool changed = false;
+            for (int c = 0; c < m_imageChannels && !changed; c++) {
+                for (int y = tileY; y < tileY + tileHeight && !changed; y++) {
+                    const void* row = m_pixelFormat == PixelFormat::UINT8 ?
+                                      static_cast<const void*>(getImageView8(c).getRow(y) + tileX) :
+                                      static_cast<const void*>(getImageView(c).getRow(y) + tileX);
+                    const void* previousRow = m_pixelFormat == PixelFormat::UINT8 ?
+                                      static_cast<const void*>(previous.getImageView8(c).getRow(y) + tileX) :
+                                      static_cast<const void*>(previous.getImageView(c).getRow(y) + tileX);
+                    changed = memcmp(row, previousRow, pixelSize * tileWidth) != 0;
+                }
             }
-            else if (h > maxHImageBoundary) {
-               paddedImage[w + paddedImageRowIndex] = sourceImage[(w) + (height - 1) * width];
+            if (!changed) {
+                continue;
             }
-            else if (w > maxWImageBoundary) {
-               paddedImage[w + paddedImageRowIndex] = sourceImage[(width - 1) + (h) * width];
+
+            // Joined to the changed tile on its left
+            if (!rects.empty() && rects.back().y == tileY && rects.back().x + rects.back().width == tileX) {
+                rects.back().width += tileWidth;
             }
             else {
-               paddedImage[w + paddedImageRowIndex] = sourceImage[(w - paddingWidth) + (h - paddingHeight) * width];
+                rects.push_back(ImageRect{tileX, tileY, tileWidth, tileHeight});
             }
         }
     }
 
-    sourceImage.clear();
+    return rects;
+}
+
+bool Image::filterRegion(const ImageRect& region, Image& resultingImage,
+                         const Kernel& kernel, const FilterAlgorithm algorithm,
+                         bool integer, Workspace& workspace) const
+{
+    int left = kernel.getKernelWidth() / 2;
+    int top = kernel.getKernelHeight() / 2;
+    int windowWidth = region.width + kernel.getKernelWidth() - 1;
+    int windowHeight = region.height + kernel.getKernelHeight() - 1;
+
+    // The window holds every pixel read by the region, borders
+    // included: its own borders do not reach the region
+    Image window;
+    window.setBorderMode(m_borderMode);
+    if (m_pixelFormat == PixelFormat::UINT8) {
+        std::vector<ImageBuffer8> planes(m_imageChannels);
+        for (int c = 0; c < m_imageChannels; c++) {
+            planes[c].reset(windowWidth, windowHeight);
+            copyWindow(getImageView8(c), planes[c].getView(), region.x - left, region.y - top, m_borderMode);
+        }
+        window.setImage(std::move(planes));
+    }
+    else {
+        std::vector<ImageBuffer> planes(m_imageChannels);
+        for (int c = 0; c < m_imageChannels; c++) {
+            planes[c].reset(windowWidth, windowHeight);
+            copyWindow(getImageView(c), planes[c].getView(), region.x - left, region.y - top, m_borderMode);
+        }
+        window.setImage(std::move(planes));
+    }
+
+    if (integer) {
+        if (!window.applyFilterInteger(kernel, false, workspace)) {
+            return false;
+        }
+
+        std::vector<ImageBuffer8>& result = workspace.getOutputPlanes8(m_imageChannels, windowWidth, windowHeight);
+        for (int c = 0; c < m_imageChannels; c++) {
+            copyPixels(ConstImageView8(result[c].getView().getRoi(left, top, region.width, region.height)),
+                       resultingImage.m_image8[c].getView().getRoi(region.x, region.y, region.width, region.height));
+        }
+
+        return true;
+    }
+
+    if (!window.applyFilterCommon(window.getFloatViews(workspace), kernel, algorithm, workspace)) {
+        return false;
+    }
+
+    std::vector<ImageBuffer>& result = workspace.getOutputPlanes(m_imageChannels, windowWidth, windowHeight);
+    for (int c = 0; c < m_imageChannels; c++) {
+        ConstImageView patch = result[c].getView().getRoi(left, top, region.width, region.height);
+        if (m_pixelFormat == PixelFormat::UINT8) {
+            copyToUint8(patch, resultingImage.m_image8[c].getView().getRoi(region.x, region.y,
+                                                                           region.width, region.height));
+        }
+        else {
+            copyPixels(patch, resultingImage.m_image[c].getView().getRoi(region.x, region.y,
+                                                                         region.width, region.height));
+        }
+    }
+
+    return true;
+}
+
+ConvolutionMethod Image::selectConvolutionMethod(const Kernel& kernel,
+                                                 const FilterAlgorithm algorithm,
+                                                 bool multithread) const
+{
+    switch (algorithm) {
+        case FilterAlgorithm::DIRECT:
+            return kernel.isSeparable() ? ConvolutionMethod::SEPARABLE : ConvolutionMethod::DIRECT;
+
+        case FilterAlgorithm::SPARSE:
+            return ConvolutionMethod::SPARSE;
+
+        case FilterAlgorithm::FFT:
+            return ConvolutionMethod::FFT;
+
+        default:
+            return ConvolutionPlanner::getInstance().getPlan(kernel,
+                                                             m_imageWidth, m_imageHeight, m_imageChannels,
+                                                             multithread).method;
+    }
+}
+
+bool Image::useIntegerFiltering(const Kernel& kernel,
+                                const FilterAlgorithm algorithm,
+                                bool multithread) const
+{
+    if (m_pixelFormat != PixelFormat::UINT8 || !kernel.isFixedPoint()) {
+        return false;
+    }
+
+    // The FFT and the sparse loop have no integer form; the integer
+    // 2D loop stands for the spatial methods planned on float pixels
+    if (algorithm == FilterAlgorithm::AUTO) {
+        return selectConvolutionMethod(kernel, algorithm, multithread) != ConvolutionMethod::FFT;
+    }
+
+    return algorithm == FilterAlgorithm::DIRECT;
+}
+
+bool Image::applyPlaneFilter(Image& resultingImage,
+                             const std::function<bool(const ConstImageView*, const ImageView*, Workspace&)>& filter,
+                             Workspace* workspace) const
+{
+    Workspace localWorkspace;
+    if (workspace == nullptr) {
+        workspace = &localWorkspace;
+    }
+
+    std::vector<ConstImageView> imageViews = getFloatViews(*workspace);
+    std::vector<ImageBuffer>& newImage = workspace->getOutputPlanes(m_imageChannels, m_imageWidth, m_imageHeight);
+    std::vector<ImageView> newImageViews(m_imageChannels);
+    for (int c = 0; c < m_imageChannels; c++) {
+        newImageViews[c] = newImage[c].getView();
+    }
+
+    if (!filter(imageViews.data(), newImageViews.data(), *workspace)) {
+        return false;
+    }
+
+    setResult(resultingImage, *workspace);
+    TRACE_STATUS("Done!");
+
+    return true;
+}
+
+std::vector<ConstImageView> Image::getFloatViews(Workspace& workspace) const
+{
+    std::vector<ConstImageView> views(m_imageChannels);
+
+    for (int c = 0; c < m_imageChannels; c++) {
+        if (m_pixelFormat == PixelFormat::FLOAT) {
+            views[c] = getImageView(c);
+        }
+        else {
+            ImageView converted = workspace.getPlane(WorkspaceBuffer::FLOAT_SOURCE, c,
+                                                     m_imageWidth, m_imageHeight);
+            copyToFloat(getImageView8(c), converted);
+            views[c] = converted;
+        }
+    }
+
+    return views;
+}
+
+void Image::setResult(Image& image, Workspace& workspace) const
+{
+    std::vector<ImageBuffer>& result = workspace.getOutputPlanes(m_imageChannels, m_imageWidth, m_imageHeight);
 
-    return paddedImage;
+    if (m_pixelFormat == PixelFormat::UINT8) {
+        std::vector<ImageBuffer8>& planes = workspace.getOutputPlanes8(m_imageChannels, m_imageWidth, m_imageHeight);
+        for (int c = 0; c < m_imageChannels; c++) {
+            copyToUint8(result[c].getView(), planes[c].getView());
+        }
+        image.swapImage(planes);
+    }
+    else {
+        image.swapImage(result);
+    }
 }
 
-std::vector<float> Image::buildZeroPaddingImage(const int paddingHeight,
-                                                const int paddingWidth) const
+bool Image::applyFilterInteger(const Kernel& kernel, bool multithread, Workspace& workspace) const
 {
+    std::vector<ImageBuffer8>& newImage = workspace.getOutputPlanes8(m_imageChannels, m_imageWidth, m_imageHeight);
+    std::vector<ConstImageView8> imageViews(m_imageChannels);
+    std::vector<ImageView8> newImageViews(m_imageChannels);
+    for (int c = 0; c < m_imageChannels; c++) {
+        imageViews[c] = getImageView8(c);
+        newImageViews[c] = newImage[c].getView();
+    }
+
+    return runBackend(multithread ? "cpu_integer" : "sequential_integer", kernel, m_borderMode,
+                      imageViews.data(), newImageViews.data(), m_imageChannels,
+                      workspace);
+}
+
+bool Image::applyFilterCommon(const std::vector<ConstImageView>& imagePlanes,
+                              const Kernel& kernel,
+                              const FilterAlgorithm algorithm,
+                              Workspace& workspace) const
+{
+    // Get image dimensions
+    int channels = imagePlanes.size();
     int height = this->getImageHeight();
     int width = this->getImageWidth();
 
-    int paddedHeight = height + paddingHeight * 2;
-    int paddedWidth = width + paddingWidth * 2;
-    int maxHImageBoundary = height + paddingHeight - 1;
-    int maxWImageBoundary = width + paddingWidth - 1;
-    int paddedImageRowIndex = 0;
-
-    std::vector<float> paddedImage(paddedHeight * paddedWidth);
-    std::vector<float> sourceImage = this->m_image;
-
-    for (int h = 0; h < paddedHeight; h++) {
-        paddedImageRowIndex = h * paddedWidth;
-        for (int w = 0; w < paddedWidth; w++) {
-            if ((h < paddingHeight) || (w < paddingWidth) ||
-                (h > maxHImageBoundary) ||
-                (w > maxWImageBoundary)) {
-                paddedImage[w + paddedImageRowIndex] = 0.0;
-            }
-            else {
-                paddedImage[w + paddedImageRowIndex] = sourceImage[(w - paddingWidth) + (h - paddingHeight) * width];
-            }
+    // Get filter dimensions
+    int filterHeight = kernel.getKernelHeight();
+    int filterWidth = kernel.getKernelWidth();
+
+     if (filterHeight == 0 || filterWidth == 0) {
+        std::cerr << "Invalid filter dimension" << std::endl;
+        return false;
+    }
+
+    // Get views on matrixes: the pixels outside the image
+    // are read by the convolution according to the border mode
+    std::vector<ImageBuffer>& newImage = workspace.getOutputPlanes(channels, width, height);
+    std::vector<ImageView> newImageViews(channels);
+    for (int c = 0; c < channels; c++) {
+        newImageViews[c] = newImage[c].getView();
+    }
+
+    const ConvolutionMethod method = selectConvolutionMethod(kernel, algorithm, false);
+
+    TRACE_SCOPE("Image::applyFilterCommon");
+
+    return runBackend(getBackendName(method, false),
+                      kernel, m_borderMode,
+                      imagePlanes.data(), newImageViews.data(), channels,
+                      workspace);
+}
+
+bool Image::multithreadFiltering(Image& resultingImage, const Kernel& kernel, const CudaMemType cudaType,
+                                 Workspace* workspace) const
+{
+    TRACE_STATUS("Applying multithread filter to image");
+    TRACE_SCOPE("Image::multithreadFiltering");
+
+    Workspace localWorkspace;
+    if (workspace == nullptr) {
+        workspace = &localWorkspace;
+    }
+
+    // Get image dimensions
+    int channels = this->getImageChannels();
+    int height = this->getImageHeight();
+    int width = this->getImageWidth();
+
+    // The constant memory limits the kernel size of the constant and
+    // shared memory backends: bigger kernels run on the CPU, where the
+    // frequency domain has no limit.
+    // CPU-only builds have no CUDA backend.
+    const char* backendName = "cpu";
+    bool runOnCpu = cudaType == CudaMemType::CPU_MULTITHREAD;
+    if (!runOnCpu) {
+        backendName = getGpuBackendName(cudaType, kernel);
+        ConvolutionBackend* backend = workspace->getBackend(backendName);
+        if (backend == nullptr || !backend->isAvailable()) {
+            TRACE_STATUS("No CUDA device available, running on the CPU");
+            runOnCpu = true;
+        }
+        else if (!backend->supports(kernel)) {
+            TRACE_STATUS("Kernel too big for the GPU, running on the CPU");
+            runOnCpu = true;
         }
     }
 
-    sourceImage.clear();
+    // The GPU kernels work on float pixels
+    if (runOnCpu && useIntegerFiltering(kernel, FilterAlgorithm::AUTO, true)) {
+        if (!applyFilterInteger(kernel, true, *workspace)) {
+            std::cerr << "Error while executing multithread filtering" << std::endl;
+            return false;
+        }
+
+        resultingImage.swapImage(workspace->getOutputPlanes8(channels, width, height));
+        TRACE_STATUS("Done!");
 
-    return paddedImage;
+        return true;
+    }
+
+    // Get views on matrixes: the pixels outside the image
+    // are read by the convolution according to the border mode.
+    // The channels are filtered by the same launch.
+    std::vector<ConstImageView> imageViews = getFloatViews(*workspace);
+    std::vector<ImageBuffer>& newImage = workspace->getOutputPlanes(channels, width, height);
+    std::vector<ImageView> newImageViews(channels);
+    for (int c = 0; c < channels; c++) {
+        newImageViews[c] = newImage[c].getView();
+    }
+
+    if (runOnCpu) {
+        backendName = getBackendName(selectConvolutionMethod(kernel, FilterAlgorithm::AUTO, true), true);
+    }
+
+    bool result = runBackend(backendName, kernel, m_borderMode,
+                             imageViews.data(), newImageViews.data(), channels,
+                             *workspace);
+
+     if (!result) {
+    	std::cerr << "Error while executing multithread filtering" << std::endl;
+
+    	return false;
+    }
+
+    setResult(resultingImage, *workspace);
+
+    TRACE_STATUS("Done!");
+
+    return true;
 }
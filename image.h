@@ -3,13 +3,56 @@
 
 #include <vector>
 #include <thread>
+#include <memory>
+#include <functional>
 #include "kernel.h"
+#include "filter_pipeline.h"
+#include "border_mode.h"
+#include "image_buffer.h"
+#include "mapped_file.h"
+#include "convolution_planner.h"
+#include "workspace.h"
+#include "box_filter.h"
+#include "rank_filter.h"
 
 enum class CudaMemType
 {
 	GLOBAL,
 	CONSTANT,
-	SHARED
+	SHARED,
+	CPU_MULTITHREAD     ///< Not a CUDA kernel: tiles executed by the CPU thread pool
+};
+
+enum class FilterAlgorithm
+{
+	AUTO,       ///< Cheapest method for the kernel and image sizes (see ConvolutionPlanner)
+	DIRECT,     ///< Spatial convolution, two 1D passes for separable kernels
+	SPARSE,     ///< Spatial convolution over the non-zero taps of the mask
+	FFT         ///< Frequency domain convolution, no kernel size limit
+};
+
+enum class PixelFormat
+{
+	FLOAT,      ///< One float per pixel, any kernel and algorithm
+	UINT8       ///< One byte per pixel, integer arithmetic for fixed-point kernels
+};
+
+enum class ImageFileFormat
+{
+	PNG,        ///< Decoded with png++, encoded by writePng
+	PGM,        ///< Binary 8-bit graymap (P5), memory mapped
+	RAW         ///< Image container of this application, memory mapped
+};
+
+/*
+ * Rectangle of pixels, in image coordinates
+ */
+struct ImageRect
+{
+	int x;
+	int y;
+	int width;
+	int height;
 };
 
 class Image
@@ -20,10 +63,16 @@ class Image
         /*
          *  @brief: Dtor
          */
-        ~Image() {
-            m_image.clear();
-            std::vector<float>().swap(m_image);
-        }
+        ~Image() {}
+
+        Image(const Image&) = default;
+        Image& operator=(const Image&) = default;
+
+        /*
+         * @brief: move the planes of another image, without copying the pixels
+         */
+        Image(Image&&) = default;
+        Image& operator=(Image&&) = default;
 
         /*
          * @brief: get loaded image width
@@ -36,7 +85,9 @@ class Image
         int getImageHeight() const;
 
         /*
-         * @brief: get number of channels of the image
+         * @brief: get number of channels of the image: 1 for grayscale,
+         *         3 for RGB and 4 for RGBA images. Each channel is stored
+         *         in its own plane and filtered independently.
          */
         int getImageChannels() const;
 
@@ -49,14 +100,132 @@ class Image
         bool setImage(const std::vector<float>& source, int width, int height);
 
         /*
-         * @brief: return the matrix state
+         * @brief: set the image taking ownership of a buffer, without copies
+         *
+         * @params: source: the buffer to be set as state
+         * @return: true is successfull, false otherwise
+         */
+        bool setImage(ImageBuffer&& source);
+
+        /*
+         * @brief: set the image taking ownership of an 8-bit buffer,
+         *         switching the pixel format to UINT8
+         *
+         * @params: source: the buffer to be set as state
+         * @return: true is successfull, false otherwise
+         */
+        bool setImage(ImageBuffer8&& source);
+
+        /*
+         * @brief: set a multi-channel image taking ownership of one buffer
+         *         per channel. Planes must have the same size.
+         *
+         * @params: planes: the channel buffers to be set as state
+         * @return: true is successfull, false otherwise
+         */
+        bool setImage(std::vector<ImageBuffer>&& planes);
+
+        /*
+         * @brief: set a multi-channel image taking ownership of one 8-bit
+         *         buffer per channel, switching the pixel format to UINT8
+         *
+         * @params: planes: the channel buffers to be set as state
+         * @return: true is successfull, false otherwise
+         */
+        bool setImage(std::vector<ImageBuffer8>&& planes);
+
+        /*
+         * @brief: exchange the channel buffers of the image with planes,
+         *         without copies or allocations: planes receives the
+         *         previous buffers of the image (see Workspace)
+         *
+         * @params: planes: the channel buffers to be set as state
+         * @return: true is successfull, false otherwise
+         */
+        bool swapImage(std::vector<ImageBuffer>& planes);
+
+        /*
+         * @brief: same as swapImage, switching the pixel format to UINT8
+         */
+        bool swapImage(std::vector<ImageBuffer8>& planes);
+
+        /*
+         * @brief: return the matrix state of a channel, empty in UINT8
+         *         format and for memory mapped images
+         *
+         * @return: the matrix state
+         */
+        const ImageBuffer& getImage(int channel = 0) const;
+
+        /*
+         * @brief: return the 8-bit matrix state of a channel, empty in
+         *         FLOAT format and for memory mapped images
+         *
+         * @return: the matrix state
+         */
+        const ImageBuffer8& getImage8(int channel = 0) const;
+
+        /*
+         * @brief: return a view on the pixels of a channel, owned or
+         *         memory mapped. Empty in UINT8 format.
+         */
+        ConstImageView getImageView(int channel = 0) const;
+
+        /*
+         * @brief: return a view on the 8-bit pixels of a channel, owned
+         *         or memory mapped. Empty in FLOAT format.
+         */
+        ConstImageView8 getImageView8(int channel = 0) const;
+
+        /*
+         * @brief: move the matrix state of the first channel out of
+         *         the image, leaving it empty
          *
          * @return: the matrix state
          */
-        std::vector<float> getImage() const;
+        ImageBuffer takeImage();
+
+        /*
+         * @brief: set how the convolution reads the pixels outside the image
+         */
+        void setBorderMode(const BorderMode border);
+
+        /*
+         * @brief: get the border mode used by the convolution
+         */
+        BorderMode getBorderMode() const;
+
+        /*
+         * @brief: set how the pixels are stored, converting the loaded
+         *         image. Float values are rounded to the nearest integer
+         *         and saturated to [0, 255].
+         */
+        void setPixelFormat(const PixelFormat format);
+
+        /*
+         * @brief: get how the pixels are stored
+         */
+        PixelFormat getPixelFormat() const;
+
+        /*
+         * @brief: set the zlib level of the PNG files written by saveImage,
+         *         PNG_COMPRESSION_FAST for intermediate outputs
+         */
+        void setPngCompression(int compressionLevel);
+
+        /*
+         * @brief: get the zlib level of the saved PNG files
+         */
+        int getPngCompression() const;
 
         /*
-         * @brief: load an image from filename path
+         * @brief: load an image from filename path. RGB and RGBA PNG
+         *         files keep their channels, palette files are expanded
+         *         to RGB, other files are loaded as grayscale. The format is
+         *         chosen from the extension (see getFileFormat). PGM and
+         *         RAW files are memory mapped: when their pixels match the
+         *         pixel format, the mapping is used as the image, without
+         *         copies, until the image is changed.
          *
          * @params: filename: the path of the image to be loaded
          * @return: true is successfull, false otherwise
@@ -64,22 +233,46 @@ class Image
         bool loadImage(const char *filename);
 
         /*
-         * @brief: save an image in filename path
+         * @brief: save an image in filename path. PGM and RAW files are
+         *         allocated with their final size and written through
+         *         a memory mapping, they hold grayscale images only.
+         *         PNG files are compressed in parallel row chunks, with
+         *         the channels interleaved back (see writePng).
          *
          * @params: filename: the path where to save the image
          * @return: true is successfull, false otherwise
          */
         bool saveImage(const char *filename) const;
 
+        /*
+         * @brief: return the file format matching the extension of
+         *         filename: .pgm, .raw, PNG otherwise
+         */
+        static ImageFileFormat getFileFormat(const char *filename);
+
+        /*
+         * @brief: return the extension of a file format, dot included
+         */
+        static const char* getFileExtension(const ImageFileFormat format);
+
         /*o
          * @brief: apply a kernel to the image and pass
-         *         result in resultingImage object
+         *         result in resultingImage object.
+         *         UINT8 images filtered by a fixed-point kernel (see
+         *         Kernel::isFixedPoint) are convolved with integer
+         *         arithmetic, other cases go through a float copy.
          *
          * @params[out]: resultingImage: the image object where the matrix will be saved
          * @params[in]: kernel: kernel to be applied to the image
+         * @params[in]: algorithm: convolution algorithm, planned by cost if AUTO
+         * @params[in]: workspace: memory reused across the calls, the result
+         *              planes are exchanged with those of resultingImage.
+         *              Allocated by the call if nullptr.
          * @return: true if successful, false otherwise
          */
-        bool applyFilter(Image& resultingImage, const Kernel& kernel) const;
+        bool applyFilter(Image& resultingImage, const Kernel& kernel,
+                         const FilterAlgorithm algorithm = FilterAlgorithm::AUTO,
+                         Workspace* workspace = nullptr) const;
 
         /*
          * @brief: apply a kernel to the image and save it's state.
@@ -87,44 +280,264 @@ class Image
          *          on the same image more than 1 times.
          *
          * @params[in]: kernel: kernel to be applied to the image
+         * @params[in]: algorithm: convolution algorithm, planned by cost if AUTO
+         * @params[in]: workspace: memory reused across the calls
+         * @return: true if successful, false otherwise
+         */
+        bool applyFilter(const Kernel& kernel,
+                         const FilterAlgorithm algorithm = FilterAlgorithm::AUTO,
+                         Workspace* workspace = nullptr);
+
+        /*
+         * @brief: apply a chain of kernels to the image, tile by tile
+         *         (see FilterPipeline), and pass result in resultingImage
+         *         object. The result is the same as applying the kernels
+         *         one by one with FilterAlgorithm::DIRECT. UINT8 images
+         *         run the kernels one by one, rounding every step to 8 bits.
+         *
+         * @params[out]: resultingImage: the image object where the matrix will be saved
+         * @params[in]: pipeline: kernels to be applied to the image
+         * @params[in]: multithread: run the tiles on the CPU thread pool
+         * @return: true if successful, false otherwise
+         */
+        bool applyFilter(Image& resultingImage, const FilterPipeline& pipeline,
+                         bool multithread = false) const;
+
+        /*
+         * @brief: blur the image with a Gaussian of standard deviation
+         *         stdDev and pass result in resultingImage object. The
+         *         recursive approximation (see recursive_gaussian.h) costs
+         *         the same for any stdDev and needs no kernel matrix,
+         *         so it is not limited to the CUDA kernel sizes.
+         *
+         * @params[out]: resultingImage: the image object where the matrix will be saved
+         * @params[in]: stdDev: standard deviation, at least 0.5
+         * @params[in]: multithread: run the row and column passes on the CPU thread pool
+         * @params[in]: workspace: memory reused across the calls (see applyFilter)
          * @return: true if successful, false otherwise
          */
-        bool applyFilter(const Kernel& kernel);
+        bool applyRecursiveGaussian(Image& resultingImage, float stdDev,
+                                    bool multithread = false,
+                                    Workspace* workspace = nullptr) const;
+
+        /*
+         * @brief: compute the mean or the variance of the
+         *         boxWidth x boxHeight window of each pixel and pass
+         *         result in resultingImage object. The running sums of
+         *         the integral image (see box_filter.h) give each window
+         *         in a few operations, so the cost does not depend on its
+         *         size. 8-bit results are rounded, and variances saturated to 255.
+         *
+         * @params[out]: resultingImage: the image object where the matrix will be saved
+         * @params[in]: boxWidth, boxHeight: odd window sizes
+         * @params[in]: statistic: value computed on each window
+         * @params[in]: multithread: run the row and column passes on the CPU thread pool
+         * @params[in]: workspace: memory reused across the calls (see applyFilter)
+         * @return: true if successful, false otherwise
+         */
+        bool applyBoxFilter(Image& resultingImage, int boxWidth, int boxHeight,
+                            BoxStatistic statistic = BoxStatistic::MEAN,
+                            bool multithread = false,
+                            Workspace* workspace = nullptr) const;
+
+        /*
+         * @brief: approximate a Gaussian blur of standard deviation
+         *         stdDev by passes box means (see runBoxGaussian) and
+         *         pass result in resultingImage object
+         *
+         * @params[out]: resultingImage: the image object where the matrix will be saved
+         * @params[in]: stdDev: standard deviation, at least 1
+         * @params[in]: passes: box means applied in sequence
+         * @params[in]: multithread: run the passes on the CPU thread pool
+         * @params[in]: workspace: memory reused across the calls (see applyFilter)
+         * @return: true if successful, false otherwise
+         */
+        bool applyBoxGaussian(Image& resultingImage, float stdDev, int passes = 3,
+                              bool multithread = false,
+                              Workspace* workspace = nullptr) const;
+
+        /*
+         * @brief: replace each pixel by the median of its
+         *         windowSize x windowSize window and pass result in
+         *         resultingImage object. The sliding histogram (see
+         *         rank_filter.h) works on the 8-bit levels of the pixels.
+         *
+         * @params[out]: resultingImage: the image object where the matrix will be saved
+         * @params[in]: windowSize: odd window size
+         * @params[in]: multithread: run the blocks of rows on the CPU thread pool
+         * @params[in]: workspace: memory reused across the calls (see applyFilter)
+         * @return: true if successful, false otherwise
+         */
+        bool applyMedianFilter(Image& resultingImage, int windowSize,
+                               bool multithread = false,
+                               Workspace* workspace = nullptr) const;
+
+        /*
+         * @brief: erode (minimum) or dilate (maximum) the image over
+         *         the windowWidth x windowHeight window of each pixel and
+         *         pass result in resultingImage object. The van Herk /
+         *         Gil-Werman passes (see rank_filter.h) cost the same for
+         *         any window size.
+         *
+         * @params[out]: resultingImage: the image object where the matrix will be saved
+         * @params[in]: windowWidth, windowHeight: odd window sizes
+         * @params[in]: operation: erosion or dilation
+         * @params[in]: multithread: run the row and column passes on the CPU thread pool
+         * @params[in]: workspace: memory reused across the calls (see applyFilter)
+         * @return: true if successful, false otherwise
+         */
+        bool applyMorphologyFilter(Image& resultingImage, int windowWidth, int windowHeight,
+                                   MorphologyOperation operation,
+                                   bool multithread = false,
+                                   Workspace* workspace = nullptr) const;
 
         /*
          * @brief: apply a CUDA multithread convolution to the image 
-         *          and pass result in resultingImage object
+         *          and pass result in resultingImage object.
+         *          CudaMemType::CPU_MULTITHREAD runs the convolution
+         *          on the CPU cores instead. The convolution runs on a
+         *          registered backend (convolution_backend.h): without a
+         *          CUDA device, or for kernels too big for the CUDA
+         *          constant memory, the CPU one is used. On the CPU the
+         *          method, tiles and threads are chosen by the
+         *          ConvolutionPlanner.
+         *          UINT8 images run the integer convolution on the CPU
+         *          for fixed-point kernels, as applyFilter does.
          *
          * @params[out]: resultingImage: the image object where the matrix will be saved
          * @params[in]: kernel: kernel to be applied to the image
          * @params[in]: cudaType: specify the type of CUDA kernel to be used
+         * @params[in]: workspace: memory reused across the calls, CUDA
+         *              device memory included (see applyFilter)
+         * @return: true if successful, false otherwise
+         */
+        bool multithreadFiltering(Image& resultingImage, const Kernel& kernel, const CudaMemType cudaType,
+                                  Workspace* workspace = nullptr) const;
+
+        /*
+         * @brief: update resultingImage, the result of applyFilter with
+         *          kernel on a previous version of this image, after the
+         *          pixels of dirtyRects changed. Only the output pixels
+         *          reading a changed pixel (the rectangles grown by the
+         *          kernel halo, wrapped around the image in WRAP mode) are
+         *          computed again, so the cost follows the area of the
+         *          rectangles instead of the image size. AUTO is planned
+         *          for the whole image: the patched pixels are the ones
+         *          applyFilter computes, up to float rounding for the FFT.
+         *
+         * @params[in,out]: resultingImage: the previous result, with the size,
+         *                  channels and pixel format of this image
+         * @params[in]: dirtyRects: changed pixels, clipped to the image
+         * @params[in]: algorithm: convolution algorithm, as for applyFilter
+         * @params[in]: workspace: memory reused across the calls
          * @return: true if successful, false otherwise
          */
-        bool multithreadFiltering(Image& resultingImage, const Kernel& kernel, const CudaMemType cudaType);
+        bool applyFilterIncremental(Image& resultingImage, const Kernel& kernel,
+                                    const std::vector<ImageRect>& dirtyRects,
+                                    const FilterAlgorithm algorithm = FilterAlgorithm::AUTO,
+                                    Workspace* workspace = nullptr) const;
+
+        /*
+         * @brief: return the tiles of tileSize x tileSize pixels that
+         *          differ from previous, the changed tiles of a row being
+         *          merged. The whole image if previous has another size,
+         *          channel count or pixel format.
+         */
+        std::vector<ImageRect> getChangedRects(const Image& previous, int tileSize = 64) const;
 
     private:
         /*
-         * @brief: A common method to apply the kernel to the image
+         * @brief: A common method to apply the kernel to the image,
+         *         in the output planes of the workspace
+         */
+        bool applyFilterCommon(const std::vector<ConstImageView>& imagePlanes,
+                               const Kernel& kernel,
+                               const FilterAlgorithm algorithm,
+                               Workspace& workspace) const;
+
+        /*
+         * @brief: A common method to run a filter without kernel on float
+         *         views of the channels, in the output planes of the
+         *         workspace, and store the result in resultingImage
+         *
+         * @param: filter: called with the source and output views of
+         *         the channels, and the workspace for its scratch memory
+         */
+        bool applyPlaneFilter(Image& resultingImage,
+                              const std::function<bool(const ConstImageView*, const ImageView*, Workspace&)>& filter,
+                              Workspace* workspace) const;
+
+        /*
+         * @brief: A common method to apply a fixed-point kernel to
+         *         the 8-bit image, in the 8-bit output planes of the workspace
+         */
+        bool applyFilterInteger(const Kernel& kernel, bool multithread, Workspace& workspace) const;
+
+        /*
+         * @brief: compute again the output pixels of region in resultingImage,
+         *         filtering a copy of the pixels they read
+         *
+         * @param: integer: use the integer convolution (see useIntegerFiltering)
+         */
+        bool filterRegion(const ImageRect& region, Image& resultingImage,
+                          const Kernel& kernel, const FilterAlgorithm algorithm,
+                          bool integer, Workspace& workspace) const;
+
+        /*
+         * @brief: return true if the 8-bit image can be filtered by the
+         *         kernel with integer arithmetic
+         */
+        bool useIntegerFiltering(const Kernel& kernel,
+                                 const FilterAlgorithm algorithm,
+                                 bool multithread) const;
+
+        /*
+         * @brief: return a float view on each channel, converting the
+         *         8-bit pixels in scratch planes of the workspace if needed
+         */
+        std::vector<ConstImageView> getFloatViews(Workspace& workspace) const;
+
+        /*
+         * @brief: store the float output planes of the workspace in image,
+         *         with this image's pixel format
+         */
+        void setResult(Image& image, Workspace& workspace) const;
+
+        /*
+         * @brief: map a PGM or RAW file and use it as the image
+         */
+        bool mapImage(const char *filename, const ImageFileFormat format);
+
+        /*
+         * @brief: write the image in a mapped PGM or RAW file
          */
-        std::vector<float> applyFilterCommon(const Kernel& kernel) const;
+        bool writeMappedImage(const char *filename, const ImageFileFormat format) const;
 
         /*
-         * @brief: return a border-replicated padded matrix using matrix state
-         *          and requested padding
+         * @brief: drop the memory mapped image, if any
          */
-        std::vector<float> buildReplicatePaddedImage(const int paddingHeight,
-                                                    const int paddingWidth) const;
+        void releaseMapping();
 
         /*
-         * @brief: return a zero padded matrix using matrix state
-         *          and requested padding
+         * @brief: return the method running an algorithm: the planned
+         *         one for AUTO, the separable passes for DIRECT when the
+         *         kernel allows them
          */
-        std::vector<float> buildZeroPaddingImage(const int paddingHeight,
-                                                const int paddingWidth) const;
+        ConvolutionMethod selectConvolutionMethod(const Kernel& kernel,
+                                                  const FilterAlgorithm algorithm,
+                                                  bool multithread) const;
 
-        std::vector<float> m_image;	    ///< Linearized matrix containing the image pixels' values
+        std::vector<ImageBuffer> m_image;       ///< One matrix per channel containing the pixels' values
+        std::vector<ImageBuffer8> m_image8;     ///< One matrix per channel in UINT8 format
+        PixelFormat m_pixelFormat;      ///< Which of the two matrix sets holds the image
+        int m_imageChannels;            ///< Number of channel planes
+        std::shared_ptr<MappedFile> m_mappedFile;   ///< Mapped source file, shared by copies
+        ConstImageView m_mappedImage;   ///< Pixels of m_mappedFile in FLOAT format
+        ConstImageView8 m_mappedImage8; ///< Pixels of m_mappedFile in UINT8 format
         int m_imageWidth;               ///< Matrix width
         int m_imageHeight;              ///< Matrix height
+        BorderMode m_borderMode;        ///< Pixels read outside the image by the convolution
+        int m_pngCompression;           ///< zlib level of the saved PNG files
 };
 
 #endif /* IMAGE_H_ */
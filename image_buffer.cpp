@@ -0,0 +1,57 @@
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include "image_buffer.h"
+#include "trace.h"
+
+static std::atomic<size_t> s_memoryUsage(0);
+static std::atomic<size_t> s_memoryPeak(0);
+static std::atomic<long long> s_allocationCount(0);
+
+
+void* allocateImageMemory(size_t bytes)
+{
+    void* memory = nullptr;
+    if (posix_memalign(&memory, IMAGE_BUFFER_ALIGNMENT, bytes) != 0) {
+        throw std::bad_alloc();
+    }
+
+    s_allocationCount.fetch_add(1, std::memory_order_relaxed);
+    TRACE_COUNT(TraceCounter::ALLOCATIONS, 1);
+    TRACE_COUNT(TraceCounter::ALLOCATED_BYTES, bytes);
+
+    size_t usage = s_memoryUsage.fetch_add(bytes) + bytes;
+
+    // Raise the peak unless another thread raised it further
+    size_t peak = s_memoryPeak.load();
+    while (usage > peak && !s_memoryPeak.compare_exchange_weak(peak, usage)) {
+    }
+
+    return memory;
+}
+
+void freeImageMemory(void* memory, size_t bytes)
+{
+    free(memory);
+    s_memoryUsage.fetch_sub(bytes);
+}
+
+size_t getImageMemoryUsage()
+{
+    return s_memoryUsage.load();
+}
+
+size_t getImageMemoryPeak()
+{
+    return s_memoryPeak.load();
+}
+
+void resetImageMemoryPeak()
+{
+    s_memoryPeak.store(s_memoryUsage.load());
+}
+
+long long getImageAllocationCount()
+{
+    return s_allocationCount.load();
+}
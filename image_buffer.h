@@ -0,0 +1,308 @@
+#ifndef IMAGE_BUFFER_H_
+#define IMAGE_BUFFER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include "trace.h"
+
+// Rows start on a cache line, which is also the widest vector load
+#define IMAGE_BUFFER_ALIGNMENT      64
+
+
+/*
+ * @brief: allocate bytes aligned to IMAGE_BUFFER_ALIGNMENT,
+ *         accounted in the image memory counters.
+ *         Throws std::bad_alloc like the standard containers.
+ */
+void* allocateImageMemory(size_t bytes);
+
+/*
+ * @brief: release memory returned by allocateImageMemory
+ */
+void freeImageMemory(void* memory, size_t bytes);
+
+/*
+ * @brief: return the bytes currently held by image buffers
+ */
+size_t getImageMemoryUsage();
+
+/*
+ * @brief: return the highest value of getImageMemoryUsage() since the
+ *         start of the process or the last resetImageMemoryPeak()
+ */
+size_t getImageMemoryPeak();
+
+/*
+ * @brief: restart the peak tracking from the current usage
+ */
+void resetImageMemoryPeak();
+
+/*
+ * @brief: return the number of allocateImageMemory calls since the
+ *         start of the process
+ */
+long long getImageAllocationCount();
+
+
+/*
+ * Non-owning view on pixels laid out row by row, rows being
+ * stride pixels apart. Views are cheap to copy and never free memory.
+ */
+template <typename T>
+class BasicImageView
+{
+    public:
+        BasicImageView() :
+            m_data(nullptr), m_width(0), m_height(0), m_stride(0) {}
+
+        BasicImageView(T* data, int width, int height, int stride) :
+            m_data(data), m_width(width), m_height(height), m_stride(stride) {}
+
+        /*
+         * @brief: view on a dense matrix, stride equal to the width
+         */
+        BasicImageView(T* data, int width, int height) :
+            m_data(data), m_width(width), m_height(height), m_stride(width) {}
+
+        /*
+         * @brief: views on mutable pixels convert to views on const pixels
+         */
+        template <typename U>
+        BasicImageView(const BasicImageView<U>& other) :
+            m_data(other.getData()), m_width(other.getWidth()),
+            m_height(other.getHeight()), m_stride(other.getStride()) {}
+
+        T* getData() const { return m_data; }
+        int getWidth() const { return m_width; }
+        int getHeight() const { return m_height; }
+        int getStride() const { return m_stride; }                  ///< In pixels
+        bool isEmpty() const { return m_width == 0 || m_height == 0; }
+
+        T* getRow(int y) const { return m_data + static_cast<ptrdiff_t>(y) * m_stride; }
+        T& operator()(int x, int y) const { return getRow(y)[x]; }
+
+        /*
+         * @brief: return the view on the width x height region whose
+         *         top left pixel is (x, y), sharing the pixels of this view
+         *
+         * @return: the region, an empty view if it is not inside this view
+         */
+        BasicImageView getRoi(int x, int y, int width, int height) const;
+
+    private:
+        T* m_data;          ///< First pixel of the first row
+        int m_width;        ///< Pixels per row
+        int m_height;       ///< Number of rows
+        int m_stride;       ///< Distance between two rows, in pixels
+};
+
+/*
+ * Owning image storage. Each row starts on an IMAGE_BUFFER_ALIGNMENT
+ * boundary, so the stride can be bigger than the width. Buffers are moved
+ * without touching the pixels; copies are deep and explicit in the
+ * memory counters.
+ */
+template <typename T>
+class BasicImageBuffer
+{
+    public:
+        BasicImageBuffer() :
+            m_data(nullptr), m_width(0), m_height(0), m_stride(0) {}
+
+        /*
+         * @brief: Ctor. Allocates width x height uninitialized pixels
+         */
+        BasicImageBuffer(int width, int height);
+
+        BasicImageBuffer(const BasicImageBuffer& other);
+
+        BasicImageBuffer(BasicImageBuffer&& other) noexcept :
+            m_data(other.m_data), m_width(other.m_width),
+            m_height(other.m_height), m_stride(other.m_stride)
+        {
+            other.m_data = nullptr;
+            other.m_width = 0;
+            other.m_height = 0;
+            other.m_stride = 0;
+        }
+
+        BasicImageBuffer& operator=(BasicImageBuffer other) noexcept
+        {
+            swap(other);
+            return *this;
+        }
+
+        /*
+         *  @brief: Dtor
+         */
+        ~BasicImageBuffer() { release(); }
+
+        void swap(BasicImageBuffer& other) noexcept
+        {
+            std::swap(m_data, other.m_data);
+            std::swap(m_width, other.m_width);
+            std::swap(m_height, other.m_height);
+            std::swap(m_stride, other.m_stride);
+        }
+
+        /*
+         * @brief: resize the buffer, keeping the allocation when the
+         *         size does not change. Pixels are left uninitialized.
+         */
+        void reset(int width, int height);
+
+        /*
+         * @brief: copy the pixels of a view with the same size as the buffer
+         */
+        void copyFrom(const BasicImageView<const T>& source);
+
+        int getWidth() const { return m_width; }
+        int getHeight() const { return m_height; }
+        int getStride() const { return m_stride; }                  ///< In pixels
+        bool isEmpty() const { return m_width == 0 || m_height == 0; }
+
+        T* getRow(int y) { return m_data + static_cast<ptrdiff_t>(y) * m_stride; }
+        const T* getRow(int y) const { return m_data + static_cast<ptrdiff_t>(y) * m_stride; }
+
+        BasicImageView<T> getView()
+        {
+            return BasicImageView<T>(m_data, m_width, m_height, m_stride);
+        }
+
+        BasicImageView<const T> getView() const
+        {
+            return BasicImageView<const T>(m_data, m_width, m_height, m_stride);
+        }
+
+        /*
+         * @brief: return the row stride giving aligned rows for width pixels
+         */
+        static int getAlignedStride(int width);
+
+    private:
+        void release();
+
+        size_t getAllocationSize() const
+        {
+            return sizeof(T) * static_cast<size_t>(m_stride) * m_height;
+        }
+
+        T* m_data;          ///< First pixel, aligned to IMAGE_BUFFER_ALIGNMENT
+        int m_width;        ///< Pixels per row
+        int m_height;       ///< Number of rows
+        int m_stride;       ///< Distance between two rows, in pixels
+};
+
+typedef BasicImageBuffer<float> ImageBuffer;
+typedef BasicImageView<float> ImageView;
+typedef BasicImageView<const float> ConstImageView;
+
+typedef BasicImageBuffer<uint8_t> ImageBuffer8;
+typedef BasicImageView<uint8_t> ImageView8;
+typedef BasicImageView<const uint8_t> ConstImageView8;
+
+/*
+ * @brief: return true if there is at least one plane and every source
+ *         and output plane has the size of the first source plane
+ */
+template <typename S, typename O>
+bool haveSamePlaneSize(const BasicImageView<S>* sourcePlanes,
+                       const BasicImageView<O>* outPlanes,
+                       int planes)
+{
+    if (planes < 1) {
+        return false;
+    }
+
+    for (int plane = 0; plane < planes; plane++) {
+        if (sourcePlanes[plane].getWidth() != sourcePlanes[0].getWidth() ||
+            sourcePlanes[plane].getHeight() != sourcePlanes[0].getHeight() ||
+            outPlanes[plane].getWidth() != sourcePlanes[0].getWidth() ||
+            outPlanes[plane].getHeight() != sourcePlanes[0].getHeight()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+template <typename T>
+BasicImageView<T> BasicImageView<T>::getRoi(int x, int y, int width, int height) const
+{
+    if (x < 0 || y < 0 || width < 0 || height < 0 ||
+        x + width > m_width || y + height > m_height) {
+        return BasicImageView();
+    }
+
+    return BasicImageView(getRow(y) + x, width, height, m_stride);
+}
+
+template <typename T>
+BasicImageBuffer<T>::BasicImageBuffer(int width, int height) :
+    m_data(nullptr), m_width(0), m_height(0), m_stride(0)
+{
+    reset(width, height);
+}
+
+template <typename T>
+BasicImageBuffer<T>::BasicImageBuffer(const BasicImageBuffer& other) :
+    m_data(nullptr), m_width(0), m_height(0), m_stride(0)
+{
+    reset(other.m_width, other.m_height);
+    copyFrom(other.getView());
+}
+
+template <typename T>
+void BasicImageBuffer<T>::reset(int width, int height)
+{
+    if (width == m_width && height == m_height) {
+        return;
+    }
+
+    release();
+
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+
+    m_width = width;
+    m_height = height;
+    m_stride = getAlignedStride(width);
+    m_data = static_cast<T*>(allocateImageMemory(getAllocationSize()));
+}
+
+template <typename T>
+void BasicImageBuffer<T>::copyFrom(const BasicImageView<const T>& source)
+{
+    TRACE_COUNT(TraceCounter::BYTES_COPIED, static_cast<long long>(sizeof(T)) * m_width * m_height);
+
+    for (int y = 0; y < m_height; y++) {
+        std::memcpy(getRow(y), source.getRow(y), sizeof(T) * m_width);
+    }
+}
+
+template <typename T>
+int BasicImageBuffer<T>::getAlignedStride(int width)
+{
+    const int pixelsPerLine = IMAGE_BUFFER_ALIGNMENT / sizeof(T);
+    return (width + pixelsPerLine - 1) / pixelsPerLine * pixelsPerLine;
+}
+
+template <typename T>
+void BasicImageBuffer<T>::release()
+{
+    if (m_data != nullptr) {
+        freeImageMemory(m_data, getAllocationSize());
+    }
+
+    m_data = nullptr;
+    m_width = 0;
+    m_height = 0;
+    m_stride = 0;
+}
+
+
+#endif /* IMAGE_BUFFER_H_ */
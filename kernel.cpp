@@ -1,6 +1,8 @@
 #include "kernel.h"
 #include <iostream>
 #include <cmath>
+#include <algorithm>
+#include "trace.h"
 
 
 #define SHARPEN_FILTER_MAX      5
@@ -10,12 +12,25 @@
 #define LINE_DETECTOR_MAX       8
 #define LINE_DETECTOR_MIN      -1
 
+// Residual allowed for a low rank decomposition, relative to the
+// biggest kernel coefficient
+#define SEPARABLE_TOLERANCE     1e-5
+#define SVD_MAX_SWEEPS          60
+
+// Coefficients closer than this to an integer are integers
+#define INTEGER_TOLERANCE       1e-6
+// Fraction bits used at most by fixed-point kernels
+#define MAX_FIXED_POINT_SHIFT   14
+
 
 Kernel::Kernel()
 {
 	this->m_filterMatrix = std::vector<float>(0);
 	this->m_filterWidth = 0;
 	this->m_filterHeight = 0;
+	this->m_separableRank = 0;
+	this->m_fixedPointShift = -1;
+	this->m_fixedPointNarrow = false;
 }
 
 void Kernel::printKernel() const
@@ -36,13 +51,22 @@ void Kernel::printKernel() const
         }
         std::cout << "" << std::endl;
     }
+    if (m_separableRank > 0) {
+        std::cout << "Separable, rank " << m_separableRank << std::endl;
+    }
+    if (m_fixedPointShift == 0) {
+        std::cout << "Integer coefficients" << std::endl;
+    }
+    else if (m_fixedPointShift > 0) {
+        std::cout << "Fixed-point, " << m_fixedPointShift << " fraction bits" << std::endl;
+    }
     std::cout << "==============" << std::endl;
     std::cout << std::endl;
 }
 
 bool Kernel::setGaussianFilter(const int height, const int width, const float stdDev)
 {
-    std::cout << "Building gaussian filter..." << std::endl;
+    TRACE_STATUS("Building gaussian filter...");
 
     if (height != width || height % 2 == 0 || width % 2 == 0) {
         std::cerr << "Height and Width values are not valid" << std::endl;
@@ -82,6 +106,34 @@ bool Kernel::setGaussianFilter(const int height, const int width, const float st
     m_filterWidth = width;
     m_filterHeight = height;
 
+    decomposeKernel();
+    quantizeKernel();
+
+    return true;
+}
+
+bool Kernel::setFilter(const std::vector<float>& kernel, const int height, const int width)
+{
+    if (height <= 0 || width <= 0 || height % 2 == 0 || width % 2 == 0) {
+        std::cerr << "Height and Width values are not valid" << std::endl;
+        std::cerr << "Width and height should be odd" << std::endl;
+
+        return false;
+    }
+
+    if (kernel.size() != static_cast<size_t>(height * width)) {
+        std::cerr << "Kernel matrix does not match the requested size" << std::endl;
+
+        return false;
+    }
+
+    m_filterMatrix = kernel;
+    m_filterWidth = width;
+    m_filterHeight = height;
+
+    decomposeKernel();
+    quantizeKernel();
+
     return true;
 }
 
@@ -99,6 +151,9 @@ bool Kernel::setSharpenFilter()
     m_filterWidth = 3;
     m_filterHeight = 3;
 
+    decomposeKernel();
+    quantizeKernel();
+
     return true;
 }
 
@@ -111,6 +166,9 @@ bool Kernel::setEdgeDetectionFilter()
     m_filterWidth = 3;
     m_filterHeight = 3;
 
+    decomposeKernel();
+    quantizeKernel();
+
     return true;
 }
 
@@ -128,6 +186,9 @@ bool Kernel::setLaplacianFilter()
     m_filterWidth = 3;
     m_filterHeight = 3;
 
+    decomposeKernel();
+    quantizeKernel();
+
     return true;
 }
 
@@ -157,6 +218,9 @@ bool Kernel::setGaussianLaplacianFilter()
     m_filterWidth = 5;
     m_filterHeight = 5;
 
+    decomposeKernel();
+    quantizeKernel();
+
     return true;
 }
 
@@ -186,7 +250,207 @@ int Kernel::getKernelHeight() const
     return m_filterHeight;
 }
 
-std::vector<float> Kernel::getKernel() const
+const std::vector<float>& Kernel::getKernel() const
 {
     return this->m_filterMatrix;
 }
+
+bool Kernel::isSeparable() const
+{
+    return m_separableRank > 0;
+}
+
+int Kernel::getSeparableRank() const
+{
+    return m_separableRank;
+}
+
+const std::vector<float>& Kernel::getRowFactors() const
+{
+    return m_rowFactors;
+}
+
+const std::vector<float>& Kernel::getColumnFactors() const
+{
+    return m_columnFactors;
+}
+
+bool Kernel::isFixedPoint() const
+{
+    return m_fixedPointShift >= 0;
+}
+
+const std::vector<int16_t>& Kernel::getFixedPointKernel() const
+{
+    return m_fixedPointMatrix;
+}
+
+int Kernel::getFixedPointShift() const
+{
+    return m_fixedPointShift;
+}
+
+bool Kernel::isFixedPointNarrow() const
+{
+    return m_fixedPointNarrow;
+}
+
+void Kernel::quantizeKernel()
+{
+    m_fixedPointMatrix.clear();
+    m_fixedPointShift = -1;
+    m_fixedPointNarrow = false;
+
+    if (m_filterMatrix.empty()) {
+        return;
+    }
+
+    bool integer = true;
+    double maxCoefficient = 0;
+    double absoluteSum = 0;
+    for (float coefficient : m_filterMatrix) {
+        integer = integer && std::fabs(coefficient - std::round(coefficient)) < INTEGER_TOLERANCE;
+        maxCoefficient = std::max(maxCoefficient, std::fabs(static_cast<double>(coefficient)));
+        absoluteSum += std::fabs(coefficient);
+    }
+
+    // Coefficients are int16, 8-bit pixels are accumulated in int32
+    // with the rounding term of the final shift
+    int shift = 0;
+    if (!integer) {
+        shift = MAX_FIXED_POINT_SHIFT;
+        while (shift > 0 && (maxCoefficient * (1 << shift) > INT16_MAX ||
+                             (absoluteSum * 255 + 1) * (1 << shift) > INT32_MAX)) {
+            shift--;
+        }
+        if (shift == 0) {
+            return;
+        }
+    }
+    else if (maxCoefficient > INT16_MAX || absoluteSum * 255 > INT32_MAX) {
+        return;
+    }
+
+    m_fixedPointMatrix.resize(m_filterMatrix.size());
+    for (size_t i = 0; i < m_filterMatrix.size(); i++) {
+        m_fixedPointMatrix[i] = static_cast<int16_t>(std::lround(m_filterMatrix[i] * (1 << shift)));
+    }
+    m_fixedPointShift = shift;
+
+    // No partial sum of 8-bit pixels can overflow an int16 accumulator
+    m_fixedPointNarrow = integer && absoluteSum * 255 <= INT16_MAX;
+}
+
+void Kernel::decomposeKernel()
+{
+    int height = m_filterHeight;
+    int width = m_filterWidth;
+
+    m_rowFactors.clear();
+    m_columnFactors.clear();
+    m_separableRank = 0;
+
+    // Rank r costs r * (width + height) taps instead of width * height
+    int maxRank = std::min((width * height - 1) / (width + height), MAX_SEPARABLE_RANK);
+    if (maxRank < 1) {
+        return;
+    }
+
+    // One-sided Jacobi SVD: rotate column pairs of a until they are orthogonal,
+    // accumulating the rotations in v. At convergence kernel = a * v^T, where
+    // the columns of a are the left singular vectors scaled by the singular values.
+    std::vector<double> a(m_filterMatrix.begin(), m_filterMatrix.end());
+    std::vector<double> v(width * width, 0.0);
+    for (int j = 0; j < width; j++) {
+        v[j + j * width] = 1.0;
+    }
+
+    for (int sweep = 0; sweep < SVD_MAX_SWEEPS; sweep++) {
+        bool rotated = false;
+        for (int p = 0; p < width - 1; p++) {
+            for (int q = p + 1; q < width; q++) {
+                double alpha = 0;
+                double beta = 0;
+                double gamma = 0;
+                for (int i = 0; i < height; i++) {
+                    alpha += a[p + i * width] * a[p + i * width];
+                    beta += a[q + i * width] * a[q + i * width];
+                    gamma += a[p + i * width] * a[q + i * width];
+                }
+
+                if (std::fabs(gamma) <= 1e-15 * std::sqrt(alpha * beta)) {
+                    continue;
+                }
+                rotated = true;
+
+                double zeta = (beta - alpha) / (2 * gamma);
+                double t = (zeta >= 0 ? 1.0 : -1.0) / (std::fabs(zeta) + std::sqrt(1 + zeta * zeta));
+                double c = 1 / std::sqrt(1 + t * t);
+                double sn = c * t;
+
+                for (int i = 0; i < height; i++) {
+                    double ap = a[p + i * width];
+                    double aq = a[q + i * width];
+                    a[p + i * width] = c * ap - sn * aq;
+                    a[q + i * width] = sn * ap + c * aq;
+                }
+                for (int i = 0; i < width; i++) {
+                    double vp = v[p + i * width];
+                    double vq = v[q + i * width];
+                    v[p + i * width] = c * vp - sn * vq;
+                    v[q + i * width] = sn * vp + c * vq;
+                }
+            }
+        }
+
+        if (!rotated) {
+            break;
+        }
+    }
+
+    // Sort the terms by decreasing singular value
+    std::vector<double> sigma(width, 0.0);
+    std::vector<int> order(width);
+    for (int j = 0; j < width; j++) {
+        for (int i = 0; i < height; i++) {
+            sigma[j] += a[j + i * width] * a[j + i * width];
+        }
+        order[j] = j;
+    }
+    std::sort(order.begin(), order.end(), [&sigma](int l, int r) { return sigma[l] > sigma[r]; });
+
+    double maxCoefficient = 0;
+    for (size_t i = 0; i < m_filterMatrix.size(); i++) {
+        maxCoefficient = std::max(maxCoefficient, static_cast<double>(std::fabs(m_filterMatrix[i])));
+    }
+    if (maxCoefficient == 0) {
+        return;
+    }
+
+    // Add terms until the residual is negligible
+    std::vector<double> residual(m_filterMatrix.begin(), m_filterMatrix.end());
+    for (int rank = 1; rank <= maxRank; rank++) {
+        int term = order[rank - 1];
+        double maxResidual = 0;
+        for (int i = 0; i < height; i++) {
+            for (int j = 0; j < width; j++) {
+                residual[j + i * width] -= a[term + i * width] * v[term + j * width];
+                maxResidual = std::max(maxResidual, std::fabs(residual[j + i * width]));
+            }
+        }
+
+        if (maxResidual <= SEPARABLE_TOLERANCE * maxCoefficient) {
+            m_separableRank = rank;
+            break;
+        }
+    }
+
+    for (int k = 0; k < m_separableRank; k++) {
+        for (int j = 0; j < width; j++) {
+            m_rowFactors.push_back(v[order[k] + j * width]);
+        }
+        for (int i = 0; i < height; i++) {
+            m_columnFactors.push_back(a[order[k] + i * width]);
+        }
+    }
+}
@@ -2,6 +2,11 @@
 #define KERNEL_H_
 
 #include <vector>
+#include <cstdint>
+
+// Separable decompositions with more terms than this are
+// not worth the extra passes over the image
+#define MAX_SEPARABLE_RANK      4
 
 
 class Kernel
@@ -32,6 +37,16 @@ class Kernel
          */
         bool setGaussianFilter(const int height, const int width, const float stdDev);
 
+        /*
+         * @brief: Set up the Kernel object from a linearized matrix
+         *
+         * @param: kernel: the height * width coefficients, row by row
+         * @param: height: integer height of the filter
+         * @param: width: integer width of the filter
+         * @return: true for successful setup, false otherwise
+         */
+        bool setFilter(const std::vector<float>& kernel, const int height, const int width);
+
         /*
          * @brief: Set up the Kernel object as a sharpener filter
          *
@@ -73,7 +88,57 @@ class Kernel
         /*
          * @brief: return the kernel as a matrix
          */
-        std::vector<float> getKernel() const;
+        const std::vector<float>& getKernel() const;
+
+        /*
+         * @brief: return true if the kernel can be applied as a sum of
+         *         getSeparableRank() horizontal + vertical 1D passes,
+         *         with less taps than the 2D matrix
+         */
+        bool isSeparable() const;
+
+        /*
+         * @brief: return the number of 1D factor pairs, 0 if not separable
+         */
+        int getSeparableRank() const;
+
+        /*
+         * @brief: return the horizontal factors, linearized as
+         *         rank rows of getKernelWidth() values
+         */
+        const std::vector<float>& getRowFactors() const;
+
+        /*
+         * @brief: return the vertical factors, linearized as
+         *         rank rows of getKernelHeight() values
+         */
+        const std::vector<float>& getColumnFactors() const;
+
+        /*
+         * @brief: return true if the kernel has a fixed-point form, used
+         *         to filter 8-bit images with integer arithmetic.
+         *         Integer kernels are exact, fractional kernels (e.g. the
+         *         Gaussian) are rounded to getFixedPointShift() fraction bits.
+         */
+        bool isFixedPoint() const;
+
+        /*
+         * @brief: return the fixed-point coefficients: the kernel
+         *         multiplied by 2^getFixedPointShift() and rounded
+         */
+        const std::vector<int16_t>& getFixedPointKernel() const;
+
+        /*
+         * @brief: return the number of fraction bits, -1 if the kernel
+         *         has no fixed-point form
+         */
+        int getFixedPointShift() const;
+
+        /*
+         * @brief: return true if the convolution of 8-bit pixels can be
+         *         accumulated in int16 without overflow
+         */
+        bool isFixedPointNarrow() const;
 
     private:
         /*
@@ -81,9 +146,27 @@ class Kernel
          */
         bool buildKernelCommon(std::vector<float> &kernel, int max, int min, int height, int width);
 
+        /*
+         * @brief: Look for a low rank decomposition of the kernel matrix
+         *         (singular value decomposition) and store the 1D factors
+         *         if it is cheaper than the 2D convolution
+         */
+        void decomposeKernel();
+
+        /*
+         * @brief: Build the fixed-point form of the kernel matrix
+         */
+        void quantizeKernel();
+
         std::vector<float> m_filterMatrix;     ///< Linearized matrix containing the kernel
         int m_filterWidth;                     ///< Kernel height
         int m_filterHeight;                    ///< Kernel width
+        std::vector<float> m_rowFactors;       ///< Horizontal 1D factors, one row per term
+        std::vector<float> m_columnFactors;    ///< Vertical 1D factors, one row per term
+        int m_separableRank;                   ///< Number of terms, 0 if not separable
+        std::vector<int16_t> m_fixedPointMatrix; ///< Kernel scaled by 2^m_fixedPointShift
+        int m_fixedPointShift;                 ///< Fraction bits, -1 if not representable
+        bool m_fixedPointNarrow;               ///< int16 accumulation does not overflow
 };
 
 
@@ -1,129 +1,355 @@
 #include <iostream>
 #include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include "image.h"
 #include "kernel.h"
+#include "filter_pipeline.h"
+#include "batch_processor.h"
+#include "streaming_convolution.h"
+#include "trace.h"
+#include "convolution_backend.h"
+#include "convolution_planner.h"
+#include "command_line.h"
+#include "filter_server.h"
+#include "result_cache.h"
 
-#define GAUSSIAN_FILTER_COMMAND        "gaussian"
-#define SHARPENING_FILTER_COMMAND      "sharpen"
-#define EDGE_DETECTION_FILTER_COMMAND  "edge_detect"
-#define LAPLACIAN_FILTER_COMMAND       "laplacian"
-#define GAUSSIAN_LAPLACIAN_COMMAND     "gaussian_laplacian"
-
-#define CUDA_GLOBAL		"global"
-#define CUDA_CONSTANT	"constant"
-#define CUDA_SHARED		"shared"
+#define SERVE_COMMAND   "serve"
 
 #define OUTPUT_FOLDER   "output/"
 #define IMAGE_EXT       ".png"
 
-enum class FilterType
+// Environment variable enabling the tracing: Chrome trace output file
+#define TRACE_FILE_ENV  "KC_TRACE_FILE"
+// Environment variable printing the status lines of the filtering calls
+#define VERBOSE_ENV     "KC_VERBOSE"
+
+/*
+ * @brief: write the trace file and print the trace summary,
+ *         called at exit when the tracing is enabled
+ */
+static void finishTrace()
+{
+	Trace& trace = Trace::getInstance();
+	Trace::setEnabled(false);
+
+	std::cout << std::endl;
+	trace.printSummary();
+	if (trace.writeChromeTrace(getenv(TRACE_FILE_ENV))) {
+		std::cout << "Trace saved in " << getenv(TRACE_FILE_ENV) << std::endl;
+	}
+}
+
+/*
+ * @brief: save a result image and report its path
+ */
+static void saveResult(const Image& image, const std::string& path)
+{
+	if (image.saveImage(path.c_str())) {
+		std::cout << "Image saved in " << path << std::endl;
+	}
+}
+
+/*
+ * @brief: apply a filter without kernel matrix (see parseFilterParameter)
+ *
+ * @return: true if successful, false otherwise
+ */
+static bool applyParameterFilter(const Image& img, Image& result, const std::string& name,
+                                 float value, bool multithread)
 {
-    GAUSSIAN_FILTER,
-    SHARPEN_FILTER,
-    EDGE_DETECTION,
-    LAPLACIAN_FILTER,
-    GAUSSIAN_LAPLACIAN_FILTER
-};
+	if (name == RECURSIVE_GAUSSIAN_COMMAND) {
+		return img.applyRecursiveGaussian(result, value, multithread);
+	}
+	if (name == BOX_GAUSSIAN_COMMAND) {
+		return img.applyBoxGaussian(result, value, 3, multithread);
+	}
+
+	// The other filters take a window size
+	int size = static_cast<int>(value);
+	if (size != value) {
+		std::cerr << "Invalid window size " << value << std::endl;
+		return false;
+	}
+	if (name == MEDIAN_FILTER_COMMAND) {
+		return img.applyMedianFilter(result, size, multithread);
+	}
+	if (name == ERODE_FILTER_COMMAND || name == DILATE_FILTER_COMMAND) {
+		MorphologyOperation operation = name == ERODE_FILTER_COMMAND ? MorphologyOperation::ERODE
+		                                                             : MorphologyOperation::DILATE;
+		return img.applyMorphologyFilter(result, size, size, operation, multithread);
+	}
+	BoxStatistic statistic = name == LOCAL_VARIANCE_COMMAND ? BoxStatistic::VARIANCE : BoxStatistic::MEAN;
+	return img.applyBoxFilter(result, size, size, statistic, multithread);
+}
+
+/*
+ * @brief: filter an image with a filter without kernel matrix, on the
+ *         thread pool then on the calling thread, and save the result
+ *
+ * @return: the exit code of the application
+ */
+static int runParameterFilter(const char* imagePath, const std::string& cmdFilter,
+                              const std::string& name, float value,
+                              BorderMode borderMode, PixelFormat pixelFormat)
+{
+	Image img;
+	img.setPixelFormat(pixelFormat);
+	if (!img.loadImage(imagePath)) {
+		std::cerr << "Unable to load image " << imagePath << std::endl;
+		return 1;
+	}
+	img.setBorderMode(borderMode);
+
+	Image newMtImg;
+	Image newNpImg;
+
+	auto t1 = std::chrono::high_resolution_clock::now();
+	bool multithreadResult = applyParameterFilter(img, newMtImg, name, value, true);
+	auto t2 = std::chrono::high_resolution_clock::now();
+
+	std::cout << std::endl;
+
+	auto t3 = std::chrono::high_resolution_clock::now();
+	bool sequentialResult = applyParameterFilter(img, newNpImg, name, value, false);
+	auto t4 = std::chrono::high_resolution_clock::now();
+
+	std::cout << std::endl;
+
+	if (multithreadResult) {
+		auto multithreadDuration = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+		std::cout << "Total Multithread Execution time: " << multithreadDuration << " μs" << std::endl;
+		saveResult(newMtImg, std::string(OUTPUT_FOLDER) + "result_" + cmdFilter +
+		                     Image::getFileExtension(Image::getFileFormat(imagePath)));
+	}
+
+	if (sequentialResult) {
+		auto singleDuration = std::chrono::duration_cast<std::chrono::microseconds>(t4 - t3).count();
+		std::cout << "Total Sequential Execution time: " << singleDuration << " μs" << std::endl;
+	}
+
+	return multithreadResult && sequentialResult ? 0 : 1;
+}
 
 int main(int argc, char **argv)
 {
 	std::cout << "===== Multithread kernel convolution =====" << std::endl;
 
+	// Scoped timers and counters are recorded only when requested
+	const char* traceFile = getenv(TRACE_FILE_ENV);
+	if (traceFile != nullptr && traceFile[0] != '\0') {
+		Trace::setEnabled(true);
+		atexit(finishTrace);
+	}
+	const char* verbose = getenv(VERBOSE_ENV);
+	Trace::setVerbose(verbose != nullptr && verbose[0] != '\0' && std::string(verbose) != "0");
+
+	// The server keeps the device, kernels and memory of the
+	// filtering across the requests of the clients
+	if (argc >= 3 && std::string(argv[1]) == SERVE_COMMAND) {
+		int workers = argc >= 4 ? atoi(argv[3]) : 1;
+
+		setupConvolutionPlanner();
+		setupResultCache();
+		BackendRegistry::getInstance().hasGpuBackend();
+
+		FilterServer server(argv[2], workers);
+		return server.run() ? 0 : 1;
+	}
+
 	// Check command line parameters
 	if (argc < 3) {
-		std::cerr << "Usage: " << argv[0] << " filter_type image_path cuda_mem_tye" << std::endl;
-		std::cerr << "filter_type: <gaussian | sharpen | edge_detect | alt_edge_detect>" << std::endl;
-	    std::cerr << "image_path: specify the image path" << std::endl;
-	    std::cerr << "(optional) cuda_mem_type: <global | constant | shared>. Default: shared" << std::endl;
+		std::cerr << "Usage: " << argv[0] << " filter_type image_path cuda_mem_tye border_mode pixel_format batch_workers" << std::endl;
+		std::cerr << "filter_type: <gaussian | sharpen | edge_detect | laplacian | gaussian_laplacian>, "
+		          << "several filter types joined by + are applied in sequence" << std::endl;
+		std::cerr << "             or, for a single image: <recursive_gaussian | box_gaussian>:<standard deviation>, "
+		          << "<box | variance | median | erode | dilate>:<odd window size>" << std::endl;
+	    std::cerr << "image_path: specify the image path, a directory or a .txt list of images for batch processing" << std::endl;
+	    std::cerr << "(optional) cuda_mem_type: <global | constant | shared | cpu | stream>. Default: shared" << std::endl;
+	    std::cerr << "(optional) border_mode: <replicate | zero | reflect | wrap>. Default: replicate" << std::endl;
+	    std::cerr << "(optional) pixel_format: <float | uint8>. Default: float" << std::endl;
+	    std::cerr << "(optional) batch_workers: decode,filter,encode threads. Default: 2,1,2" << std::endl;
+	    std::cerr << "Server mode: " << argv[0] << " " << SERVE_COMMAND << " socket_path workers" << std::endl;
+	    std::cerr << "(optional) workers: connections served concurrently. Default: 1" << std::endl;
 	    return 1;
 	}
 
-	FilterType filterType;
+	// Several filters joined by FILTER_CHAIN_SEPARATOR are applied
+	// one after the other as a pipeline
 	std::string cmdFilter = std::string(argv[1]);
-	if (cmdFilter == GAUSSIAN_FILTER_COMMAND) {
-		filterType = FilterType::GAUSSIAN_FILTER;
+	std::string parameterFilter;
+	float filterParameter = 0;
+	bool kernelFilter = !parseFilterParameter(cmdFilter, parameterFilter, filterParameter);
+	FilterPipeline pipeline;
+	if (kernelFilter && !parseFilterCommand(cmdFilter, pipeline)) {
+	    std::cerr << "filter_type: <gaussian | sharpen | edge_detect | laplacian | gaussian_laplacian >" << std::endl;
+	    return 1;
 	}
-	else if (cmdFilter == SHARPENING_FILTER_COMMAND) {
-		filterType = FilterType::SHARPEN_FILTER;
+	for (int i = 0; i < pipeline.getKernelCount(); i++) {
+		pipeline.getKernel(i).printKernel();
 	}
-	else if (cmdFilter == EDGE_DETECTION_FILTER_COMMAND) {
-		filterType = FilterType::EDGE_DETECTION;
+	pipeline.setCollapseLinear(true);
+
+	CudaMemType cudaType = CudaMemType::SHARED;
+	bool streamMode = false;
+	if (argc >= 4) {
+		std::string cudaMemCmd = std::string(argv[3]);
+		if (cudaMemCmd == CPU_STREAM)
+			streamMode = true;
+		else
+			parseCudaMemType(cudaMemCmd, cudaType);
 	}
-	else if (cmdFilter == LAPLACIAN_FILTER_COMMAND) {
-		filterType = FilterType::LAPLACIAN_FILTER;
+
+	BorderMode borderMode = BorderMode::REPLICATE;
+	if (argc >= 5 && !parseBorderMode(argv[4], borderMode)) {
+		std::cerr << "Invalid border mode " << argv[4] << std::endl;
+		std::cerr << "border_mode: <replicate | zero | reflect | wrap>" << std::endl;
+		return 1;
 	}
-	else if (cmdFilter == GAUSSIAN_LAPLACIAN_COMMAND) {
-		filterType = FilterType::GAUSSIAN_LAPLACIAN_FILTER;
+
+	PixelFormat pixelFormat = PixelFormat::FLOAT;
+	if (argc >= 6 && !parsePixelFormat(argv[5], pixelFormat)) {
+		std::cerr << "Invalid pixel format " << argv[5] << std::endl;
+		std::cerr << "pixel_format: <float | uint8>" << std::endl;
+		return 1;
 	}
-	else {
-		std::cerr << "Invalid filter type " << cmdFilter << std::endl;
-	    std::cerr << "filter_type: <gaussian | sharpen | edge_detect | laplacian | gaussian_laplacian >" << std::endl;
-	    return 1;
+
+	// The cost model of the planner is measured on the first run
+	// and reused by the next ones
+	setupConvolutionPlanner();
+	setupResultCache();
+
+	// The filters without kernel run on the CPU, without the
+	// CUDA, stream and batch modes
+	if (!kernelFilter) {
+		if (streamMode || BatchProcessor::isBatchPath(argv[2])) {
+			std::cerr << "Filter " << parameterFilter << " runs on a single image" << std::endl;
+			return 1;
+		}
+
+		return runParameterFilter(argv[2], cmdFilter, parameterFilter, filterParameter,
+		                          borderMode, pixelFormat);
 	}
 
-    Kernel filter = Kernel();
-	switch (filterType)
-	{
-	 	case FilterType::GAUSSIAN_FILTER:
-	 		filter.setGaussianFilter(7, 7, 1);
-	 	break;
+	const Kernel& filter = pipeline.getKernel(0);
 
-	    case FilterType::SHARPEN_FILTER:
-	    	filter.setSharpenFilter();
-	    break;
+	// Rows are decoded, filtered and encoded on the fly: the images
+	// are never held in memory
+	if (streamMode) {
+		if (pipeline.getKernelCount() > 1) {
+			std::cerr << "Filter chains cannot be streamed" << std::endl;
+			return 1;
+		}
 
-	    case FilterType::EDGE_DETECTION:
-	    	filter.setEdgeDetectionFilter();
-	    break;
+		const std::string streamPath = std::string(OUTPUT_FOLDER) + "result_" + cmdFilter + std::string(IMAGE_EXT);
+		auto t1 = std::chrono::high_resolution_clock::now();
+		bool streamResult = runStreamingConvolution(argv[2], streamPath.c_str(), filter, borderMode);
+		auto t2 = std::chrono::high_resolution_clock::now();
 
-	    case FilterType::LAPLACIAN_FILTER:
-	    	filter.setLaplacianFilter();
-	    break;
+		if (streamResult) {
+			auto streamDuration = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+			std::cout << "Image saved in " << streamPath << std::endl;
+			std::cout << "Total Streaming Execution time: " << streamDuration << " μs" << std::endl;
+		}
 
-	    case FilterType::GAUSSIAN_LAPLACIAN_FILTER:
-	    	filter.setGaussianLaplacianFilter();
-	    break;
+		std::cout << "Peak image memory: " << getImageMemoryPeak() / 1024 << " KiB" << std::endl;
 
-	    default:
-	    	std::cerr << "Unable to find requested filter, switching to gaussian..." << std::endl;
-	        filter.setGaussianFilter(5, 5, 2);
-	    break;
+		return streamResult ? 0 : 1;
 	}
-	filter.printKernel();
 
-	CudaMemType cudaType = CudaMemType::SHARED;
-	if (argc == 4) {
-		std::string cudaMemCmd = std::string(argv[3]);
-		if (cudaMemCmd == CUDA_GLOBAL)
-			cudaType = CudaMemType::GLOBAL;
-		else if(cudaMemCmd == CUDA_CONSTANT)
-			cudaType = CudaMemType::CONSTANT;
-		else if(cudaMemCmd == CUDA_SHARED)
-			cudaType = CudaMemType::SHARED;
+	// A directory or a list file runs the batch mode: the images are
+	// filtered once, with decoding and encoding overlapped
+	if (BatchProcessor::isBatchPath(argv[2])) {
+		std::vector<std::string> imagePaths;
+		if (!BatchProcessor::listImages(argv[2], imagePaths)) {
+			return 1;
+		}
+
+		BatchProcessor batch(pipeline, cudaType, borderMode, pixelFormat);
+		if (argc >= 7) {
+			int decodeWorkers = 0;
+			int filterWorkers = 0;
+			int encodeWorkers = 0;
+			if (sscanf(argv[6], "%d,%d,%d", &decodeWorkers, &filterWorkers, &encodeWorkers) != 3) {
+				std::cerr << "Invalid batch workers " << argv[6] << std::endl;
+				std::cerr << "batch_workers: decode,filter,encode" << std::endl;
+				return 1;
+			}
+			batch.setWorkers(decodeWorkers, filterWorkers, encodeWorkers);
+		}
+
+		// Init the CUDA device outside the measures
+		if (cudaType != CudaMemType::CPU_MULTITHREAD) {
+			BackendRegistry::getInstance().hasGpuBackend();
+		}
+
+		bool batchResult = batch.run(imagePaths, OUTPUT_FOLDER, "_" + cmdFilter);
+		ResultCache::getInstance().printStats();
+
+		std::cout << "Peak image memory: " << getImageMemoryPeak() / 1024 << " KiB" << std::endl;
+
+		return batchResult ? 0 : 1;
 	}
 
 	Image img;
+	img.setPixelFormat(pixelFormat);
 	bool loadResult = img.loadImage(argv[2]);
 	if (!loadResult) {
 		std::cerr << "Unable to load image " << argv[2] << std::endl;
 		return 1;
 	}
+	img.setBorderMode(borderMode);
 
 	Image newMtImg;
 	Image newNpImg;
 
-	// Init the CUDA device
-	cudaFree(0);
+	// PGM and RAW sources are saved in their own format
+	std::string outputPath = std::string(OUTPUT_FOLDER) + "result_" + cmdFilter +
+	                         Image::getFileExtension(Image::getFileFormat(argv[2]));
+
+	// A result computed by a previous run sharing the cache folder
+	// is saved without filtering. The run ends before the memory tier
+	// could serve the result again.
+	ResultCache& cache = ResultCache::getInstance();
+	cache.setMemoryBudget(0);
+	uint64_t cacheKey = 0;
+	if (cache.isEnabled()) {
+		cacheKey = ResultCache::getKey(img, pipeline, cudaType, FilterAlgorithm::AUTO);
+		if (cache.lookup(cacheKey, newMtImg)) {
+			std::cout << "Result found in the cache" << std::endl;
+			saveResult(newMtImg, outputPath);
+			cache.printStats();
+			return 0;
+		}
+	}
+
+	// Init the CUDA device outside the measures
+	if (cudaType != CudaMemType::CPU_MULTITHREAD) {
+		BackendRegistry::getInstance().hasGpuBackend();
+	}
 
 	// Executing multithread filtering for each image
 	auto t1 = std::chrono::high_resolution_clock::now();
-	bool cudaResult = img.multithreadFiltering(newMtImg, filter, cudaType);
+	bool cudaResult = false;
+	if (pipeline.getKernelCount() > 1) {
+		// Filter chains are fused on the CPU
+		cudaResult = img.applyFilter(newMtImg, pipeline, true);
+	}
+	else {
+		cudaResult = img.multithreadFiltering(newMtImg, filter, cudaType);
+	}
 	auto t2 = std::chrono::high_resolution_clock::now();
 
 	std::cout << std::endl;
 
 	auto t3 = std::chrono::high_resolution_clock::now();
-	bool sequentialResult = img.applyFilter(newNpImg, filter);
+	bool sequentialResult = false;
+	if (pipeline.getKernelCount() > 1) {
+		sequentialResult = img.applyFilter(newNpImg, pipeline);
+	}
+	else {
+		sequentialResult = img.applyFilter(newNpImg, filter);
+	}
 	auto t4 = std::chrono::high_resolution_clock::now();
 
 	std::cout << std::endl;
@@ -131,14 +357,19 @@ int main(int argc, char **argv)
 	// Evaluating execution times and save results
 	if (cudaResult) {
 		auto multithreadDuration = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
-		std::cout << "Total CUDA Execution time: " << multithreadDuration << " μs" << std::endl;
-		newMtImg.saveImage(std::string(std::string(OUTPUT_FOLDER) + 
-							"result_" + cmdFilter +
-							std::string(IMAGE_EXT)).c_str());
+		std::cout << "Total Multithread Execution time: " << multithreadDuration << " μs" << std::endl;
+		saveResult(newMtImg, outputPath);
+		if (cache.isEnabled()) {
+			cache.store(cacheKey, newMtImg);
+		}
 	}
 
 	if (sequentialResult) {
 		auto singleDuration = std::chrono::duration_cast<std::chrono::microseconds>(t4 - t3).count();
 		std::cout << "Total Sequential Execution time: " << singleDuration << " μs" << std::endl;
 	}
+
+	cache.printStats();
+
+	std::cout << "Peak image memory: " << getImageMemoryPeak() / 1024 << " KiB" << std::endl;
 }
@@ -0,0 +1,132 @@
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mapped_file.h"
+
+
+bool MappedFile::openRead(const char* filename)
+{
+    close();
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Unable to open " << filename << std::endl;
+        return false;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size == 0) {
+        std::cerr << "Unable to map empty file " << filename << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps the file referenced
+    ::close(fd);
+
+    if (data == MAP_FAILED) {
+        std::cerr << "Unable to map " << filename << std::endl;
+        return false;
+    }
+
+    m_data = static_cast<uint8_t*>(data);
+    m_size = status.st_size;
+
+    return true;
+}
+
+bool MappedFile::create(const char* filename, size_t size)
+{
+    close();
+
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Unable to create " << filename << std::endl;
+        return false;
+    }
+
+    // Allocate the blocks now: a full disk fails here instead of
+    // raising SIGBUS while the pixels are written
+    if (posix_fallocate(fd, 0, size) != 0 && ftruncate(fd, size) != 0) {
+        std::cerr << "Unable to allocate " << size << " bytes for " << filename << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (data == MAP_FAILED) {
+        std::cerr << "Unable to map " << filename << std::endl;
+        return false;
+    }
+
+    m_data = static_cast<uint8_t*>(data);
+    m_size = size;
+
+    return true;
+}
+
+bool MappedFile::openShared(const char* name, size_t size)
+{
+    close();
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        std::cerr << "Unable to open shared memory " << name << std::endl;
+        return false;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || size == 0 || static_cast<size_t>(status.st_size) < size) {
+        std::cerr << "Shared memory " << name << " is smaller than " << size << " bytes" << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (data == MAP_FAILED) {
+        std::cerr << "Unable to map shared memory " << name << std::endl;
+        return false;
+    }
+
+    m_data = static_cast<uint8_t*>(data);
+    m_size = size;
+
+    return true;
+}
+
+bool MappedFile::createShared(const char* name, size_t size)
+{
+    close();
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        std::cerr << "Unable to create shared memory " << name << std::endl;
+        return false;
+    }
+
+    if (ftruncate(fd, size) != 0) {
+        std::cerr << "Unable to allocate " << size << " bytes for shared memory " << name << std::endl;
+        ::close(fd);
+        return false;
+    }
+    ::close(fd);
+
+    return openShared(name, size);
+}
+
+void MappedFile::close()
+{
+    if (m_data != nullptr) {
+        munmap(m_data, m_size);
+    }
+
+    m_data = nullptr;
+    m_size = 0;
+}
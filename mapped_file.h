@@ -0,0 +1,72 @@
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+
+/*
+ * File mapped in the process memory with mmap. The pages are read from
+ * the file on first access and written back by the kernel, so the file
+ * contents can be used as an image buffer without copies.
+ */
+class MappedFile
+{
+    public:
+        MappedFile() : m_data(nullptr), m_size(0) {}
+
+        /*
+         *  @brief: Dtor. Unmaps the file
+         */
+        ~MappedFile() { close(); }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        /*
+         * @brief: map an existing file for reading
+         *
+         * @return: true if successful, false otherwise
+         */
+        bool openRead(const char* filename);
+
+        /*
+         * @brief: create or truncate a file of size bytes and map it
+         *         for writing. The whole file is allocated up front.
+         *
+         * @return: true if successful, false otherwise
+         */
+        bool create(const char* filename, size_t size);
+
+        /*
+         * @brief: map the first size bytes of an existing POSIX shared
+         *         memory object (see shm_open) for reading and writing
+         *
+         * @return: true if successful, false otherwise
+         */
+        bool openShared(const char* name, size_t size);
+
+        /*
+         * @brief: create or truncate a POSIX shared memory object of
+         *         size bytes and map it for reading and writing. The
+         *         object lives until shm_unlink.
+         *
+         * @return: true if successful, false otherwise
+         */
+        bool createShared(const char* name, size_t size);
+
+        /*
+         * @brief: unmap the file, flushing the written pages
+         */
+        void close();
+
+        uint8_t* getData() const { return m_data; }
+        size_t getSize() const { return m_size; }
+
+    private:
+        uint8_t* m_data;        ///< First byte of the mapping, page aligned
+        size_t m_size;          ///< Mapped bytes, the file size
+};
+
+
+#endif /* MAPPED_FILE_H_ */
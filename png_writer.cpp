@@ -0,0 +1,322 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+#include <zlib.h>
+#include "png_writer.h"
+#include "thread_pool.h"
+
+// Uncompressed bytes per chunk: big enough for the deflate window to
+// find matches, small enough to split images in several tasks
+#define PNG_CHUNK_BYTES         (256 * 1024)
+
+// PNG row filter types
+#define ROW_FILTER_NONE         0
+#define ROW_FILTER_SUB          1
+#define ROW_FILTER_UP           2
+#define ROW_FILTER_AVERAGE      3
+#define ROW_FILTER_PAETH        4
+#define ROW_FILTER_COUNT        5
+
+// PNG color types
+#define PNG_COLOR_GRAY          0
+#define PNG_COLOR_RGB           2
+#define PNG_COLOR_GRAY_ALPHA    4
+#define PNG_COLOR_RGBA          6
+
+
+static inline uint8_t paethPredictor(int a, int b, int c)
+{
+    const int p = a + b - c;
+    const int pa = std::abs(p - a);
+    const int pb = std::abs(p - b);
+    const int pc = std::abs(p - c);
+
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+/*
+ * @brief: write the filter type byte and the filtered row in out.
+ *         Filters predict each byte from the same channel of the
+ *         previous pixel, pixelSize bytes before. previous is nullptr
+ *         for the first row of the image.
+ */
+static void filterRow(const uint8_t* row, const uint8_t* previous, int rowSize,
+                      int pixelSize, int filter, uint8_t* out)
+{
+    out[0] = filter;
+    out++;
+
+    // The row above the image reads as zeros: Up becomes None,
+    // Average halves the left pixel and Paeth becomes Sub
+    if (previous == nullptr && filter != ROW_FILTER_AVERAGE) {
+        filter = filter == ROW_FILTER_UP ? ROW_FILTER_NONE :
+                 filter == ROW_FILTER_PAETH ? ROW_FILTER_SUB : filter;
+    }
+
+    const int first = std::min(pixelSize, rowSize);
+
+    switch (filter) {
+        case ROW_FILTER_SUB:
+            std::copy(row, row + first, out);
+            for (int x = first; x < rowSize; x++) {
+                out[x] = row[x] - row[x - pixelSize];
+            }
+        break;
+
+        case ROW_FILTER_UP:
+            for (int x = 0; x < rowSize; x++) {
+                out[x] = row[x] - previous[x];
+            }
+        break;
+
+        case ROW_FILTER_AVERAGE:
+            for (int x = 0; x < rowSize; x++) {
+                const int a = x >= pixelSize ? row[x - pixelSize] : 0;
+                const int b = previous != nullptr ? previous[x] : 0;
+                out[x] = row[x] - (a + b) / 2;
+            }
+        break;
+
+        case ROW_FILTER_PAETH:
+            for (int x = 0; x < first; x++) {
+                out[x] = row[x] - previous[x];
+            }
+            for (int x = first; x < rowSize; x++) {
+                out[x] = row[x] - paethPredictor(row[x - pixelSize], previous[x], previous[x - pixelSize]);
+            }
+        break;
+
+        default:
+            std::copy(row, row + rowSize, out);
+        break;
+    }
+}
+
+/*
+ * @brief: return row y of the image with its channels interleaved,
+ *         stored in buffer unless there is a single plane
+ */
+static const uint8_t* getInterleavedRow(const ConstImageView8* planes, int channels,
+                                        int y, std::vector<uint8_t>& buffer)
+{
+    if (channels == 1) {
+        return planes[0].getRow(y);
+    }
+
+    const int width = planes[0].getWidth();
+    for (int c = 0; c < channels; c++) {
+        const uint8_t* planeRow = planes[c].getRow(y);
+        for (int x = 0; x < width; x++) {
+            buffer[x * channels + c] = planeRow[x];
+        }
+    }
+
+    return buffer.data();
+}
+
+/*
+ * @brief: return the sum of the filtered bytes read as signed values,
+ *         lower for rows that compress better
+ */
+static long getFilterCost(const uint8_t* filtered, int rowSize)
+{
+    long cost = 0;
+    for (int x = 0; x < rowSize; x++) {
+        cost += std::abs(static_cast<int>(static_cast<int8_t>(filtered[x])));
+    }
+
+    return cost;
+}
+
+/*
+ * A run of rows compressed independently
+ */
+struct CompressedChunk
+{
+    std::vector<uint8_t> data;      ///< Raw deflate blocks
+    uLong adler;                    ///< Checksum of the uncompressed bytes
+    uLong length;                   ///< Uncompressed bytes
+    bool valid;                     ///< Compression succeeded
+};
+
+static void compressChunk(const ConstImageView8* planes, int channels,
+                          int startRow, int endRow,
+                          int compressionLevel, bool last, CompressedChunk& chunk)
+{
+    const int rowSize = planes[0].getWidth() * channels;
+    const size_t lineSize = rowSize + 1;
+
+    // Filter the rows: the first row of the chunk is predicted from the
+    // last row of the previous chunk, as in a sequential encoder
+    std::vector<uint8_t> filtered(lineSize * (endRow - startRow));
+    std::vector<uint8_t> candidate(lineSize);
+    std::vector<uint8_t> rowBuffer(rowSize);
+    std::vector<uint8_t> previousBuffer(rowSize);
+
+    const uint8_t* previous = startRow > 0 ?
+                              getInterleavedRow(planes, channels, startRow - 1, previousBuffer) : nullptr;
+
+    for (int y = startRow; y < endRow; y++) {
+        const uint8_t* row = getInterleavedRow(planes, channels, y, rowBuffer);
+        uint8_t* out = filtered.data() + lineSize * (y - startRow);
+
+        if (compressionLevel <= PNG_COMPRESSION_FAST) {
+            filterRow(row, previous, rowSize, channels, ROW_FILTER_SUB, out);
+        }
+        else {
+            long bestCost = -1;
+            for (int filter = 0; filter < ROW_FILTER_COUNT; filter++) {
+                filterRow(row, previous, rowSize, channels, filter, candidate.data());
+                long cost = getFilterCost(candidate.data() + 1, rowSize);
+                if (bestCost < 0 || cost < bestCost) {
+                    bestCost = cost;
+                    std::copy(candidate.begin(), candidate.end(), out);
+                }
+            }
+        }
+
+        // The interleaved row becomes the previous one
+        if (channels > 1) {
+            rowBuffer.swap(previousBuffer);
+        }
+        previous = channels > 1 ? previousBuffer.data() : row;
+    }
+
+    chunk.length = filtered.size();
+    chunk.adler = adler32(adler32(0L, Z_NULL, 0), filtered.data(), filtered.size());
+    chunk.valid = false;
+
+    // Raw deflate: the zlib header and checksum are written once for all
+    // the chunks. Chunks before the last one end with a sync flush, which
+    // aligns them on a byte boundary without marking the final block.
+    z_stream stream;
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    if (deflateInit2(&stream, compressionLevel, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return;
+    }
+
+    chunk.data.resize(deflateBound(&stream, filtered.size()) + 16);
+    stream.next_in = filtered.data();
+    stream.avail_in = filtered.size();
+    stream.next_out = chunk.data.data();
+    stream.avail_out = chunk.data.size();
+
+    int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    chunk.valid = last ? result == Z_STREAM_END : (result == Z_OK && stream.avail_in == 0);
+    chunk.data.resize(chunk.data.size() - stream.avail_out);
+
+    deflateEnd(&stream);
+}
+
+static void writeUint32(std::ofstream& file, uint32_t value)
+{
+    const char bytes[4] = {static_cast<char>(value >> 24), static_cast<char>(value >> 16),
+                           static_cast<char>(value >> 8), static_cast<char>(value)};
+    file.write(bytes, 4);
+}
+
+/*
+ * @brief: write a PNG chunk: length, type, data and CRC of type and data
+ */
+static void writePngChunk(std::ofstream& file, const char* type,
+                          const uint8_t* data, size_t size)
+{
+    writeUint32(file, size);
+    file.write(type, 4);
+    file.write(reinterpret_cast<const char*>(data), size);
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(type), 4);
+    // A null buffer would reset the CRC to its initial value
+    if (size > 0) {
+        crc = crc32(crc, data, size);
+    }
+    writeUint32(file, crc);
+}
+
+bool writePng(const char* filename,
+              const ConstImageView8* planes,
+              int channels,
+              int compressionLevel,
+              bool multithread)
+{
+    if (channels < 1 || channels > 4 ||
+        !haveSamePlaneSize(planes, planes, channels) || planes[0].isEmpty()) {
+        std::cerr << "Invalid image planes" << std::endl;
+        return false;
+    }
+
+    const int width = planes[0].getWidth();
+    const int height = planes[0].getHeight();
+
+    compressionLevel = std::min(std::max(compressionLevel, PNG_COMPRESSION_NONE), PNG_COMPRESSION_BEST);
+
+    const int chunkRows = std::max(1, PNG_CHUNK_BYTES / (width * channels + 1));
+    const int numChunks = (height + chunkRows - 1) / chunkRows;
+    std::vector<CompressedChunk> chunks(numChunks);
+
+    auto runChunk = [&](int chunk) {
+        compressChunk(planes, channels,
+                      chunk * chunkRows, std::min((chunk + 1) * chunkRows, height),
+                      compressionLevel, chunk == numChunks - 1, chunks[chunk]);
+    };
+
+    runTasks(numChunks, runChunk, multithread);
+
+    uLong adler = adler32(0L, Z_NULL, 0);
+    for (const CompressedChunk& chunk : chunks) {
+        if (!chunk.valid) {
+            std::cerr << "PNG compression failed" << std::endl;
+            return false;
+        }
+        adler = adler32_combine(adler, chunk.adler, chunk.length);
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Unable to write " << filename << std::endl;
+        return false;
+    }
+
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+    // 8 bits per channel, deflate, adaptive filtering, no interlace
+    const uint8_t colorTypes[4] = {PNG_COLOR_GRAY, PNG_COLOR_GRAY_ALPHA, PNG_COLOR_RGB, PNG_COLOR_RGBA};
+    const uint8_t header[13] = {static_cast<uint8_t>(width >> 24), static_cast<uint8_t>(width >> 16),
+                                static_cast<uint8_t>(width >> 8), static_cast<uint8_t>(width),
+                                static_cast<uint8_t>(height >> 24), static_cast<uint8_t>(height >> 16),
+                                static_cast<uint8_t>(height >> 8), static_cast<uint8_t>(height),
+                                8, colorTypes[channels - 1], 0, 0, 0};
+    writePngChunk(file, "IHDR", header, sizeof(header));
+
+    // zlib header: 32K window, level hint as zlib writes it
+    const uint8_t levelFlags = compressionLevel <= PNG_COMPRESSION_FAST ? 0x01 :
+                               compressionLevel < PNG_COMPRESSION_DEFAULT ? 0x5e :
+                               compressionLevel == PNG_COMPRESSION_DEFAULT ? 0x9c : 0xda;
+    const uint8_t zlibHeader[2] = {0x78, levelFlags};
+    writePngChunk(file, "IDAT", zlibHeader, sizeof(zlibHeader));
+
+    for (const CompressedChunk& chunk : chunks) {
+        writePngChunk(file, "IDAT", chunk.data.data(), chunk.data.size());
+    }
+
+    const uint8_t checksum[4] = {static_cast<uint8_t>(adler >> 24), static_cast<uint8_t>(adler >> 16),
+                                 static_cast<uint8_t>(adler >> 8), static_cast<uint8_t>(adler)};
+    writePngChunk(file, "IDAT", checksum, sizeof(checksum));
+    writePngChunk(file, "IEND", nullptr, 0);
+
+    if (!file) {
+        std::cerr << "Unable to write " << filename << std::endl;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,36 @@
+#ifndef PNG_WRITER_H_
+#define PNG_WRITER_H_
+
+#include "image_buffer.h"
+
+// zlib compression levels accepted by writePng
+#define PNG_COMPRESSION_NONE        0
+#define PNG_COMPRESSION_FAST        1   ///< For intermediate outputs
+#define PNG_COMPRESSION_DEFAULT     6
+#define PNG_COMPRESSION_BEST        9
+
+/*
+ * @brief: This function will write an 8-bit PNG file with one channel per
+ *         plane: gray, gray and alpha, RGB or RGBA. The rows
+ *         are split in chunks that are filtered and deflated independently,
+ *         on the thread pool if multithread is set; the compressed chunks
+ *         are joined into one zlib stream (each one ends on a byte boundary
+ *         with a sync flush) whose checksum is combined from the chunk ones.
+ *         The planes are interleaved by the chunk tasks.
+ *         The fast and no compression levels use the Sub row filter only,
+ *         the others pick the filter of each row with the minimum sum of
+ *         absolute differences heuristic, as libpng does.
+ *
+ * @param: channels: number of planes, from 1 to 4
+ * @param: compressionLevel: zlib level, from PNG_COMPRESSION_NONE
+ *         to PNG_COMPRESSION_BEST
+ * @return: true if successful, false otherwise
+ */
+bool writePng(const char* filename,
+              const ConstImageView8* planes,
+              int channels,
+              int compressionLevel,
+              bool multithread);
+
+
+#endif /* PNG_WRITER_H_ */
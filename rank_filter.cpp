@@ -0,0 +1,320 @@
+#include <iostream>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "rank_filter.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// Rows filtered by a task of the median and of the morphology rows pass,
+// columns of a task of the morphology columns pass
+#define RANK_ROW_BLOCK      16
+#define RANK_COLUMN_STRIP   64
+#define RANK_LEVELS         256
+
+
+namespace {
+
+/*
+ * Buffers of a thread, kept across the calls
+ */
+struct RankBuffers
+{
+    std::vector<uint8_t> levels;    ///< Extended rows of the median, as 8-bit levels
+    std::vector<float> lines;       ///< Interleaved lines of the morphology
+    std::vector<float> suffix;      ///< Suffix extrema of the lines
+};
+
+RankBuffers& getRankBuffers()
+{
+    thread_local RankBuffers buffers;
+    return buffers;
+}
+
+/*
+ * @brief: return the 8-bit level nearest to a pixel
+ */
+inline uint8_t toLevel(float pixel)
+{
+    return static_cast<uint8_t>(std::min(std::max(pixel, 0.0f), 255.0f) + 0.5f);
+}
+
+struct MinOperation
+{
+    static float apply(float a, float b) { return std::min(a, b); }
+};
+
+struct MaxOperation
+{
+    static float apply(float a, float b) { return std::max(a, b); }
+};
+
+/*
+ * @brief: van Herk / Gil-Werman extremum of the windows of size
+ *         samples of interleaved lines, sample i of line j being
+ *         lines[i * stride + j]. Window y, samples [y, y + size), is
+ *         written in place of sample y, for y < length - size + 1.
+ *         suffix holds length * stride samples.
+ */
+template <typename Operation>
+void vanHerkLines(float* lines, int length, int stride, int size, float* suffix)
+{
+    // Extrema from each sample to the end of its segment
+    for (int i = length - 1; i >= 0; i--) {
+        const float* line = lines + static_cast<size_t>(i) * stride;
+        float* extremum = suffix + static_cast<size_t>(i) * stride;
+        if (i == length - 1 || (i + 1) % size == 0) {
+            std::copy(line, line + stride, extremum);
+        }
+        else {
+            const float* next = extremum + stride;
+            for (int j = 0; j < stride; j++) {
+                extremum[j] = Operation::apply(line[j], next[j]);
+            }
+        }
+    }
+
+    // Extrema from the start of the segment to each sample, kept in
+    // the sample: window y ends at sample i, whose value is not read again
+    float* prefix = lines;
+    for (int i = 0; i < length; i++) {
+        float* line = lines + static_cast<size_t>(i) * stride;
+        if (i % size != 0) {
+            for (int j = 0; j < stride; j++) {
+                line[j] = Operation::apply(prefix[j], line[j]);
+            }
+        }
+        prefix = line;
+
+        const int y = i - size + 1;
+        if (y >= 0) {
+            float* window = lines + static_cast<size_t>(y) * stride;
+            const float* extremum = suffix + static_cast<size_t>(y) * stride;
+            for (int j = 0; j < stride; j++) {
+                window[j] = Operation::apply(extremum[j], line[j]);
+            }
+        }
+    }
+}
+
+}
+
+
+bool runMedianFilter(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                int windowSize,
+                BorderMode border,
+                bool multithread)
+{
+    if (windowSize <= 0 || windowSize % 2 == 0) {
+        std::cerr << "Median window size must be odd and positive" << std::endl;
+        return false;
+    }
+    if (!haveSamePlaneSize(sourceImages, outImages, planes)) {
+        std::cerr << "Output image size mismatch" << std::endl;
+        return false;
+    }
+
+    TRACE_SCOPE("runMedianFilter");
+
+    const int width = sourceImages[0].getWidth();
+    const int height = sourceImages[0].getHeight();
+    const int radius = windowSize / 2;
+    const int paddedWidth = width + 2 * radius;
+    // Smallest level whose count, with the levels below, reaches half of the window
+    const int rank = (windowSize * windowSize + 1) / 2;
+
+    std::vector<int> columnIndex(paddedWidth);
+    for (int j = 0; j < paddedWidth; j++) {
+        columnIndex[j] = getBorderIndex(j - radius, width, border);
+    }
+
+    const int rowBlocks = (height + RANK_ROW_BLOCK - 1) / RANK_ROW_BLOCK;
+    runTasks(rowBlocks * planes, [&](int task) {
+        const int plane = task / rowBlocks;
+        const int startRow = (task % rowBlocks) * RANK_ROW_BLOCK;
+        const int rows = std::min(RANK_ROW_BLOCK, height - startRow);
+        const int paddedRows = rows + 2 * radius;
+        const ConstImageView& source = sourceImages[plane];
+        const ImageView& out = outImages[plane];
+
+        // Levels of the rows read by the block, extended by the border mode
+        std::vector<uint8_t>& levels = getRankBuffers().levels;
+        levels.resize(static_cast<size_t>(paddedRows) * paddedWidth);
+        for (int i = 0; i < paddedRows; i++) {
+            uint8_t* levelRow = levels.data() + static_cast<size_t>(i) * paddedWidth;
+            const int y = getBorderIndex(startRow + i - radius, height, border);
+            if (y < 0) {
+                std::fill(levelRow, levelRow + paddedWidth, 0);
+                continue;
+            }
+
+            const float* sourceRow = source.getRow(y);
+            for (int j = 0; j < paddedWidth; j++) {
+                const int x = columnIndex[j];
+                levelRow[j] = x < 0 ? 0 : toLevel(sourceRow[x]);
+            }
+        }
+
+        int histogram[RANK_LEVELS];
+        for (int r = 0; r < rows; r++) {
+            const uint8_t* window = levels.data() + static_cast<size_t>(r) * paddedWidth;
+            float* outRow = out.getRow(startRow + r);
+
+            std::fill(histogram, histogram + RANK_LEVELS, 0);
+            for (int i = 0; i < windowSize; i++) {
+                const uint8_t* levelRow = window + static_cast<size_t>(i) * paddedWidth;
+                for (int j = 0; j < windowSize; j++) {
+                    histogram[levelRow[j]]++;
+                }
+            }
+
+            // below counts the window values lower than the median level
+            int median = 0;
+            int below = 0;
+            while (below + histogram[median] < rank) {
+                below += histogram[median];
+                median++;
+            }
+            outRow[0] = static_cast<float>(median);
+
+            for (int x = 1; x < width; x++) {
+                const uint8_t* leaving = window + x - 1;
+                const uint8_t* entering = window + x + windowSize - 1;
+                for (int i = 0; i < windowSize; i++) {
+                    const uint8_t oldLevel = leaving[static_cast<size_t>(i) * paddedWidth];
+                    const uint8_t newLevel = entering[static_cast<size_t>(i) * paddedWidth];
+                    histogram[oldLevel]--;
+                    histogram[newLevel]++;
+                    below += (newLevel < median) - (oldLevel < median);
+                }
+
+                while (below >= rank) {
+                    median--;
+                    below -= histogram[median];
+                }
+                while (below + histogram[median] < rank) {
+                    below += histogram[median];
+                    median++;
+                }
+                outRow[x] = static_cast<float>(median);
+            }
+        }
+    }, multithread);
+
+    return true;
+}
+
+bool runMorphologyFilter(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                int windowWidth, int windowHeight,
+                MorphologyOperation operation,
+                BorderMode border,
+                bool multithread,
+                Workspace* workspace)
+{
+    if (windowWidth <= 0 || windowHeight <= 0 || windowWidth % 2 == 0 || windowHeight % 2 == 0) {
+        std::cerr << "Morphology window sizes must be odd and positive" << std::endl;
+        return false;
+    }
+    if (!haveSamePlaneSize(sourceImages, outImages, planes)) {
+        std::cerr << "Output image size mismatch" << std::endl;
+        return false;
+    }
+
+    TRACE_SCOPE("runMorphologyFilter");
+
+    Workspace localWorkspace;
+    if (workspace == nullptr) {
+        workspace = &localWorkspace;
+    }
+
+    const int width = sourceImages[0].getWidth();
+    const int height = sourceImages[0].getHeight();
+    const int radiusX = windowWidth / 2;
+    const int radiusY = windowHeight / 2;
+    const int paddedWidth = width + 2 * radiusX;
+    const int paddedHeight = height + 2 * radiusY;
+    auto lineFilter = operation == MorphologyOperation::ERODE ? vanHerkLines<MinOperation>
+                                                              : vanHerkLines<MaxOperation>;
+
+    std::vector<ImageView> rowPass(planes);
+    for (int plane = 0; plane < planes; plane++) {
+        rowPass[plane] = workspace->getPlane(WorkspaceBuffer::ROW_PASS, plane, width, height);
+    }
+
+    std::vector<int> columnIndex(paddedWidth);
+    for (int j = 0; j < paddedWidth; j++) {
+        columnIndex[j] = getBorderIndex(j - radiusX, width, border);
+    }
+
+    // Rows pass, from the source to the rows pass planes: the rows of a
+    // block are transposed, so that the passes run across them
+    const int rowBlocks = (height + RANK_ROW_BLOCK - 1) / RANK_ROW_BLOCK;
+    runTasks(rowBlocks * planes, [&](int task) {
+        const int plane = task / rowBlocks;
+        const int startRow = (task % rowBlocks) * RANK_ROW_BLOCK;
+        const int rows = std::min(RANK_ROW_BLOCK, height - startRow);
+        const ConstImageView& source = sourceImages[plane];
+
+        RankBuffers& buffers = getRankBuffers();
+        buffers.lines.resize(static_cast<size_t>(paddedWidth) * rows);
+        buffers.suffix.resize(buffers.lines.size());
+        float* lines = buffers.lines.data();
+
+        for (int r = 0; r < rows; r++) {
+            const float* sourceRow = source.getRow(startRow + r);
+            for (int i = 0; i < paddedWidth; i++) {
+                const int x = columnIndex[i];
+                lines[static_cast<size_t>(i) * rows + r] = x < 0 ? 0.0f : sourceRow[x];
+            }
+        }
+
+        lineFilter(lines, paddedWidth, rows, windowWidth, buffers.suffix.data());
+
+        for (int r = 0; r < rows; r++) {
+            float* passRow = rowPass[plane].getRow(startRow + r);
+            for (int x = 0; x < width; x++) {
+                passRow[x] = lines[static_cast<size_t>(x) * rows + r];
+            }
+        }
+    }, multithread);
+
+    // Columns pass, from the rows pass planes to the output
+    const int columnStrips = (width + RANK_COLUMN_STRIP - 1) / RANK_COLUMN_STRIP;
+    runTasks(columnStrips * planes, [&](int task) {
+        const int plane = task / columnStrips;
+        const int startCol = (task % columnStrips) * RANK_COLUMN_STRIP;
+        const int cols = std::min(RANK_COLUMN_STRIP, width - startCol);
+        const ImageView& out = outImages[plane];
+
+        RankBuffers& buffers = getRankBuffers();
+        buffers.lines.resize(static_cast<size_t>(paddedHeight) * cols);
+        buffers.suffix.resize(buffers.lines.size());
+        float* lines = buffers.lines.data();
+
+        for (int i = 0; i < paddedHeight; i++) {
+            const int y = getBorderIndex(i - radiusY, height, border);
+            float* line = lines + static_cast<size_t>(i) * cols;
+            if (y >= 0) {
+                const float* passRow = rowPass[plane].getRow(y) + startCol;
+                std::copy(passRow, passRow + cols, line);
+            }
+            else {
+                std::fill(line, line + cols, 0.0f);
+            }
+        }
+
+        lineFilter(lines, paddedHeight, cols, windowHeight, buffers.suffix.data());
+
+        for (int y = 0; y < height; y++) {
+            const float* line = lines + static_cast<size_t>(y) * cols;
+            std::copy(line, line + cols, out.getRow(y) + startCol);
+        }
+    }, multithread);
+
+    return true;
+}
@@ -0,0 +1,73 @@
+#ifndef RANK_FILTER_H_
+#define RANK_FILTER_H_
+
+#include "border_mode.h"
+#include "image_buffer.h"
+#include "workspace.h"
+
+/*
+ * Operation of runMorphologyFilter on the window of each pixel
+ */
+enum class MorphologyOperation
+{
+    ERODE,          ///< Minimum of the window
+    DILATE          ///< Maximum of the window
+};
+
+/*
+ * @brief: This function will compute the median of the
+ *         windowSize x windowSize window centered on each pixel with
+ *         the sliding histogram of Huang, Yang and Tang ("A fast
+ *         two-dimensional median filtering algorithm", 1979): the
+ *         256-level histogram of a window is moved along the row by
+ *         removing its left column and adding the right one, and the
+ *         median level is moved from the previous one. A pixel costs
+ *         2 * windowSize histogram updates instead of a sort of
+ *         windowSize^2 values. The pixels are rounded to the 8-bit
+ *         levels, the outputs are levels.
+ *
+ * @param: planes: number of source and output views, the channels
+ *         of an image. The output views must not be the source views.
+ * @param: windowSize: odd window size
+ * @param: multithread: the blocks of rows are split among the thread
+ *         pool threads, otherwise run on the calling thread
+ * @return: true if successful, false otherwise
+ */
+bool runMedianFilter(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                int windowSize,
+                BorderMode border,
+                bool multithread);
+
+/*
+ * @brief: This function will compute the minimum (erosion) or the
+ *         maximum (dilation) of the windowWidth x windowHeight window
+ *         centered on each pixel, along the rows, then along the
+ *         columns, with the algorithm of van Herk and Gil-Werman:
+ *         each line is cut in segments of the window size, whose
+ *         prefix and suffix extrema give any window as the extremum
+ *         of two values. A pixel costs 3 comparisons per pass,
+ *         whatever the window size. The pixels outside of the image
+ *         are given by the border mode, zero for BorderMode::ZERO.
+ *
+ * @param: planes: number of source and output views, the channels
+ *         of an image. The output views may be the source views.
+ * @param: windowWidth, windowHeight: odd window sizes
+ * @param: multithread: the rows, then the column strips, are split
+ *         among the thread pool threads, otherwise run on the calling thread
+ * @param: workspace: holds the rows pass planes (ROW_PASS),
+ *         allocated by the call if nullptr
+ * @return: true if successful, false otherwise
+ */
+bool runMorphologyFilter(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                int windowWidth, int windowHeight,
+                MorphologyOperation operation,
+                BorderMode border,
+                bool multithread,
+                Workspace* workspace = nullptr);
+
+
+#endif /* RANK_FILTER_H_ */
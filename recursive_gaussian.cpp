@@ -0,0 +1,240 @@
+#include <iostream>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "recursive_gaussian.h"
+#include "cpu_convolution.h"
+#include "simd_convolution.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// Lines filtered together by a task: the recursions run across them,
+// so that each step is a vector operation
+#define RECURSIVE_ROW_BLOCK     16
+#define RECURSIVE_COLUMN_STRIP  64
+// The interleaved lines are padded to a multiple of the widest vector
+#define RECURSIVE_LANES         16
+
+
+namespace {
+
+/*
+ * Line buffer of a thread, kept across the calls
+ */
+struct RecursiveBuffers
+{
+    std::vector<float> lines;
+};
+
+RecursiveBuffers& getRecursiveBuffers()
+{
+    thread_local RecursiveBuffers buffers;
+    return buffers;
+}
+
+/*
+ * @brief: return the interleaving stride of count lines
+ */
+inline int getLaneStride(int count)
+{
+    return (count + RECURSIVE_LANES - 1) / RECURSIVE_LANES * RECURSIVE_LANES;
+}
+
+/*
+ * @brief: compute the coefficients of Young and van Vliet,
+ *         "Recursive implementation of the Gaussian filter" (1995),
+ *         normalized as in recursiveLines (simd_convolution.h)
+ */
+void getCoefficients(float sigma, float* coefficients)
+{
+    double q;
+    if (sigma >= 2.5f) {
+        q = 0.98711 * sigma - 0.96330;
+    }
+    else {
+        q = 3.97156 - 4.14554 * std::sqrt(1.0 - 0.26891 * sigma);
+    }
+
+    const double q2 = q * q;
+    const double q3 = q2 * q;
+    const double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+    const double b1 = 2.44413 * q + 2.85619 * q2 + 1.26661 * q3;
+    const double b2 = -(1.4281 * q2 + 1.26661 * q3);
+    const double b3 = 0.422205 * q3;
+
+    coefficients[0] = static_cast<float>(1.0 - (b1 + b2 + b3) / b0);
+    coefficients[1] = static_cast<float>(b1 / b0);
+    coefficients[2] = static_cast<float>(b2 / b0);
+    coefficients[3] = static_cast<float>(b3 / b0);
+}
+
+/*
+ * @brief: scalar recursion, fallback of the vector units
+ */
+void recursiveLinesScalar(float* lines, int length, int stride, const float* c)
+{
+    for (int j = 0; j < stride; j++) {
+        float* line = lines + j;
+        float w1 = line[0];
+        float w2 = w1;
+        float w3 = w1;
+        for (int i = 0; i < length; i++) {
+            float& sample = line[static_cast<size_t>(i) * stride];
+            sample = c[0] * sample + c[1] * w1 + c[2] * w2 + c[3] * w3;
+            w3 = w2;
+            w2 = w1;
+            w1 = sample;
+        }
+
+        w1 = w2 = w3 = line[static_cast<size_t>(length - 1) * stride];
+        for (int i = length - 1; i >= 0; i--) {
+            float& sample = line[static_cast<size_t>(i) * stride];
+            sample = c[0] * sample + c[1] * w1 + c[2] * w2 + c[3] * w3;
+            w3 = w2;
+            w2 = w1;
+            w1 = sample;
+        }
+    }
+}
+
+/*
+ * @brief: return the recursion of the instruction set selected
+ *         for the convolution (see getCpuIsa)
+ */
+RecursiveLinesFunction getRecursiveLines()
+{
+    switch (getCpuIsa()) {
+        case CpuIsa::AVX512:
+            return getRecursiveLinesAvx512();
+
+        case CpuIsa::AVX2:
+            return getRecursiveLinesAvx2();
+
+        case CpuIsa::SSE:
+            return getRecursiveLinesSse();
+
+        default:
+            return recursiveLinesScalar;
+    }
+}
+}
+
+
+bool runRecursiveGaussian(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                float sigma,
+                BorderMode border,
+                bool multithread)
+{
+    if (!(sigma >= RECURSIVE_GAUSSIAN_MIN_SIGMA)) {
+        std::cerr << "Recursive Gaussian needs a standard deviation of at least "
+                  << RECURSIVE_GAUSSIAN_MIN_SIGMA << std::endl;
+        return false;
+    }
+    if (!haveSamePlaneSize(sourceImages, outImages, planes)) {
+        std::cerr << "Output image size mismatch" << std::endl;
+        return false;
+    }
+
+    TRACE_SCOPE("runRecursiveGaussian");
+
+    TRACE_STATUS("Starting recursive Gaussian, sigma " << sigma);
+
+    const int width = sourceImages[0].getWidth();
+    const int height = sourceImages[0].getHeight();
+    float coefficients[4];
+    getCoefficients(sigma, coefficients);
+    const RecursiveLinesFunction recursiveLines = getRecursiveLines();
+
+    // Samples read beyond each end of a line: the passes start
+    // from the steady state of the outermost one
+    const int pad = static_cast<int>(std::ceil(4.0f * sigma)) + 3;
+    const int paddedWidth = width + 2 * pad;
+    const int paddedHeight = height + 2 * pad;
+
+    // Rows pass, from the source to the output planes
+    std::vector<int> columnIndex(paddedWidth);
+    for (int i = 0; i < paddedWidth; i++) {
+        columnIndex[i] = getBorderIndex(i - pad, width, border);
+    }
+
+    const int rowBlocks = (height + RECURSIVE_ROW_BLOCK - 1) / RECURSIVE_ROW_BLOCK;
+    auto filterRows = [&](int task) {
+        const int plane = task / rowBlocks;
+        const int startRow = (task % rowBlocks) * RECURSIVE_ROW_BLOCK;
+        const int rows = std::min(RECURSIVE_ROW_BLOCK, height - startRow);
+        const ConstImageView& source = sourceImages[plane];
+        const ImageView& out = outImages[plane];
+
+        const int stride = getLaneStride(rows);
+
+        std::vector<float>& lines = getRecursiveBuffers().lines;
+        lines.resize(static_cast<size_t>(paddedWidth) * stride);
+        if (rows < stride) {
+            std::fill(lines.begin(), lines.end(), 0.0f);
+        }
+
+        // The rows are transposed, so that the recursion runs across them
+        for (int r = 0; r < rows; r++) {
+            const float* sourceRow = source.getRow(startRow + r);
+            float* line = lines.data() + r;
+            for (int i = 0; i < paddedWidth; i++) {
+                const int x = columnIndex[i];
+                line[static_cast<size_t>(i) * stride] = x < 0 ? 0.0f : sourceRow[x];
+            }
+        }
+
+        recursiveLines(lines.data(), paddedWidth, stride, coefficients);
+
+        for (int r = 0; r < rows; r++) {
+            float* outRow = out.getRow(startRow + r);
+            const float* sample = lines.data() + static_cast<size_t>(pad) * stride + r;
+            for (int x = 0; x < width; x++) {
+                outRow[x] = sample[static_cast<size_t>(x) * stride];
+            }
+        }
+    };
+
+    // Columns pass, in place on the output planes: each strip of
+    // columns is read before being written
+    const int columnStrips = (width + RECURSIVE_COLUMN_STRIP - 1) / RECURSIVE_COLUMN_STRIP;
+    auto filterColumns = [&](int task) {
+        const int plane = task / columnStrips;
+        const int startCol = (task % columnStrips) * RECURSIVE_COLUMN_STRIP;
+        const int cols = std::min(RECURSIVE_COLUMN_STRIP, width - startCol);
+        const ImageView& out = outImages[plane];
+
+        const int stride = getLaneStride(cols);
+
+        std::vector<float>& lines = getRecursiveBuffers().lines;
+        lines.resize(static_cast<size_t>(paddedHeight) * stride);
+
+        for (int i = 0; i < paddedHeight; i++) {
+            const int y = getBorderIndex(i - pad, height, border);
+            float* line = lines.data() + static_cast<size_t>(i) * stride;
+            if (y >= 0) {
+                std::copy(out.getRow(y) + startCol, out.getRow(y) + startCol + cols, line);
+                std::fill(line + cols, line + stride, 0.0f);
+            }
+            else {
+                std::fill(line, line + stride, 0.0f);
+            }
+        }
+
+        recursiveLines(lines.data(), paddedHeight, stride, coefficients);
+
+        for (int y = 0; y < height; y++) {
+            float* outRow = out.getRow(y) + startCol;
+            const float* sample = lines.data() + static_cast<size_t>(y + pad) * stride;
+            for (int x = 0; x < cols; x++) {
+                outRow[x] = std::min(std::max(sample[x], 0.0f), 255.0f);
+            }
+        }
+    };
+
+    runTasks(rowBlocks * planes, filterRows, multithread);
+    runTasks(columnStrips * planes, filterColumns, multithread);
+
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef RECURSIVE_GAUSSIAN_H_
+#define RECURSIVE_GAUSSIAN_H_
+
+#include "border_mode.h"
+#include "image_buffer.h"
+
+// Smallest standard deviation the recursive approximation is defined for
+#define RECURSIVE_GAUSSIAN_MIN_SIGMA    0.5f
+
+/*
+ * @brief: This function will approximate the Gaussian blur of
+ *         standard deviation sigma with the third order recursive
+ *         filter of Young and van Vliet: a causal and an anti-causal
+ *         pass along the rows, then along the columns. The cost per
+ *         pixel is the same for any sigma, there is no kernel matrix.
+ *         The lines are extended by about 4 sigma according to the
+ *         border mode before the passes.
+ *         Against the direct convolution with a normalized
+ *         (6 sigma + 1)^2 Gaussian kernel, on the README test image,
+ *         the error is at most 6.5 gray levels for sigma >= 1.5, or
+ *         8.3 with BorderMode::ZERO, whose borders are steps down to 0
+ *         (RMS below 1.6 in every mode). It grows up to 22 levels at
+ *         sigma 0.5, where the coefficients are the coarsest: the
+ *         direct kernel is small there anyway (see README).
+ *
+ * @param: planes: number of source and output views, the channels
+ *         of an image
+ * @param: multithread: the lines of each pass are split among the
+ *         thread pool threads, otherwise run on the calling thread
+ * @return: true if successful, false if sigma is too small or the
+ *          sizes differ
+ */
+bool runRecursiveGaussian(const ConstImageView* sourceImages,
+                const ImageView* outImages,
+                int planes,
+                float sigma,
+                BorderMode border,
+                bool multithread);
+
+
+#endif /* RECURSIVE_GAUSSIAN_H_ */
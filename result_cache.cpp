@@ -0,0 +1,524 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <iterator>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include "result_cache.h"
+#include "trace.h"
+
+// Changing the key material or the file layout invalidates the stored results
+#define CACHE_KEY_VERSION       2
+#define CACHE_FILE_MAGIC        "KCRESLT1"
+#define CACHE_FILE_EXTENSION    ".kcr"
+
+/*
+ * Header of a result file, followed by the rows of each channel
+ */
+struct CacheFileHeader
+{
+    char magic[8];
+    uint64_t key;
+    int32_t width;
+    int32_t height;
+    int32_t channels;
+    int32_t format;         ///< PixelFormat
+};
+
+// XXH64 constants
+static const uint64_t HASH_PRIME1 = 11400714785074694791ULL;
+static const uint64_t HASH_PRIME2 = 14029467366897019727ULL;
+static const uint64_t HASH_PRIME3 = 1609587929392839161ULL;
+static const uint64_t HASH_PRIME4 = 9650029242287828579ULL;
+static const uint64_t HASH_PRIME5 = 2870177450012600261ULL;
+
+static inline uint64_t rotateLeft(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t readWord(const uint8_t* data)
+{
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+static inline uint64_t hashRound(uint64_t accumulator, uint64_t input)
+{
+    accumulator += input * HASH_PRIME2;
+    return rotateLeft(accumulator, 31) * HASH_PRIME1;
+}
+
+static inline uint64_t hashMerge(uint64_t hash, uint64_t lane)
+{
+    hash ^= hashRound(0, lane);
+    return hash * HASH_PRIME1 + HASH_PRIME4;
+}
+
+/*
+ * @brief: hash size bytes with XXH64: four independent lanes of 8 bytes
+ *         words, several GB/s on a core. Chained calls pass the previous
+ *         hash as seed.
+ */
+static uint64_t hashBytes(const void* data, size_t size, uint64_t seed)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    const uint8_t* end = bytes + size;
+    uint64_t hash;
+
+    if (size >= 32) {
+        uint64_t lane1 = seed + HASH_PRIME1 + HASH_PRIME2;
+        uint64_t lane2 = seed + HASH_PRIME2;
+        uint64_t lane3 = seed;
+        uint64_t lane4 = seed - HASH_PRIME1;
+
+        for (; bytes + 32 <= end; bytes += 32) {
+            lane1 = hashRound(lane1, readWord(bytes));
+            lane2 = hashRound(lane2, readWord(bytes + 8));
+            lane3 = hashRound(lane3, readWord(bytes + 16));
+            lane4 = hashRound(lane4, readWord(bytes + 24));
+        }
+
+        hash = rotateLeft(lane1, 1) + rotateLeft(lane2, 7) +
+               rotateLeft(lane3, 12) + rotateLeft(lane4, 18);
+        hash = hashMerge(hash, lane1);
+        hash = hashMerge(hash, lane2);
+        hash = hashMerge(hash, lane3);
+        hash = hashMerge(hash, lane4);
+    }
+    else {
+        hash = seed + HASH_PRIME5;
+    }
+
+    hash += size;
+
+    for (; bytes + 8 <= end; bytes += 8) {
+        hash ^= hashRound(0, readWord(bytes));
+        hash = rotateLeft(hash, 27) * HASH_PRIME1 + HASH_PRIME4;
+    }
+    if (bytes + 4 <= end) {
+        uint32_t half;
+        memcpy(&half, bytes, sizeof(half));
+        hash ^= half * HASH_PRIME1;
+        hash = rotateLeft(hash, 23) * HASH_PRIME2 + HASH_PRIME3;
+        bytes += 4;
+    }
+    for (; bytes < end; bytes++) {
+        hash ^= *bytes * HASH_PRIME5;
+        hash = rotateLeft(hash, 11) * HASH_PRIME1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+/*
+ * @brief: return the bytes of a row of the image
+ */
+static size_t getRowSize(const Image& image)
+{
+    size_t pixelSize = image.getPixelFormat() == PixelFormat::UINT8 ? sizeof(uint8_t) : sizeof(float);
+    return pixelSize * image.getImageWidth();
+}
+
+/*
+ * @brief: return the first byte of a row of a channel, owned or mapped
+ */
+static const void* getRow(const Image& image, int channel, int y)
+{
+    if (image.getPixelFormat() == PixelFormat::UINT8) {
+        return image.getImageView8(channel).getRow(y);
+    }
+
+    return image.getImageView(channel).getRow(y);
+}
+
+/*
+ * @brief: return the pixel bytes of an image
+ */
+static size_t getImageSize(const Image& image)
+{
+    return getRowSize(image) * image.getImageHeight() * image.getImageChannels();
+}
+
+/*
+ * @brief: parse the key of a result file name, 16 hexadecimal digits
+ *         and the extension
+ *
+ * @return: true if successful, false otherwise
+ */
+static bool parseFileName(const std::string& name, uint64_t& key)
+{
+    if (name.size() != 16 + strlen(CACHE_FILE_EXTENSION) ||
+        name.compare(16, std::string::npos, CACHE_FILE_EXTENSION) != 0) {
+        return false;
+    }
+
+    key = 0;
+    for (int i = 0; i < 16; i++) {
+        char digit = name[i];
+        if (digit >= '0' && digit <= '9') {
+            key = (key << 4) | (digit - '0');
+        }
+        else if (digit >= 'a' && digit <= 'f') {
+            key = (key << 4) | (digit - 'a' + 10);
+        }
+        else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+ResultCache::ResultCache()
+{
+    // No memory tier by default: its hits would be reported as filtering times
+    m_memoryBudget = 0;
+    m_diskBudget = 0;
+    m_stats = {0, 0, 0, 0, 0, 0, 0, 0};
+}
+
+ResultCache& ResultCache::getInstance()
+{
+    static ResultCache cache;
+    return cache;
+}
+
+uint64_t ResultCache::getKey(const Image& source, const FilterPipeline& pipeline,
+                             CudaMemType cudaType, FilterAlgorithm algorithm)
+{
+    TRACE_SCOPE("ResultCache::getKey");
+
+    int32_t parameters[] = {
+        CACHE_KEY_VERSION,
+        source.getImageWidth(),
+        source.getImageHeight(),
+        source.getImageChannels(),
+        static_cast<int32_t>(source.getPixelFormat()),
+        static_cast<int32_t>(source.getBorderMode()),
+        static_cast<int32_t>(cudaType),
+        static_cast<int32_t>(algorithm),
+        pipeline.getCollapseLinear() ? 1 : 0,
+        pipeline.getKernelCount()
+    };
+    uint64_t hash = hashBytes(parameters, sizeof(parameters), 0);
+
+    for (int i = 0; i < pipeline.getKernelCount(); i++) {
+        const Kernel& kernel = pipeline.getKernel(i);
+        int32_t size[] = {kernel.getKernelWidth(), kernel.getKernelHeight()};
+        hash = hashBytes(size, sizeof(size), hash);
+        hash = hashBytes(kernel.getKernel().data(), kernel.getKernel().size() * sizeof(float), hash);
+    }
+
+    // Row by row: the padding at the end of the rows is not part of the image
+    size_t rowSize = getRowSize(source);
+    for (int c = 0; c < source.getImageChannels(); c++) {
+        for (int y = 0; y < source.getImageHeight(); y++) {
+            hash = hashBytes(getRow(source, c, y), rowSize, hash);
+        }
+    }
+
+    return hash;
+}
+
+void ResultCache::setMemoryBudget(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_memoryBudget = bytes;
+    while (!m_memoryEntries.empty() && m_stats.memoryBytes > m_memoryBudget) {
+        m_stats.memoryBytes -= m_memoryEntries.back().bytes;
+        m_memoryIndex.erase(m_memoryEntries.back().key);
+        m_memoryEntries.pop_back();
+        m_stats.memoryEvictions++;
+    }
+}
+
+bool ResultCache::setDiskTier(const std::string& directory, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_directory.clear();
+    m_diskEntries.clear();
+    m_diskIndex.clear();
+    m_stats.diskBytes = 0;
+
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Unable to create the cache directory " << directory << std::endl;
+        return false;
+    }
+
+    DIR* folder = opendir(directory.c_str());
+    if (folder == nullptr) {
+        std::cerr << "Unable to open the cache directory " << directory << std::endl;
+        return false;
+    }
+
+    m_directory = directory;
+    if (m_directory.back() != '/') {
+        m_directory += '/';
+    }
+    m_diskBudget = bytes;
+
+    // Files of previous runs, ordered by last use
+    std::vector<std::pair<time_t, DiskEntry>> files;
+    struct dirent* entry;
+    while ((entry = readdir(folder)) != nullptr) {
+        uint64_t key;
+        struct stat status;
+        if (parseFileName(entry->d_name, key) &&
+            stat((m_directory + entry->d_name).c_str(), &status) == 0) {
+            files.push_back(std::make_pair(status.st_mtime, DiskEntry{key, static_cast<size_t>(status.st_size)}));
+        }
+    }
+    closedir(folder);
+
+    std::sort(files.begin(), files.end(),
+              [](const std::pair<time_t, DiskEntry>& a, const std::pair<time_t, DiskEntry>& b) {
+                  return a.first > b.first;
+              });
+    for (const auto& file : files) {
+        m_diskEntries.push_back(file.second);
+        m_diskIndex[file.second.key] = std::prev(m_diskEntries.end());
+        m_stats.diskBytes += file.second.bytes;
+    }
+
+    while (!m_diskEntries.empty() && m_stats.diskBytes > m_diskBudget) {
+        unlink(getFilePath(m_diskEntries.back().key).c_str());
+        m_stats.diskBytes -= m_diskEntries.back().bytes;
+        m_diskIndex.erase(m_diskEntries.back().key);
+        m_diskEntries.pop_back();
+        m_stats.diskEvictions++;
+    }
+
+    return true;
+}
+
+bool ResultCache::isEnabled() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return m_memoryBudget > 0 || !m_directory.empty();
+}
+
+bool ResultCache::lookup(uint64_t key, Image& result)
+{
+    TRACE_SCOPE("ResultCache::lookup");
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto cached = m_memoryIndex.find(key);
+    if (cached != m_memoryIndex.end()) {
+        m_memoryEntries.splice(m_memoryEntries.begin(), m_memoryEntries, cached->second);
+        result = cached->second->image;
+        m_stats.memoryHits++;
+        return true;
+    }
+
+    // Files written by other processes are not indexed yet: the
+    // file of the key is looked for in any case
+    if (!m_directory.empty() && loadDisk(key, result)) {
+        storeMemory(key, result);
+        m_stats.diskHits++;
+        return true;
+    }
+
+    m_stats.misses++;
+
+    return false;
+}
+
+void ResultCache::store(uint64_t key, const Image& result)
+{
+    TRACE_SCOPE("ResultCache::store");
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_memoryIndex.count(key) > 0) {
+        return;
+    }
+
+    storeMemory(key, result);
+    if (!m_directory.empty()) {
+        storeDisk(key, result);
+    }
+    m_stats.stores++;
+}
+
+ResultCacheStats ResultCache::getStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return m_stats;
+}
+
+void ResultCache::printStats() const
+{
+    if (!isEnabled()) {
+        return;
+    }
+
+    ResultCacheStats stats = getStats();
+    std::cout << "Result cache: " << stats.memoryHits << " memory hits, "
+              << stats.diskHits << " disk hits, "
+              << stats.misses << " misses, "
+              << stats.memoryEvictions + stats.diskEvictions << " evictions ("
+              << stats.memoryBytes / 1024 << " KiB in memory, "
+              << stats.diskBytes / 1024 << " KiB on disk)" << std::endl;
+}
+
+void ResultCache::storeMemory(uint64_t key, const Image& result)
+{
+    size_t bytes = getImageSize(result);
+    if (bytes > m_memoryBudget || m_memoryIndex.count(key) > 0) {
+        return;
+    }
+
+    while (!m_memoryEntries.empty() && m_stats.memoryBytes + bytes > m_memoryBudget) {
+        m_stats.memoryBytes -= m_memoryEntries.back().bytes;
+        m_memoryIndex.erase(m_memoryEntries.back().key);
+        m_memoryEntries.pop_back();
+        m_stats.memoryEvictions++;
+    }
+
+    m_memoryEntries.push_front(MemoryEntry{key, result, bytes});
+    m_memoryIndex[key] = m_memoryEntries.begin();
+    m_stats.memoryBytes += bytes;
+}
+
+void ResultCache::storeDisk(uint64_t key, const Image& result)
+{
+    size_t bytes = sizeof(CacheFileHeader) + getImageSize(result);
+    if (bytes > m_diskBudget) {
+        return;
+    }
+
+    CacheFileHeader header;
+    memcpy(header.magic, CACHE_FILE_MAGIC, sizeof(header.magic));
+    header.key = key;
+    header.width = result.getImageWidth();
+    header.height = result.getImageHeight();
+    header.channels = result.getImageChannels();
+    header.format = static_cast<int32_t>(result.getPixelFormat());
+
+    // Written aside and renamed: readers never see a partial file
+    std::string path = getFilePath(key);
+    std::string temporaryPath = path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream file(temporaryPath, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        size_t rowSize = getRowSize(result);
+        for (int c = 0; c < result.getImageChannels(); c++) {
+            for (int y = 0; y < result.getImageHeight(); y++) {
+                file.write(static_cast<const char*>(getRow(result, c, y)), rowSize);
+            }
+        }
+
+        if (!file) {
+            std::cerr << "Unable to write the cache file " << temporaryPath << std::endl;
+            file.close();
+            unlink(temporaryPath.c_str());
+            return;
+        }
+    }
+
+    if (rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        unlink(temporaryPath.c_str());
+        return;
+    }
+
+    touchDisk(key, bytes);
+
+    while (m_diskEntries.size() > 1 && m_stats.diskBytes > m_diskBudget) {
+        unlink(getFilePath(m_diskEntries.back().key).c_str());
+        m_stats.diskBytes -= m_diskEntries.back().bytes;
+        m_diskIndex.erase(m_diskEntries.back().key);
+        m_diskEntries.pop_back();
+        m_stats.diskEvictions++;
+    }
+}
+
+bool ResultCache::loadDisk(uint64_t key, Image& result)
+{
+    std::string path = getFilePath(key);
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    CacheFileHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || memcmp(header.magic, CACHE_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.key != key || header.width <= 0 || header.height <= 0 ||
+        header.channels < 1 || header.channels > 4) {
+        return false;
+    }
+
+    bool loaded = false;
+    if (header.format == static_cast<int32_t>(PixelFormat::UINT8)) {
+        std::vector<ImageBuffer8> planes;
+        for (int c = 0; c < header.channels; c++) {
+            planes.emplace_back(header.width, header.height);
+            for (int y = 0; y < header.height; y++) {
+                file.read(reinterpret_cast<char*>(planes[c].getRow(y)), header.width);
+            }
+        }
+        loaded = file && result.setImage(std::move(planes));
+    }
+    else {
+        std::vector<ImageBuffer> planes;
+        for (int c = 0; c < header.channels; c++) {
+            planes.emplace_back(header.width, header.height);
+            for (int y = 0; y < header.height; y++) {
+                file.read(reinterpret_cast<char*>(planes[c].getRow(y)), header.width * sizeof(float));
+            }
+        }
+        loaded = file && result.setImage(std::move(planes));
+    }
+
+    if (!loaded) {
+        return false;
+    }
+
+    // The modification time orders the files of the next runs
+    utime(path.c_str(), nullptr);
+    touchDisk(key, sizeof(header) + getImageSize(result));
+
+    return true;
+}
+
+void ResultCache::touchDisk(uint64_t key, size_t bytes)
+{
+    auto indexed = m_diskIndex.find(key);
+    if (indexed != m_diskIndex.end()) {
+        m_stats.diskBytes -= indexed->second->bytes;
+        m_diskEntries.erase(indexed->second);
+    }
+
+    m_diskEntries.push_front(DiskEntry{key, bytes});
+    m_diskIndex[key] = m_diskEntries.begin();
+    m_stats.diskBytes += bytes;
+}
+
+std::string ResultCache::getFilePath(uint64_t key) const
+{
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+
+    return m_directory + name + CACHE_FILE_EXTENSION;
+}
@@ -0,0 +1,162 @@
+#ifndef RESULT_CACHE_H_
+#define RESULT_CACHE_H_
+
+#include <cstdint>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include "image.h"
+#include "filter_pipeline.h"
+
+/*
+ * Counters of the result cache
+ */
+struct ResultCacheStats
+{
+    long long memoryHits;       ///< Lookups served by the memory tier
+    long long diskHits;         ///< Lookups served by the disk tier
+    long long misses;           ///< Lookups found in no tier
+    long long stores;           ///< Results added
+    long long memoryEvictions;  ///< Results dropped from the memory tier
+    long long diskEvictions;    ///< Result files removed from the disk tier
+    size_t memoryBytes;         ///< Pixel bytes held by the memory tier
+    size_t diskBytes;           ///< File bytes held by the disk tier
+};
+
+/*
+ * Filtered images indexed by a hash of what determines them: the source
+ * pixels, the kernels, the border mode, the pixel format, the
+ * filtering device and algorithm and whether the chain may be collapsed
+ * in a single kernel. Results are kept in memory up to a byte budget
+ * (none until setMemoryBudget is called) and,
+ * once a directory is set, in files up to another budget; both tiers
+ * drop the least recently used results first. A result found on disk
+ * is moved back to the memory tier. The disk tier is content addressed,
+ * so processes sharing a directory find the results of each other.
+ * Thread safe.
+ */
+class ResultCache
+{
+    public:
+        ResultCache(const ResultCache&) = delete;
+        ResultCache& operator=(const ResultCache&) = delete;
+
+        /*
+         * @brief: return the process wide cache
+         */
+        static ResultCache& getInstance();
+
+        /*
+         * @brief: return the key of the result of filtering source
+         *         with algorithm on the cudaType device
+         */
+        static uint64_t getKey(const Image& source, const FilterPipeline& pipeline,
+                               CudaMemType cudaType, FilterAlgorithm algorithm);
+
+        /*
+         * @brief: set the size of the memory tier, 0 disables it
+         */
+        void setMemoryBudget(size_t bytes);
+
+        /*
+         * @brief: keep the results in files of directory, created if
+         *         missing, up to bytes. The files already present are
+         *         part of the tier.
+         *
+         * @return: true if successful, false otherwise
+         */
+        bool setDiskTier(const std::string& directory, size_t bytes);
+
+        /*
+         * @brief: return true if a tier can hold results: callers
+         *         skip computing the keys otherwise
+         */
+        bool isEnabled() const;
+
+        /*
+         * @brief: copy the result of key in result
+         *
+         * @return: true if the result is cached, false otherwise
+         */
+        bool lookup(uint64_t key, Image& result);
+
+        /*
+         * @brief: add the result of key to the tiers
+         */
+        void store(uint64_t key, const Image& result);
+
+        /*
+         * @brief: return the counters and the bytes held
+         */
+        ResultCacheStats getStats() const;
+
+        /*
+         * @brief: print the counters of the cache, if enabled
+         */
+        void printStats() const;
+
+    private:
+        ResultCache();
+
+        /*
+         * A result of the memory tier
+         */
+        struct MemoryEntry
+        {
+            uint64_t key;
+            Image image;
+            size_t bytes;       ///< Pixel bytes
+        };
+
+        /*
+         * A result file of the disk tier
+         */
+        struct DiskEntry
+        {
+            uint64_t key;
+            size_t bytes;       ///< File size
+        };
+
+        /*
+         * @brief: add a result to the memory tier, evicting the least
+         *         recently used ones over the budget
+         */
+        void storeMemory(uint64_t key, const Image& result);
+
+        /*
+         * @brief: write a result file, evicting the least recently
+         *         used ones over the budget
+         */
+        void storeDisk(uint64_t key, const Image& result);
+
+        /*
+         * @brief: read the result file of key
+         *
+         * @return: true if successful, false if there is no valid file
+         */
+        bool loadDisk(uint64_t key, Image& result);
+
+        /*
+         * @brief: record a disk tier file as the most recently used
+         */
+        void touchDisk(uint64_t key, size_t bytes);
+
+        /*
+         * @brief: return the path of the result file of key
+         */
+        std::string getFilePath(uint64_t key) const;
+
+        mutable std::mutex m_mutex;                 ///< Protects the members below
+        size_t m_memoryBudget;                      ///< Bytes of the memory tier
+        std::list<MemoryEntry> m_memoryEntries;     ///< Most recently used first
+        std::unordered_map<uint64_t, std::list<MemoryEntry>::iterator> m_memoryIndex;
+        std::string m_directory;                    ///< Disk tier folder, empty if disabled
+        size_t m_diskBudget;                        ///< Bytes of the disk tier
+        std::list<DiskEntry> m_diskEntries;         ///< Most recently used first
+        std::unordered_map<uint64_t, std::list<DiskEntry>::iterator> m_diskIndex;
+        ResultCacheStats m_stats;                   ///< Counters and bytes held
+};
+
+
+#endif /* RESULT_CACHE_H_ */
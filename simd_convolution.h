@@ -0,0 +1,87 @@
+#ifndef SIMD_CONVOLUTION_H_
+#define SIMD_CONVOLUTION_H_
+
+#include <cstdint>
+
+/*
+ * Vectorized row loops used by convolveTile and the separable passes
+ * (cpu_convolution.h), for the interior of the image only: border
+ * pixels are resolved by the callers.
+ * Each instruction set lives in its own translation unit, compiled
+ * with the matching flags: callers must check the CPU support first.
+ * Every output pixel accumulates its taps in the same order as the
+ * scalar loop, with separate multiply and add (no FMA), so results
+ * are the same as the sequential filter.
+ *
+ * convolveRow:     outRow[x] = sum(mask[h][w] * rows[h][x - filterWidth / 2 + w])
+ * horizontalRow:   outRow[x] = sum(coefficients[w] * sourceRow[x - taps / 2 + w])
+ * verticalRow:     outRow[x] = sum(coefficients[h] * rows[h][x])
+ * convolveRowU8:   outRow[x] = (sum(mask[h][w] * rows[h][x - filterWidth / 2 + w])
+ *                              + rounding) >> shift, saturated to 0..255
+ *
+ * The recursive Gaussian (recursive_gaussian.h) uses the same units:
+ *
+ * recursiveLines:  causal then anti-causal third order recursion of
+ *                  interleaved lines, sample i of line j being
+ *                  lines[i * stride + j], stride a multiple of 16:
+ *                  w[i] = c[0] * w[i] + c[1] * w[i -+ 1] + c[2] * w[i -+ 2]
+ *                         + c[3] * w[i -+ 3], from the steady state of
+ *                  the first sample of each pass
+ */
+
+typedef void (*ConvolveRowFunction)(const float* const* rows,
+                float* outRow,
+                const float* mask,
+                int filterWidth, int filterHeight,
+                int startCol, int endCol);
+
+typedef void (*HorizontalRowFunction)(const float* sourceRow,
+                float* outRow,
+                const float* coefficients, int taps,
+                int startCol, int endCol);
+
+typedef void (*VerticalRowFunction)(const float* const* rows,
+                float* outRow,
+                const float* coefficients, int taps,
+                int startCol, int endCol,
+                bool accumulate, bool threshold);
+
+typedef void (*RecursiveLinesFunction)(float* lines,
+                int length, int stride,
+                const float* coefficients);
+
+typedef void (*ConvolveRowU8Function)(const uint8_t* const* rows,
+                uint8_t* outRow,
+                const int16_t* mask,
+                int filterWidth, int filterHeight,
+                int shift,
+                int startCol, int endCol);
+
+/*
+ * Each instruction set returns the row loop for a kernel size: a
+ * fully unrolled specialization for the common sizes (3, 5 and 7 taps
+ * per side), the generic loop otherwise. Select once per image or
+ * tile, not per row.
+ * The 8-bit loop accumulates in int16 when narrow is true (see
+ * Kernel::isFixedPointNarrow), in int32 otherwise.
+ */
+ConvolveRowFunction getConvolveRowSse(int filterWidth, int filterHeight);
+HorizontalRowFunction getHorizontalRowSse(int taps);
+VerticalRowFunction getVerticalRowSse(int taps);
+ConvolveRowU8Function getConvolveRowU8Sse(bool narrow);
+RecursiveLinesFunction getRecursiveLinesSse();
+
+ConvolveRowFunction getConvolveRowAvx2(int filterWidth, int filterHeight);
+HorizontalRowFunction getHorizontalRowAvx2(int taps);
+VerticalRowFunction getVerticalRowAvx2(int taps);
+ConvolveRowU8Function getConvolveRowU8Avx2(bool narrow);
+RecursiveLinesFunction getRecursiveLinesAvx2();
+
+ConvolveRowFunction getConvolveRowAvx512(int filterWidth, int filterHeight);
+HorizontalRowFunction getHorizontalRowAvx512(int taps);
+VerticalRowFunction getVerticalRowAvx512(int taps);
+ConvolveRowU8Function getConvolveRowU8Avx512(bool narrow);
+RecursiveLinesFunction getRecursiveLinesAvx512();
+
+
+#endif /* SIMD_CONVOLUTION_H_ */
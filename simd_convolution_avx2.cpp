@@ -0,0 +1,92 @@
+// Built with -mavx2 (see Makefile)
+#include <immintrin.h>
+#include "simd_convolution.h"
+#include "simd_convolution_impl.h"
+
+namespace {
+
+struct Avx2Vector
+{
+    typedef __m256 Type;
+    static const int WIDTH = 8;
+
+    static inline Type set1(float value) { return _mm256_set1_ps(value); }
+    static inline Type load(const float* ptr) { return _mm256_loadu_ps(ptr); }
+    static inline void store(float* ptr, Type value) { _mm256_storeu_ps(ptr, value); }
+    static inline Type add(Type a, Type b) { return _mm256_add_ps(a, b); }
+    static inline Type mul(Type a, Type b) { return _mm256_mul_ps(a, b); }
+    static inline Type min(Type a, Type b) { return _mm256_min_ps(a, b); }
+    static inline Type max(Type a, Type b) { return _mm256_max_ps(a, b); }
+};
+
+// 16 pixels, int16 lanes
+struct Avx2NarrowAccumulator
+{
+    typedef __m256i Type;
+    static const int WIDTH = 16;
+
+    static inline Type set1(int32_t value) { return _mm256_set1_epi16(static_cast<int16_t>(value)); }
+
+    static inline Type multiplyAdd(Type sum, const uint8_t* source, int16_t coefficient)
+    {
+        const __m256i pixels = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source)));
+        return _mm256_add_epi16(sum, _mm256_mullo_epi16(pixels, _mm256_set1_epi16(coefficient)));
+    }
+
+    static inline void store(uint8_t* dest, Type sum, int shift)
+    {
+        sum = _mm256_sra_epi16(sum, _mm_cvtsi32_si128(shift));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest),
+                         _mm_packus_epi16(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1)));
+    }
+};
+
+// 8 pixels, int32 lanes
+struct Avx2WideAccumulator
+{
+    typedef __m256i Type;
+    static const int WIDTH = 8;
+
+    static inline Type set1(int32_t value) { return _mm256_set1_epi32(value); }
+
+    static inline Type multiplyAdd(Type sum, const uint8_t* source, int16_t coefficient)
+    {
+        const __m256i pixels = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source)));
+        return _mm256_add_epi32(sum, _mm256_mullo_epi32(pixels, _mm256_set1_epi32(coefficient)));
+    }
+
+    static inline void store(uint8_t* dest, Type sum, int shift)
+    {
+        sum = _mm256_sra_epi32(sum, _mm_cvtsi32_si128(shift));
+        const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dest), _mm_packus_epi16(words, words));
+    }
+};
+
+} // namespace
+
+ConvolveRowFunction getConvolveRowAvx2(int filterWidth, int filterHeight)
+{
+    return selectConvolveRow<Avx2Vector>(filterWidth, filterHeight);
+}
+
+HorizontalRowFunction getHorizontalRowAvx2(int taps)
+{
+    return selectHorizontalRow<Avx2Vector>(taps);
+}
+
+VerticalRowFunction getVerticalRowAvx2(int taps)
+{
+    return selectVerticalRow<Avx2Vector>(taps);
+}
+
+ConvolveRowU8Function getConvolveRowU8Avx2(bool narrow)
+{
+    return narrow ? convolveRowU8Simd<Avx2NarrowAccumulator> :
+                    convolveRowU8Simd<Avx2WideAccumulator>;
+}
+
+RecursiveLinesFunction getRecursiveLinesAvx2()
+{
+    return recursiveLinesSimd<Avx2Vector>;
+}
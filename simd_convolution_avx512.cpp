@@ -0,0 +1,70 @@
+// Built with -mavx512f (see Makefile)
+#include <immintrin.h>
+#include "simd_convolution.h"
+#include "simd_convolution_impl.h"
+
+namespace {
+
+struct Avx512Vector
+{
+    typedef __m512 Type;
+    static const int WIDTH = 16;
+
+    static inline Type set1(float value) { return _mm512_set1_ps(value); }
+    static inline Type load(const float* ptr) { return _mm512_loadu_ps(ptr); }
+    static inline void store(float* ptr, Type value) { _mm512_storeu_ps(ptr, value); }
+    static inline Type add(Type a, Type b) { return _mm512_add_ps(a, b); }
+    static inline Type mul(Type a, Type b) { return _mm512_mul_ps(a, b); }
+    static inline Type min(Type a, Type b) { return _mm512_min_ps(a, b); }
+    static inline Type max(Type a, Type b) { return _mm512_max_ps(a, b); }
+};
+
+// 16 pixels, int32 lanes. 16 bit lanes need AVX512BW, so the
+// narrow kernels use this accumulator too.
+struct Avx512Accumulator
+{
+    typedef __m512i Type;
+    static const int WIDTH = 16;
+
+    static inline Type set1(int32_t value) { return _mm512_set1_epi32(value); }
+
+    static inline Type multiplyAdd(Type sum, const uint8_t* source, int16_t coefficient)
+    {
+        const __m512i pixels = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source)));
+        return _mm512_add_epi32(sum, _mm512_mullo_epi32(pixels, _mm512_set1_epi32(coefficient)));
+    }
+
+    static inline void store(uint8_t* dest, Type sum, int shift)
+    {
+        sum = _mm512_sra_epi32(sum, _mm_cvtsi32_si128(shift));
+        sum = _mm512_min_epi32(_mm512_max_epi32(sum, _mm512_setzero_si512()), _mm512_set1_epi32(255));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest), _mm512_cvtepi32_epi8(sum));
+    }
+};
+
+} // namespace
+
+ConvolveRowFunction getConvolveRowAvx512(int filterWidth, int filterHeight)
+{
+    return selectConvolveRow<Avx512Vector>(filterWidth, filterHeight);
+}
+
+HorizontalRowFunction getHorizontalRowAvx512(int taps)
+{
+    return selectHorizontalRow<Avx512Vector>(taps);
+}
+
+VerticalRowFunction getVerticalRowAvx512(int taps)
+{
+    return selectVerticalRow<Avx512Vector>(taps);
+}
+
+ConvolveRowU8Function getConvolveRowU8Avx512(bool)
+{
+    return convolveRowU8Simd<Avx512Accumulator>;
+}
+
+RecursiveLinesFunction getRecursiveLinesAvx512()
+{
+    return recursiveLinesSimd<Avx512Vector>;
+}
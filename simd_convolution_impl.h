@@ -0,0 +1,535 @@
+#ifndef SIMD_CONVOLUTION_IMPL_H_
+#define SIMD_CONVOLUTION_IMPL_H_
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Convolution loops shared by the simd_convolution_*.cpp units.
+ * V is a vector traits struct providing Type, WIDTH and the
+ * set1/load/store/add/mul/min/max operations.
+ * A is an 8-bit accumulator traits struct providing Type, WIDTH,
+ * set1 (accumulator value), multiplyAdd (WIDTH pixels times a
+ * coefficient) and store (shift, saturate to 0..255 and write WIDTH pixels).
+ * Only the per-ISA units include this file: everything has internal
+ * linkage so that code built with wider instruction sets is never
+ * picked by the linker for the other units.
+ */
+
+namespace {
+
+inline float thresholdPixel(float pixelSum)
+{
+    pixelSum = pixelSum < 0 ? 0 : pixelSum;
+    return pixelSum > 255 ? 255 : pixelSum;
+}
+
+/*
+ * Calls f(0), f(1), ..., f(N - 1) without a loop: with N known at
+ * compile time every tap gets its own instructions and constant offsets
+ */
+template <int N>
+struct Unroll
+{
+    template <class F>
+    static inline void run(F& f)
+    {
+        Unroll<N - 1>::run(f);
+        f(N - 1);
+    }
+};
+
+template <>
+struct Unroll<0>
+{
+    template <class F>
+    static inline void run(F&) {}
+};
+
+template <class V>
+void convolveRowSimd(const float* const* rows,
+                float* outRow,
+                const float* mask,
+                int filterWidth, int filterHeight,
+                int startCol, int endCol)
+{
+    typedef typename V::Type Vec;
+    const int n = V::WIDTH;
+    const int s = filterWidth / 2;
+    const Vec zero = V::set1(0.0f);
+    const Vec maxValue = V::set1(255.0f);
+
+    // n adjacent outputs share the same mask coefficient, broadcast once per tap
+    int x = startCol;
+
+    // Two independent accumulators hide the add latency
+    for (; x + 2 * n <= endCol; x += 2 * n) {
+        Vec sum0 = zero;
+        Vec sum1 = zero;
+        for (int h = 0; h < filterHeight; h++) {
+            const float* sourceRow = rows[h] + x - s;
+            const float* maskRow = mask + h * filterWidth;
+            for (int w = 0; w < filterWidth; w++) {
+                const Vec coefficient = V::set1(maskRow[w]);
+                sum0 = V::add(sum0, V::mul(coefficient, V::load(sourceRow + w)));
+                sum1 = V::add(sum1, V::mul(coefficient, V::load(sourceRow + w + n)));
+            }
+        }
+        // Branchless thresholding
+        V::store(outRow + x, V::min(V::max(sum0, zero), maxValue));
+        V::store(outRow + x + n, V::min(V::max(sum1, zero), maxValue));
+    }
+
+    for (; x + n <= endCol; x += n) {
+        Vec sum = zero;
+        for (int h = 0; h < filterHeight; h++) {
+            const float* sourceRow = rows[h] + x - s;
+            const float* maskRow = mask + h * filterWidth;
+            for (int w = 0; w < filterWidth; w++) {
+                sum = V::add(sum, V::mul(V::set1(maskRow[w]), V::load(sourceRow + w)));
+            }
+        }
+        V::store(outRow + x, V::min(V::max(sum, zero), maxValue));
+    }
+
+    for (; x < endCol; x++) {
+        float pixelSum = 0;
+        for (int h = 0; h < filterHeight; h++) {
+            const float* sourceRow = rows[h] + x - s;
+            const float* maskRow = mask + h * filterWidth;
+            for (int w = 0; w < filterWidth; w++) {
+                pixelSum += maskRow[w] * sourceRow[w];
+            }
+        }
+        outRow[x] = thresholdPixel(pixelSum);
+    }
+}
+
+template <class V>
+void horizontalRowSimd(const float* sourceRow,
+                float* outRow,
+                const float* coefficients, int taps,
+                int startCol, int endCol)
+{
+    typedef typename V::Type Vec;
+    const int n = V::WIDTH;
+    const int s = taps / 2;
+    int x = startCol;
+
+    for (; x + 2 * n <= endCol; x += 2 * n) {
+        const float* source = sourceRow + x - s;
+        Vec sum0 = V::set1(0.0f);
+        Vec sum1 = V::set1(0.0f);
+        for (int w = 0; w < taps; w++) {
+            const Vec coefficient = V::set1(coefficients[w]);
+            sum0 = V::add(sum0, V::mul(coefficient, V::load(source + w)));
+            sum1 = V::add(sum1, V::mul(coefficient, V::load(source + w + n)));
+        }
+        V::store(outRow + x, sum0);
+        V::store(outRow + x + n, sum1);
+    }
+
+    for (; x + n <= endCol; x += n) {
+        const float* source = sourceRow + x - s;
+        Vec sum = V::set1(0.0f);
+        for (int w = 0; w < taps; w++) {
+            sum = V::add(sum, V::mul(V::set1(coefficients[w]), V::load(source + w)));
+        }
+        V::store(outRow + x, sum);
+    }
+
+    for (; x < endCol; x++) {
+        const float* source = sourceRow + x - s;
+        float pixelSum = 0;
+        for (int w = 0; w < taps; w++) {
+            pixelSum += coefficients[w] * source[w];
+        }
+        outRow[x] = pixelSum;
+    }
+}
+
+template <class V>
+void verticalRowSimd(const float* const* rows,
+                float* outRow,
+                const float* coefficients, int taps,
+                int startCol, int endCol,
+                bool accumulate, bool threshold)
+{
+    typedef typename V::Type Vec;
+    const int n = V::WIDTH;
+    const Vec zero = V::set1(0.0f);
+    const Vec maxValue = V::set1(255.0f);
+    int x = startCol;
+
+    for (; x + n <= endCol; x += n) {
+        Vec sum = zero;
+        for (int h = 0; h < taps; h++) {
+            sum = V::add(sum, V::mul(V::set1(coefficients[h]), V::load(rows[h] + x)));
+        }
+        if (accumulate) {
+            sum = V::add(V::load(outRow + x), sum);
+        }
+        if (threshold) {
+            sum = V::min(V::max(sum, zero), maxValue);
+        }
+        V::store(outRow + x, sum);
+    }
+
+    for (; x < endCol; x++) {
+        float pixelSum = 0;
+        for (int h = 0; h < taps; h++) {
+            pixelSum += coefficients[h] * rows[h][x];
+        }
+        if (accumulate) {
+            pixelSum = outRow[x] + pixelSum;
+        }
+        outRow[x] = threshold ? thresholdPixel(pixelSum) : pixelSum;
+    }
+}
+
+/*
+ * Specializations for a kernel size known at compile time: the mask
+ * is broadcast in registers once per row and the taps are unrolled.
+ * Taps are accumulated in the same order as the generic loops.
+ */
+template <class V, int FW, int FH>
+void convolveRowFixed(const float* const* rows,
+                float* outRow,
+                const float* mask,
+                int, int,
+                int startCol, int endCol)
+{
+    typedef typename V::Type Vec;
+    const int n = V::WIDTH;
+    const Vec zero = V::set1(0.0f);
+    const Vec maxValue = V::set1(255.0f);
+
+    Vec coefficients[FW * FH];
+    for (int tap = 0; tap < FW * FH; tap++) {
+        coefficients[tap] = V::set1(mask[tap]);
+    }
+
+    const float* sourceRows[FH];
+    for (int h = 0; h < FH; h++) {
+        sourceRows[h] = rows[h] - FW / 2;
+    }
+
+    int x = startCol;
+
+    for (; x + 2 * n <= endCol; x += 2 * n) {
+        Vec sum0 = zero;
+        Vec sum1 = zero;
+        auto accumulate = [&](int tap) {
+            const float* source = sourceRows[tap / FW] + x + tap % FW;
+            sum0 = V::add(sum0, V::mul(coefficients[tap], V::load(source)));
+            sum1 = V::add(sum1, V::mul(coefficients[tap], V::load(source + n)));
+        };
+        Unroll<FW * FH>::run(accumulate);
+        V::store(outRow + x, V::min(V::max(sum0, zero), maxValue));
+        V::store(outRow + x + n, V::min(V::max(sum1, zero), maxValue));
+    }
+
+    for (; x + n <= endCol; x += n) {
+        Vec sum = zero;
+        auto accumulate = [&](int tap) {
+            const float* source = sourceRows[tap / FW] + x + tap % FW;
+            sum = V::add(sum, V::mul(coefficients[tap], V::load(source)));
+        };
+        Unroll<FW * FH>::run(accumulate);
+        V::store(outRow + x, V::min(V::max(sum, zero), maxValue));
+    }
+
+    for (; x < endCol; x++) {
+        float pixelSum = 0;
+        auto accumulate = [&](int tap) {
+            pixelSum += mask[tap] * sourceRows[tap / FW][x + tap % FW];
+        };
+        Unroll<FW * FH>::run(accumulate);
+        outRow[x] = thresholdPixel(pixelSum);
+    }
+}
+
+template <class V, int TAPS>
+void horizontalRowFixed(const float* sourceRow,
+                float* outRow,
+                const float* coefficients, int,
+                int startCol, int endCol)
+{
+    typedef typename V::Type Vec;
+    const int n = V::WIDTH;
+
+    Vec vectorCoefficients[TAPS];
+    for (int w = 0; w < TAPS; w++) {
+        vectorCoefficients[w] = V::set1(coefficients[w]);
+    }
+
+    int x = startCol;
+
+    for (; x + 2 * n <= endCol; x += 2 * n) {
+        const float* source = sourceRow + x - TAPS / 2;
+        Vec sum0 = V::set1(0.0f);
+        Vec sum1 = V::set1(0.0f);
+        auto accumulate = [&](int w) {
+            sum0 = V::add(sum0, V::mul(vectorCoefficients[w], V::load(source + w)));
+            sum1 = V::add(sum1, V::mul(vectorCoefficients[w], V::load(source + w + n)));
+        };
+        Unroll<TAPS>::run(accumulate);
+        V::store(outRow + x, sum0);
+        V::store(outRow + x + n, sum1);
+    }
+
+    for (; x + n <= endCol; x += n) {
+        const float* source = sourceRow + x - TAPS / 2;
+        Vec sum = V::set1(0.0f);
+        auto accumulate = [&](int w) {
+            sum = V::add(sum, V::mul(vectorCoefficients[w], V::load(source + w)));
+        };
+        Unroll<TAPS>::run(accumulate);
+        V::store(outRow + x, sum);
+    }
+
+    for (; x < endCol; x++) {
+        const float* source = sourceRow + x - TAPS / 2;
+        float pixelSum = 0;
+        auto accumulate = [&](int w) {
+            pixelSum += coefficients[w] * source[w];
+        };
+        Unroll<TAPS>::run(accumulate);
+        outRow[x] = pixelSum;
+    }
+}
+
+template <class V, int TAPS>
+void verticalRowFixed(const float* const* rows,
+                float* outRow,
+                const float* coefficients, int,
+                int startCol, int endCol,
+                bool accumulate, bool threshold)
+{
+    typedef typename V::Type Vec;
+    const int n = V::WIDTH;
+    const Vec zero = V::set1(0.0f);
+    const Vec maxValue = V::set1(255.0f);
+
+    Vec vectorCoefficients[TAPS];
+    const float* sourceRows[TAPS];
+    for (int h = 0; h < TAPS; h++) {
+        vectorCoefficients[h] = V::set1(coefficients[h]);
+        sourceRows[h] = rows[h];
+    }
+
+    int x = startCol;
+
+    for (; x + n <= endCol; x += n) {
+        Vec sum = zero;
+        auto accumulateTap = [&](int h) {
+            sum = V::add(sum, V::mul(vectorCoefficients[h], V::load(sourceRows[h] + x)));
+        };
+        Unroll<TAPS>::run(accumulateTap);
+        if (accumulate) {
+            sum = V::add(V::load(outRow + x), sum);
+        }
+        if (threshold) {
+            sum = V::min(V::max(sum, zero), maxValue);
+        }
+        V::store(outRow + x, sum);
+    }
+
+    for (; x < endCol; x++) {
+        float pixelSum = 0;
+        auto accumulateTap = [&](int h) {
+            pixelSum += coefficients[h] * sourceRows[h][x];
+        };
+        Unroll<TAPS>::run(accumulateTap);
+        if (accumulate) {
+            pixelSum = outRow[x] + pixelSum;
+        }
+        outRow[x] = threshold ? thresholdPixel(pixelSum) : pixelSum;
+    }
+}
+
+template <class A>
+void convolveRowU8Simd(const uint8_t* const* rows,
+                uint8_t* outRow,
+                const int16_t* mask,
+                int filterWidth, int filterHeight,
+                int shift,
+                int startCol, int endCol)
+{
+    typedef typename A::Type Accumulator;
+    const int n = A::WIDTH;
+    const int s = filterWidth / 2;
+    // Round to nearest when dropping the fraction bits
+    const int32_t bias = shift > 0 ? 1 << (shift - 1) : 0;
+    int x = startCol;
+
+    for (; x + n <= endCol; x += n) {
+        Accumulator sum = A::set1(bias);
+        for (int h = 0; h < filterHeight; h++) {
+            const uint8_t* sourceRow = rows[h] + x - s;
+            const int16_t* maskRow = mask + h * filterWidth;
+            for (int w = 0; w < filterWidth; w++) {
+                sum = A::multiplyAdd(sum, sourceRow + w, maskRow[w]);
+            }
+        }
+        A::store(outRow + x, sum, shift);
+    }
+
+    for (; x < endCol; x++) {
+        int32_t pixelSum = bias;
+        for (int h = 0; h < filterHeight; h++) {
+            const uint8_t* sourceRow = rows[h] + x - s;
+            const int16_t* maskRow = mask + h * filterWidth;
+            for (int w = 0; w < filterWidth; w++) {
+                pixelSum += maskRow[w] * sourceRow[w];
+            }
+        }
+        pixelSum >>= shift;
+        outRow[x] = static_cast<uint8_t>(pixelSum < 0 ? 0 : (pixelSum > 255 ? 255 : pixelSum));
+    }
+}
+
+/*
+ * Steps of the recursion on n adjacent lines: the outputs i -+ 1 to
+ * i -+ 3 are kept in registers, two vectors of lines run together to
+ * hide the latency of the dependency chain
+ */
+template <class V>
+inline void recursiveStep(const float* coefficients, float* sample,
+                typename V::Type& w1, typename V::Type& w2, typename V::Type& w3)
+{
+    typedef typename V::Type Vec;
+    const Vec value = V::add(V::add(V::mul(V::set1(coefficients[0]), V::load(sample)),
+                                    V::mul(V::set1(coefficients[1]), w1)),
+                             V::add(V::mul(V::set1(coefficients[2]), w2),
+                                    V::mul(V::set1(coefficients[3]), w3)));
+    w3 = w2;
+    w2 = w1;
+    w1 = value;
+    V::store(sample, value);
+}
+
+template <class V>
+void recursiveLinesSimd(float* lines,
+                int length, int stride,
+                const float* coefficients)
+{
+    typedef typename V::Type Vec;
+    const int n = V::WIDTH;
+    const ptrdiff_t step = stride;
+    const ptrdiff_t last = (length - 1) * step;
+    int j = 0;
+
+    for (; j + 2 * n <= stride; j += 2 * n) {
+        float* line = lines + j;
+        Vec w1 = V::load(line);
+        Vec w2 = w1;
+        Vec w3 = w1;
+        Vec u1 = V::load(line + n);
+        Vec u2 = u1;
+        Vec u3 = u1;
+        for (int i = 0; i < length; i++) {
+            recursiveStep<V>(coefficients, line + i * step, w1, w2, w3);
+            recursiveStep<V>(coefficients, line + i * step + n, u1, u2, u3);
+        }
+
+        w1 = w2 = w3 = V::load(line + last);
+        u1 = u2 = u3 = V::load(line + last + n);
+        for (int i = length - 1; i >= 0; i--) {
+            recursiveStep<V>(coefficients, line + i * step, w1, w2, w3);
+            recursiveStep<V>(coefficients, line + i * step + n, u1, u2, u3);
+        }
+    }
+
+    for (; j < stride; j += n) {
+        float* line = lines + j;
+        Vec w1 = V::load(line);
+        Vec w2 = w1;
+        Vec w3 = w1;
+        for (int i = 0; i < length; i++) {
+            recursiveStep<V>(coefficients, line + i * step, w1, w2, w3);
+        }
+
+        w1 = w2 = w3 = V::load(line + last);
+        for (int i = length - 1; i >= 0; i--) {
+            recursiveStep<V>(coefficients, line + i * step, w1, w2, w3);
+        }
+    }
+}
+
+/*
+ * Dispatch tables: the specialization matching the kernel size,
+ * the generic loop otherwise. The sizes are the ones of the built-in
+ * filters (kernel.cpp) and of their 1D factors.
+ */
+template <class V>
+ConvolveRowFunction selectConvolveRow(int filterWidth, int filterHeight)
+{
+    static const struct
+    {
+        int width;
+        int height;
+        ConvolveRowFunction function;
+    } table[] = {
+        {3, 3, convolveRowFixed<V, 3, 3>},
+        {5, 5, convolveRowFixed<V, 5, 5>},
+        {7, 7, convolveRowFixed<V, 7, 7>}
+    };
+
+    for (const auto& entry : table) {
+        if (entry.width == filterWidth && entry.height == filterHeight) {
+            return entry.function;
+        }
+    }
+
+    return convolveRowSimd<V>;
+}
+
+template <class V>
+HorizontalRowFunction selectHorizontalRow(int taps)
+{
+    static const struct
+    {
+        int taps;
+        HorizontalRowFunction function;
+    } table[] = {
+        {3, horizontalRowFixed<V, 3>},
+        {5, horizontalRowFixed<V, 5>},
+        {7, horizontalRowFixed<V, 7>}
+    };
+
+    for (const auto& entry : table) {
+        if (entry.taps == taps) {
+            return entry.function;
+        }
+    }
+
+    return horizontalRowSimd<V>;
+}
+
+template <class V>
+VerticalRowFunction selectVerticalRow(int taps)
+{
+    static const struct
+    {
+        int taps;
+        VerticalRowFunction function;
+    } table[] = {
+        {3, verticalRowFixed<V, 3>},
+        {5, verticalRowFixed<V, 5>},
+        {7, verticalRowFixed<V, 7>}
+    };
+
+    for (const auto& entry : table) {
+        if (entry.taps == taps) {
+            return entry.function;
+        }
+    }
+
+    return verticalRowSimd<V>;
+}
+
+} // namespace
+
+
+#endif /* SIMD_CONVOLUTION_IMPL_H_ */
@@ -0,0 +1,108 @@
+// SSE2 is part of the x86-64 baseline: no extra flags needed
+#include <emmintrin.h>
+#include "simd_convolution.h"
+#include "simd_convolution_impl.h"
+
+namespace {
+
+struct SseVector
+{
+    typedef __m128 Type;
+    static const int WIDTH = 4;
+
+    static inline Type set1(float value) { return _mm_set1_ps(value); }
+    static inline Type load(const float* ptr) { return _mm_loadu_ps(ptr); }
+    static inline void store(float* ptr, Type value) { _mm_storeu_ps(ptr, value); }
+    static inline Type add(Type a, Type b) { return _mm_add_ps(a, b); }
+    static inline Type mul(Type a, Type b) { return _mm_mul_ps(a, b); }
+    static inline Type min(Type a, Type b) { return _mm_min_ps(a, b); }
+    static inline Type max(Type a, Type b) { return _mm_max_ps(a, b); }
+};
+
+// 8 pixels, int16 lanes
+struct SseNarrowAccumulator
+{
+    typedef __m128i Type;
+    static const int WIDTH = 8;
+
+    static inline Type set1(int32_t value) { return _mm_set1_epi16(static_cast<int16_t>(value)); }
+
+    static inline Type multiplyAdd(Type sum, const uint8_t* source, int16_t coefficient)
+    {
+        const __m128i pixels = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source)),
+                                                 _mm_setzero_si128());
+        return _mm_add_epi16(sum, _mm_mullo_epi16(pixels, _mm_set1_epi16(coefficient)));
+    }
+
+    static inline void store(uint8_t* dest, Type sum, int shift)
+    {
+        sum = _mm_sra_epi16(sum, _mm_cvtsi32_si128(shift));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dest), _mm_packus_epi16(sum, sum));
+    }
+};
+
+// 8 pixels, int32 lanes: the 16 x 16 bit products are rebuilt
+// from their low and high halves
+struct SseWideAccumulator
+{
+    struct Type
+    {
+        __m128i low;
+        __m128i high;
+    };
+    static const int WIDTH = 8;
+
+    static inline Type set1(int32_t value)
+    {
+        Type sum = {_mm_set1_epi32(value), _mm_set1_epi32(value)};
+        return sum;
+    }
+
+    static inline Type multiplyAdd(Type sum, const uint8_t* source, int16_t coefficient)
+    {
+        const __m128i pixels = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source)),
+                                                 _mm_setzero_si128());
+        const __m128i coefficients = _mm_set1_epi16(coefficient);
+        const __m128i productLow = _mm_mullo_epi16(pixels, coefficients);
+        const __m128i productHigh = _mm_mulhi_epi16(pixels, coefficients);
+        sum.low = _mm_add_epi32(sum.low, _mm_unpacklo_epi16(productLow, productHigh));
+        sum.high = _mm_add_epi32(sum.high, _mm_unpackhi_epi16(productLow, productHigh));
+        return sum;
+    }
+
+    static inline void store(uint8_t* dest, Type sum, int shift)
+    {
+        const __m128i count = _mm_cvtsi32_si128(shift);
+        const __m128i words = _mm_packs_epi32(_mm_sra_epi32(sum.low, count),
+                                              _mm_sra_epi32(sum.high, count));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dest), _mm_packus_epi16(words, words));
+    }
+};
+
+} // namespace
+
+ConvolveRowFunction getConvolveRowSse(int filterWidth, int filterHeight)
+{
+    return selectConvolveRow<SseVector>(filterWidth, filterHeight);
+}
+
+HorizontalRowFunction getHorizontalRowSse(int taps)
+{
+    return selectHorizontalRow<SseVector>(taps);
+}
+
+VerticalRowFunction getVerticalRowSse(int taps)
+{
+    return selectVerticalRow<SseVector>(taps);
+}
+
+ConvolveRowU8Function getConvolveRowU8Sse(bool narrow)
+{
+    return narrow ? convolveRowU8Simd<SseNarrowAccumulator> :
+                    convolveRowU8Simd<SseWideAccumulator>;
+}
+
+RecursiveLinesFunction getRecursiveLinesSse()
+{
+    return recursiveLinesSimd<SseVector>;
+}
@@ -0,0 +1,281 @@
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+#include <png.h>
+#include "streaming_convolution.h"
+#include "cpu_convolution.h"
+#include "image_buffer.h"
+#include "trace.h"
+
+
+/*
+ * libpng reports errors through this callback: the exception unwinds
+ * out of the library, as png++ does
+ */
+static void handlePngError(png_structp, png_const_charp message)
+{
+    throw std::runtime_error(message);
+}
+
+static void handlePngWarning(png_structp, png_const_charp)
+{
+}
+
+/*
+ * Reads an 8-bit grayscale PNG file row by row. Other color types
+ * and bit depths are converted as png::image<png::gray_pixel> does.
+ */
+class PngRowReader
+{
+    public:
+        PngRowReader() : m_file(nullptr), m_png(nullptr), m_info(nullptr) {}
+
+        /*
+         *  @brief: Dtor
+         */
+        ~PngRowReader()
+        {
+            if (m_png != nullptr) {
+                png_destroy_read_struct(&m_png, &m_info, nullptr);
+            }
+            if (m_file != nullptr) {
+                fclose(m_file);
+            }
+        }
+
+        PngRowReader(const PngRowReader&) = delete;
+        PngRowReader& operator=(const PngRowReader&) = delete;
+
+        /*
+         * @brief: open the file and read its header. Throws on errors.
+         */
+        void open(const char* filename)
+        {
+            m_file = fopen(filename, "rb");
+            if (m_file == nullptr) {
+                throw std::runtime_error(std::string("cannot read ") + filename);
+            }
+
+            m_png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, handlePngError, handlePngWarning);
+            if (m_png == nullptr) {
+                throw std::runtime_error("cannot create the PNG reader");
+            }
+            m_info = png_create_info_struct(m_png);
+            if (m_info == nullptr) {
+                throw std::runtime_error("cannot create the PNG info");
+            }
+
+            png_init_io(m_png, m_file);
+            png_read_info(m_png, m_info);
+
+            // Rows of interlaced files are only complete after the last pass
+            if (png_get_interlace_type(m_png, m_info) != PNG_INTERLACE_NONE) {
+                throw std::runtime_error("interlaced PNG files cannot be streamed");
+            }
+
+            const int colorType = png_get_color_type(m_png, m_info);
+            const int bitDepth = png_get_bit_depth(m_png, m_info);
+
+            if (colorType == PNG_COLOR_TYPE_PALETTE) {
+                png_set_palette_to_rgb(m_png);
+            }
+            if (colorType == PNG_COLOR_TYPE_GRAY && bitDepth < 8) {
+                png_set_expand_gray_1_2_4_to_8(m_png);
+            }
+            if (bitDepth == 16) {
+                png_set_strip_16(m_png);
+            }
+            if (colorType & PNG_COLOR_MASK_ALPHA) {
+                png_set_strip_alpha(m_png);
+            }
+            if (colorType == PNG_COLOR_TYPE_PALETTE || (colorType & PNG_COLOR_MASK_COLOR)) {
+                png_set_rgb_to_gray_fixed(m_png, 1, -1, -1);
+            }
+            png_read_update_info(m_png, m_info);
+        }
+
+        int getWidth() const { return png_get_image_width(m_png, m_info); }
+        int getHeight() const { return png_get_image_height(m_png, m_info); }
+
+        void readRow(uint8_t* row) { png_read_row(m_png, row, nullptr); }
+
+        void finish() { png_read_end(m_png, nullptr); }
+
+    private:
+        FILE* m_file;           ///< Source file
+        png_structp m_png;      ///< libpng decoder
+        png_infop m_info;       ///< Image header
+};
+
+/*
+ * Writes an 8-bit grayscale PNG file row by row
+ */
+class PngRowWriter
+{
+    public:
+        PngRowWriter() : m_file(nullptr), m_png(nullptr), m_info(nullptr) {}
+
+        /*
+         *  @brief: Dtor
+         */
+        ~PngRowWriter()
+        {
+            if (m_png != nullptr) {
+                png_destroy_write_struct(&m_png, &m_info);
+            }
+            if (m_file != nullptr) {
+                fclose(m_file);
+            }
+        }
+
+        PngRowWriter(const PngRowWriter&) = delete;
+        PngRowWriter& operator=(const PngRowWriter&) = delete;
+
+        /*
+         * @brief: create the file and write its header. Throws on errors.
+         */
+        void open(const char* filename, int width, int height)
+        {
+            m_file = fopen(filename, "wb");
+            if (m_file == nullptr) {
+                throw std::runtime_error(std::string("cannot write ") + filename);
+            }
+
+            m_png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, handlePngError, handlePngWarning);
+            if (m_png == nullptr) {
+                throw std::runtime_error("cannot create the PNG writer");
+            }
+            m_info = png_create_info_struct(m_png);
+            if (m_info == nullptr) {
+                throw std::runtime_error("cannot create the PNG info");
+            }
+
+            png_init_io(m_png, m_file);
+            png_set_IHDR(m_png, m_info, width, height, 8,
+                         PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE,
+                         PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+            png_write_info(m_png, m_info);
+        }
+
+        void writeRow(const uint8_t* row) { png_write_row(m_png, row); }
+
+        void finish() { png_write_end(m_png, nullptr); }
+
+    private:
+        FILE* m_file;           ///< Output file
+        png_structp m_png;      ///< libpng encoder
+        png_infop m_info;       ///< Image header
+};
+
+
+bool runStreamingConvolution(const char* sourceFile,
+                const char* outFile,
+                const Kernel& kernel,
+                BorderMode border)
+{
+    const int filterWidth = kernel.getKernelWidth();
+    const int filterHeight = kernel.getKernelHeight();
+
+    if (filterWidth == 0 || filterHeight == 0) {
+        std::cerr << "Invalid filter dimension" << std::endl;
+        return false;
+    }
+
+    if (border == BorderMode::WRAP) {
+        std::cerr << "Wrap border mode cannot be streamed" << std::endl;
+        return false;
+    }
+
+    TRACE_STATUS("Starting streaming convolution of " << sourceFile);
+
+    TRACE_SCOPE("runStreamingConvolution");
+
+    try {
+        PngRowReader reader;
+        reader.open(sourceFile);
+
+        const int width = reader.getWidth();
+        const int height = reader.getHeight();
+        TRACE_COUNT(TraceCounter::PIXELS_PROCESSED, static_cast<long long>(width) * height);
+        const int s = filterHeight / 2;
+        const int rank = kernel.isSeparable() ? kernel.getSeparableRank() : 1;
+
+        PngRowWriter writer;
+        writer.open(outFile, width, height);
+
+        // Ring buffers indexed by source row modulo the kernel height:
+        // the source rows, or the horizontal pass of each term
+        std::vector<ImageBuffer> rings(rank);
+        for (int term = 0; term < rank; term++) {
+            rings[term].reset(width, filterHeight);
+        }
+
+        std::vector<uint8_t> pngRow(width);
+        std::vector<float> sourceRow(width);
+        std::vector<float> outRow(width);
+        std::vector<float> zeroRow(width, 0.0f);
+        std::vector<const float*> rows(filterHeight);
+
+        int rowsRead = 0;
+        for (int y = 0; y < height; y++) {
+            // Decode up to the last row read by output row y, the rows above
+            // its window have been used and can be overwritten
+            for (; rowsRead <= std::min(y + s, height - 1); rowsRead++) {
+                reader.readRow(pngRow.data());
+
+                float* ringRow = kernel.isSeparable() ? sourceRow.data() :
+                                                        rings[0].getRow(rowsRead % filterHeight);
+                for (int x = 0; x < width; x++) {
+                    ringRow[x] = pngRow[x];
+                }
+
+                for (int term = 0; term < rank && kernel.isSeparable(); term++) {
+                    horizontalPass(sourceRow.data(), width,
+                                   rings[term].getRow(rowsRead % filterHeight), rings[term].getStride(),
+                                   kernel.getRowFactors().data() + term * filterWidth, filterWidth,
+                                   width, border,
+                                   0, width,
+                                   0, 1);
+                }
+            }
+
+            for (int term = 0; term < rank; term++) {
+                for (int h = 0; h < filterHeight; h++) {
+                    int row = getBorderIndex(y - s + h, height, border);
+                    rows[h] = row < 0 ? zeroRow.data() : rings[term].getRow(row % filterHeight);
+                }
+
+                if (kernel.isSeparable()) {
+                    verticalRows(rows.data(), outRow.data(),
+                                 kernel.getColumnFactors().data() + term * filterHeight, filterHeight,
+                                 width,
+                                 term > 0, term == rank - 1);
+                }
+                else {
+                    convolveRows(rows.data(), outRow.data(),
+                                 kernel.getKernel().data(),
+                                 width,
+                                 filterWidth, filterHeight,
+                                 border);
+                }
+            }
+
+            // Same conversion as Image::saveImage: saturated and truncated
+            for (int x = 0; x < width; x++) {
+                pngRow[x] = static_cast<uint8_t>(std::min(std::max(outRow[x], 0.0f), 255.0f));
+            }
+            writer.writeRow(pngRow.data());
+        }
+
+        reader.finish();
+        writer.finish();
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Streaming convolution failed: " << e.what() << std::endl;
+        return false;
+    }
+
+    return true;
+}
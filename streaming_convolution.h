@@ -0,0 +1,30 @@
+#ifndef STREAMING_CONVOLUTION_H_
+#define STREAMING_CONVOLUTION_H_
+
+#include "kernel.h"
+#include "border_mode.h"
+
+/*
+ * @brief: This function will filter a PNG file into another PNG file
+ *         without holding the images in memory. Source rows are decoded
+ *         one at a time into a ring buffer of kernel height rows; each
+ *         output row is convolved as soon as the rows it reads are
+ *         available and passed to the encoder, so the memory is
+ *         O(width x kernel height) whatever the image height.
+ *         Separable kernels keep their horizontal pass results in the
+ *         ring buffer, one per term, so their output matches loading,
+ *         filtering with FilterAlgorithm::DIRECT and saving the image
+ *         up to rounding: the sums are not taken in the same order.
+ *         Other kernels give the same output.
+ *         WRAP border mode, which reads the bottom rows for the top
+ *         ones, and interlaced PNG files are not supported.
+ *
+ * @return: true if successful, false otherwise
+ */
+bool runStreamingConvolution(const char* sourceFile,
+                const char* outFile,
+                const Kernel& kernel,
+                BorderMode border);
+
+
+#endif /* STREAMING_CONVOLUTION_H_ */
@@ -0,0 +1,181 @@
+#include <algorithm>
+#include "thread_pool.h"
+#include "trace.h"
+
+
+ThreadPool::ThreadPool(unsigned int numThreads) : m_queues(numThreads == 0 ?
+                                                           std::max(std::thread::hardware_concurrency(), 1u) :
+                                                           numThreads)
+{
+    m_task = nullptr;
+    m_generation = 0;
+    m_jobWorkers = 0;
+    m_activeWorkers = 0;
+    m_stop = false;
+
+    // The calling thread works on the last queue
+    for (unsigned int i = 0; i + 1 < m_queues.size(); i++) {
+        m_workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        m_stop = true;
+    }
+    m_wakeCondition.notify_all();
+
+    for (size_t i = 0; i < m_workers.size(); i++) {
+        m_workers[i].join();
+    }
+}
+
+unsigned int ThreadPool::getThreadCount() const
+{
+    return m_queues.size();
+}
+
+ThreadPool& ThreadPool::getInstance()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::parallelFor(int numTasks, const std::function<void(int)>& task,
+                             unsigned int maxThreads)
+{
+    if (numTasks <= 0) {
+        return;
+    }
+
+    if (maxThreads == 0 || maxThreads > m_queues.size()) {
+        maxThreads = m_queues.size();
+    }
+
+    if (m_workers.empty() || numTasks == 1 || maxThreads == 1) {
+        for (int i = 0; i < numTasks; i++) {
+            task(i);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> jobLock(m_jobMutex);
+
+    // Seed contiguous ranges, so neighbouring tiles stay on the same core
+    // unless they get stolen. The first maxThreads - 1 workers and the
+    // calling thread take part, the queues of the others stay empty.
+    const unsigned int noQueues = m_queues.size();
+    for (unsigned int t = 0; t < maxThreads; t++) {
+        unsigned int q = t + 1 < maxThreads ? t : noQueues - 1;
+        int first = static_cast<long>(numTasks) * t / maxThreads;
+        int last = static_cast<long>(numTasks) * (t + 1) / maxThreads;
+
+        std::lock_guard<std::mutex> lock(m_queues[q].mutex);
+        for (int i = first; i < last; i++) {
+            m_queues[q].tasks.push_back(i);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        m_task = &task;
+        m_jobWorkers = maxThreads - 1;
+        m_generation++;
+    }
+    m_wakeCondition.notify_all();
+
+    runTasks(noQueues - 1, task);
+
+    // All queues are empty: wait for the tasks still running in the workers.
+    // Resetting the job prevents late workers from joining it.
+    std::unique_lock<std::mutex> lock(m_stateMutex);
+    m_task = nullptr;
+    m_doneCondition.wait(lock, [this] { return m_activeWorkers == 0; });
+}
+
+void ThreadPool::workerLoop(unsigned int queueIndex)
+{
+    unsigned long seenGeneration = 0;
+
+    while (true) {
+        const std::function<void(int)>* task = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(m_stateMutex);
+            m_wakeCondition.wait(lock, [this, seenGeneration] {
+                return m_stop || m_generation != seenGeneration;
+            });
+
+            if (m_stop) {
+                return;
+            }
+
+            seenGeneration = m_generation;
+            task = m_task;
+            if (task == nullptr || queueIndex >= m_jobWorkers) {
+                continue;
+            }
+            m_activeWorkers++;
+        }
+
+        runTasks(queueIndex, *task);
+
+        {
+            std::lock_guard<std::mutex> lock(m_stateMutex);
+            m_activeWorkers--;
+        }
+        m_doneCondition.notify_one();
+    }
+}
+
+void ThreadPool::runTasks(unsigned int queueIndex, const std::function<void(int)>& task)
+{
+    // One event per thread and job: the gaps show the idle time
+    TRACE_SCOPE("pool tasks");
+
+    int taskIndex = 0;
+    while (getTask(queueIndex, taskIndex)) {
+        task(taskIndex);
+    }
+}
+
+bool ThreadPool::getTask(unsigned int queueIndex, int& taskIndex)
+{
+    {
+        TaskQueue& own = m_queues[queueIndex];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            taskIndex = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    // Own queue is empty: steal from the other threads
+    unsigned int noQueues = m_queues.size();
+    for (unsigned int i = 1; i < noQueues; i++) {
+        TaskQueue& victim = m_queues[(queueIndex + i) % noQueues];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            taskIndex = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void runTasks(int numTasks, const std::function<void(int)>& task, bool multithread,
+              unsigned int maxThreads)
+{
+    if (multithread) {
+        ThreadPool::getInstance().parallelFor(numTasks, task, maxThreads);
+    }
+    else {
+        for (int i = 0; i < numTasks; i++) {
+            task(i);
+        }
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+
+class ThreadPool
+{
+    public:
+        /*
+         * @brief: Ctor. Spawns numThreads - 1 workers, the calling thread
+         *         takes part in every parallelFor as the last worker.
+         *
+         * @param: numThreads: number of threads, 0 to use all the cores
+         */
+        explicit ThreadPool(unsigned int numThreads = 0);
+
+        /*
+         *  @brief: Dtor. Joins all the workers
+         */
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        /*
+         * @brief: return the number of threads taking part in a job,
+         *         calling thread included
+         */
+        unsigned int getThreadCount() const;
+
+        /*
+         * @brief: run task(i) for each i in [0, numTasks) and wait for
+         *         completion. Indexes are seeded in contiguous ranges
+         *         into per-thread queues; a thread that drains its own
+         *         queue steals from the back of the others, so uneven
+         *         tasks still balance. Tasks must not call parallelFor.
+         *
+         * @param: numTasks: number of tasks to be executed
+         * @param: task: the function to be called with the task index
+         * @param: maxThreads: threads taking part in the job, calling thread
+         *         included. 0 uses all of them.
+         */
+        void parallelFor(int numTasks, const std::function<void(int)>& task,
+                         unsigned int maxThreads = 0);
+
+        /*
+         * @brief: return the process wide pool, sized on the number of cores
+         */
+        static ThreadPool& getInstance();
+
+    private:
+        struct TaskQueue
+        {
+            std::mutex mutex;
+            std::deque<int> tasks;
+        };
+
+        /*
+         * @brief: worker main loop
+         */
+        void workerLoop(unsigned int queueIndex);
+
+        /*
+         * @brief: execute tasks from the own queue, then steal from the others
+         *         until every queue is empty
+         */
+        void runTasks(unsigned int queueIndex, const std::function<void(int)>& task);
+
+        /*
+         * @brief: pop a task from the front of the own queue or
+         *         from the back of another queue
+         */
+        bool getTask(unsigned int queueIndex, int& taskIndex);
+
+        std::vector<std::thread> m_workers;         ///< Worker threads
+        std::vector<TaskQueue> m_queues;            ///< One queue per thread, caller's queue is the last one
+        std::mutex m_jobMutex;                      ///< Serializes parallelFor calls
+        std::mutex m_stateMutex;                    ///< Protects the job state below
+        std::condition_variable m_wakeCondition;    ///< Signals a new job or the pool shutdown
+        std::condition_variable m_doneCondition;    ///< Signals a worker leaving the job
+        const std::function<void(int)>* m_task;     ///< Current job, nullptr when idle
+        unsigned long m_generation;                 ///< Incremented on each new job
+        unsigned int m_jobWorkers;                  ///< Workers taking part in the current job
+        unsigned int m_activeWorkers;               ///< Workers currently running the job
+        bool m_stop;                                ///< Pool shutdown request
+};
+
+/*
+ * @brief: run task(i) for each i in [0, numTasks) on the process wide
+ *         pool, or in order on the calling thread
+ *
+ * @param: multithread: use the pool, otherwise run on the calling thread
+ * @param: maxThreads: threads taking part in the job (see parallelFor)
+ */
+void runTasks(int numTasks, const std::function<void(int)>& task, bool multithread,
+              unsigned int maxThreads = 0);
+
+
+#endif /* THREAD_POOL_H_ */
@@ -0,0 +1,183 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <map>
+#include <string>
+#include "trace.h"
+
+static const char* const s_counterNames[static_cast<int>(TraceCounter::COUNT)] = {
+    "pixels_processed",
+    "bytes_copied",
+    "allocations",
+    "allocated_bytes"
+};
+
+std::atomic<bool> Trace::s_enabled(false);
+std::atomic<bool> Trace::s_verbose(false);
+
+
+/*
+ * Totals of the scopes sharing a name
+ */
+struct ScopeStatistics
+{
+    long long calls;
+    long long total;        ///< Nanoseconds
+    long long min;
+    long long max;
+};
+
+Trace::Trace() : m_origin(std::chrono::steady_clock::now())
+{
+    for (int i = 0; i < static_cast<int>(TraceCounter::COUNT); i++) {
+        m_counters[i] = 0;
+    }
+}
+
+Trace& Trace::getInstance()
+{
+    static Trace trace;
+    return trace;
+}
+
+void Trace::setEnabled(bool enabled)
+{
+    // Create the collector before the first scope reads the clock
+    getInstance();
+    s_enabled.store(enabled);
+}
+
+void Trace::setVerbose(bool verbose)
+{
+    s_verbose.store(verbose);
+}
+
+long long Trace::getCount(TraceCounter counter) const
+{
+    return m_counters[static_cast<int>(counter)].load();
+}
+
+long long Trace::getTime() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_origin).count();
+}
+
+Trace::ThreadEvents& Trace::getThreadEvents()
+{
+    // Owned by the collector: the events outlive the threads
+    thread_local ThreadEvents* threadEvents = nullptr;
+
+    if (threadEvents == nullptr) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_threads.push_back(std::unique_ptr<ThreadEvents>(new ThreadEvents()));
+        threadEvents = m_threads.back().get();
+        threadEvents->threadId = m_threads.size();
+    }
+
+    return *threadEvents;
+}
+
+void Trace::addEvent(const char* name, long long start, long long duration)
+{
+    getThreadEvents().events.push_back({name, start, duration});
+}
+
+bool Trace::writeChromeTrace(const char* filename) const
+{
+    std::ofstream file(filename);
+    if (!file) {
+        std::cerr << "Unable to write " << filename << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Timestamps are in microseconds
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << std::endl;
+
+    long long end = 0;
+    for (const std::unique_ptr<ThreadEvents>& thread : m_threads) {
+        file << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << thread->threadId
+             << ", \"args\": {\"name\": \"thread " << thread->threadId << "\"}}," << std::endl;
+
+        for (const Event& event : thread->events) {
+            file << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << thread->threadId
+                 << ", \"ts\": " << event.start / 1000.0 << ", \"dur\": " << event.duration / 1000.0 << "}," << std::endl;
+            end = std::max(end, event.start + event.duration);
+        }
+    }
+
+    file << "{\"name\": \"counters\", \"ph\": \"C\", \"pid\": 1, \"tid\": 0, \"ts\": " << end / 1000.0 << ", \"args\": {";
+    for (int i = 0; i < static_cast<int>(TraceCounter::COUNT); i++) {
+        file << (i > 0 ? ", " : "") << "\"" << s_counterNames[i] << "\": " << m_counters[i].load();
+    }
+    file << "}}" << std::endl;
+    file << "]}" << std::endl;
+
+    if (!file) {
+        std::cerr << "Unable to write " << filename << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void Trace::printSummary() const
+{
+    std::map<std::string, ScopeStatistics> scopes;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const std::unique_ptr<ThreadEvents>& thread : m_threads) {
+            for (const Event& event : thread->events) {
+                auto inserted = scopes.insert({event.name, {0, 0, event.duration, event.duration}});
+                ScopeStatistics& statistics = inserted.first->second;
+                statistics.calls++;
+                statistics.total += event.duration;
+                statistics.min = std::min(statistics.min, event.duration);
+                statistics.max = std::max(statistics.max, event.duration);
+            }
+        }
+    }
+
+    std::vector<std::pair<std::string, ScopeStatistics>> sorted(scopes.begin(), scopes.end());
+    std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, ScopeStatistics>& a,
+                                               const std::pair<std::string, ScopeStatistics>& b) {
+        return a.second.total > b.second.total;
+    });
+
+    std::cout << "Trace summary, times in μs" << std::endl;
+    std::cout << std::left << std::setw(32) << "Scope" << std::right
+              << std::setw(8) << "Calls"
+              << std::setw(12) << "Total"
+              << std::setw(12) << "Mean"
+              << std::setw(12) << "Min"
+              << std::setw(12) << "Max" << std::endl;
+
+    for (const auto& scope : sorted) {
+        const ScopeStatistics& statistics = scope.second;
+        std::cout << std::left << std::setw(32) << scope.first << std::right
+                  << std::setw(8) << statistics.calls
+                  << std::setw(12) << statistics.total / 1000
+                  << std::setw(12) << statistics.total / statistics.calls / 1000
+                  << std::setw(12) << statistics.min / 1000
+                  << std::setw(12) << statistics.max / 1000 << std::endl;
+    }
+
+    for (int i = 0; i < static_cast<int>(TraceCounter::COUNT); i++) {
+        std::cout << s_counterNames[i] << ": " << m_counters[i].load() << std::endl;
+    }
+}
+
+void Trace::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const std::unique_ptr<ThreadEvents>& thread : m_threads) {
+        thread->events.clear();
+    }
+
+    for (int i = 0; i < static_cast<int>(TraceCounter::COUNT); i++) {
+        m_counters[i] = 0;
+    }
+}
@@ -0,0 +1,204 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+ * Counters accumulated while tracing is enabled
+ */
+enum class TraceCounter
+{
+    PIXELS_PROCESSED,   ///< Output pixels computed by the convolution functions, all planes
+    BYTES_COPIED,       ///< Image buffer copies and host-device transfers
+    ALLOCATIONS,        ///< Image buffer allocations
+    ALLOCATED_BYTES,    ///< Bytes of the image buffer allocations
+    COUNT
+};
+
+/*
+ * Process wide collector of timed scopes and counters. Disabled by
+ * default: a disabled scope or counter costs a relaxed atomic load.
+ * Each thread appends its events to its own buffer, so scopes
+ * on the thread pool workers do not contend.
+ */
+class Trace
+{
+    public:
+        Trace(const Trace&) = delete;
+        Trace& operator=(const Trace&) = delete;
+
+        /*
+         * @brief: return the process wide collector
+         */
+        static Trace& getInstance();
+
+        /*
+         * @brief: return true if scopes and counters are recorded
+         */
+        static bool isEnabled()
+        {
+            return s_enabled.load(std::memory_order_relaxed);
+        }
+
+        /*
+         * @brief: start or stop recording. Events recorded so far are kept.
+         */
+        static void setEnabled(bool enabled);
+
+        /*
+         * @brief: return true if the status lines of the filtering
+         *         calls are printed (see TRACE_STATUS)
+         */
+        static bool isVerbose()
+        {
+            return s_verbose.load(std::memory_order_relaxed);
+        }
+
+        /*
+         * @brief: print or drop the status lines, dropped by default
+         */
+        static void setVerbose(bool verbose);
+
+        /*
+         * @brief: add value to a counter, if tracing is enabled
+         */
+        static void addCount(TraceCounter counter, long long value)
+        {
+            if (isEnabled()) {
+                getInstance().m_counters[static_cast<int>(counter)].fetch_add(value, std::memory_order_relaxed);
+            }
+        }
+
+        /*
+         * @brief: return the current value of a counter
+         */
+        long long getCount(TraceCounter counter) const;
+
+        /*
+         * @brief: record a completed scope of the calling thread
+         *
+         * @param: name: must outlive the collector (a string literal)
+         * @param: start, duration: nanoseconds since the collector creation
+         */
+        void addEvent(const char* name, long long start, long long duration);
+
+        /*
+         * @brief: return the nanoseconds elapsed since the collector creation
+         */
+        long long getTime() const;
+
+        /*
+         * @brief: write the recorded scopes as Chrome trace events
+         *         (chrome://tracing, Perfetto), one track per thread,
+         *         and the counter totals. Scopes must not be running.
+         *
+         * @return: true if successful, false otherwise
+         */
+        bool writeChromeTrace(const char* filename) const;
+
+        /*
+         * @brief: print the number of calls, total, mean, min and max time
+         *         of each scope name, slowest first, and the counters
+         */
+        void printSummary() const;
+
+        /*
+         * @brief: drop the recorded scopes and reset the counters
+         */
+        void clear();
+
+    private:
+        /*
+         * A completed scope
+         */
+        struct Event
+        {
+            const char* name;
+            long long start;        ///< Nanoseconds since the collector creation
+            long long duration;     ///< Nanoseconds
+        };
+
+        /*
+         * Events of a thread, written by that thread only
+         */
+        struct ThreadEvents
+        {
+            int threadId;
+            std::vector<Event> events;
+        };
+
+        Trace();
+
+        /*
+         * @brief: return the event buffer of the calling thread,
+         *         registered on the first call
+         */
+        ThreadEvents& getThreadEvents();
+
+        static std::atomic<bool> s_enabled;                         ///< Recording switch
+        static std::atomic<bool> s_verbose;                         ///< Status lines switch
+        std::chrono::steady_clock::time_point m_origin;            ///< Time zero of the events
+        std::atomic<long long> m_counters[static_cast<int>(TraceCounter::COUNT)];
+        mutable std::mutex m_mutex;                                 ///< Protects m_threads
+        std::vector<std::unique_ptr<ThreadEvents>> m_threads;       ///< Buffers of the threads that recorded events
+};
+
+/*
+ * Records the lifetime of a scope when tracing is enabled
+ */
+class TraceScope
+{
+    public:
+        explicit TraceScope(const char* name) : m_name(Trace::isEnabled() ? name : nullptr), m_start(0)
+        {
+            if (m_name != nullptr) {
+                m_start = Trace::getInstance().getTime();
+            }
+        }
+
+        ~TraceScope()
+        {
+            if (m_name != nullptr) {
+                Trace& trace = Trace::getInstance();
+                trace.addEvent(m_name, m_start, trace.getTime() - m_start);
+            }
+        }
+
+        TraceScope(const TraceScope&) = delete;
+        TraceScope& operator=(const TraceScope&) = delete;
+
+    private:
+        const char* m_name;     ///< nullptr when tracing was disabled at construction
+        long long m_start;      ///< Nanoseconds since the collector creation
+};
+
+// Prints a status line of a filtering call ("Applying ...", "Done!")
+// when verbose output is on, without flushing std::cout, so that the
+// timed paths do not wait on the terminal. Kept with -DDISABLE_TRACE.
+#define TRACE_STATUS(message) \
+    do { \
+        if (Trace::isVerbose()) { \
+            std::cout << message << '\n'; \
+        } \
+    } while (0)
+
+#define TRACE_CONCAT_(a, b)     a##b
+#define TRACE_CONCAT(a, b)      TRACE_CONCAT_(a, b)
+
+// Times the enclosing scope. Building with -DDISABLE_TRACE removes
+// the scopes and counters entirely.
+#ifndef DISABLE_TRACE
+#define TRACE_SCOPE(name)               TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_COUNT(counter, value)     Trace::addCount(counter, value)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_COUNT(counter, value)
+#endif
+
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,191 @@
+#include <algorithm>
+#include "workspace.h"
+#include "convolution_backend.h"
+
+/*
+ * @brief: return the bytes allocated by an image buffer
+ */
+template <typename T>
+static size_t getBufferSize(const BasicImageBuffer<T>& buffer)
+{
+    return sizeof(T) * static_cast<size_t>(buffer.getStride()) * buffer.getHeight();
+}
+
+/*
+ * @brief: resize output planes to width x height pixels
+ *
+ * @return: the bytes allocated, 0 if every plane had the size already
+ */
+template <typename T>
+static size_t resetOutputPlanes(std::vector<BasicImageBuffer<T>>& outputPlanes,
+                                int planes, int width, int height)
+{
+    size_t allocatedBytes = 0;
+
+    outputPlanes.resize(planes);
+    for (auto& plane : outputPlanes) {
+        if (plane.getWidth() != width || plane.getHeight() != height) {
+            plane.reset(width, height);
+            allocatedBytes += getBufferSize(plane);
+        }
+    }
+
+    return allocatedBytes;
+}
+
+
+Workspace::Workspace()
+{
+    for (auto& deviceMemory : m_deviceMemory) {
+        deviceMemory = {nullptr, 0, nullptr};
+    }
+
+    m_stats = {0, 0, 0, 0, 0};
+}
+
+Workspace::~Workspace()
+{
+    release();
+}
+
+ImageView Workspace::getPlane(WorkspaceBuffer buffer, int plane, int width, int height)
+{
+    std::vector<ImageBuffer>& planes = m_planes[static_cast<int>(buffer)];
+    if (static_cast<int>(planes.size()) <= plane) {
+        planes.resize(plane + 1);
+    }
+
+    // Smaller requests are served by a region of the held plane
+    ImageBuffer& scratch = planes[plane];
+    size_t allocatedBytes = 0;
+    if (width > scratch.getWidth() || height > scratch.getHeight()) {
+        scratch.reset(std::max(width, scratch.getWidth()), std::max(height, scratch.getHeight()));
+        allocatedBytes = getBufferSize(scratch);
+    }
+
+    addRequest(allocatedBytes);
+
+    return scratch.getView().getRoi(0, 0, width, height);
+}
+
+std::vector<ImageBuffer>& Workspace::getOutputPlanes(int planes, int width, int height)
+{
+    addRequest(resetOutputPlanes(m_outputPlanes, planes, width, height));
+
+    return m_outputPlanes;
+}
+
+std::vector<ImageBuffer8>& Workspace::getOutputPlanes8(int planes, int width, int height)
+{
+    addRequest(resetOutputPlanes(m_outputPlanes8, planes, width, height));
+
+    return m_outputPlanes8;
+}
+
+void* Workspace::getDeviceMemory(DeviceBuffer buffer, size_t bytes,
+                                 DeviceAllocator allocate, DeviceDeallocator deallocate)
+{
+    DeviceMemory& deviceMemory = m_deviceMemory[static_cast<int>(buffer)];
+
+    if (deviceMemory.memory != nullptr && deviceMemory.bytes >= bytes) {
+        addRequest(0);
+        return deviceMemory.memory;
+    }
+
+    if (deviceMemory.memory != nullptr) {
+        deviceMemory.deallocate(deviceMemory.memory);
+        m_stats.deviceBytes -= deviceMemory.bytes;
+        deviceMemory = {nullptr, 0, nullptr};
+    }
+
+    void* memory = allocate(bytes);
+    if (memory == nullptr) {
+        return nullptr;
+    }
+
+    deviceMemory = {memory, bytes, deallocate};
+    m_stats.deviceBytes += bytes;
+    addRequest(bytes);
+
+    return memory;
+}
+
+ConvolutionBackend* Workspace::getBackend(const char* name)
+{
+    for (const auto& backend : m_backends) {
+        if (backend.first == name) {
+            addRequest(0);
+            return backend.second.get();
+        }
+    }
+
+    std::unique_ptr<ConvolutionBackend> backend = BackendRegistry::getInstance().create(name);
+    if (!backend) {
+        return nullptr;
+    }
+
+    backend->setWorkspace(this);
+    m_backends.push_back(std::make_pair(std::string(name), std::move(backend)));
+    m_stats.allocations++;
+
+    return m_backends.back().second.get();
+}
+
+WorkspaceStats Workspace::getStats() const
+{
+    WorkspaceStats stats = m_stats;
+
+    // Output planes change hands with the result images
+    stats.hostBytes = 0;
+    for (const auto& planes : m_planes) {
+        for (const auto& plane : planes) {
+            stats.hostBytes += getBufferSize(plane);
+        }
+    }
+    for (const auto& plane : m_outputPlanes) {
+        stats.hostBytes += getBufferSize(plane);
+    }
+    for (const auto& plane : m_outputPlanes8) {
+        stats.hostBytes += getBufferSize(plane);
+    }
+
+    return stats;
+}
+
+void Workspace::resetStats()
+{
+    m_stats.allocations = 0;
+    m_stats.allocatedBytes = 0;
+    m_stats.reuses = 0;
+}
+
+void Workspace::release()
+{
+    for (auto& planes : m_planes) {
+        planes.clear();
+    }
+    m_outputPlanes.clear();
+    m_outputPlanes8.clear();
+
+    for (auto& deviceMemory : m_deviceMemory) {
+        if (deviceMemory.memory != nullptr) {
+            deviceMemory.deallocate(deviceMemory.memory);
+        }
+        deviceMemory = {nullptr, 0, nullptr};
+    }
+
+    m_backends.clear();
+
+    m_stats.deviceBytes = 0;
+}
+
+void Workspace::addRequest(size_t allocatedBytes)
+{
+    if (allocatedBytes > 0) {
+        m_stats.allocations++;
+        m_stats.allocatedBytes += allocatedBytes;
+    }
+    else {
+        m_stats.reuses++;
+    }
+}
@@ -0,0 +1,156 @@
+#ifndef WORKSPACE_H_
+#define WORKSPACE_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <memory>
+#include "image_buffer.h"
+
+class ConvolutionBackend;
+
+/*
+ * Host scratch planes of a filtering call
+ */
+enum class WorkspaceBuffer
+{
+    FLOAT_SOURCE,   ///< 8-bit channels converted to float
+    ROW_PASS,       ///< Horizontal pass of the separable convolution and of the box filter
+    SQUARE_ROW_PASS,    ///< Horizontal pass of the squared pixels, box variance
+    BOX_SOURCE,     ///< Source extended by the radii of the boxes, box Gaussian
+    COUNT
+};
+
+/*
+ * Device memory of the CUDA launchers
+ */
+enum class DeviceBuffer
+{
+    SOURCE,         ///< Source planes
+    MASK,           ///< Kernel coefficients, global memory kernel
+    ROW_PASS,       ///< Horizontal pass of the separable kernels
+    OUTPUT,         ///< Output planes
+    COUNT
+};
+
+/*
+ * @brief: allocate device memory, nullptr on failure
+ */
+typedef void* (*DeviceAllocator)(size_t bytes);
+
+/*
+ * @brief: release memory returned by a DeviceAllocator
+ */
+typedef void (*DeviceDeallocator)(void* memory);
+
+/*
+ * Allocation counters of a workspace
+ */
+struct WorkspaceStats
+{
+    long long allocations;      ///< Buffers and backends created or grown
+    long long allocatedBytes;   ///< Bytes of the buffer allocations
+    long long reuses;           ///< Requests served by a held buffer or backend
+    size_t hostBytes;           ///< Host memory held by the buffers
+    size_t deviceBytes;         ///< Device memory held by the buffers
+};
+
+/*
+ * Memory reused by the filtering calls that receive it: scratch planes,
+ * output planes, CUDA device memory and backend instances. A buffer
+ * grows to the biggest request and is kept until release(), so a loop
+ * filtering images of the same size stops allocating after its first
+ * call. A workspace serves one filtering call at a time.
+ */
+class Workspace
+{
+    public:
+        Workspace();
+
+        /*
+         *  @brief: Dtor. Releases the buffers
+         */
+        ~Workspace();
+
+        Workspace(const Workspace&) = delete;
+        Workspace& operator=(const Workspace&) = delete;
+
+        /*
+         * @brief: return a width x height scratch plane, with uninitialized
+         *         pixels, valid until the next request of the same plane
+         */
+        ImageView getPlane(WorkspaceBuffer buffer, int plane, int width, int height);
+
+        /*
+         * @brief: return planes buffers of width x height pixels, to be
+         *         exchanged with the planes of the result image (see
+         *         Image::swapImage). The buffers given back by the image
+         *         are reused by the next call when they have the same size.
+         */
+        std::vector<ImageBuffer>& getOutputPlanes(int planes, int width, int height);
+
+        /*
+         * @brief: same as getOutputPlanes, for 8-bit images
+         */
+        std::vector<ImageBuffer8>& getOutputPlanes8(int planes, int width, int height);
+
+        /*
+         * @brief: return bytes of device memory, valid until the next
+         *         request of the same buffer. The memory is released
+         *         with deallocate.
+         *
+         * @return: the memory, nullptr if the allocation failed
+         */
+        void* getDeviceMemory(DeviceBuffer buffer, size_t bytes,
+                              DeviceAllocator allocate, DeviceDeallocator deallocate);
+
+        /*
+         * @brief: return the instance of a registered backend, created on
+         *         the first request. The backend uses this workspace.
+         *
+         * @return: the backend, nullptr if the name is not registered
+         */
+        ConvolutionBackend* getBackend(const char* name);
+
+        /*
+         * @brief: return the allocation counters and the memory held
+         */
+        WorkspaceStats getStats() const;
+
+        /*
+         * @brief: reset the allocation and reuse counters, keeping
+         *         the buffers
+         */
+        void resetStats();
+
+        /*
+         * @brief: release the buffers and the backends
+         */
+        void release();
+
+    private:
+        /*
+         * Device memory and the function releasing it
+         */
+        struct DeviceMemory
+        {
+            void* memory;
+            size_t bytes;
+            DeviceDeallocator deallocate;
+        };
+
+        /*
+         * @brief: count a served request, allocated or reused
+         */
+        void addRequest(size_t allocatedBytes);
+
+        std::vector<ImageBuffer> m_planes[static_cast<int>(WorkspaceBuffer::COUNT)];   ///< Scratch planes, high-water size
+        std::vector<ImageBuffer> m_outputPlanes;        ///< Float output planes
+        std::vector<ImageBuffer8> m_outputPlanes8;      ///< 8-bit output planes
+        DeviceMemory m_deviceMemory[static_cast<int>(DeviceBuffer::COUNT)];     ///< High-water device buffers
+        std::vector<std::pair<std::string, std::unique_ptr<ConvolutionBackend>>> m_backends;  ///< Created backends
+        WorkspaceStats m_stats;         ///< Allocation counters and device memory held
+};
+
+
+#endif /* WORKSPACE_H_ */